@@ -0,0 +1,176 @@
+/* Goxel 3D voxels editor
+ *
+ * copyright (c) 2024-present Guillaume Chereau <guillaume@noctua-software.com>
+ *
+ * Goxel is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * Goxel is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * goxel.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Batch mode: apply a list of filters to an image without any gui, so that
+ * it can run on machines without a display.
+ *
+ * The filters are given in an ini file, one section per pass, run in
+ * order.  The section name is the filter id, optionally followed by a colon
+ * and any text, so that the same filter can be run twice in a row.  The
+ * 'layer' key gives the comma separated names of the layers to apply the
+ * filter to (the active layer if not set), and a layer is created if it
+ * doesn't exist.  The other keys are the filter settings, the ones not
+ * given keep their default value, or the value of the previous pass of the
+ * same filter for the filters that remember their settings.  Each section
+ * needs at least one key to be seen:
+ *
+ *   [genland]
+ *   layer = Terrain
+ *   seed = 12
+ *
+ *   [terrain_coloring]
+ *   layer = Terrain
+ *   color_water = 40, 90, 120
+ *
+ *   [shadows_from_sun:noon]
+ *   layer = Terrain
+ *   sun_angle_deg = 90
+ */
+
+#include "goxel.h"
+#include "utils/ini.h"
+
+typedef struct {
+    char section[128];
+    filter_t *filter;
+    char layers[256];
+    int lineno;
+    int error;
+} batch_t;
+
+static layer_t *get_layer(image_t *img, const char *name)
+{
+    layer_t *layer;
+
+    DL_FOREACH(img->layers, layer) {
+        if (strcmp(layer->name, name) == 0) return layer;
+    }
+    LOG_I("Create layer %s", name);
+    layer = image_add_layer(img, layer_new(name));
+    layer->parent_id = 0;
+    return layer;
+}
+
+// Apply the filter of the current section to all its layers.
+static int batch_run_pass(batch_t *batch)
+{
+    char *name, *end, *saveptr;
+    layer_t *layer;
+
+    if (!batch->filter) return 0;
+    LOG_I("Run filter %s", batch->section);
+    if (!*batch->layers) {
+        layer = goxel.image->active_layer;
+        if (!layer) return -1;
+        return batch->filter->apply_fn(batch->filter, layer);
+    }
+    for (name = strtok_r(batch->layers, ",", &saveptr); name;
+         name = strtok_r(NULL, ",", &saveptr))
+    {
+        while (*name == ' ') name++;
+        end = name + strlen(name);
+        while (end > name && end[-1] == ' ') *(--end) = '\0';
+        layer = get_layer(goxel.image, name);
+        goxel.image->active_layer = layer;
+        if (batch->filter->apply_fn(batch->filter, layer)) return -1;
+    }
+    return 0;
+}
+
+static int batch_ini_handler(void *user, const char *section,
+                             const char *name, const char *value,
+                             int lineno)
+{
+    batch_t *batch = user;
+    char id[128];
+
+    if (batch->error) return 1;
+
+    // New section: run the previous pass and get the new filter.
+    if (strcmp(section, batch->section) != 0) {
+        if (batch_run_pass(batch)) {
+            LOG_E("Filter %s failed (line %d)", batch->section,
+                  batch->lineno);
+            batch->error = -1;
+            return 1;
+        }
+        snprintf(batch->section, sizeof(batch->section), "%s", section);
+        snprintf(id, sizeof(id), "%.*s", (int)strcspn(section, ":"),
+                 section);
+        batch->filter = filter_get(id);
+        batch->layers[0] = '\0';
+        batch->lineno = lineno;
+        if (!batch->filter) {
+            LOG_E("Unknown filter '%s' (line %d)", id, lineno);
+            batch->error = -1;
+            return 1;
+        }
+        if (!batch->filter->apply_fn) {
+            LOG_E("Filter '%s' cannot run in batch mode (line %d)",
+                  id, lineno);
+            batch->error = -1;
+            return 1;
+        }
+        if (batch->filter->on_open)
+            batch->filter->on_open(batch->filter);
+    }
+
+    if (strcmp(name, "layer") == 0) {
+        snprintf(batch->layers, sizeof(batch->layers), "%s", value);
+        return 1;
+    }
+    if (filter_set_setting(batch->filter, name, value)) {
+        LOG_E("Invalid setting %s = %s (line %d)", name, value, lineno);
+        batch->error = -1;
+    }
+    return 1;
+}
+
+int batch_run(const char *path, const char *input, const char *output)
+{
+    batch_t batch = {};
+    int err;
+
+    if (!output) {
+        LOG_E("No output file given for the batch");
+        return -1;
+    }
+    if (input && goxel_import_file(input, NULL)) {
+        LOG_E("Cannot load %s", input);
+        return -1;
+    }
+    err = ini_parse(path, batch_ini_handler, &batch);
+    if (err) {
+        if (err > 0)
+            LOG_E("Parse error in %s line %d", path, err);
+        else
+            LOG_E("Cannot read %s", path);
+        return -1;
+    }
+    if (batch.error) return batch.error;
+    if (batch_run_pass(&batch)) {
+        LOG_E("Filter %s failed (line %d)", batch.section, batch.lineno);
+        return -1;
+    }
+    if (goxel_export_to_file(output, NULL)) {
+        LOG_E("Cannot save %s", output);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,714 @@
+/* Goxel 3D voxels editor
+ *
+ * copyright (c) 2024-present Guillaume Chereau <guillaume@noctua-software.com>
+ *
+ * Goxel is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * Goxel is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * goxel.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Performance benchmarks.  Not run by default: use the --bench option, or
+ * the goxel_bench program.
+ * Each benchmark works on synthetic data, so that the timings can be
+ * compared between builds.  The results can also be written as JSON, to
+ * track the regressions.
+ */
+
+#include "goxel.h"
+#include "../ext_src/stb/stb_ds.h"
+
+#include <errno.h>
+#include <inttypes.h>
+
+#define BENCH_GOX_PATH "/tmp/goxel_bench.gox"
+#define BENCH_VXL_PATH "/tmp/goxel_bench.vxl"
+
+typedef struct {
+    char    name[128];
+    double  time;   // Total time in seconds.
+    int     count;  // Number of operations timed.
+    int64_t mem;    // For the memory results, in bytes.
+} bench_result_t;
+
+// stb array of all the results.
+static bench_result_t *g_results = NULL;
+
+// Size of the synthetic maps along x and y.
+static int g_size = 512;
+
+static void bench_report(double t, int count, const char *fmt, ...)
+{
+    bench_result_t r = {.time = t, .count = count};
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(r.name, sizeof(r.name), fmt, args);
+    va_end(args);
+    arrput(g_results, r);
+    if (count > 1)
+        LOG_I("%s: %.3f ms (%.3f us/op)", r.name, t * 1e3, t * 1e6 / count);
+    else
+        LOG_I("%s: %.3f ms", r.name, t * 1e3);
+}
+
+static void bench_report_mem(int64_t mem, const char *fmt, ...)
+{
+    bench_result_t r = {.mem = mem};
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(r.name, sizeof(r.name), fmt, args);
+    va_end(args);
+    arrput(g_results, r);
+    LOG_I("%s: %.2f MiB", r.name, mem / (double)(1 << 20));
+}
+
+static int bench_write_json(const char *path)
+{
+    FILE *file;
+    int i;
+
+    file = fopen(path, "w");
+    if (!file) {
+        LOG_E("Cannot write to %s: %s", path, strerror(errno));
+        return -1;
+    }
+    fprintf(file, "{\n");
+    fprintf(file, "  \"version\": \"%s\",\n", GOXEL_VERSION_STR);
+    fprintf(file, "  \"threads\": %d,\n", thread_pool_get_nb_threads());
+    fprintf(file, "  \"size\": %d,\n", g_size);
+    fprintf(file, "  \"results\": [\n");
+    for (i = 0; i < arrlen(g_results); i++) {
+        fprintf(file, "    {\"name\": \"%s\", \"time\": %.9f, "
+                "\"count\": %d, \"mem\": %" PRId64 "}%s\n",
+                g_results[i].name, g_results[i].time, g_results[i].count,
+                g_results[i].mem,
+                i < arrlen(g_results) - 1 ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+    fclose(file);
+    return 0;
+}
+
+// Fill a layer with nb_blocks tiles, each with different data so that
+// they don't get merged into the same block when saved.
+static void bench_fill_unique_tiles(volume_t *volume, int nb_blocks)
+{
+    int i, pos[3];
+    volume_accessor_t accessor = volume_get_accessor(volume);
+    for (i = 0; i < nb_blocks; i++) {
+        pos[0] = (i % 64) * TILE_SIZE;
+        pos[1] = (i / 64 % 64) * TILE_SIZE;
+        pos[2] = (i / (64 * 64)) * TILE_SIZE;
+        volume_set_at(volume, &accessor, pos,
+                      (uint8_t[]){i & 0xff, (i >> 8) & 0xff, i >> 16, 255});
+        pos[0] += TILE_SIZE - 1;
+        volume_set_at(volume, &accessor, pos, (uint8_t[]){255, 0, 0, 255});
+    }
+}
+
+static void bench_gox_save_load(bool raw_tiles)
+{
+    const int sizes[] = {
+        10000 * g_size / 512 * g_size / 512,
+        20000 * g_size / 512 * g_size / 512,
+        40000 * g_size / 512 * g_size / 512,
+    };
+    const char *name = raw_tiles ? "gox (raw)" : "gox";
+    image_t *img, *prev_img;
+    double t;
+    int i, err;
+    bool prev_raw_tiles = goxel.gox_raw_tiles;
+
+    goxel.gox_raw_tiles = raw_tiles;
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        img = image_new();
+        bench_fill_unique_tiles(img->layers->volume, sizes[i]);
+        t = sys_get_time();
+        save_to_file(img, BENCH_GOX_PATH, false);
+        t = sys_get_time() - t;
+        bench_report(t, sizes[i], "%s save %d blocks", name, sizes[i]);
+        image_delete(img);
+
+        prev_img = goxel.image;
+        goxel.image = image_new();
+        t = sys_get_time();
+        err = load_from_file(BENCH_GOX_PATH, true);
+        t = sys_get_time() - t;
+        CHECK(err == 0);
+        bench_report(t, sizes[i], "%s load %d blocks", name, sizes[i]);
+        image_delete(goxel.image);
+        goxel.image = prev_img;
+    }
+    goxel.gox_raw_tiles = prev_raw_tiles;
+    remove(BENCH_GOX_PATH);
+}
+
+// Fill a volume with a size x size x 64 AoS like terrain, with hills, caves
+// and noisy colors.  Use different shifts to get different terrains.
+static void bench_fill_terrain(volume_t *volume, int shift)
+{
+    uint8_t *tile = malloc(TILE_SIZE * TILE_SIZE * TILE_SIZE * 4);
+    uint8_t *v;
+    int tx, ty, tz, x, y, z, p[3], h;
+
+    for (tz = -32; tz < 32; tz += TILE_SIZE)
+    for (ty = -g_size / 2; ty < g_size / 2; ty += TILE_SIZE)
+    for (tx = -g_size / 2; tx < g_size / 2; tx += TILE_SIZE) {
+        v = tile;
+        for (z = 0; z < TILE_SIZE; z++)
+        for (y = 0; y < TILE_SIZE; y++)
+        for (x = 0; x < TILE_SIZE; x++, v += 4) {
+            p[0] = tx + x + shift;
+            p[1] = ty + y + shift;
+            p[2] = tz + z;
+            h = 8 * sin(p[0] / 23.0) * cos(p[1] / 31.0) + (p[0] ^ p[1]) % 3;
+            v[0] = 100 + (p[0] * 7 + p[2]) % 50;
+            v[1] = 120 + (p[1] * 5 + p[2]) % 60;
+            v[2] = 60;
+            v[3] = (p[2] < h && (p[0] * p[0] + p[2] * p[2] * 16) % 97 > 5)
+                    ? 255 : 0;
+        }
+        volume_write_tile(volume, (int[]){tx, ty, tz}, tile);
+    }
+    free(tile);
+}
+
+static void bench_vxl_save_load(void)
+{
+    const int bbox[2][3] = {{-g_size / 2, -g_size / 2, -32},
+                            {g_size / 2, g_size / 2, 32}};
+    const file_format_t *format;
+    volume_t *volume = volume_new();
+    image_t *img;
+    double t;
+    int err;
+
+    bench_fill_terrain(volume, 0);
+    t = sys_get_time();
+    err = vxl_export_voxels(volume, bbox, BENCH_VXL_PATH);
+    t = sys_get_time() - t;
+    CHECK(err == 0);
+    bench_report(t, 1, "vxl export (voxels)");
+
+    t = sys_get_time();
+    err = vxl_export_columns(volume, bbox, BENCH_VXL_PATH);
+    t = sys_get_time() - t;
+    CHECK(err == 0);
+    bench_report(t, 1, "vxl export (columns)");
+
+    format = file_format_for_path(BENCH_VXL_PATH, NULL, "r");
+    img = image_new();
+    t = sys_get_time();
+    err = format->import_func(format, img, BENCH_VXL_PATH);
+    t = sys_get_time() - t;
+    CHECK(err == 0);
+    bench_report(t, 1, "vxl load");
+
+    image_delete(img);
+    volume_delete(volume);
+    remove(BENCH_VXL_PATH);
+}
+
+// Paint some dabs in the tool volume of a layer in the middle of a stack of
+// layers, and get the render volume after each one, like the brush tool.
+static void bench_render_volume(void)
+{
+    const int nb_layers = 32, nb_dabs = 50;
+    image_t *img = image_new();
+    layer_t *active = NULL, *layer;
+    painter_t painter = {
+        .mode = MODE_OVER,
+        .shape = &shape_sphere,
+        .color = {255, 255, 0, 255},
+    };
+    float box[4][4];
+    double t;
+    int i;
+
+    bench_fill_terrain(img->layers->volume, 0);
+    for (i = 1; i < nb_layers; i++) {
+        layer = image_add_layer(img, NULL);
+        painter.color[0] = i * 8;
+        mat4_set_identity(box);
+        mat4_itranslate(box, (i % 8) * 40 - 160, (i / 8) * 40 - 80, 10);
+        mat4_iscale(box, 12, 12, 12);
+        volume_op(layer->volume, &painter, box);
+        if (i == nb_layers / 2) active = layer;
+    }
+    img->active_layer = active;
+    goxel.tool_volume = volume_copy(active->volume);
+    goxel_get_render_volume(img);
+
+    t = sys_get_time();
+    for (i = 0; i < nb_dabs; i++) {
+        mat4_set_identity(box);
+        mat4_itranslate(box, i * 4 - 100, 0, 8);
+        mat4_iscale(box, 3, 3, 3);
+        volume_op(goxel.tool_volume, &painter, box);
+        goxel_get_render_volume(img);
+    }
+    t = sys_get_time() - t;
+    bench_report(t, nb_dabs, "render volume %d layers (per dab)",
+                 nb_layers);
+
+    volume_delete(goxel.tool_volume);
+    goxel.tool_volume = NULL;
+    image_delete(img);
+}
+
+// Blend of tiles voxels for each mode, as done by volume_merge, compared
+// to calling voxel_combine for each voxel.
+static void bench_voxels_combine(void)
+{
+    const char *names[] = {
+        [MODE_OVER] = "over",
+        [MODE_SUB] = "sub",
+        [MODE_SUB_CLAMP] = "sub clamp",
+        [MODE_PAINT] = "paint",
+        [MODE_MAX] = "max",
+        [MODE_INTERSECT] = "intersect",
+        [MODE_INTERSECT_FILL] = "intersect fill",
+        [MODE_MULT_ALPHA] = "mult alpha",
+    };
+    const int n = TILE_SIZE * TILE_SIZE * TILE_SIZE, nb_tiles = 2000;
+    uint8_t *a, *b, *out;
+    double t1, t2;
+    int i, k, mode;
+
+    a = malloc(n * 4);
+    b = malloc(n * 4);
+    out = malloc(n * 4);
+    for (i = 0; i < n; i++) {
+        memcpy(a + i * 4, (uint8_t[]){i * 3, i * 5, i * 7, 255}, 4);
+        memcpy(b + i * 4, (uint8_t[]){i * 11, i * 13, 50,
+                                      (i / 64 % 3) ? 255 : 0}, 4);
+    }
+    for (mode = MODE_OVER; mode <= MODE_MULT_ALPHA; mode++) {
+        t1 = sys_get_time();
+        for (k = 0; k < nb_tiles; k++) {
+            for (i = 0; i < n; i++)
+                voxel_combine(a + i * 4, b + i * 4, mode, out + i * 4);
+        }
+        t1 = sys_get_time() - t1;
+        t2 = sys_get_time();
+        for (k = 0; k < nb_tiles; k++)
+            voxels_combine(a, b, mode, NULL, out, n);
+        t2 = sys_get_time() - t2;
+        bench_report(t2, nb_tiles, "voxels_combine %s (per tile)",
+                     names[mode]);
+        bench_report(t1, nb_tiles, "voxel_combine %s (per tile)",
+                     names[mode]);
+    }
+    free(a);
+    free(b);
+    free(out);
+}
+
+// Big volume_op on the terrain for each shape and mode, like a large brush
+// stamp or a selection crop.
+static void bench_volume_op(void)
+{
+    const shape_t *shapes[] = {&shape_sphere, &shape_cube, &shape_cylinder};
+    const char *modes_names[] = {
+        [MODE_OVER] = "over",
+        [MODE_SUB] = "sub",
+        [MODE_SUB_CLAMP] = "sub clamp",
+        [MODE_PAINT] = "paint",
+        [MODE_MAX] = "max",
+        [MODE_INTERSECT] = "intersect",
+        [MODE_INTERSECT_FILL] = "intersect fill",
+        [MODE_MULT_ALPHA] = "mult alpha",
+    };
+    const float r = g_size / 5;
+    volume_t *terrain = volume_new(), *volume;
+    painter_t painter = {
+        .color = {255, 0, 0, 255},
+        .smoothness = 1,
+    };
+    float box[4][4];
+    double t;
+    int i, mode;
+
+    bench_fill_terrain(terrain, 0);
+    for (i = 0; i < ARRAY_SIZE(shapes); i++)
+    for (mode = MODE_OVER; mode <= MODE_MULT_ALPHA; mode++) {
+        volume = volume_copy(terrain);
+        painter.shape = shapes[i];
+        painter.mode = mode;
+        mat4_set_identity(box);
+        mat4_itranslate(box, i * 10, 0, 0);
+        mat4_iscale(box, r, r, r);
+        t = sys_get_time();
+        volume_op(volume, &painter, box);
+        t = sys_get_time() - t;
+        bench_report(t, 1, "volume op %s %s (radius %d)",
+                     shapes[i]->id, modes_names[mode], (int)r);
+        volume_delete(volume);
+    }
+    volume_delete(terrain);
+}
+
+// volume_set_at and volume_get_at on all the voxels of a size x size x 16
+// box, with and without accessor.
+static void bench_set_get_at(void)
+{
+    volume_t *volume = volume_new();
+    volume_accessor_t accessor;
+    uint8_t v[4] = {0, 0, 0, 255};
+    const int n = g_size * g_size * 16;
+    double t;
+    int i, x, y, z;
+
+    for (i = 0; i < 2; i++) {
+        volume_clear(volume);
+        accessor = volume_get_accessor(volume);
+        t = sys_get_time();
+        for (z = 0; z < 16; z++)
+        for (y = -g_size / 2; y < g_size / 2; y++)
+        for (x = -g_size / 2; x < g_size / 2; x++) {
+            v[0] = x;
+            v[1] = y;
+            volume_set_at(volume, i ? &accessor : NULL, (int[]){x, y, z}, v);
+        }
+        t = sys_get_time() - t;
+        bench_report(t, n, "set_at (%s)", i ? "accessor" : "no accessor");
+
+        accessor = volume_get_accessor(volume);
+        t = sys_get_time();
+        for (z = 0; z < 16; z++)
+        for (y = -g_size / 2; y < g_size / 2; y++)
+        for (x = -g_size / 2; x < g_size / 2; x++)
+            volume_get_at(volume, i ? &accessor : NULL, (int[]){x, y, z}, v);
+        t = sys_get_time() - t;
+        bench_report(t, n, "get_at (%s)", i ? "accessor" : "no accessor");
+    }
+    volume_delete(volume);
+}
+
+static void bench_iterators(void)
+{
+    const struct {
+        int flags;
+        const char *name;
+    } iters[] = {
+        {VOLUME_ITER_TILES, "tiles"},
+        {VOLUME_ITER_TILES | VOLUME_ITER_INCLUDES_NEIGHBORS,
+            "tiles with neighbors"},
+        {VOLUME_ITER_VOXELS, "voxels"},
+        {VOLUME_ITER_VOXELS | VOLUME_ITER_SKIP_EMPTY, "voxels skip empty"},
+    };
+    volume_t *volume = volume_new();
+    volume_iterator_t iter;
+    int i, n, pos[3];
+    double t;
+
+    bench_fill_terrain(volume, 0);
+    for (i = 0; i < ARRAY_SIZE(iters); i++) {
+        n = 0;
+        t = sys_get_time();
+        iter = volume_get_iterator(volume, iters[i].flags);
+        while (volume_iter(&iter, pos)) n++;
+        t = sys_get_time() - t;
+        bench_report(t, n, "iter %s", iters[i].name);
+    }
+    volume_delete(volume);
+}
+
+// Merge two different terrains, like when merging the layers.
+static void bench_volume_merge(void)
+{
+    const int modes[] = {MODE_OVER, MODE_SUB, MODE_MAX};
+    const char *names[] = {"over", "sub", "max"};
+    volume_t *a = volume_new(), *b = volume_new(), *volume;
+    double t;
+    int i;
+
+    bench_fill_terrain(a, 0);
+    bench_fill_terrain(b, 7);
+    for (i = 0; i < ARRAY_SIZE(modes); i++) {
+        volume = volume_copy(a);
+        t = sys_get_time();
+        volume_merge(volume, b, modes[i], NULL);
+        t = sys_get_time() - t;
+        bench_report(t, volume_get_tiles_count(b), "volume merge %s (per tile)",
+                     names[i]);
+        volume_delete(volume);
+    }
+    volume_delete(a);
+    volume_delete(b);
+}
+
+// Read all the tiles of the terrain with their one voxel border, like the
+// marching cubes do.
+static void bench_volume_read(void)
+{
+    const int size[3] = {TILE_SIZE + 2, TILE_SIZE + 2, TILE_SIZE + 2};
+    volume_t *volume = volume_new();
+    volume_iterator_t iter;
+    uint8_t *data = malloc(size[0] * size[1] * size[2] * 4);
+    int n = 0, pos[3];
+    double t;
+
+    bench_fill_terrain(volume, 0);
+    t = sys_get_time();
+    iter = volume_get_iterator(volume, VOLUME_ITER_TILES);
+    while (volume_iter(&iter, pos)) {
+        volume_read(volume, (int[]){pos[0] - 1, pos[1] - 1, pos[2] - 1},
+                    size, data);
+        n++;
+    }
+    t = sys_get_time() - t;
+    bench_report(t, n, "volume read (per tile)");
+    free(data);
+    volume_delete(volume);
+}
+
+// Generate the render vertices of all the tiles of the terrain.
+static void bench_generate_vertices(void)
+{
+    const struct {
+        int effects;
+        const char *name;
+    } modes[] = {
+        {0, "blocks"},
+        {EFFECT_MARCHING_CUBES, "marching cubes"},
+    };
+    volume_t *volume = volume_new();
+    volume_iterator_t iter;
+    voxel_vertex_t *buffer;
+    int i, n, pos[3], size, subdivide;
+    double t;
+
+    buffer = calloc(TILE_SIZE * TILE_SIZE * TILE_SIZE * 6 * 4,
+                    sizeof(*buffer));
+    bench_fill_terrain(volume, 0);
+    for (i = 0; i < ARRAY_SIZE(modes); i++) {
+        n = 0;
+        t = sys_get_time();
+        iter = volume_get_iterator(volume,
+                VOLUME_ITER_TILES | VOLUME_ITER_INCLUDES_NEIGHBORS);
+        while (volume_iter(&iter, pos)) {
+            volume_generate_vertices(volume, pos, modes[i].effects, buffer,
+                                     &size, &subdivide);
+            n++;
+        }
+        t = sys_get_time() - t;
+        bench_report(t, n, "generate vertices %s (per tile)", modes[i].name);
+    }
+    free(buffer);
+    volume_delete(volume);
+}
+
+// Memory and access cost of the palette tiles, compared to RGBA tiles, on
+// the synthetic terrain and on a genland map.
+static void bench_palette_tiles(void)
+{
+    const char *maps[] = {"terrain", "genland"};
+    const int size[3] = {TILE_SIZE + 2, TILE_SIZE + 2, TILE_SIZE + 2};
+    image_t *img, *prev_img = goxel.image;
+    filter_t *genland = filter_get("genland");
+    volume_global_stats_t stats0, stats;
+    volume_t *volume;
+    volume_accessor_t accessor;
+    volume_iterator_t iter;
+    uint8_t v[4], *data;
+    int i, palette, n, x, y, z, pos[3], bbox[2][3];
+    const char *mode;
+    double t;
+
+    data = malloc(size[0] * size[1] * size[2] * 4);
+    for (i = 0; i < ARRAY_SIZE(maps); i++)
+    for (palette = 0; palette < 2; palette++) {
+        mode = palette ? "palette" : "rgba";
+        volume_set_palette_tiles(palette);
+        volume_get_global_stats(&stats0);
+        img = image_new();
+        if (i == 0) {
+            bench_fill_terrain(img->layers->volume, 0);
+        } else {
+            goxel.image = img;
+            image_set_image_dimensions_and_center(img, 512, 512, 64);
+            if (genland->on_open) genland->on_open(genland);
+            CHECK(genland->apply_fn(genland, img->layers) == 0);
+            goxel.image = prev_img;
+        }
+        volume = img->layers->volume;
+        volume_get_global_stats(&stats);
+        bench_report_mem(stats.mem - stats0.mem, "%s memory (%s)",
+                         maps[i], mode);
+
+        volume_get_bbox(volume, bbox, false);
+        accessor = volume_get_accessor(volume);
+        n = 0;
+        t = sys_get_time();
+        for (z = bbox[0][2]; z < bbox[1][2]; z++)
+        for (y = bbox[0][1]; y < bbox[1][1]; y++)
+        for (x = bbox[0][0]; x < bbox[1][0]; x++, n++)
+            volume_get_at(volume, &accessor, (int[]){x, y, z}, v);
+        t = sys_get_time() - t;
+        bench_report(t, n, "%s get_at (%s)", maps[i], mode);
+
+        n = 0;
+        t = sys_get_time();
+        iter = volume_get_iterator(volume, VOLUME_ITER_TILES);
+        while (volume_iter(&iter, pos)) {
+            volume_read(volume, (int[]){pos[0] - 1, pos[1] - 1, pos[2] - 1},
+                        size, data);
+            n++;
+        }
+        t = sys_get_time() - t;
+        bench_report(t, n, "%s volume read (%s, per tile)", maps[i], mode);
+        image_delete(img);
+    }
+    volume_set_palette_tiles(true);
+    free(data);
+}
+
+// Run the main filters one after the other on the terrain, with their
+// default settings, like the batch mode.
+static void bench_filters(void)
+{
+    const struct {
+        const char *id;
+        bool new_layer;
+    } filters[] = {
+        {"genland", true},
+        {"terrain_coloring"},
+        {"shadows_from_sun"},
+        {"water_layer", true},
+    };
+    image_t *img = image_new(), *prev_img = goxel.image;
+    layer_t *terrain = img->layers, *layer;
+    filter_t *filter;
+    double t;
+    int i, err;
+
+    goxel.image = img;
+    image_set_image_dimensions_and_center(img, g_size, g_size, 64);
+    bench_fill_terrain(terrain->volume, 0);
+    for (i = 0; i < ARRAY_SIZE(filters); i++) {
+        filter = filter_get(filters[i].id);
+        CHECK(filter && filter->apply_fn);
+        if (filter->on_open) filter->on_open(filter);
+        layer = filters[i].new_layer ? image_add_layer(img, NULL) : terrain;
+        img->active_layer = layer;
+        t = sys_get_time();
+        err = filter->apply_fn(filter, layer);
+        t = sys_get_time() - t;
+        CHECK(err == 0);
+        bench_report(t, 1, "filter %s", filters[i].id);
+    }
+    goxel.image = prev_img;
+    image_delete(img);
+}
+
+static bool bench_flood_fill_cond(void *user, const uint8_t value[4])
+{
+    return value[3] == 0;
+}
+
+// Fill tool flood fills: a size x size x 1 plane, and a 128^3 cavity inside
+// a hollow cube.
+static void bench_flood_fill(void)
+{
+    const int plane[2][3] = {{-g_size / 2, -g_size / 2, 0},
+                             {g_size / 2, g_size / 2, 1}};
+    const int aabb[2][3] = {{-80, -80, -80}, {80, 80, 80}};
+    volume_t *volume = volume_new(), *out = volume_new();
+    mask_t *region = mask_new();
+    painter_t painter = {
+        .mode = MODE_OVER,
+        .shape = &shape_cube,
+        .color = {255, 255, 255, 255},
+    };
+    float box[4][4];
+    double t;
+
+    t = sys_get_time();
+    volume_flood_fill(volume, (int[]){0, 0, 0}, plane, 4,
+                      bench_flood_fill_cond, NULL, region);
+    mask_to_volume(region, out, painter.color);
+    t = sys_get_time() - t;
+    bench_report(t, mask_count(region), "flood fill %dx%dx1 plane",
+                 g_size, g_size);
+
+    mat4_set_identity(box);
+    mat4_iscale(box, 65, 65, 65);
+    volume_op(volume, &painter, box);
+    painter.mode = MODE_SUB;
+    mat4_iscale(box, 64. / 65, 64. / 65, 64. / 65);
+    volume_op(volume, &painter, box);
+    t = sys_get_time();
+    volume_flood_fill(volume, (int[]){0, 0, 0}, aabb, 6,
+                      bench_flood_fill_cond, NULL, region);
+    mask_to_volume(region, out, painter.color);
+    t = sys_get_time() - t;
+    bench_report(t, mask_count(region), "flood fill 128^3 cavity");
+
+    mask_delete(region);
+    volume_delete(volume);
+    volume_delete(out);
+}
+
+// Heights of all the columns of the terrain, as done by the filters, the
+// first time and once the columns tops are cached.
+static void bench_column_top(void)
+{
+    volume_t *volume = volume_new();
+    int dimensions[3] = {g_size, g_size, 64};
+    int start_pos[3] = {-g_size / 2, -g_size / 2, -32};
+    int *heights;
+    double t;
+    int i;
+
+    bench_fill_terrain(volume, 0);
+    allocate_heights(dimensions, &heights);
+    for (i = 0; i < 2; i++) {
+        t = sys_get_time();
+        volume_get_heights_in_box(volume, dimensions, start_pos, heights);
+        t = sys_get_time() - t;
+        bench_report(t, 1, "column tops (%s)", i ? "cached" : "first");
+    }
+    free(heights);
+    volume_delete(volume);
+}
+
+int bench_run(int size, const char *json_path)
+{
+    int ret = 0;
+
+    if (size) g_size = max(TILE_SIZE, size / TILE_SIZE * TILE_SIZE);
+    LOG_I("bench: using %d threads, size %d", thread_pool_get_nb_threads(),
+          g_size);
+    arrsetlen(g_results, 0);
+    bench_set_get_at();
+    bench_iterators();
+    bench_volume_op();
+    bench_volume_merge();
+    bench_volume_read();
+    bench_generate_vertices();
+    bench_voxels_combine();
+    bench_gox_save_load(false);
+    bench_gox_save_load(true);
+    bench_vxl_save_load();
+    bench_render_volume();
+    bench_flood_fill();
+    bench_column_top();
+    bench_palette_tiles();
+    bench_filters();
+    if (json_path)
+        ret = bench_write_json(json_path);
+    return ret;
+}
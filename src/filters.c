@@ -18,6 +18,8 @@
 
 #include "goxel.h"
 #include "../ext_src/stb/stb_ds.h"
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h> // For qsort
 #include <string.h> // For strcasecmp (POSIX) / _stricmp (Windows)
 
@@ -102,6 +104,84 @@ void filters_iter_menu(const char *menu, const char *submenu,
     }
 }
 
+filter_t *filter_get(const char *id)
+{
+    int i;
+    const char *prefix = "filter_open_";
+
+    for (i = 0; i < arrlen(g_filters); i++) {
+        if (strncmp(g_filters[i]->action_id, prefix, strlen(prefix)) != 0)
+            continue;
+        if (strcmp(g_filters[i]->action_id + strlen(prefix), id) == 0)
+            return g_filters[i];
+    }
+    return NULL;
+}
+
+int filter_set_setting(filter_t *filter, const char *name, const char *value)
+{
+    const filter_setting_t *setting;
+    void *ptr;
+    char *end;
+    long v;
+    float f;
+    int c[4] = {0, 0, 0, 255}, len, len4, i;
+
+    for (setting = filter->settings; setting && setting->name; setting++) {
+        if (strcmp(setting->name, name) == 0) break;
+    }
+    if (!setting || !setting->name) return -1;
+    ptr = (char *)filter + setting->offset;
+
+    switch (setting->type) {
+    case FILTER_SETTING_INT:
+        errno = 0;
+        v = strtol(value, &end, 10);
+        if (end == value || *end || errno || v < INT_MIN || v > INT_MAX)
+            return -1;
+        *(int *)ptr = (int)v;
+        return 0;
+    case FILTER_SETTING_FLOAT:
+        errno = 0;
+        f = strtof(value, &end);
+        if (end == value || *end || errno) return -1;
+        *(float *)ptr = f;
+        return 0;
+    case FILTER_SETTING_BOOL:
+        if (strcmp(value, "1") == 0 || strcasecmp(value, "true") == 0) {
+            *(bool *)ptr = true;
+            return 0;
+        }
+        if (strcmp(value, "0") == 0 || strcasecmp(value, "false") == 0) {
+            *(bool *)ptr = false;
+            return 0;
+        }
+        return -1;
+    case FILTER_SETTING_COLOR:
+        // "r,g,b" or "r,g,b,a", with nothing after.
+        len = -1;
+        sscanf(value, "%d , %d , %d %n", &c[0], &c[1], &c[2], &len);
+        if (len < 0) return -1;
+        if (value[len] == ',') {
+            len4 = -1;
+            sscanf(value + len, ", %d %n", &c[3], &len4);
+            if (len4 < 0) return -1;
+            len += len4;
+        }
+        if (value[len]) return -1;
+        // Check all the components before changing the color.
+        for (i = 0; i < 4; i++) {
+            if (c[i] < 0 || c[i] > 255) return -1;
+        }
+        for (i = 0; i < 4; i++)
+            ((uint8_t *)ptr)[i] = c[i];
+        return 0;
+    default:
+        assert(false);
+        return -1;
+    }
+}
+
 bool filters_mouse_overlay(const float viewport[4])
 {
     int i;
@@ -116,4 +196,187 @@ bool filters_mouse_overlay(const float viewport[4])
             filter->mouse_fn(filter, viewport);
     }
     return handled;
-}
\ No newline at end of file
+}
+
+/******* Background jobs ***************************************************/
+
+typedef struct {
+    volume_t    *volume;
+    int         layer_id;   // Layer to commit to, or zero.
+    uint64_t    key;        // Key of the layer volume when we started.
+} job_volume_t;
+
+struct filter_job {
+    filter_t        *filter;
+    void            (*run)(filter_job_t *job, void *args);
+    void            (*commit)(filter_job_t *job, void *args);
+    void            (*cleanup)(void *args);
+    void            *args;
+    job_volume_t    *volumes;   // stb array.
+    image_t         *image;
+    // Shared with the worker thread, only accessed atomically.
+    float           progress;
+    bool            canceled;
+    bool            done;
+};
+
+// stb array of the started jobs.
+static filter_job_t **g_jobs = NULL;
+
+filter_job_t *filter_job_new(filter_t *filter,
+                             void (*run)(filter_job_t *job, void *args),
+                             void (*commit)(filter_job_t *job, void *args),
+                             const void *args, int size)
+{
+    filter_job_t *job = calloc(1, sizeof(*job));
+    job->filter = filter;
+    job->run = run;
+    job->commit = commit;
+    job->image = goxel.image;
+    job->args = calloc(1, max(size, 1));
+    if (args) memcpy(job->args, args, size);
+    return job;
+}
+
+static void filter_job_delete(filter_job_t *job)
+{
+    int i;
+    for (i = 0; i < arrlen(job->volumes); i++)
+        volume_delete(job->volumes[i].volume);
+    arrfree(job->volumes);
+    if (job->cleanup) job->cleanup(job->args);
+    free(job->args);
+    free(job);
+}
+
+int filter_job_add_volume(filter_job_t *job, const volume_t *volume,
+                          layer_t *layer)
+{
+    job_volume_t v = {};
+    v.volume = volume ? volume_copy_detached(volume) : volume_new();
+    if (layer) {
+        v.layer_id = layer->id;
+        v.key = volume_get_key(layer->volume);
+    }
+    arrput(job->volumes, v);
+    return arrlen(job->volumes) - 1;
+}
+
+void filter_job_set_cleanup(filter_job_t *job, void (*cleanup)(void *args))
+{
+    job->cleanup = cleanup;
+}
+
+volume_t *filter_job_get_volume(filter_job_t *job, int i)
+{
+    if (i < 0 || i >= arrlen(job->volumes)) return NULL;
+    return job->volumes[i].volume;
+}
+
+static filter_job_t *get_running_job(const filter_t *filter)
+{
+    int i;
+    for (i = 0; i < arrlen(g_jobs); i++) {
+        if (g_jobs[i]->filter == filter) return g_jobs[i];
+    }
+    return NULL;
+}
+
+static void filter_job_thread_func(void *user)
+{
+    filter_job_t *job = user;
+    job->run(job, job->args);
+    __atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+}
+
+void filter_job_start(filter_job_t *job)
+{
+    if (get_running_job(job->filter)) {
+        LOG_W("Filter %s is already running", job->filter->name);
+        filter_job_delete(job);
+        return;
+    }
+    arrput(g_jobs, job);
+    thread_pool_spawn(filter_job_thread_func, job);
+}
+
+bool filter_job_progress(filter_job_t *job, float progress)
+{
+    if (!job) return true;
+    __atomic_store(&job->progress, &progress, __ATOMIC_RELAXED);
+    return !__atomic_load_n(&job->canceled, __ATOMIC_RELAXED);
+}
+
+bool filter_job_gui(filter_t *filter)
+{
+    filter_job_t *job = get_running_job(filter);
+    float progress;
+    bool canceled;
+
+    if (!job) return false;
+    __atomic_load(&job->progress, &progress, __ATOMIC_RELAXED);
+    canceled = __atomic_load_n(&job->canceled, __ATOMIC_RELAXED);
+    gui_progress_bar(progress, canceled ? "Canceling..." : NULL);
+    gui_enabled_begin(!canceled);
+    if (gui_button("Cancel", -1, 0))
+        __atomic_store_n(&job->canceled, true, __ATOMIC_RELAXED);
+    gui_enabled_end();
+    return true;
+}
+
+static void filter_job_commit(filter_job_t *job)
+{
+    int i;
+    layer_t *layer;
+    const job_volume_t *v;
+
+    if (job->image != goxel.image) return;
+    if (job->commit) {
+        job->commit(job, job->args);
+        return;
+    }
+    // Only commit if none of the layers changed since we started, so that
+    // we don't lose any edit.
+    for (i = 0; i < arrlen(job->volumes); i++) {
+        v = &job->volumes[i];
+        if (!v->layer_id) continue;
+        layer = layer_find(job->image, v->layer_id);
+        if (layer && layer->volume &&
+                volume_get_key(layer->volume) == v->key)
+            continue;
+        LOG_W("Layers changed while running filter %s", job->filter->name);
+        gui_alert(job->filter->name, "The layers changed while the filter "
+                  "was running, the result has been discarded.");
+        return;
+    }
+    image_history_push(job->image);
+    for (i = 0; i < arrlen(job->volumes); i++) {
+        v = &job->volumes[i];
+        if (!v->layer_id) continue;
+        layer = layer_find(job->image, v->layer_id);
+        volume_set(layer->volume, v->volume);
+    }
+}
+
+void filter_job_run_sync(filter_job_t *job)
+{
+    job->run(job, job->args);
+    filter_job_commit(job);
+    filter_job_delete(job);
+}
+
+void filters_update(void)
+{
+    int i;
+    filter_job_t *job;
+
+    for (i = 0; i < arrlen(g_jobs); i++) {
+        job = g_jobs[i];
+        if (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) continue;
+        arrdel(g_jobs, i);
+        i--;
+        if (!__atomic_load_n(&job->canceled, __ATOMIC_RELAXED))
+            filter_job_commit(job);
+        filter_job_delete(job);
+    }
+}
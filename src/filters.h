@@ -20,8 +20,32 @@
 #define FILTERS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct filter filter_t;
+struct layer;
+struct volume;
+
+enum {
+    FILTER_SETTING_INT = 1,
+    FILTER_SETTING_FLOAT,
+    FILTER_SETTING_BOOL,
+    FILTER_SETTING_COLOR, // uint8_t[4]
+};
+
+/*
+ * Type: filter_setting_t
+ * Describe a filter setting, so that we can set it from its name, like in
+ * the batch mode.  Use the FILTER_SETTING macro to define them.
+ */
+typedef struct {
+    const char *name;
+    int type;
+    int offset; // Offset of the value in the filter struct.
+} filter_setting_t;
+
+#define FILTER_SETTING(name_, type_, klass_, member_) \
+    {name_, FILTER_SETTING_##type_, offsetof(klass_, member_)}
 
 struct filter {
     int (*gui_fn)(filter_t *filter);
@@ -48,6 +72,14 @@ struct filter {
     /* Set when the user re-selects an open filter from a menu; gui centres
      * the window once then clears this. */
     bool request_center;
+    /* Optional, to run the filter without the gui: apply the filter to a
+     * layer of the current image, as a single undo step, and return 0 on
+     * success.  Called after on_open, so the settings have their default
+     * values unless they have been set. */
+    int (*apply_fn)(filter_t *filter, struct layer *layer);
+    /* Settings that can be set from their name, terminated by an empty
+     * entry.  Optional. */
+    const filter_setting_t *settings;
 };
 
 #define FILTER_REGISTER(id_, klass_, ...) \
@@ -76,8 +108,135 @@ void filters_iter_all(
 void filters_iter_menu(const char *menu, const char *submenu,
         void *arg, void (*f)(void *arg, filter_t *filter));
 
+/*
+ * Function: filter_get
+ * Get a filter from its id, that is the action id without the
+ * 'filter_open_' prefix, or NULL if there is none.
+ */
+filter_t *filter_get(const char *id);
+
+/*
+ * Function: filter_set_setting
+ * Set a filter setting from its name and value as text.
+ *
+ * The ints and floats are parsed with strtol and strtof, the bools accept
+ * 0, 1, true or false, and the colors are given as 'r,g,b' or 'r,g,b,a'
+ * with values from 0 to 255.
+ *
+ * Returns:
+ *   0 on success, -1 if the setting doesn't exist or the value is not
+ *   valid.
+ */
+int filter_set_setting(filter_t *filter, const char *name, const char *value);
+
 /* If any open filter has override_mouse, call its mouse_fn (if set) and
  * return true so the caller can skip tool_iter. */
 bool filters_mouse_overlay(const float viewport[4]);
 
+/*
+ * Type: filter_job_t
+ * Heavy part of a filter running on a background thread.
+ *
+ * The job works on detached copies of some volumes, taken when it starts,
+ * so that the editor stays responsive, and can be canceled.  Once finished
+ * the result is committed on the main thread, by default with a single
+ * image_history_push followed by a volume_set of each of the job layers.
+ * A filter can only have one job running at a time.
+ */
+typedef struct filter_job filter_job_t;
+
+/*
+ * Function: filter_job_new
+ * Create a new job.  Add the volumes, then call filter_job_start.
+ *
+ * Parameters:
+ *   filter - The filter that owns the job.
+ *   run    - Called on the worker thread.
+ *   commit - Called on the main thread when the job finished without being
+ *            canceled.  If NULL, set the job layers to the job volumes, in
+ *            one undo step.
+ *   args   - Arguments of the job, usually the filter settings.  They are
+ *            copied, so that the filter can be edited while the job runs.
+ *   size   - Size of args.
+ */
+filter_job_t *filter_job_new(filter_t *filter,
+                             void (*run)(filter_job_t *job, void *args),
+                             void (*commit)(filter_job_t *job, void *args),
+                             const void *args, int size);
+
+/*
+ * Function: filter_job_add_volume
+ * Add a detached copy of a volume to a job.
+ *
+ * Parameters:
+ *   job    - A job that didn't start yet, or the job from its run function
+ *            to return more volumes than it started with.
+ *   volume - The volume to copy.  Can be NULL to start from an empty one.
+ *   layer  - If set, the default commit sets this layer volume to the job
+ *            volume.  The job is discarded if the layer changed meanwhile.
+ *
+ * Returns:
+ *   The index of the volume in the job.
+ */
+int filter_job_add_volume(filter_job_t *job, const struct volume *volume,
+                          struct layer *layer);
+
+/*
+ * Function: filter_job_set_cleanup
+ * Set a function called on the job args when the job is deleted, committed
+ * or not.  For jobs whose args own some memory.
+ */
+void filter_job_set_cleanup(filter_job_t *job, void (*cleanup)(void *args));
+
+/*
+ * Function: filter_job_get_volume
+ * Return the job copy of a volume added with filter_job_add_volume, or
+ * NULL if there is no volume at this index.
+ */
+struct volume *filter_job_get_volume(filter_job_t *job, int i);
+
+/*
+ * Function: filter_job_start
+ * Queue the job to run in the background.  Owned by the filters after
+ * that, and deleted once committed or canceled.
+ */
+void filter_job_start(filter_job_t *job);
+
+/*
+ * Function: filter_job_run_sync
+ * Run a job on the current thread and commit it right away, without going
+ * through the background thread.  Used when there is no gui to wait for
+ * the result.  The job is deleted after that.
+ */
+void filter_job_run_sync(filter_job_t *job);
+
+/*
+ * Function: filter_job_progress
+ * Report the progress of a job, from the worker thread.
+ *
+ * Parameters:
+ *   job      - A job, or NULL, in which case nothing is done.
+ *   progress - Value from 0 to 1.
+ *
+ * Returns:
+ *   false if the job has been canceled, in which case the run function
+ *   should return as soon as possible.
+ */
+bool filter_job_progress(filter_job_t *job, float progress);
+
+/*
+ * Function: filter_job_gui
+ * Render the progress and cancel button of the running job of a filter.
+ *
+ * Returns:
+ *   true if the filter has a running job.
+ */
+bool filter_job_gui(filter_t *filter);
+
+/*
+ * Function: filters_update
+ * Commit the finished jobs.  Called once per frame from the main thread.
+ */
+void filters_update(void);
+
 #endif // FILTERS_H
@@ -386,6 +386,63 @@ static void gui_biome_detail(filter_biomes_t *filter)
     }
 }
 
+typedef struct {
+    biomes_settings_t settings;
+    float box[4][4];
+    int layer_id; // Layer to replace, or zero to create a new one.
+} biomes_args_t;
+
+static void biomes_job(filter_job_t *job, void *args_)
+{
+    biomes_args_t *args = args_;
+    generate_biomes_terrain(filter_job_get_volume(job, 0), &args->settings,
+                            args->box);
+}
+
+static void biomes_commit(filter_job_t *job, void *args_)
+{
+    biomes_args_t *args = args_;
+    layer_t *layer;
+    float box[4][4];
+    int dimensions[3];
+
+    if (args->layer_id && !layer_find(goxel.image, args->layer_id)) {
+        LOG_W("Biomes target layer has been deleted");
+        return;
+    }
+    image_history_push(goxel.image);
+    if (args->layer_id) {
+        layer = layer_find(goxel.image, args->layer_id);
+    } else {
+        layer = image_ensure_layer_for_generation(
+            goxel.image, "Biomes", args->settings.layer_target);
+    }
+    if (!layer || !layer->volume)
+        return;
+    volume_set(layer->volume, filter_job_get_volume(job, 0));
+    if (args->settings.resize_image) {
+        volume_get_box(goxel_get_layers_volume(goxel.image), true, box);
+        box_get_dimensions(box, dimensions);
+        image_set_image_dimensions_and_center(
+            goxel.image, dimensions[0], dimensions[1], dimensions[2]);
+    }
+}
+
+/* The settings are copied, so that they can be edited or reset while the
+ * job runs.  The generation always starts from an empty volume. */
+static filter_job_t *biomes_job_new(filter_biomes_t *filter, layer_t *layer)
+{
+    biomes_args_t args = {.settings = *filter->settings};
+    filter_job_t *job;
+
+    mat4_copy(goxel.image->box, args.box);
+    if (layer) args.layer_id = layer->id;
+    job = filter_job_new(&filter->filter, biomes_job, biomes_commit,
+                         &args, sizeof(args));
+    filter_job_add_volume(job, NULL, NULL);
+    return job;
+}
+
 static int gui(filter_t *filter_)
 {
     filter_biomes_t *filter = (void *)filter_;
@@ -545,21 +602,14 @@ static int gui(filter_t *filter_)
     if (gui_button("Reset to defaults", -1, 0))
         reset_to_default(filter);
 
-    if (gui_button_primary("Generate", -1, 0)) {
-        image_history_push(goxel.image);
-        layer = image_ensure_layer_for_generation(
-            goxel.image, "Biomes", s->layer_target);
-        if (layer && layer->volume) {
-            generate_biomes_terrain(layer->volume, s);
-            if (s->resize_image) {
-                float box[4][4];
-                int dimensions[3];
-                volume_get_box(goxel_get_layers_volume(goxel.image), true, box);
-                box_get_dimensions(box, dimensions);
-                image_set_image_dimensions_and_center(
-                    goxel.image, dimensions[0], dimensions[1], dimensions[2]);
-            }
+    if (!filter_job_gui(filter_) && gui_button_primary("Generate", -1, 0)) {
+        layer = NULL;
+        if (s->layer_target == LAYER_TARGET_REPLACE) {
+            layer = goxel.image->active_layer;
+            if (!layer || !layer->volume)
+                return 0;
         }
+        filter_job_start(biomes_job_new(filter, layer));
     }
 
     gui_label_size_pop();
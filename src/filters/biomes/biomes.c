@@ -267,12 +267,12 @@ static int resolve_gradient_source(const biomes_settings_t *settings, int idx)
     return idx;
 }
 
-static int height_cap(void)
+static int height_cap(float box[4][4])
 {
     int dimensions[3];
-    if (!goxel.image || box_is_null(goxel.image->box))
+    if (box_is_null(box))
         return BIOMES_MIN_HEIGHT;
-    box_get_dimensions(goxel.image->box, dimensions);
+    box_get_dimensions(box, dimensions);
     return max(BIOMES_MIN_HEIGHT, dimensions[2]);
 }
 
@@ -310,31 +310,67 @@ static void set_column_aos(volume_t *volume, const int start_pos[3],
     }
 }
 
+typedef struct {
+    mm_heightmap_t *hm;
+    int start_pos[3];
+    int cap;
+} heightmap_write_t;
+
+/* Fill the terrain columns intersecting a tile. */
+static bool write_heightmap_tile(void *user, const int pos[3],
+                                 uint8_t *voxels)
+{
+    const heightmap_write_t *w = user;
+    const uint8_t underground[4] = {90, 80, 70, 255};
+    int x, y, z, gx, gy, gz, aos_z, idx, h, z_color_end;
+    uint8_t color[4];
+    bool changed = false;
+
+    for (y = 0; y < TILE_SIZE; y++) {
+        gy = pos[1] + y - w->start_pos[1];
+        if (gy < 0 || gy >= w->hm->height)
+            continue;
+        for (x = 0; x < TILE_SIZE; x++) {
+            gx = pos[0] + x - w->start_pos[0];
+            if (gx < 0 || gx >= w->hm->width)
+                continue;
+            idx = gy * w->hm->width + gx;
+            h = (int)(w->hm->hmap[idx] * 63);
+            z_color_end = min(h + 3, 63);
+            voxel_rgba_from_packed(w->hm->cmap[idx], color);
+            /* Solid from aos h .. 63 (surface band colored). */
+            for (z = 0; z < TILE_SIZE; z++) {
+                gz = pos[2] + z - w->start_pos[2];
+                aos_z = 63 - gz;
+                if (gz < 0 || gz >= w->cap || aos_z < h || aos_z > 63)
+                    continue;
+                memcpy(voxels + ((z * TILE_SIZE + y) * TILE_SIZE + x) * 4,
+                       (aos_z <= z_color_end) ? color : underground, 4);
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
 static void write_heightmap_to_volume(volume_t *volume, mm_heightmap_t *hm,
-                                      biomes_settings_t *settings, int cap)
+                                      biomes_settings_t *settings,
+                                      float box[4][4], int cap)
 {
-    int start_pos[3];
-    int idx;
-    uint8_t underground[4] = {90, 80, 70, 255};
+    heightmap_write_t w = {.hm = hm, .cap = cap};
+    int aabb[2][3];
 
     if (settings->layer_target == LAYER_TARGET_REPLACE)
         volume_clear(volume);
 
-    box_get_start_pos(goxel.image->box, start_pos);
-
-    for (idx = 0; idx < hm->width * hm->height; idx++) {
-        int x = idx % hm->width;
-        int y = idx / hm->width;
-        int h = (int)(hm->hmap[idx] * 63);
-        int z_color_end = h + 3;
-        uint8_t color[4];
-        if (z_color_end > 63)
-            z_color_end = 63;
-        voxel_rgba_from_packed(hm->cmap[idx], color);
-        /* Solid from aos h .. 63 (surface band colored). */
-        set_column_aos(volume, start_pos, x, y, h, 63, z_color_end,
-                       color, underground, cap);
-    }
+    box_get_start_pos(box, w.start_pos);
+    aabb[0][0] = w.start_pos[0];
+    aabb[0][1] = w.start_pos[1];
+    aabb[0][2] = w.start_pos[2];
+    aabb[1][0] = w.start_pos[0] + hm->width;
+    aabb[1][1] = w.start_pos[1] + hm->height;
+    aabb[1][2] = w.start_pos[2] + min(cap, 64);
+    volume_write_tiles(volume, aabb, write_heightmap_tile, &w);
 }
 
 static void place_tree(volume_t *volume, const int start_pos[3],
@@ -428,7 +464,8 @@ static void apply_surface_color_noise(mm_heightmap_t *hm, const int *biome_ids,
     }
 }
 
-void generate_biomes_terrain(volume_t *volume, biomes_settings_t *settings)
+void generate_biomes_terrain(volume_t *volume, biomes_settings_t *settings,
+                             const float image_box[4][4])
 {
     mm_rng_t rng;
     mm_gradient_t grads[BIOMES_MAX];
@@ -441,9 +478,11 @@ void generate_biomes_terrain(volume_t *volume, biomes_settings_t *settings)
     int grad_tables[BIOMES_MAX][MM_GRAD_STEPS * 3];
     const int *grad_ptrs[BIOMES_MAX];
     int start_pos[3];
+    float box[4][4];
 
-    if (!volume || !settings || !goxel.image)
+    if (!volume || !settings)
         return;
+    mat4_copy(image_box, box);
 
     n = settings->n_biomes;
     if (n < 1)
@@ -452,7 +491,7 @@ void generate_biomes_terrain(volume_t *volume, biomes_settings_t *settings)
         n = BIOMES_MAX;
 
     mm_rng_seed(&rng, (uint32_t)settings->seed);
-    cap = height_cap();
+    cap = height_cap(box);
 
     for (i = 0; i < n; i++) {
         const biomes_biome_settings_t *bs = &settings->biomes[i];
@@ -559,10 +598,10 @@ void generate_biomes_terrain(volume_t *volume, biomes_settings_t *settings)
     if (settings->smooth_colors)
         mm_hm_smooth_colors(&hmap);
 
-    write_heightmap_to_volume(volume, &hmap, settings, cap);
+    write_heightmap_to_volume(volume, &hmap, settings, box, cap);
 
     {
-        box_get_start_pos(goxel.image->box, start_pos);
+        box_get_start_pos(box, start_pos);
         for (i = 0; i < bmap.width * bmap.height; i++) {
             int tx = i % bmap.width;
             int ty = i / bmap.width;
@@ -100,6 +100,9 @@ typedef struct {
 } biomes_settings_t;
 
 void biomes_settings_set_defaults(biomes_settings_t *s);
-void generate_biomes_terrain(volume_t *volume, biomes_settings_t *settings);
+/* Generate the terrain from the corner of box (usually the image box).
+ * Doesn't access the image, so that it can run from a filter job. */
+void generate_biomes_terrain(volume_t *volume, biomes_settings_t *settings,
+                             const float image_box[4][4]);
 
 #endif /* FILTERS_BIOMES_BIOMES_H */
@@ -18,6 +18,7 @@
 
 #include "goxel.h"
 #include "utils/color.h"
+#include "../../ext_src/stb/stb_ds.h"
 
 #include <float.h>
 #include <limits.h>
@@ -312,15 +313,7 @@ static void paint_foundations(volume_t *vol, const building_group_t *g,
 static int sample_terrain_top(const volume_t *terrain, volume_accessor_t *acc,
                               int x, int y, int z_from, int z_min)
 {
-    int pos[3] = {x, y, 0};
-    uint8_t c[4];
-
-    for (pos[2] = z_from; pos[2] >= z_min; pos[2]--) {
-        volume_get_at(terrain, acc, pos, c);
-        if (c[3])
-            return pos[2];
-    }
-    return INT_MIN;
+    return volume_get_column_top(terrain, x, y, z_min, z_from);
 }
 
 /*
@@ -1708,147 +1701,95 @@ static bool prepare_building_layers(layer_t *buildings_root, int building_idx,
     return true;
 }
 
-static void apply_buildings(filter_buildings_t *filter, layer_t *layer)
-{
-    volume_t *src = NULL;
+typedef struct {
+    filter_buildings_t filter;
+    int plan_layer_id;
+    // Set by the job.
+    const char *error;
+    int skipped;
+    // stb array of the number of floors of each generated building.  The
+    // job volumes after the plan and terrain are, for each building, its
+    // floors then its roof, or a single volume if all_one_layer is set.
+    int *floors;
+} buildings_args_t;
+
+static void buildings_args_cleanup(void *args_)
+{
+    buildings_args_t *args = args_;
+    arrfree(args->floors);
+}
+
+/* Runs on the job thread: job volume 0 is the plan, 1 the terrain. */
+static void buildings_job(filter_job_t *job, void *args_)
+{
+    buildings_args_t *args = args_;
+    const filter_buildings_t *filter = &args->filter;
+    const volume_t *src = filter_job_get_volume(job, 0);
+    const volume_t *terrain = filter_job_get_volume(job, 1);
     volume_t *floor_volumes[BUILDING_MAX_FLOOR_COLORS];
     volume_t *roof_volume = NULL;
-    layer_t *buildings_root = NULL;
-    layer_t *single_target = NULL;
     building_group_t *groups = NULL;
     int ngroups = 0;
-    int i, max_floors = 0;
-    int floor_h, floor_t, wall_t, max_building_size, max_roof_h;
-    int win_w, win_h, win_gap, win_above;
-    int sit_threshold, max_submerge;
+    int i, f, max_floors = 0;
     int **terrain_tops = NULL;
-    int skipped = 0;
     int placed = 0;
-    int building_idx = 0;
-
-    if (!layer || !layer->volume || volume_is_empty(layer->volume)) {
-        gui_alert("Plan - Buildings", "Active layer has no voxels.");
-        return;
-    }
-
-    floor_h = clampi(filter->floor_height, 1, 256);
-    floor_t = clampi(filter->floor_thickness, 1, 64);
-    wall_t = clampi(filter->wall_thickness, 1, 64);
-    max_building_size = clampi(filter->max_building_size, 0, 1024);
-    max_roof_h = clampi(filter->max_roof_height, 1, 256);
-    win_w = clampi(filter->window_width, 1, 64);
-    win_h = clampi(filter->window_height, 1, 64);
-    win_gap = clampi(filter->window_min_gap, 0, 64);
-    win_above = clampi(filter->window_above_floor, 0, 256);
-    sit_threshold = clampi(filter->sit_threshold, 1, 100);
-    max_submerge = clampi(filter->max_submerge, 0, 64);
-    filter->floor_color_count =
-        clampi(filter->floor_color_count, 1, BUILDING_MAX_FLOOR_COLORS);
-    filter->wall_color_count =
-        clampi(filter->wall_color_count, 1, BUILDING_MAX_WALL_COLORS);
-    /* Both counts are modulo divisors below, so zero would trap. */
-    filter->roof_pair_count =
-        clampi(filter->roof_pair_count, 1, BUILDING_MAX_ROOF_PAIRS);
-    filter->seed = clampi(filter->seed, 0, RAND_MAX);
-    filter->floor_height = floor_h;
-    filter->floor_thickness = floor_t;
-    filter->wall_thickness = wall_t;
-    filter->max_building_size = max_building_size;
-    filter->max_roof_height = max_roof_h;
-    filter->window_width = win_w;
-    filter->window_height = win_h;
-    filter->window_min_gap = win_gap;
-    filter->window_above_floor = win_above;
-    filter->sit_threshold = sit_threshold;
-    filter->max_submerge = max_submerge;
-
-    if (filter->use_layer_heights) {
-        if (!filter->terrain_layer || !filter->terrain_layer->volume ||
-            volume_is_empty(filter->terrain_layer->volume)) {
-            gui_alert("Plan - Buildings",
-                      "Select a terrain layer with voxels, or turn off "
-                      "Position using layer heights.");
-            return;
-        }
-    }
-
-    src = volume_copy(layer->volume);
-    if (!src) {
-        gui_alert("Plan - Buildings", "Could not copy the active layer.");
-        return;
-    }
 
     if (!collect_groups(src, filter, &groups, &ngroups)) {
-        gui_alert("Plan - Buildings", "Out of memory while scanning footprints.");
-        volume_delete(src);
+        args->error = "Out of memory while scanning footprints.";
         return;
     }
 
     if (ngroups == 0) {
-        gui_alert("Plan - Buildings",
-                  "No footprint blocks match the configured floor colours.");
+        args->error = "No footprint blocks match the configured floor colours.";
         free_groups(groups, ngroups);
-        volume_delete(src);
         return;
     }
 
     if (filter->use_layer_heights) {
         int terrain_bbox[2][3];
         volume_accessor_t terrain_acc;
-        const volume_t *terrain = filter->terrain_layer->volume;
 
         /* Approximate tile bbox once - never recompute exact bbox per cell. */
         if (!volume_get_bbox(terrain, terrain_bbox, false)) {
-            gui_alert("Plan - Buildings",
-                      "Terrain layer bounding box is empty.");
+            args->error = "Terrain layer bounding box is empty.";
             free_groups(groups, ngroups);
-            volume_delete(src);
             return;
         }
         terrain_acc = volume_get_accessor(terrain);
 
         terrain_tops = calloc((size_t)ngroups, sizeof(*terrain_tops));
         if (!terrain_tops) {
-            gui_alert("Plan - Buildings", "Out of memory while sitting buildings.");
+            args->error = "Out of memory while sitting buildings.";
             free_groups(groups, ngroups);
-            volume_delete(src);
             return;
         }
         for (i = 0; i < ngroups; i++) {
             terrain_tops[i] = malloc((size_t)groups[i].ncells *
                                      sizeof(*terrain_tops[i]));
             if (!terrain_tops[i]) {
-                gui_alert("Plan - Buildings",
-                          "Out of memory while sitting buildings.");
-                while (i-- > 0)
-                    free(terrain_tops[i]);
-                free(terrain_tops);
-                free_groups(groups, ngroups);
-                volume_delete(src);
-                return;
+                args->error = "Out of memory while sitting buildings.";
+                goto end;
             }
             if (!resolve_building_sit(&groups[i], terrain, &terrain_acc,
-                                      terrain_bbox[0][2], sit_threshold,
-                                      max_submerge, terrain_tops[i])) {
+                                      terrain_bbox[0][2],
+                                      filter->sit_threshold,
+                                      filter->max_submerge,
+                                      terrain_tops[i])) {
                 free(terrain_tops[i]);
                 terrain_tops[i] = NULL;
-                skipped++;
+                args->skipped++;
             } else {
                 placed++;
             }
         }
         if (placed == 0) {
-            gui_alert("Plan - Buildings",
-                      "No buildings could sit on the terrain layer (missing "
-                      "terrain under some footprints).");
-            for (i = 0; i < ngroups; i++)
-                free(terrain_tops[i]);
-            free(terrain_tops);
-            free_groups(groups, ngroups);
-            volume_delete(src);
-            return;
+            args->error = "No buildings could sit on the terrain layer "
+                          "(missing terrain under some footprints).";
+            goto end;
         }
     }
+    if (!filter_job_progress(job, 0.2f))
+        goto end;
 
     for (i = 0; i < ngroups; i++) {
         if (terrain_tops && !terrain_tops[i])
@@ -1857,24 +1798,11 @@ static void apply_buildings(filter_buildings_t *filter, layer_t *layer)
             max_floors = groups[i].floors;
     }
 
-    image_history_push(goxel.image);
     if (filter->all_one_layer) {
-        single_target = prepare_single_target_layer(layer);
-        if (!single_target) {
-            gui_alert("Plan - Buildings",
-                      "Could not create the buildings layer.");
-            goto fail_after_history;
-        }
+        roof_volume = filter_job_get_volume(
+                job, filter_job_add_volume(job, NULL, NULL));
         for (i = 0; i < max_floors; i++)
-            floor_volumes[i] = single_target->volume;
-        roof_volume = single_target->volume;
-    } else {
-        buildings_root = prepare_buildings_root(layer);
-        if (!buildings_root) {
-            gui_alert("Plan - Buildings",
-                      "Could not create the buildings layers.");
-            goto fail_after_history;
-        }
+            floor_volumes[i] = roof_volume;
     }
 
     for (i = 0; i < ngroups; i++) {
@@ -1884,18 +1812,17 @@ static void apply_buildings(filter_buildings_t *filter, layer_t *layer)
 
         if (terrain_tops && !terrain_tops[i])
             continue;
+        if (!filter_job_progress(job, 0.2f + 0.8f * i / ngroups))
+            goto end;
 
         if (!filter->all_one_layer) {
-            building_idx++;
-            if (!prepare_building_layers(buildings_root, building_idx,
-                                         groups[i].floors, floor_volumes,
-                                         &roof_volume)) {
-                gui_alert("Plan - Buildings",
-                          "Could not create the buildings layers.");
-                image_delete_layer(goxel.image, buildings_root);
-                goxel.image->active_layer = layer;
-                goto fail_after_history;
+            for (f = 0; f < groups[i].floors; f++) {
+                floor_volumes[f] = filter_job_get_volume(
+                        job, filter_job_add_volume(job, NULL, NULL));
             }
+            roof_volume = filter_job_get_volume(
+                    job, filter_job_add_volume(job, NULL, NULL));
+            arrput(args->floors, groups[i].floors);
         }
 
         hash = building_hash(&groups[i], filter->seed);
@@ -1903,44 +1830,136 @@ static void apply_buildings(filter_buildings_t *filter, layer_t *layer)
         wall_color = (int)((hash ^ (hash >> 16)) %
                            (unsigned)filter->wall_color_count);
         generate_group(floor_volumes, roof_volume, &groups[i],
-                       floor_h, floor_t, wall_t, max_building_size,
-                       filter->generate_roofs, max_roof_h,
+                       filter->floor_height, filter->floor_thickness,
+                       filter->wall_thickness, filter->max_building_size,
+                       filter->generate_roofs, filter->max_roof_height,
                        filter->roof_colors[roof_pair],
                        filter->wall_colors[wall_color],
-                       filter->generate_windows, win_w, win_h, win_gap,
-                       win_above,
+                       filter->generate_windows, filter->window_width,
+                       filter->window_height, filter->window_min_gap,
+                       filter->window_above_floor,
                        terrain_tops ? terrain_tops[i] : NULL);
     }
 
-    if (buildings_root)
-        goxel.image->active_layer = buildings_root;
+end:
+    if (terrain_tops) {
+        for (i = 0; i < ngroups; i++)
+            free(terrain_tops[i]);
+        free(terrain_tops);
+    }
+    free_groups(groups, ngroups);
+}
+
+/* Create the buildings layers from the job volumes, in one undo step. */
+static void buildings_commit(filter_job_t *job, void *args_)
+{
+    buildings_args_t *args = args_;
+    layer_t *plan_layer, *target;
+    volume_t *floor_volumes[BUILDING_MAX_FLOOR_COLORS];
+    volume_t *roof_volume;
+    int i, f, n = 2;
+
+    if (args->error) {
+        gui_alert("Plan - Buildings", args->error);
+        return;
+    }
+    plan_layer = layer_find(goxel.image, args->plan_layer_id);
+    if (!plan_layer) {
+        gui_alert("Plan - Buildings", "The plan layer has been deleted.");
+        return;
+    }
+
+    image_history_push(goxel.image);
+    if (args->filter.all_one_layer) {
+        target = prepare_single_target_layer(plan_layer);
+        if (!target) {
+            gui_alert("Plan - Buildings",
+                      "Could not create the buildings layer.");
+            return;
+        }
+        volume_set(target->volume, filter_job_get_volume(job, n));
+    } else {
+        target = prepare_buildings_root(plan_layer);
+        if (!target) {
+            gui_alert("Plan - Buildings",
+                      "Could not create the buildings layers.");
+            return;
+        }
+        for (i = 0; i < arrlen(args->floors); i++) {
+            if (!prepare_building_layers(target, i + 1, args->floors[i],
+                                         floor_volumes, &roof_volume)) {
+                gui_alert("Plan - Buildings",
+                          "Could not create the buildings layers.");
+                image_delete_layer(goxel.image, target);
+                goxel.image->active_layer = plan_layer;
+                return;
+            }
+            for (f = 0; f < args->floors[i]; f++)
+                volume_set(floor_volumes[f], filter_job_get_volume(job, n++));
+            volume_set(roof_volume, filter_job_get_volume(job, n++));
+        }
+        goxel.image->active_layer = target;
+    }
 
-    if (skipped > 0) {
+    if (args->skipped > 0) {
         char msg[128];
         snprintf(msg, sizeof(msg),
                  "Skipped %d building(s) with missing terrain under the "
                  "footprint.",
-                 skipped);
+                 args->skipped);
         gui_alert("Plan - Buildings", msg);
     }
+}
 
-    if (terrain_tops) {
-        for (i = 0; i < ngroups; i++)
-            free(terrain_tops[i]);
-        free(terrain_tops);
+static void apply_buildings(filter_buildings_t *filter, layer_t *layer)
+{
+    filter_job_t *job;
+    const volume_t *terrain = NULL;
+
+    if (!layer || !layer->volume || volume_is_empty(layer->volume)) {
+        gui_alert("Plan - Buildings", "Active layer has no voxels.");
+        return;
     }
-    free_groups(groups, ngroups);
-    volume_delete(src);
-    return;
 
-fail_after_history:
-    if (terrain_tops) {
-        for (i = 0; i < ngroups; i++)
-            free(terrain_tops[i]);
-        free(terrain_tops);
+    filter->floor_height = clampi(filter->floor_height, 1, 256);
+    filter->floor_thickness = clampi(filter->floor_thickness, 1, 64);
+    filter->wall_thickness = clampi(filter->wall_thickness, 1, 64);
+    filter->max_building_size = clampi(filter->max_building_size, 0, 1024);
+    filter->max_roof_height = clampi(filter->max_roof_height, 1, 256);
+    filter->window_width = clampi(filter->window_width, 1, 64);
+    filter->window_height = clampi(filter->window_height, 1, 64);
+    filter->window_min_gap = clampi(filter->window_min_gap, 0, 64);
+    filter->window_above_floor = clampi(filter->window_above_floor, 0, 256);
+    filter->sit_threshold = clampi(filter->sit_threshold, 1, 100);
+    filter->max_submerge = clampi(filter->max_submerge, 0, 64);
+    filter->floor_color_count =
+        clampi(filter->floor_color_count, 1, BUILDING_MAX_FLOOR_COLORS);
+    filter->wall_color_count =
+        clampi(filter->wall_color_count, 1, BUILDING_MAX_WALL_COLORS);
+    /* Both counts are modulo divisors below, so zero would trap. */
+    filter->roof_pair_count =
+        clampi(filter->roof_pair_count, 1, BUILDING_MAX_ROOF_PAIRS);
+    filter->seed = clampi(filter->seed, 0, RAND_MAX);
+
+    if (filter->use_layer_heights) {
+        if (!filter->terrain_layer || !filter->terrain_layer->volume ||
+            volume_is_empty(filter->terrain_layer->volume)) {
+            gui_alert("Plan - Buildings",
+                      "Select a terrain layer with voxels, or turn off "
+                      "Position using layer heights.");
+            return;
+        }
+        terrain = filter->terrain_layer->volume;
     }
-    free_groups(groups, ngroups);
-    volume_delete(src);
+
+    job = filter_job_new(&filter->filter, buildings_job, buildings_commit,
+                         &(buildings_args_t){.filter = *filter,
+                                             .plan_layer_id = layer->id},
+                         sizeof(buildings_args_t));
+    filter_job_set_cleanup(job, buildings_args_cleanup);
+    filter_job_add_volume(job, layer->volume, NULL);
+    filter_job_add_volume(job, terrain, NULL);
+    filter_job_start(job);
 }
 
 static int gui(filter_t *filter_)
@@ -2174,7 +2193,8 @@ static int gui(filter_t *filter_)
         bool has_layer = goxel.image && goxel.image->active_layer;
 
         gui_enabled_begin(has_layer);
-        if (gui_button_primary("Generate", -1, 0))
+        if (!filter_job_gui(filter_) &&
+                gui_button_primary("Generate", -1, 0))
             apply_buildings(filter, layer);
         gui_enabled_end();
         gui_alert_if_disabled_clicked(has_layer, "No layer selected",
@@ -43,7 +43,8 @@
  *    surrounding terrain (also downward by depth).
  * 6. Scatter debris by min-max density, settle onto terrain, bleed colour.
  *
- * Edits the chosen layer in place and hides the plan layer (one undo step).
+ * Runs as a filter job on copies of the layers, then edits the chosen layer
+ * and hides the plan layer (one undo step).
  */
 
 typedef struct {
@@ -423,9 +424,12 @@ static float blast_column_range(int x, int y, const explosion_center_t *c,
 /*
  * Union of all blasts at XY: deepest floor, highest ceiling, strongest
  * debris strength, and soft coverage of the winning (deepest) blast.
+ * Only the centres within range of XY in the grid are tested, ids must be
+ * big enough to hold all the centres.
  */
 static float max_blast_range(int x, int y, const explosion_center_t *centers,
-                             int ncenters, float aa, float dithering, int seed,
+                             int ncenters, point_grid_t *grid, int range,
+                             int *ids, float aa, float dithering, int seed,
                              int *out_floor_z, int *out_ceil_z,
                              float *out_strength, float *out_scorch,
                              float *out_debris, float *out_radius,
@@ -440,11 +444,13 @@ static float max_blast_range(int x, int y, const explosion_center_t *centers,
     float best_r = 1.f;
     float best_depth = 1.f;
     int best_i = 0;
-    int i;
+    int i, k, n;
     bool any = false;
 
-    for (i = 0; i < ncenters; i++) {
+    n = point_grid_query(grid, x, y, range, ids, ncenters);
+    for (k = 0; k < n; k++) {
         int floor_z, ceil_z;
+        i = ids[k];
         float edge = blast_column_range(x, y, &centers[i], aa, dithering, seed,
                                         &floor_z, &ceil_z);
         if (edge <= 0.f)
@@ -573,9 +579,10 @@ static float outer_bleed_cover(float dist, float radius, float aa,
     return (k >= 0.f) ? 1.f : 0.f;
 }
 
-/* Strongest surrounding-bleed cover across all blast centres. */
+/* Strongest surrounding-bleed cover across the blast centres within range. */
 static float max_outer_bleed(int x, int y, const explosion_center_t *centers,
-                             int ncenters, float aa, float dithering,
+                             int ncenters, point_grid_t *grid, int range,
+                             int *ids, float aa, float dithering,
                              float reach, int seed, float *out_scorch,
                              float *out_depth, int *out_nearest)
 {
@@ -583,13 +590,18 @@ static float max_outer_bleed(int x, int y, const explosion_center_t *centers,
     float best_scorch = 0.f;
     float best_depth = 1.f;
     int best_i = 0;
-    int i;
-
-    for (i = 0; i < ncenters; i++) {
-        float dist = warped_blast_dist(x, y, &centers[i], seed);
-        float radius = warped_blast_radius(x, y, &centers[i], seed);
-        float cover = outer_bleed_cover(dist, radius, aa, dithering,
-                                        reach, x, y, seed);
+    int i, k, n;
+
+    n = point_grid_query(grid, x, y, range, ids, ncenters);
+    for (k = 0; k < n; k++) {
+        float dist;
+        float radius;
+        float cover;
+        i = ids[k];
+        dist = warped_blast_dist(x, y, &centers[i], seed);
+        radius = warped_blast_radius(x, y, &centers[i], seed);
+        cover = outer_bleed_cover(dist, radius, aa, dithering,
+                                  reach, x, y, seed);
         if (cover > best) {
             best = cover;
             best_scorch = centers[i].scorch;
@@ -649,17 +661,7 @@ static void bleed_debris_color(volume_t *vol, int x, int y, int z,
 static int find_top_solid_z(const volume_t *vol, int x, int y,
                             int z_from, int z_min)
 {
-    int pos[3] = {x, y, z_from};
-    uint8_t c[4];
-
-    if (z_from < z_min)
-        return INT_MIN;
-    for (; pos[2] >= z_min; pos[2]--) {
-        volume_get_at(vol, NULL, pos, c);
-        if (c[3])
-            return pos[2];
-    }
-    return INT_MIN;
+    return volume_get_column_top(vol, x, y, z_min, z_from);
 }
 
 /*
@@ -699,12 +701,25 @@ static bool settle_debris_onto_surface(const volume_t *vol, int x, int y,
     return true;
 }
 
-static void apply_explosions(filter_explosions_t *filter, layer_t *plan_layer)
+typedef struct {
+    filter_explosions_t filter;
+    int plan_layer_id;
+    uint64_t target_key;    // Key of the target volume when we started.
+    const char *error;      // Set by the job if nothing could be done.
+    bool done;              // Set by the job if the volume was edited.
+} explosions_args_t;
+
+/*
+ * Carve the blasts of the plan volume into work, on the job thread.
+ * Returns false if nothing was done, with error set if the user should
+ * know why.
+ */
+static bool run_explosions(const filter_explosions_t *filter, volume_t *work,
+                           const volume_t *plan_volume, filter_job_t *job,
+                           const char **error)
 {
     explosion_center_t *plan = NULL;
     int nplan = 0;
-    layer_t *target;
-    volume_t *work = NULL;
     volume_t *debris = NULL;
     int seed;
     float aa, dither;
@@ -714,41 +729,23 @@ static void apply_explosions(filter_explosions_t *filter, layer_t *plan_layer)
     int bbox[2][3];
     int margin;
     float max_r;
+    point_grid_t *grid = NULL;
+    int *ids = NULL;
+    int range;
     const uint8_t empty[4] = {0, 0, 0, 0};
+    bool ret = false;
 
-    if (!plan_layer || !plan_layer->volume ||
-        volume_is_empty(plan_layer->volume)) {
-        gui_alert("Plan - Explosions", "Active layer has no voxels.");
-        return;
-    }
-
-    target = find_layer_by_id(filter->target_layer_id);
-    if (!target || !target->volume) {
-        gui_alert("Plan - Explosions", "Select a terrain layer to blast.");
-        return;
-    }
-    if (target == plan_layer) {
-        gui_alert("Plan - Explosions",
-                  "Choose a different layer than the active plan layer.");
-        return;
-    }
-    if (volume_is_empty(target->volume)) {
-        gui_alert("Plan - Explosions", "Target layer is empty.");
-        return;
-    }
-
-    if (!collect_plan_voxels(plan_layer->volume, &plan, &nplan) || nplan == 0) {
+    if (!collect_plan_voxels(plan_volume, &plan, &nplan) || nplan == 0) {
         free(plan);
-        return;
+        return false;
     }
     collapse_plan_xy(plan, &nplan);
     if (filter->use_layer_heights) {
-        project_plan_voxels(plan, &nplan, target->volume);
+        project_plan_voxels(plan, &nplan, work);
         if (nplan == 0) {
-            gui_alert("Plan - Explosions",
-                      "No plan columns intersect the selected layer.");
+            *error = "No plan columns intersect the selected layer.";
             free(plan);
-            return;
+            return false;
         }
     }
 
@@ -766,6 +763,13 @@ static void apply_explosions(filter_explosions_t *filter, layer_t *plan_layer)
     }
     margin = (int)ceilf(max_r + aa + dither) + 4;
 
+    /*
+     * The warped radius is at most 1.3 radius and the warp moves the
+     * distance by at most 0.54 radius, so no blast reaches further than
+     * range from its centre.
+     */
+    range = (int)ceilf(max_r * 2.f) + (int)ceilf(aa + dither) + 2;
+
     minx = maxx = plan[0].x;
     miny = maxy = plan[0].y;
     for (i = 1; i < nplan; i++) {
@@ -779,24 +783,24 @@ static void apply_explosions(filter_explosions_t *filter, layer_t *plan_layer)
     miny -= margin;
     maxy += margin;
 
-    if (!volume_get_bbox(target->volume, bbox, true)) {
+    if (!volume_get_bbox(work, bbox, true)) {
         free(plan);
-        return;
+        return false;
     }
 
-    image_history_push(goxel.image);
-    /* Hide the plan layer as part of the same undo step. */
-    plan_layer->visible = false;
-
-    work = volume_copy(target->volume);
-    if (!work)
-        goto end;
     debris = volume_new();
     if (!debris)
         goto end;
 
+    grid = point_grid_new(range);
+    for (i = 0; i < nplan; i++)
+        point_grid_add(grid, plan[i].x, plan[i].y);
+    ids = calloc(max(nplan, 1), sizeof(*ids));
+
     /* Pass 1: carve bowl + upper hemisphere, collect debris. */
     for (y = miny; y <= maxy; y++) {
+        if (!filter_job_progress(job, 0.8f * (y - miny) / (maxy - miny + 1)))
+            goto end;
         for (x = minx; x <= maxx; x++) {
             int floor_z, ceil_z;
             float edge;
@@ -813,7 +817,8 @@ static void apply_explosions(filter_explosions_t *filter, layer_t *plan_layer)
             int depth_i;
             int scorch_lo, scorch_hi;
 
-            edge = max_blast_range(x, y, plan, nplan, aa, dither, seed,
+            edge = max_blast_range(x, y, plan, nplan, grid, range, ids,
+                                   aa, dither, seed,
                                    &floor_z, &ceil_z, &strength, &scorch,
                                    &debris_amt, &blast_r, &blast_depth,
                                    &nearest);
@@ -979,8 +984,10 @@ static void apply_explosions(filter_explosions_t *filter, layer_t *plan_layer)
                     int depth_i;
                     float depth_span;
 
-                    cover = max_outer_bleed(x, y, plan, nplan, aa, dither, reach,
-                                            seed, &scorch, &blast_depth, &nearest);
+                    cover = max_outer_bleed(x, y, plan, nplan, grid,
+                                            range + (int)ceilf(reach), ids,
+                                            aa, dither, reach, seed, &scorch,
+                                            &blast_depth, &nearest);
                     if (cover <= 0.03f)
                         continue;
 
@@ -1074,14 +1081,82 @@ static void apply_explosions(filter_explosions_t *filter, layer_t *plan_layer)
         }
     }
 
-    volume_set(target->volume, work);
+    ret = filter_job_progress(job, 1.f);
 
 end:
-    if (work)
-        volume_delete(work);
     if (debris)
         volume_delete(debris);
+    point_grid_delete(grid);
+    free(ids);
     free(plan);
+    return ret;
+}
+
+static void explosions_job(filter_job_t *job, void *args_)
+{
+    explosions_args_t *args = args_;
+    args->done = run_explosions(&args->filter, filter_job_get_volume(job, 0),
+                                filter_job_get_volume(job, 1), job,
+                                &args->error);
+}
+
+static void explosions_commit(filter_job_t *job, void *args_)
+{
+    explosions_args_t *args = args_;
+    layer_t *target, *plan_layer;
+
+    if (args->error)
+        gui_alert("Plan - Explosions", args->error);
+    if (!args->done)
+        return;
+    target = find_layer_by_id(args->filter.target_layer_id);
+    plan_layer = find_layer_by_id(args->plan_layer_id);
+    if (!target || !target->volume || !plan_layer ||
+            volume_get_key(target->volume) != args->target_key) {
+        gui_alert("Plan - Explosions", "The layers changed while the filter "
+                  "was running, the result has been discarded.");
+        return;
+    }
+    image_history_push(goxel.image);
+    /* Hide the plan layer as part of the same undo step. */
+    plan_layer->visible = false;
+    volume_set(target->volume, filter_job_get_volume(job, 0));
+}
+
+static void apply_explosions(filter_explosions_t *filter, layer_t *plan_layer)
+{
+    explosions_args_t args = {.filter = *filter};
+    layer_t *target;
+    filter_job_t *job;
+
+    if (!plan_layer || !plan_layer->volume ||
+        volume_is_empty(plan_layer->volume)) {
+        gui_alert("Plan - Explosions", "Active layer has no voxels.");
+        return;
+    }
+
+    target = find_layer_by_id(filter->target_layer_id);
+    if (!target || !target->volume) {
+        gui_alert("Plan - Explosions", "Select a terrain layer to blast.");
+        return;
+    }
+    if (target == plan_layer) {
+        gui_alert("Plan - Explosions",
+                  "Choose a different layer than the active plan layer.");
+        return;
+    }
+    if (volume_is_empty(target->volume)) {
+        gui_alert("Plan - Explosions", "Target layer is empty.");
+        return;
+    }
+
+    args.plan_layer_id = plan_layer->id;
+    args.target_key = volume_get_key(target->volume);
+    job = filter_job_new(&filter->filter, explosions_job, explosions_commit,
+                         &args, sizeof(args));
+    filter_job_add_volume(job, target->volume, NULL);
+    filter_job_add_volume(job, plan_layer->volume, NULL);
+    filter_job_start(job);
 }
 
 static int gui(filter_t *filter_)
@@ -1195,7 +1270,7 @@ static int gui(filter_t *filter_)
         bool ready = has_layer && find_layer_by_id(filter->target_layer_id);
 
         gui_enabled_begin(ready);
-        if (gui_button("Detonate", -1, 0))
+        if (!filter_job_gui(filter_) && gui_button("Detonate", -1, 0))
             apply_explosions(filter, layer);
         gui_enabled_end();
         gui_alert_if_disabled_clicked(ready, "Cannot detonate",
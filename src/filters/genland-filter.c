@@ -29,7 +29,8 @@
 typedef struct
 {
     filter_t filter;
-    genland_settings_t *settings;
+    genland_settings_t settings;
+    bool settings_initialized;
 } filter_genland_t;
 
 // Define a static instance containing all default values.
@@ -58,12 +59,7 @@ static const genland_settings_t default_genland_settings = {
 
 
 static void reset_to_default(filter_genland_t *filter) {
-    if (filter->settings)
-        free(filter->settings);
-    filter->settings = malloc(sizeof(genland_settings_t));
-    if (!filter->settings)
-        return;
-    memcpy(filter->settings, &default_genland_settings, sizeof(genland_settings_t));
+    filter->settings = default_genland_settings;
 }
 
 static void gui_tooltip_with_default(const char *tooltip, const char *default_fmt, ...)
@@ -79,6 +75,73 @@ static void gui_tooltip_with_default(const char *tooltip, const char *default_fm
     gui_tooltip_if_hovered(final_tooltip);
 }
 
+typedef struct {
+    genland_settings_t settings;
+    float box[4][4];
+    int layer_id; // Layer to write to, or zero to create a new one.
+} genland_args_t;
+
+static void genland_job(filter_job_t *job, void *args_)
+{
+    genland_args_t *args = args_;
+    generate_tomland_terrain(filter_job_get_volume(job, 0), &args->settings,
+                             args->box);
+}
+
+static void genland_commit(filter_job_t *job, void *args_)
+{
+    genland_args_t *args = args_;
+    layer_t *layer;
+    float box[4][4];
+    int dimensions[3];
+
+    if (args->layer_id && !layer_find(goxel.image, args->layer_id)) {
+        LOG_W("Genland target layer has been deleted");
+        return;
+    }
+    image_history_push(goxel.image);
+    if (args->layer_id) {
+        layer = layer_find(goxel.image, args->layer_id);
+    } else {
+        layer = image_ensure_layer_for_generation(
+            goxel.image, "Genland", args->settings.layer_target);
+    }
+    if (!layer || !layer->volume)
+        return;
+    volume_set(layer->volume, filter_job_get_volume(job, 0));
+
+    if (args->settings.resize_image) {
+        volume_get_box(goxel_get_layers_volume(goxel.image), true, box);
+        box_get_dimensions(box, dimensions);
+        image_set_image_dimensions_and_center(goxel.image,
+            dimensions[0], dimensions[1], dimensions[2]);
+    }
+}
+
+static filter_job_t *genland_job_new(filter_genland_t *filter,
+                                     layer_t *layer)
+{
+    genland_args_t args = {.settings = filter->settings};
+    filter_job_t *job;
+
+    mat4_copy(goxel.image->box, args.box);
+    if (layer) args.layer_id = layer->id;
+    job = filter_job_new(&filter->filter, genland_job, genland_commit,
+                         &args, sizeof(args));
+    // When replacing a layer the generation starts from an empty volume.
+    filter_job_add_volume(job, (layer && filter->settings.layer_target !=
+                                LAYER_TARGET_REPLACE) ? layer->volume : NULL,
+                          NULL);
+    return job;
+}
+
+static int apply(filter_t *filter_, layer_t *layer)
+{
+    if (!layer->volume) return -1;
+    filter_job_run_sync(genland_job_new((void *)filter_, layer));
+    return 0;
+}
+
 static int gui(filter_t *filter_)
 {
     filter_genland_t *filter = (void *)filter_;
@@ -95,14 +158,14 @@ static int gui(filter_t *filter_)
     gui_separator();
     if (gui_collapsing_header("Heights", true))
     {
-        gui_input_float("Base height", &filter->settings->base_height, 1.00, 0, 1000, "%.0f");
+        gui_input_float("Base height", &filter->settings.base_height, 1.00, 0, 1000, "%.0f");
         gui_tooltip_with_default(
             "Average column height before noise is applied. Amplitude adds and "
             "subtracts from this. Columns are clipped to the image box height "
             "(at least 64)",
             "%.0f", default_genland_settings.base_height);
 
-        gui_input_float("Amplitude", &filter->settings->amplitude, 1.00, 0, 1000, "%.0f");
+        gui_input_float("Amplitude", &filter->settings.amplitude, 1.00, 0, 1000, "%.0f");
         gui_tooltip_with_default(
             "How strongly noise pushes terrain up and down from Base height. "
             "Higher = more extreme peaks and valleys. Columns are clipped to the "
@@ -112,67 +175,67 @@ static int gui(filter_t *filter_)
     gui_separator();
 
 
-    gui_input_int("# of rivers", &filter->settings->num_rivers, 0, 100);
+    gui_input_int("# of rivers", &filter->settings.num_rivers, 0, 100);
     gui_tooltip_with_default("How many rivers should we attempt to generate", "%i", default_genland_settings.num_rivers);
 
-    gui_input_float("River width", &filter->settings->river_width, 0.001, 0, 1, "%.3f");
+    gui_input_float("River width", &filter->settings.river_width, 0.001, 0, 1, "%.3f");
     gui_tooltip_with_default("How wide the river(s) should generate", "%.2f", default_genland_settings.river_width);
 
-    gui_input_float("River phase", &filter->settings->river_phase, 0.01, 0, 1, "%.2f");
+    gui_input_float("River phase", &filter->settings.river_phase, 0.01, 0, 1, "%.2f");
     gui_tooltip_with_default("Where the rivers begin, 0 = far left, 1 = far right", "%.2f", default_genland_settings.river_phase);
 
-    gui_input_float("River meander", &filter->settings->river_meander, 0.1, 0, 20, "%.1f");
+    gui_input_float("River meander", &filter->settings.river_meander, 0.1, 0, 20, "%.1f");
     gui_tooltip_with_default(
         "How strongly river noise warps the river path sideways. "
         "0 = straight channels, higher = more winding",
         "%.1f", default_genland_settings.river_meander);
 
-    gui_input_float("Terrain noise", &filter->settings->noise_terrain, 0.1, 0, 100, "%.1f");
-    gui_input_float("River noise", &filter->settings->noise_river, 0.1, 0, 100, "%.1f");
-    gui_input_float("Grass bias", &filter->settings->grass_bias, 0.05, -1, 1, "%.2f");
+    gui_input_float("Terrain noise", &filter->settings.noise_terrain, 0.1, 0, 100, "%.1f");
+    gui_input_float("River noise", &filter->settings.noise_river, 0.1, 0, 100, "%.1f");
+    gui_input_float("Grass bias", &filter->settings.grass_bias, 0.05, -1, 1, "%.2f");
     gui_tooltip_with_default(
         "Shifts how much grass tint is applied (added to the grass blend). "
         "Positive = more grass, negative = more ground",
         "%.2f", default_genland_settings.grass_bias);
 
     if(gui_collapsing_header("Additional params", false)) {
-        gui_input_int("# Octaves", &filter->settings->num_octaves, 0, 100);
+        gui_input_int("# Octaves", &filter->settings.num_octaves, 0, 100);
         gui_tooltip_with_default("# of times noise is applied", "%i", default_genland_settings.num_octaves);
     
-        gui_input_float("Octave mult", &filter->settings->amp_octave_mult, 0.01, 0, 1, "%.2f");
+        gui_input_float("Octave mult", &filter->settings.amp_octave_mult, 0.01, 0, 1, "%.2f");
         gui_tooltip_with_default("How aggressively each octave of noise affects the final result, lower = less aggressive", "%.2f", default_genland_settings.amp_octave_mult);    
     }
 
     if (gui_collapsing_header("Colors", true)) {
-        gui_color_small("Ground", filter->settings->color_ground);
-        gui_color_small("Grass1", filter->settings->color_grass1);
-        gui_color_small("Grass2", filter->settings->color_grass2);
-        gui_color_small("Water", filter->settings->color_water);
+        gui_color_small("Ground", filter->settings.color_ground);
+        gui_color_small("Grass1", filter->settings.color_grass1);
+        gui_color_small("Grass2", filter->settings.color_grass2);
+        gui_color_small("Water", filter->settings.color_water);
     }
 
     if (gui_collapsing_header("Lighting", false)) {
-        gui_input_float("Shadow", &filter->settings->shadow_factor, 1.00, 0, 255, "%.0f");
+        gui_input_float("Shadow", &filter->settings.shadow_factor, 1.00, 0, 255, "%.0f");
         gui_tooltip_with_default("How strong shadows from a simulated sun are", "%.0f", default_genland_settings.shadow_factor);
 
-        gui_input_float("Ambient", &filter->settings->ambience_factor, 0.01, 0, 1, "%.2f");
+        gui_input_float("Ambient", &filter->settings.ambience_factor, 0.01, 0, 1, "%.2f");
         gui_tooltip_with_default("How strongly lighting normals affect blocks", "%.2f", default_genland_settings.ambience_factor);
     }
 
     gui_separator();
 
-    gui_layer_target_picker(&filter->settings->layer_target);
+    gui_layer_target_picker(&filter->settings.layer_target);
 
-    gui_checkbox("Resize image", &filter->settings->resize_image,
+    gui_checkbox("Resize image", &filter->settings.resize_image,
         "If checked, we will automatically resize the image box after generating\n"
         "If unchecked, the image box will remain as it was.");
 
     gui_separator();
-    gui_input_int("Seed", &filter->settings->seed, 0, RAND_MAX);
+    gui_input_int("Seed", &filter->settings.seed, 0, RAND_MAX);
     gui_tooltip_with_default("'Seeding' allows for consistent generations (if using the same number)", "%i", default_genland_settings.seed);
     if (gui_button("Randomize seed", -1, 0))
     {
         srand(time(NULL));
-        filter->settings->seed = rand();
+        filter->settings.seed = rand();
     }
     gui_separator();
 
@@ -181,23 +244,15 @@ static int gui(filter_t *filter_)
         reset_to_default(filter);
     }
 
-    if (gui_button_primary("Generate", -1, 0))
+    if (!filter_job_gui(filter_) && gui_button_primary("Generate", -1, 0))
     {
-        image_history_push(goxel.image);
-        layer = image_ensure_layer_for_generation(
-            goxel.image, "Genland", filter->settings->layer_target);
-        if (!layer || !layer->volume)
-            return 0;
-        generate_tomland_terrain(layer->volume, filter->settings);
-
-        if (filter->settings->resize_image) {
-            float box[4][4];
-            volume_get_box(goxel_get_layers_volume(goxel.image), true, box);
-            int dimensions[3];
-            box_get_dimensions(box, dimensions);
-            image_set_image_dimensions_and_center(goxel.image,
-                dimensions[0], dimensions[1], dimensions[2]);
+        layer = NULL;
+        if (filter->settings.layer_target == LAYER_TARGET_REPLACE) {
+            layer = goxel.image->active_layer;
+            if (!layer || !layer->volume)
+                return 0;
         }
+        filter_job_start(genland_job_new(filter, layer));
     }
     gui_label_size_pop();
     return 0;
@@ -206,14 +261,46 @@ static int gui(filter_t *filter_)
 static void on_open(filter_t *filter_)
 {
     filter_genland_t *filter = (void *)filter_;
-    if (!filter->settings)
+    if (!filter->settings_initialized) {
         reset_to_default(filter);
+        filter->settings_initialized = true;
+    }
 }
 
+#define SETTING(name, type, member) \
+    FILTER_SETTING(name, type, filter_genland_t, settings.member)
+
+static const filter_setting_t SETTINGS[] = {
+    SETTING("seed", INT, seed),
+    SETTING("num_octaves", INT, num_octaves),
+    SETTING("amp_octave_mult", FLOAT, amp_octave_mult),
+    SETTING("river_width", FLOAT, river_width),
+    SETTING("river_phase", FLOAT, river_phase),
+    SETTING("river_meander", FLOAT, river_meander),
+    SETTING("num_rivers", INT, num_rivers),
+    SETTING("amplitude", FLOAT, amplitude),
+    SETTING("base_height", FLOAT, base_height),
+    SETTING("noise_terrain", FLOAT, noise_terrain),
+    SETTING("noise_river", FLOAT, noise_river),
+    SETTING("color_ground", COLOR, color_ground),
+    SETTING("color_grass1", COLOR, color_grass1),
+    SETTING("color_grass2", COLOR, color_grass2),
+    SETTING("color_water", COLOR, color_water),
+    SETTING("grass_bias", FLOAT, grass_bias),
+    SETTING("shadow_factor", FLOAT, shadow_factor),
+    SETTING("ambience_factor", FLOAT, ambience_factor),
+    SETTING("resize_image", BOOL, resize_image),
+    {}
+};
+
+#undef SETTING
+
 FILTER_REGISTER(genland, filter_genland_t,
                 .name = "Genland",
                 .menu = "effects",
                 .submenu = "generate",
                 .on_open = on_open,
                 .panel_width = 350,
-                .gui_fn = gui, )
\ No newline at end of file
+                .gui_fn = gui,
+                .apply_fn = apply,
+                .settings = SETTINGS, )
\ No newline at end of file
@@ -51,12 +51,12 @@ typedef struct
 #define VSHL 9 // used in lighting calc
 
 /* Cap column height at the image box Z, but never below GENLAND_MIN_HEIGHT. */
-static int genland_height_cap(void)
+static int genland_height_cap(float box[4][4])
 {
     int dimensions[3];
-    if (box_is_null(goxel.image->box))
+    if (box_is_null(box))
         return GENLAND_MIN_HEIGHT;
-    box_get_dimensions(goxel.image->box, dimensions);
+    box_get_dimensions(box, dimensions);
     return max(GENLAND_MIN_HEIGHT, dimensions[2]);
 }
 
@@ -184,35 +184,69 @@ float hgt[VSID * VSID];
 int column_h[VSID * VSID]; // clipped column heights for voxel fill
 unsigned char sh[VSID * VSID];
 
-static void process_voxel_data(volume_t *volume, genland_settings_t *settings,
-                               vcol *argb, const int *heights, int height_cap)
+typedef struct
 {
-    if (settings->layer_target == LAYER_TARGET_REPLACE) {
-        volume_clear(volume);
-    }
+    const vcol *argb;
+    const int *heights;
+    int max_top_z;
     int start_pos[3];
-    box_get_start_pos(goxel.image->box, start_pos);
+} voxel_data_t;
+
+// Fill the terrain columns intersecting a tile.
+static bool process_voxel_tile(void *user, const int pos[3], uint8_t *voxels)
+{
+    const voxel_data_t *data = (const voxel_data_t *)user;
+    bool changed = false;
 
-    int pos[3];
-    int max_top_z = max(height_cap - 1, 0);
-    for (int y = 0; y < VSID; y++)
+    for (int y = 0; y < TILE_SIZE; y++)
     {
-        for (int x = 0; x < VSID; x++, argb++, heights++)
+        int gy = pos[1] + y - data->start_pos[1];
+        if (gy < 0 || gy >= VSID)
+            continue;
+        for (int x = 0; x < TILE_SIZE; x++)
         {
-            int voxelTopZ = clamp(*heights - 1, 0, max_top_z);
-            if (voxelTopZ < 0)
+            int gx = pos[0] + x - data->start_pos[0];
+            if (gx < 0 || gx >= VSID)
                 continue;
-
-            for (int z = 0; z <= voxelTopZ; z++)
+            const vcol *argb = &data->argb[gy * VSID + gx];
+            int voxelTopZ = clamp(data->heights[gy * VSID + gx] - 1, 0,
+                                  data->max_top_z);
+            int z0 = max(data->start_pos[2], pos[2]);
+            int z1 = min(data->start_pos[2] + voxelTopZ + 1, pos[2] + TILE_SIZE);
+            for (int z = z0; z < z1; z++)
             {
-                pos[0] = x + start_pos[0];
-                pos[1] = y + start_pos[1];
-                pos[2] = z + start_pos[2];
-                uint8_t color[4] = {argb->r, argb->g, argb->b, 255};
-                volume_set_at(volume, NULL, pos, color);
+                uint8_t *v = voxels + (((z - pos[2]) * TILE_SIZE + y) * TILE_SIZE + x) * 4;
+                v[0] = argb->r;
+                v[1] = argb->g;
+                v[2] = argb->b;
+                v[3] = 255;
+                changed = true;
             }
         }
     }
+    return changed;
+}
+
+static void process_voxel_data(volume_t *volume, genland_settings_t *settings,
+                               float box[4][4], vcol *argb,
+                               const int *heights, int height_cap)
+{
+    if (settings->layer_target == LAYER_TARGET_REPLACE) {
+        volume_clear(volume);
+    }
+    voxel_data_t data;
+    int aabb[2][3];
+    data.argb = argb;
+    data.heights = heights;
+    data.max_top_z = max(height_cap - 1, 0);
+    box_get_start_pos(box, data.start_pos);
+
+    for (int i = 0; i < 3; i++)
+        aabb[0][i] = data.start_pos[i];
+    aabb[1][0] = data.start_pos[0] + VSID;
+    aabb[1][1] = data.start_pos[1] + VSID;
+    aabb[1][2] = data.start_pos[2] + data.max_top_z + 1;
+    volume_write_tiles(volume, aabb, process_voxel_tile, &data);
 }
 
 #define PI 3.141592653589793
@@ -221,7 +255,8 @@ static void process_voxel_data(volume_t *volume, genland_settings_t *settings,
 
 #define EPS 0.1
 
-extern "C" void generate_tomland_terrain(volume_t *volume, genland_settings_t *settings)
+extern "C" void generate_tomland_terrain(volume_t *volume, genland_settings_t *settings,
+                                         const float box[4][4])
 {
     // Variables for noise sampling, blending, and color computations
     double sampleX, sampleY, tempValue, grassBlend, secondaryBlend, riverNoise;
@@ -238,13 +273,16 @@ extern "C" void generate_tomland_terrain(volume_t *volume, genland_settings_t *s
     long octaveIndex, shadowIter, pixelX, pixelY, globalIndex, octave, progressPercent, maxAmbient, colorIndex;
     // Lookup table for noise mask values per octave
     long *maskLUT = (long *)calloc(settings->num_octaves, sizeof(long));
+    // Image box, copied since the box helpers don't take a const.
+    float image_box[4][4];
+    mat4_copy(box, image_box);
 
     printf("Heightmap generator by Tom Dobrowoski (http://ged.ax.pl/~tomkh)\n");
     printf("Assistance by Ken Silverman (http://advsys.net/ken)\n");
 
     noiseinit(settings->seed);
 
-    int height_cap = genland_height_cap();
+    int height_cap = genland_height_cap(image_box);
 
     // Tom's algorithm from 12/04/2005 (more or less)
     printf("Generating landscape\n");
@@ -419,7 +457,7 @@ extern "C" void generate_tomland_terrain(volume_t *volume, genland_settings_t *s
     }
 
     // Process and integrate the voxel data into the volume structure
-    process_voxel_data(volume, settings, buf, column_h, height_cap);
+    process_voxel_data(volume, settings, image_box, buf, column_h, height_cap);
 
     free(octaveAmplitudes);
     free(maskLUT);
@@ -40,6 +40,12 @@ typedef struct {
     layer_target_t layer_target;
 } genland_settings_t;
 
-EXTERNC void generate_tomland_terrain(volume_t *volume, genland_settings_t *settings);
+/*
+ * Generate the terrain into a volume, starting at the corner of the given
+ * box (usually the image box).  Doesn't access the image, so that it can
+ * run from a filter job.
+ */
+EXTERNC void generate_tomland_terrain(volume_t *volume, genland_settings_t *settings,
+                                      const float box[4][4]);
 
 #undef EXTERNC
\ No newline at end of file
@@ -305,31 +305,19 @@ static void paint_hedge_column(volume_t *vol, int x, int y, int base_z,
     }
 }
 
-static int seed_is_nearest(const hedge_seed_t *seeds, int nseeds, int si,
-                           int x, int y)
+/* Ties go to the lowest seed index, so each column is only stamped once. */
+static int seed_is_nearest(const hedge_seed_t *seeds, point_grid_t *grid,
+                           int si, int x, int y)
 {
-    int i;
     int dx = seeds[si].x - x;
     int dy = seeds[si].y - y;
-    float d0 = (float)(dx * dx + dy * dy);
+    int d0 = (int)ceilf(sqrtf((float)(dx * dx + dy * dy)));
 
-    for (i = 0; i < nseeds; i++) {
-        float d;
-        if (i == si)
-            continue;
-        dx = seeds[i].x - x;
-        dy = seeds[i].y - y;
-        d = (float)(dx * dx + dy * dy);
-        if (d < d0)
-            return 0;
-        if (d == d0 && i < si)
-            return 0;
-    }
-    return 1;
+    return point_grid_nearest(grid, x, y, d0, NULL) == si;
 }
 
-static void stamp_seed(volume_t *vol, const hedge_seed_t *seeds, int nseeds,
-                       int si, int min_h, int max_h, int min_w, int max_w,
+static void stamp_seed(volume_t *vol, const hedge_seed_t *seeds,
+                       point_grid_t *grid, int si, int min_h, int max_h, int min_w, int max_w,
                        const filter_hedges_t *filter)
 {
     const hedge_seed_t *seed = &seeds[si];
@@ -354,7 +342,7 @@ static void stamp_seed(volume_t *vol, const hedge_seed_t *seeds, int nseeds,
             float height_t;
             int height;
 
-            if (!seed_is_nearest(seeds, nseeds, si, x, y))
+            if (!seed_is_nearest(seeds, grid, si, x, y))
                 continue;
 
             half_w = seed_half;
@@ -418,6 +406,7 @@ static void apply_hedges(filter_hedges_t *filter, layer_t *layer)
     layer_t *target_layer;
     layer_t *surface_layer = NULL;
     hedge_seed_t *seeds = NULL;
+    point_grid_t *grid;
     int nseeds = 0;
     int min_h, max_h, min_w, max_w;
     int i;
@@ -471,9 +460,13 @@ static void apply_hedges(filter_hedges_t *filter, layer_t *layer)
     }
     volume_clear(target_layer->volume);
 
+    grid = point_grid_new(16);
+    for (i = 0; i < nseeds; i++)
+        point_grid_add(grid, seeds[i].x, seeds[i].y);
     for (i = 0; i < nseeds; i++)
-        stamp_seed(target_layer->volume, seeds, nseeds, i, min_h, max_h, min_w, max_w,
+        stamp_seed(target_layer->volume, seeds, grid, i, min_h, max_h, min_w, max_w,
                    filter);
+    point_grid_delete(grid);
 
     /* Keep the centreline populated if noise ate the seed column. */
     for (i = 0; i < nseeds; i++) {
@@ -97,17 +97,7 @@ static layer_t *find_layer_by_id(int id)
 static int find_top_solid_z(const volume_t *vol, int x, int y,
                             int z_from, int z_min)
 {
-    int pos[3] = {x, y, z_from};
-    uint8_t c[4];
-
-    if (z_from < z_min)
-        return INT_MIN;
-    for (; pos[2] >= z_min; pos[2]--) {
-        volume_get_at(vol, NULL, pos, c);
-        if (c[3])
-            return pos[2];
-    }
-    return INT_MIN;
+    return volume_get_column_top(vol, x, y, z_min, z_from);
 }
 
 static bool collect_plan_depths(const volume_t *vol,
@@ -152,24 +142,18 @@ static bool collect_plan_depths(const volume_t *vol,
     return true;
 }
 
-/* Chebyshev distance to nearest imprint column; *inside if (x,y) is imprint. */
-static int min_cheb_xy(int x, int y, const imprint_col_t *cols, int ncols,
+/* Chebyshev distance to nearest imprint column within max_dist, INT_MAX if
+ * there is none; *inside if (x,y) is imprint. */
+static int min_cheb_xy(int x, int y, point_grid_t *grid, int max_dist,
                        bool *inside)
 {
-    int best = INT_MAX;
-    int i;
+    int d;
 
     *inside = false;
-    for (i = 0; i < ncols; i++) {
-        int dx = abs(x - cols[i].x);
-        int dy = abs(y - cols[i].y);
-        int d = dx > dy ? dx : dy;
-        if (d < best)
-            best = d;
-        if (cols[i].x == x && cols[i].y == y)
-            *inside = true;
-    }
-    return best;
+    if (point_grid_nearest_cheb(grid, x, y, max_dist, &d) == -1)
+        return INT_MAX;
+    *inside = (d == 0);
+    return d;
 }
 
 /*
@@ -303,6 +287,7 @@ static void apply_imprint_color(volume_t *work, const imprint_col_t *cols,
     int i, x, y;
     float aa, dither;
     int band;
+    point_grid_t *grid;
     int z_lo = bbox[0][2];
     int z_hi = bbox[1][2] - 1;
 
@@ -322,16 +307,25 @@ static void apply_imprint_color(volume_t *work, const imprint_col_t *cols,
         if (cols[i].y > plan_max[1]) plan_max[1] = cols[i].y;
     }
 
+    /* Past band the coverage is always zero. */
+    grid = point_grid_new(max(band, 8));
+    for (i = 0; i < ncols; i++)
+        point_grid_add(grid, cols[i].x, cols[i].y);
+
     for (y = plan_min[1] - band; y <= plan_max[1] + band; y++) {
         for (x = plan_min[0] - band; x <= plan_max[0] + band; x++) {
             bool inside;
-            int cheb = min_cheb_xy(x, y, cols, ncols, &inside);
-            float cov = imprint_paint_coverage(inside, cheb, aa, dither, x, y);
+            int cheb = min_cheb_xy(x, y, grid, band, &inside);
+            float cov;
+            if (cheb == INT_MAX)
+                continue;
+            cov = imprint_paint_coverage(inside, cheb, aa, dither, x, y);
             if (cov <= 0.f)
                 continue;
             paint_surface_column(work, x, y, z_lo, z_hi, cov, filter);
         }
     }
+    point_grid_delete(grid);
 }
 
 static void apply_imprint(filter_imprint_t *filter, layer_t *plan_layer)
@@ -92,31 +92,31 @@ static void queue_free(pos_queue_t *q)
 
 /* Flood-fill solids from seed into out; mark them in visited.
  * allow_diagonals: 26-connected; otherwise face-adjacent (6-connected). */
-static bool flood_component(const volume_t *src, volume_t *visited,
+static bool flood_component(const volume_t *src, mask_t *visited,
                             const int seed[3], volume_t *out,
                             bool allow_diagonals)
 {
     pos_queue_t queue = {0};
-    volume_accessor_t src_acc, vis_acc, out_acc;
+    volume_accessor_t src_acc, out_acc;
+    mask_accessor_t vis_acc = {};
     uint8_t color[4];
     int pos[3], npos[3];
     int dx, dy, dz;
     bool ok = true;
 
     src_acc = volume_get_accessor(src);
-    vis_acc = volume_get_accessor(visited);
     out_acc = volume_get_accessor(out);
 
     volume_get_at(src, &src_acc, seed, color);
     if (!color[3])
         return true;
-    if (volume_get_alpha_at(visited, &vis_acc, seed))
+    if (mask_get_at(visited, &vis_acc, seed))
         return true;
 
     if (!queue_push(&queue, seed))
         return false;
 
-    volume_set_at(visited, &vis_acc, seed, (uint8_t[]){255, 255, 255, 255});
+    mask_set_at(visited, &vis_acc, seed, true);
     volume_set_at(out, &out_acc, seed, color);
 
     while (queue.count > 0) {
@@ -136,13 +136,12 @@ static bool flood_component(const volume_t *src, volume_t *visited,
                     npos[0] = pos[0] + dx;
                     npos[1] = pos[1] + dy;
                     npos[2] = pos[2] + dz;
-                    if (volume_get_alpha_at(visited, &vis_acc, npos))
+                    if (mask_get_at(visited, &vis_acc, npos))
                         continue;
                     volume_get_at(src, &src_acc, npos, color);
                     if (!color[3])
                         continue;
-                    volume_set_at(visited, &vis_acc, npos,
-                                  (uint8_t[]){255, 255, 255, 255});
+                    mask_set_at(visited, &vis_acc, npos, true);
                     volume_set_at(out, &out_acc, npos, color);
                     if (!queue_push(&queue, npos)) {
                         ok = false;
@@ -177,7 +176,7 @@ static bool collect_components(const volume_t *src, int max_sublayers,
                                bool allow_diagonals, volume_t ***out_comps,
                                int *out_n, bool *exceeded)
 {
-    volume_t *visited = NULL;
+    mask_t *visited = NULL;
     volume_t **comps = NULL;
     int n = 0;
     int cap = 0;
@@ -189,7 +188,7 @@ static bool collect_components(const volume_t *src, int max_sublayers,
     *out_n = 0;
     *exceeded = false;
 
-    visited = volume_new();
+    visited = mask_new();
     if (!visited)
         return false;
 
@@ -200,13 +199,13 @@ static bool collect_components(const volume_t *src, int max_sublayers,
         volume_get_at(src, &iter, pos, color);
         if (!color[3])
             continue;
-        if (volume_get_alpha_at(visited, NULL, pos))
+        if (mask_get_at(visited, NULL, pos))
             continue;
 
         if (n >= max_sublayers) {
             *exceeded = true;
             free_components(comps, n);
-            volume_delete(visited);
+            mask_delete(visited);
             return true;
         }
 
@@ -215,7 +214,7 @@ static bool collect_components(const volume_t *src, int max_sublayers,
             !flood_component(src, visited, pos, comp, allow_diagonals)) {
             volume_delete(comp);
             free_components(comps, n);
-            volume_delete(visited);
+            mask_delete(visited);
             return false;
         }
 
@@ -225,7 +224,7 @@ static bool collect_components(const volume_t *src, int max_sublayers,
             if (!nbuf) {
                 volume_delete(comp);
                 free_components(comps, n);
-                volume_delete(visited);
+                mask_delete(visited);
                 return false;
             }
             comps = nbuf;
@@ -234,7 +233,7 @@ static bool collect_components(const volume_t *src, int max_sublayers,
         comps[n++] = comp;
     }
 
-    volume_delete(visited);
+    mask_delete(visited);
     *out_comps = comps;
     *out_n = n;
     return true;
@@ -166,26 +166,19 @@ static void project_plan_voxels(road_vox_t *plan, int *nplan,
     *nplan = n;
 }
 
-/* Nearest plan in XY; returns that plan voxel's Z. */
-static float min_dist_xy(int x, int y, const road_vox_t *plan, int nplan,
-                         int *out_plan_z)
+/* Nearest plan in XY within max_dist; returns that plan voxel's Z. */
+static float min_dist_xy(int x, int y, const road_vox_t *plan,
+                         point_grid_t *grid, int max_dist, int *out_plan_z)
 {
-    float best = FLT_MAX;
-    int best_z = 0;
+    int64_t d2;
     int i;
 
-    for (i = 0; i < nplan; i++) {
-        float dx = (float)(x - plan[i].x);
-        float dy = (float)(y - plan[i].y);
-        float d = sqrtf(dx * dx + dy * dy);
-        if (d < best) {
-            best = d;
-            best_z = plan[i].z;
-        }
-    }
+    i = point_grid_nearest(grid, x, y, max_dist, &d2);
+    if (i == -1)
+        return FLT_MAX;
     if (out_plan_z)
-        *out_plan_z = best_z;
-    return best;
+        *out_plan_z = plan[i].z;
+    return sqrtf((float)d2);
 }
 
 static float road_coverage(float dist, int thickness, float aa, float dithering,
@@ -300,6 +293,7 @@ static void apply_roads(filter_roads_t *filter, layer_t *layer)
     layer_t *target_layer;
     layer_t *source_layer;
     volume_t *dest, *work = NULL;
+    point_grid_t *grid = NULL;
     int plan_min[2], plan_max[2];
     int i, dx, dy;
 
@@ -395,7 +389,12 @@ static void apply_roads(filter_roads_t *filter, layer_t *layer)
         goto end;
     }
 
-    /* Paint road colour onto the copied surface using the plan XY shape. */
+    /* Paint road colour onto the copied surface using the plan XY shape.
+     * Beyond radius the coverage is always zero, so we only need the
+     * nearest plan voxel within that distance. */
+    grid = point_grid_new(max(radius, 8));
+    for (i = 0; i < nplan; i++)
+        point_grid_add(grid, plan[i].x, plan[i].y);
     for (y = plan_min[1] - radius; y <= plan_max[1] + radius; y++) {
         for (x = plan_min[0] - radius; x <= plan_max[0] + radius; x++) {
             int plan_z;
@@ -404,7 +403,9 @@ static void apply_roads(filter_roads_t *filter, layer_t *layer)
             int pos[3];
             int z;
 
-            dist = min_dist_xy(x, y, plan, nplan, &plan_z);
+            dist = min_dist_xy(x, y, plan, grid, radius, &plan_z);
+            if (dist == FLT_MAX)
+                continue;
             cov = road_coverage(dist, thickness, aa, dither, x, y);
             if (cov <= 0.f)
                 continue;
@@ -437,6 +438,7 @@ static void apply_roads(filter_roads_t *filter, layer_t *layer)
 
     volume_set(dest, work);
 end:
+    point_grid_delete(grid);
     if (work) volume_delete(work);
     free(plan);
 }
@@ -133,6 +133,198 @@ static volume_t *build_casters_volume(const image_t *img, const layer_t *active,
     return casters;
 }
 
+typedef struct {
+    filter_shadows_from_sun_t filter;
+    int dims[3];
+    int start_pos[3];
+} shadows_args_t;
+
+/* Runs on the filter job thread, with the layer volume and the casters. */
+static void shadows_job(filter_job_t *job, void *args_)
+{
+    const shadows_args_t *args = args_;
+    const filter_shadows_from_sun_t *filter = &args->filter;
+    volume_t *volume = filter_job_get_volume(job, 0);
+    const volume_t *casters = filter_job_get_volume(job, 1);
+    int dims[3] = {args->dims[0], args->dims[1], args->dims[2]};
+    int start_pos[3] = {args->start_pos[0], args->start_pos[1],
+                        args->start_pos[2]};
+    const int gw = dims[0];
+    const int gh = dims[1];
+    const int n = gw * gh;
+    int *recv_heights = NULL;
+    int *cast_heights = NULL;
+    float *h_recv = NULL;
+    float *h_cast = NULL;
+    unsigned char *sh = NULL;
+    unsigned char *sh_tmp = NULL;
+    volume_iterator_t iter;
+    uint8_t col[4];
+    int x, y, idx, pos[3];
+
+    allocate_heights(dims, &recv_heights);
+    allocate_heights(dims, &cast_heights);
+    volume_get_heights_in_box(volume, dims, start_pos, recv_heights);
+    volume_get_heights_in_box(casters, dims, start_pos, cast_heights);
+
+    h_recv = malloc(sizeof(float) * (size_t)n);
+    h_cast = malloc(sizeof(float) * (size_t)n);
+    sh = calloc((size_t)n, 1);
+    if (!h_recv || !h_cast || !sh)
+        goto cleanup;
+
+    for (idx = 0; idx < n; idx++) {
+        h_recv[idx] = (recv_heights[idx] >= 0)
+                          ? (float)recv_heights[idx]
+                          : -1000.f;
+        h_cast[idx] = (cast_heights[idx] >= 0)
+                          ? (float)cast_heights[idx]
+                          : -1000.f;
+    }
+    if (!filter_job_progress(job, 0.2f))
+        goto cleanup;
+
+    /* Sun angle 0–180°: elevation = 90 − |angle − 90|.
+     * 90° → vertical-only; 0°/180° → horizon (long shadows);
+     * angle < 90 casts toward −X, angle > 90 toward +X. */
+    {
+        const float angle = clamp(filter->sun_angle_deg, 0.f, 180.f);
+        const float elev_deg = 90.f - fabsf(angle - 90.f);
+        const int shadow_range = max(8, max(gw, gh) / 4);
+        const int dir = (angle <= 90.f) ? -1 : 1;
+
+        if (elev_deg >= 89.5f) {
+            for (idx = 0; idx < n; idx++) {
+                if (h_recv[idx] < -500.f)
+                    continue;
+                if (h_cast[idx] > h_recv[idx])
+                    sh[idx] = 255;
+            }
+        } else {
+            const float elev_rad =
+                elev_deg * (float)(M_PI / 180.0);
+            const float sun_step = max(tanf(elev_rad), 1e-4f);
+
+            for (y = 0; y < gh; y++) {
+                if (!filter_job_progress(job, 0.2f + 0.6f * y / gh))
+                    goto cleanup;
+                for (x = 0; x < gw; x++) {
+                    idx = y * gw + x;
+                    if (h_recv[idx] < -500.f)
+                        continue;
+                    float shadowCheckValue = h_recv[idx] + sun_step;
+                    for (int shadowIter = 1, octaveIndex = 1;
+                         octaveIndex < shadow_range;
+                         shadowIter++, octaveIndex++,
+                         shadowCheckValue += sun_step) {
+                        int sy = y + dir * (shadowIter >> 1);
+                        int sx = x + dir * octaveIndex;
+                        if (filter->wrap_shadows) {
+                            sy = wrap_coord(sy, gh);
+                            sx = wrap_coord(sx, gw);
+                        } else if (sx < 0 || sx >= gw || sy < 0 ||
+                                   sy >= gh) {
+                            break;
+                        }
+                        if (h_cast[sy * gw + sx] > shadowCheckValue) {
+                            sh[idx] = 255;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (filter->do_smoothing) {
+        const int r = clamp(filter->shadow_blur_blocks, 0, 16);
+        if (r > 0) {
+            sh_tmp = malloc((size_t)n);
+            if (sh_tmp) {
+                shadow_box_blur(sh_tmp, sh, gw, gh, r,
+                                filter->wrap_shadows);
+                memcpy(sh, sh_tmp, (size_t)n);
+            }
+        }
+    }
+    if (!filter_job_progress(job, 0.9f))
+        goto cleanup;
+
+    iter = volume_get_iterator(volume,
+                               VOLUME_ITER_VOXELS | VOLUME_ITER_SKIP_EMPTY);
+    for (y = 0; y < gh; y++) {
+        pos[1] = y + start_pos[1];
+        for (x = 0; x < gw; x++) {
+            idx = y * gw + x;
+            if (recv_heights[idx] < 0)
+                continue;
+            pos[0] = x + start_pos[0];
+            pos[2] = recv_heights[idx] + start_pos[2];
+            volume_get_at(volume, &iter, pos, col);
+            if (!col[3])
+                continue;
+            {
+                float t = (float)sh[idx] / 255.f;
+                float mult = 1.f - t * filter->strength;
+                adjust_colour_brightness(col, mult);
+                volume_set_at(volume, &iter, pos, col);
+            }
+        }
+    }
+    filter_job_progress(job, 1.f);
+
+cleanup:
+    free(h_recv);
+    free(h_cast);
+    free(sh);
+    free(sh_tmp);
+    free(recv_heights);
+    free(cast_heights);
+}
+
+static filter_job_t *shadows_job_new(filter_shadows_from_sun_t *filter,
+                                     layer_t *layer)
+{
+    shadows_args_t args = {.filter = *filter};
+    volume_t *casters;
+    filter_job_t *job;
+    float box[4][4];
+
+    if (!layer || !layer->volume)
+        return NULL;
+
+    mat4_copy(goxel.image->box, box);
+    if (box_is_null(box))
+        volume_get_box(layer->volume, true, box);
+    box_get_dimensions(box, args.dims);
+    box_get_start_pos(box, args.start_pos);
+    if (args.dims[0] <= 0 || args.dims[1] <= 0 || args.dims[2] <= 0)
+        return NULL;
+
+    casters = build_casters_volume(goxel.image, layer,
+                                   filter->include_current_layer);
+    if (!casters) {
+        LOG_W("[shadows-from-sun] no caster volume for \"%s\"",
+              layer->name);
+        return NULL;
+    }
+
+    job = filter_job_new(&filter->filter, shadows_job, NULL,
+                         &args, sizeof(args));
+    filter_job_add_volume(job, layer->volume, layer);
+    filter_job_add_volume(job, casters, NULL);
+    volume_delete(casters);
+    return job;
+}
+
+static int apply(filter_t *filter_, layer_t *layer)
+{
+    filter_job_t *job = shadows_job_new((void *)filter_, layer);
+    if (!job) return -1;
+    filter_job_run_sync(job);
+    return 0;
+}
+
 static int gui(filter_t *filter_)
 {
     filter_shadows_from_sun_t *filter = (void *)filter_;
@@ -183,166 +375,12 @@ static int gui(filter_t *filter_)
         bool has_layer = goxel.image && goxel.image->active_layer;
 
         gui_enabled_begin(has_layer);
-        if (gui_button_primary("Apply to current layer", -1, 0)) {
-            layer_t *layer;
-            volume_t *casters = NULL;
-            float box[4][4];
-            int dims[3], start_pos[3], pos[3];
-            int *recv_heights = NULL;
-            int *cast_heights = NULL;
-            float *h_recv = NULL;
-            float *h_cast = NULL;
-            unsigned char *sh = NULL;
-            unsigned char *sh_tmp = NULL;
-            int gw, gh, n;
-            volume_iterator_t iter;
-            uint8_t col[4];
-            int x, y, idx;
-
-            if (!goxel.image || !goxel.image->active_layer)
-                goto apply_end;
-            layer = goxel.image->active_layer;
-            if (!layer->volume)
-                goto apply_end;
-
-            mat4_copy(goxel.image->box, box);
-            if (box_is_null(box))
-                volume_get_box(layer->volume, true, box);
-            box_get_dimensions(box, dims);
-            box_get_start_pos(box, start_pos);
-            gw = dims[0];
-            gh = dims[1];
-            if (gw <= 0 || gh <= 0 || dims[2] <= 0)
-                goto apply_end;
-            n = gw * gh;
-
-            casters = build_casters_volume(goxel.image, layer,
-                                           filter->include_current_layer);
-            if (!casters) {
-                LOG_W("[shadows-from-sun] no caster volume for \"%s\"",
-                      layer->name);
-                goto apply_end;
-            }
-
-            image_history_push(goxel.image);
-
-            allocate_heights(dims, &recv_heights);
-            allocate_heights(dims, &cast_heights);
-            volume_get_heights_in_box(layer->volume, dims, start_pos, recv_heights);
-            volume_get_heights_in_box(casters, dims, start_pos, cast_heights);
-
-            h_recv = malloc(sizeof(float) * (size_t)n);
-            h_cast = malloc(sizeof(float) * (size_t)n);
-            sh = calloc((size_t)n, 1);
-            if (!h_recv || !h_cast || !sh)
-                goto apply_cleanup;
-
-            for (idx = 0; idx < n; idx++) {
-                h_recv[idx] = (recv_heights[idx] >= 0)
-                                  ? (float)recv_heights[idx]
-                                  : -1000.f;
-                h_cast[idx] = (cast_heights[idx] >= 0)
-                                  ? (float)cast_heights[idx]
-                                  : -1000.f;
-            }
-
-            /* Sun angle 0–180°: elevation = 90 − |angle − 90|.
-             * 90° → vertical-only; 0°/180° → horizon (long shadows);
-             * angle < 90 casts toward −X, angle > 90 toward +X. */
-            {
-                const float angle = clamp(filter->sun_angle_deg, 0.f, 180.f);
-                const float elev_deg = 90.f - fabsf(angle - 90.f);
-                const int shadow_range = max(8, max(gw, gh) / 4);
-                const int dir = (angle <= 90.f) ? -1 : 1;
-
-                if (elev_deg >= 89.5f) {
-                    for (idx = 0; idx < n; idx++) {
-                        if (h_recv[idx] < -500.f)
-                            continue;
-                        if (h_cast[idx] > h_recv[idx])
-                            sh[idx] = 255;
-                    }
-                } else {
-                    const float elev_rad =
-                        elev_deg * (float)(M_PI / 180.0);
-                    const float sun_step = max(tanf(elev_rad), 1e-4f);
-
-                    for (y = 0; y < gh; y++) {
-                        for (x = 0; x < gw; x++) {
-                            idx = y * gw + x;
-                            if (h_recv[idx] < -500.f)
-                                continue;
-                            float shadowCheckValue = h_recv[idx] + sun_step;
-                            for (int shadowIter = 1, octaveIndex = 1;
-                                 octaveIndex < shadow_range;
-                                 shadowIter++, octaveIndex++,
-                                 shadowCheckValue += sun_step) {
-                                int sy = y + dir * (shadowIter >> 1);
-                                int sx = x + dir * octaveIndex;
-                                if (filter->wrap_shadows) {
-                                    sy = wrap_coord(sy, gh);
-                                    sx = wrap_coord(sx, gw);
-                                } else if (sx < 0 || sx >= gw || sy < 0 ||
-                                           sy >= gh) {
-                                    break;
-                                }
-                                if (h_cast[sy * gw + sx] > shadowCheckValue) {
-                                    sh[idx] = 255;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-
-            if (filter->do_smoothing) {
-                const int r = clamp(filter->shadow_blur_blocks, 0, 16);
-                if (r > 0) {
-                    sh_tmp = malloc((size_t)n);
-                    if (sh_tmp) {
-                        shadow_box_blur(sh_tmp, sh, gw, gh, r,
-                                        filter->wrap_shadows);
-                        memcpy(sh, sh_tmp, (size_t)n);
-                        free(sh_tmp);
-                        sh_tmp = NULL;
-                    }
-                }
-            }
-
-            iter = volume_get_iterator(layer->volume,
-                                       VOLUME_ITER_VOXELS | VOLUME_ITER_SKIP_EMPTY);
-            for (y = 0; y < gh; y++) {
-                pos[1] = y + start_pos[1];
-                for (x = 0; x < gw; x++) {
-                    idx = y * gw + x;
-                    if (recv_heights[idx] < 0)
-                        continue;
-                    pos[0] = x + start_pos[0];
-                    pos[2] = recv_heights[idx] + start_pos[2];
-                    volume_get_at(layer->volume, &iter, pos, col);
-                    if (!col[3])
-                        continue;
-                    {
-                        float t = (float)sh[idx] / 255.f;
-                        float mult = 1.f - t * filter->strength;
-                        adjust_colour_brightness(col, mult);
-                        volume_set_at(layer->volume, &iter, pos, col);
-                    }
-                }
-            }
-
-        apply_cleanup:
-            free(h_recv);
-            free(h_cast);
-            free(sh);
-            free(sh_tmp);
-            free(recv_heights);
-            free(cast_heights);
-            if (casters)
-                volume_delete(casters);
+        if (!filter_job_gui(filter_) &&
+                gui_button_primary("Apply to current layer", -1, 0)) {
+            filter_job_t *job = shadows_job_new(filter,
+                                                goxel.image->active_layer);
+            if (job) filter_job_start(job);
         }
-    apply_end:
         gui_enabled_end();
         gui_alert_if_disabled_clicked(has_layer, "No layer selected",
                                       "Select a layer first.");
@@ -361,10 +399,27 @@ static void on_open(filter_t *filter_)
     filter->include_current_layer = true;
 }
 
+#define SETTING(name, type, member) \
+    FILTER_SETTING(name, type, filter_shadows_from_sun_t, member)
+
+static const filter_setting_t SETTINGS[] = {
+    SETTING("strength", FLOAT, strength),
+    SETTING("sun_angle_deg", FLOAT, sun_angle_deg),
+    SETTING("wrap_shadows", BOOL, wrap_shadows),
+    SETTING("do_smoothing", BOOL, do_smoothing),
+    SETTING("shadow_blur_blocks", INT, shadow_blur_blocks),
+    SETTING("include_current_layer", BOOL, include_current_layer),
+    {}
+};
+
+#undef SETTING
+
 FILTER_REGISTER(shadows_from_sun, filter_shadows_from_sun_t,
                 .name = "Shadows (From Sun)",
                 .menu = "effects",
                 .submenu = "lighting",
                 .on_open = on_open,
                 .gui_fn = gui,
+                .apply_fn = apply,
+                .settings = SETTINGS,
                 .panel_width = 450, )
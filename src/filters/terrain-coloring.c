@@ -26,6 +26,7 @@
 
 #include "goxel.h"
 
+#include <limits.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -327,37 +328,46 @@ static void terrain_column_slopes(const float *hgt, int gw, int gh, int x, int y
 static int column_top_z(volume_t *volume, volume_iterator_t *it,
                           const int start_pos[3], int dz, int x, int y)
 {
-    int pos[3];
-    uint8_t c[4];
-
-    pos[0] = x + start_pos[0];
-    pos[1] = y + start_pos[1];
-    for (int z = dz - 1; z >= 0; z--) {
-        pos[2] = z + start_pos[2];
-        volume_get_at(volume, it, pos, c);
-        if (c[3])
-            return z;
-    }
-    return -1;
+    int z = volume_get_column_top(volume, x + start_pos[0], y + start_pos[1],
+                                  start_pos[2], start_pos[2] + dz - 1);
+    return z == INT_MIN ? -1 : z - start_pos[2];
 }
 
-static void apply_terrain_coloring(volume_t *volume, terrain_coloring_settings_t *s,
-                                   bool step_grass_tones, bool step_water_tint,
-                                   bool step_ambient, bool step_directional,
-                                   bool step_shadow_cast, bool step_shadow_smooth,
-                                   int normal_half_span, float grass_detail_noise,
-                                   float grass_slope_exponent, float grass_slope_gain,
-                                   float grass_height_scale,
-                                   int water_bottom_layers,
-                                   float water_noise_strength, int shadow_blur_blocks,
-                                   float shadow_sun_height_step, bool wrap_shadows,
-                                   float rugged_color_noise)
+/*
+ * Runs on the filter job thread: only use the settings copied in the job.
+ * The progress goes from progress0 to progress1; returns false if the job
+ * has been canceled.
+ */
+static bool apply_terrain_coloring(volume_t *volume, const float image_box[4][4],
+                                   const filter_terrain_coloring_t *filter,
+                                   filter_job_t *job,
+                                   float progress0, float progress1)
 {
+    const terrain_coloring_settings_t *s = &filter->settings;
+    const bool step_grass_tones = filter->step_grass_tones;
+    const bool step_water_tint = filter->step_water_tint;
+    const bool step_ambient = filter->step_ambient;
+    const bool step_directional = filter->step_directional;
+    const bool step_shadow_cast = filter->step_shadow_cast;
+    const bool step_shadow_smooth = filter->step_shadow_smooth;
+    const int normal_half_span = filter->normal_half_span;
+    const float grass_detail_noise = filter->grass_detail_noise;
+    const float grass_slope_exponent = filter->grass_slope_exponent;
+    const float grass_slope_gain = filter->grass_slope_gain;
+    const float grass_height_scale = filter->grass_height_scale;
+    const int water_bottom_layers = filter->water_bottom_layers;
+    const float water_noise_strength = filter->water_noise_strength;
+    const int shadow_blur_blocks = filter->shadow_blur_blocks;
+    const float shadow_sun_height_step = filter->shadow_sun_height_step;
+    const bool wrap_shadows = filter->wrap_shadows;
+    const float rugged_color_noise = filter->rugged_color_noise;
+    const float dp = progress1 - progress0;
+    bool ret = false;
     float box[4][4];
     int dimensions[3], start_pos[3];
     volume_iterator_t it = {0};
 
-    mat4_copy(goxel.image->box, box);
+    mat4_copy(image_box, box);
     if (box_is_null(box))
         volume_get_box(volume, true, box);
 
@@ -370,7 +380,7 @@ static void apply_terrain_coloring(volume_t *volume, terrain_coloring_settings_t
     const int n = gw * gh;
 
     if (gw <= 0 || gh <= 0 || dz <= 0)
-        return;
+        return true;
 
     float *hgt = NULL;
     uint8_t *amb_r = NULL;
@@ -448,6 +458,9 @@ static void apply_terrain_coloring(volume_t *volume, terrain_coloring_settings_t
         }
     }
 
+    if (!filter_job_progress(job, progress0 + dp * 0.2f))
+        goto cleanup;
+
     /* Pass 2: material + lighting terms (genland inner loop, height from mesh) */
     for (int y = 0; y < gh; y++) {
         for (int x = 0; x < gw; x++) {
@@ -656,6 +669,9 @@ static void apply_terrain_coloring(volume_t *volume, terrain_coloring_settings_t
         }
     }
 
+    if (!filter_job_progress(job, progress0 + dp * 0.6f))
+        goto cleanup;
+
     /* Shadows (genland): height field must stay float for comparison */
     if (step_shadow_cast) {
         const int shadow_range = max(8, max(gw, gh) / 4);
@@ -700,6 +716,9 @@ static void apply_terrain_coloring(volume_t *volume, terrain_coloring_settings_t
         }
     }
 
+    if (!filter_job_progress(job, progress0 + dp * 0.8f))
+        goto cleanup;
+
     /* Final merge + paint columns */
     for (int y = 0; y < gh; y++) {
         for (int x = 0; x < gw; x++) {
@@ -752,6 +771,8 @@ static void apply_terrain_coloring(volume_t *volume, terrain_coloring_settings_t
         }
     }
 
+    ret = filter_job_progress(job, progress1);
+
 cleanup:
     free(h_normal);
     free(hgt);
@@ -763,6 +784,46 @@ cleanup:
     free(buf_b);
     free(sh);
     free(water_pack);
+    return ret;
+}
+
+typedef struct {
+    filter_terrain_coloring_t filter;
+    float box[4][4];
+} terrain_coloring_args_t;
+
+static void terrain_coloring_job(filter_job_t *job, void *args_)
+{
+    terrain_coloring_args_t *args = args_;
+    int i, n;
+
+    for (n = 0; filter_job_get_volume(job, n); n++) {}
+    for (i = 0; i < n; i++) {
+        if (!apply_terrain_coloring(filter_job_get_volume(job, i), args->box,
+                                    &args->filter, job,
+                                    (float)i / n, (float)(i + 1) / n))
+            return;
+    }
+}
+
+static filter_job_t *terrain_coloring_job_new(
+        filter_terrain_coloring_t *filter)
+{
+    terrain_coloring_args_t args = {.filter = *filter};
+    mat4_copy(goxel.image->box, args.box);
+    return filter_job_new(&filter->filter, terrain_coloring_job, NULL,
+                          &args, sizeof(args));
+}
+
+static int apply(filter_t *filter_, layer_t *layer)
+{
+    filter_job_t *job;
+
+    if (!layer->volume) return -1;
+    job = terrain_coloring_job_new((void *)filter_);
+    filter_job_add_volume(job, layer->volume, layer);
+    filter_job_run_sync(job);
+    return 0;
 }
 
 static int gui(filter_t *filter_)
@@ -874,26 +935,20 @@ static int gui(filter_t *filter_)
         bool has_layer = goxel.image && goxel.image->active_layer;
 
         gui_enabled_begin(has_layer);
-        if (gui_button_primary("Apply to current layer", -1, 0)) {
+        if (!filter_job_gui(filter_) &&
+                gui_button_primary("Apply to current layer", -1, 0)) {
+            filter_job_t *job;
             layer_t *layer;
 
-            image_history_push(goxel.image);
+            job = terrain_coloring_job_new(filter);
             DL_FOREACH(goxel.image->layers, layer) {
                 if (!layer_in_active_subtree(goxel.image, layer))
                     continue;
                 if (!layer->volume)
                     continue;
-                apply_terrain_coloring(
-                    layer->volume, &filter->settings, filter->step_grass_tones,
-                    filter->step_water_tint, filter->step_ambient,
-                    filter->step_directional, filter->step_shadow_cast,
-                    filter->step_shadow_smooth, filter->normal_half_span,
-                    filter->grass_detail_noise, filter->grass_slope_exponent,
-                    filter->grass_slope_gain, filter->grass_height_scale,
-                    filter->water_bottom_layers, filter->water_noise_strength,
-                    filter->shadow_blur_blocks, filter->shadow_sun_height_step,
-                    filter->wrap_shadows, filter->rugged_color_noise);
+                filter_job_add_volume(job, layer->volume, layer);
             }
+            filter_job_start(job);
         }
         gui_enabled_end();
         gui_alert_if_disabled_clicked(has_layer, "No layer selected",
@@ -912,10 +967,47 @@ static void on_open(filter_t *filter_)
     }
 }
 
+#define SETTING(name, type, member) \
+    FILTER_SETTING(name, type, filter_terrain_coloring_t, member)
+
+static const filter_setting_t SETTINGS[] = {
+    SETTING("seed", INT, settings.seed),
+    SETTING("color_ground", COLOR, settings.color_ground),
+    SETTING("color_grass1", COLOR, settings.color_grass1),
+    SETTING("color_grass2", COLOR, settings.color_grass2),
+    SETTING("color_water", COLOR, settings.color_water),
+    SETTING("shadow_factor", FLOAT, settings.shadow_factor),
+    SETTING("ambience_factor", FLOAT, settings.ambience_factor),
+    SETTING("directional_light_intensity", FLOAT,
+            settings.directional_light_intensity),
+    SETTING("step_grass_tones", BOOL, step_grass_tones),
+    SETTING("step_water_tint", BOOL, step_water_tint),
+    SETTING("step_ambient", BOOL, step_ambient),
+    SETTING("step_directional", BOOL, step_directional),
+    SETTING("step_shadow_cast", BOOL, step_shadow_cast),
+    SETTING("step_shadow_smooth", BOOL, step_shadow_smooth),
+    SETTING("normal_half_span", INT, normal_half_span),
+    SETTING("grass_detail_noise", FLOAT, grass_detail_noise),
+    SETTING("grass_slope_exponent", FLOAT, grass_slope_exponent),
+    SETTING("grass_slope_gain", FLOAT, grass_slope_gain),
+    SETTING("grass_height_scale", FLOAT, grass_height_scale),
+    SETTING("water_bottom_layers", INT, water_bottom_layers),
+    SETTING("water_noise_strength", FLOAT, water_noise_strength),
+    SETTING("shadow_blur_blocks", INT, shadow_blur_blocks),
+    SETTING("shadow_sun_height_step", FLOAT, shadow_sun_height_step),
+    SETTING("wrap_shadows", BOOL, wrap_shadows),
+    SETTING("rugged_color_noise", FLOAT, rugged_color_noise),
+    {}
+};
+
+#undef SETTING
+
 FILTER_REGISTER(terrain_coloring, filter_terrain_coloring_t,
                 .name = "Terrain Coloring",
                 .menu = "effects",
                 .submenu = "generate",
                 .on_open = on_open,
                 .panel_width = 350,
-                .gui_fn = gui, )
+                .gui_fn = gui,
+                .apply_fn = apply,
+                .settings = SETTINGS, )
@@ -56,6 +56,14 @@ static int aabb_index(const int pos[3], const int start_pos[3],
     return (x * dimensions[1] + y) * dimensions[2] + z;
 }
 
+static void aabb_pos(int idx, const int start_pos[3], const int dimensions[3],
+                     int pos[3])
+{
+    pos[0] = idx / (dimensions[2] * dimensions[1]) + start_pos[0];
+    pos[1] = (idx / dimensions[2]) % dimensions[1] + start_pos[1];
+    pos[2] = idx % dimensions[2] + start_pos[2];
+}
+
 /* Exposed only to air inside the image box - box faces do not count. */
 static bool voxel_is_surface(const volume_t *volume, volume_iterator_t *iter,
                              const int pos[3], const int start_pos[3],
@@ -100,7 +108,7 @@ static void bfs_solid(bfs_node_t *queue, int *q_head, int *q_tail,
         {0, 1, 0}, {0, -1, 0},
         {0, 0, 1}, {0, 0, -1},
     };
-    int idx, dist, dx, dy, dz, x, y, z, i, npos[3], nidx, ndist;
+    int idx, dist, i, pos[3], npos[3], nidx, ndist;
 
     while (*q_head < *q_tail) {
         idx = queue[*q_head].idx;
@@ -113,17 +121,11 @@ static void bfs_solid(bfs_node_t *queue, int *q_head, int *q_tail,
         if (dist >= radius)
             continue;
 
-        dz = idx % dimensions[2];
-        dy = (idx / dimensions[2]) % dimensions[1];
-        dx = idx / (dimensions[2] * dimensions[1]);
-        x = dx + start_pos[0];
-        y = dy + start_pos[1];
-        z = dz + start_pos[2];
-
+        aabb_pos(idx, start_pos, dimensions, pos);
         for (i = 0; i < 6; i++) {
-            npos[0] = x + offsets[i][0];
-            npos[1] = y + offsets[i][1];
-            npos[2] = z + offsets[i][2];
+            npos[0] = pos[0] + offsets[i][0];
+            npos[1] = pos[1] + offsets[i][1];
+            npos[2] = pos[2] + offsets[i][2];
             if (!pos_in_aabb(npos, start_pos, dimensions))
                 continue;
             nidx = aabb_index(npos, start_pos, dimensions);
@@ -153,87 +155,129 @@ static void on_visit_min_dist(int idx, int dist, void *user)
         ctx->min_dist[idx] = dist;
 }
 
-typedef struct {
-    const bool *surface;
-    const int *min_dist;
-    const uint8_t *surf_color;
-    float *sum_r;
-    float *sum_g;
-    float *sum_b;
-    int *sum_n;
-} accumulate_ctx_t;
-
-static void on_visit_accumulate(int idx, int dist, void *user)
+/*
+ * Sum the colours of the surfaces nearest to a solid voxel.  Those are the
+ * surfaces we reach by only stepping to neighbours one step closer to a
+ * surface, since all the nodes of a shortest path to a nearest surface are
+ * themselves at their own min distance.  This is much cheaper than a BFS
+ * from each surface, where most of the visited voxels are then ignored.
+ */
+static int sum_nearest_surfaces(int idx, const int *min_dist,
+                                const uint8_t (*colors)[4],
+                                const int start_pos[3],
+                                const int dimensions[3],
+                                int *stack, uint8_t *visited,
+                                uint8_t visit_token, int sum[3])
 {
-    accumulate_ctx_t *ctx = user;
-
-    if (dist <= 0 || ctx->surface[idx])
-        return;
-    if (dist != ctx->min_dist[idx])
-        return;
-    ctx->sum_r[idx] += (float)ctx->surf_color[0];
-    ctx->sum_g[idx] += (float)ctx->surf_color[1];
-    ctx->sum_b[idx] += (float)ctx->surf_color[2];
-    ctx->sum_n[idx]++;
+    static const int offsets[6][3] = {
+        {1, 0, 0}, {-1, 0, 0},
+        {0, 1, 0}, {0, -1, 0},
+        {0, 0, 1}, {0, 0, -1},
+    };
+    int i, n = 0, nb = 0, pos[3], npos[3], nidx;
+
+    sum[0] = sum[1] = sum[2] = 0;
+    visited[idx] = visit_token;
+    stack[nb++] = idx;
+    while (nb) {
+        idx = stack[--nb];
+        if (min_dist[idx] == 0) {
+            sum[0] += colors[idx][0];
+            sum[1] += colors[idx][1];
+            sum[2] += colors[idx][2];
+            n++;
+            continue;
+        }
+        aabb_pos(idx, start_pos, dimensions, pos);
+        for (i = 0; i < 6; i++) {
+            npos[0] = pos[0] + offsets[i][0];
+            npos[1] = pos[1] + offsets[i][1];
+            npos[2] = pos[2] + offsets[i][2];
+            if (!pos_in_aabb(npos, start_pos, dimensions))
+                continue;
+            nidx = aabb_index(npos, start_pos, dimensions);
+            if (visited[nidx] == visit_token ||
+                min_dist[nidx] != min_dist[idx] - 1)
+                continue;
+            visited[nidx] = visit_token;
+            stack[nb++] = nidx;
+        }
+    }
+    return n;
 }
 
-static void apply_color_permeation(volume_t *volume, int depth, int blur)
+// Max number of tiles computed in parallel before writing them.
+#define PERMEATION_BATCH_SIZE 256
+
+/*
+ * The permeation is computed one tile at a time, on a block made of the
+ * tile and a halo of radius voxels around it: a voxel only gets the colour
+ * of the surfaces at most radius steps away, and the solid paths to them
+ * never leave the halo.  So the memory used depends on the radius and not
+ * on the image box, and the tiles can be computed in parallel.
+ */
+typedef struct {
+    const volume_t *volume;     // Copy of the volume before the filter.
+    int start_pos[3];           // Image box.
+    int dimensions[3];
+    int depth;
+    int blur;
+    int (*tiles)[3];
+    uint8_t **out;              // New voxels of each tile, NULL if unchanged.
+} permeation_ctx_t;
+
+static void permeation_tile(void *user, int tile_idx)
 {
-    float box[4][4];
-    int dimensions[3], start_pos[3];
-    int x, y, z, pos[3], idx, size, radius;
-    volume_iterator_t iter;
+    permeation_ctx_t *ctx = user;
+    const int *tile_pos = ctx->tiles[tile_idx];
+    const int n = TILE_SIZE;
+    const int depth = ctx->depth, blur = ctx->blur;
+    const int radius = depth + blur;
+    int tile_start[3], tile_dims[3], dimensions[3], start_pos[3];
+    int i, x, y, z, pos[3], idx, size, q_head, q_tail, nb, sum[3];
+    volume_iterator_t iter = {0};
     bool *solid = NULL;
     bool *surface = NULL;
     uint8_t (*colors)[4] = NULL;
-    float *sum_r = NULL;
-    float *sum_g = NULL;
-    float *sum_b = NULL;
-    int *sum_n = NULL;
     int *min_dist = NULL;
+    int *stack = NULL;
     uint8_t *visited = NULL;
     bfs_node_t *queue = NULL;
     uint8_t visit_token = 0;
-    uint8_t out[4];
+    uint8_t *voxels = NULL, *v;
+    const uint8_t *data;
     float surf_r, surf_g, surf_b, t;
-    int i, dx, dy, dz, q_head, q_tail;
+    bool changed = false;
     min_dist_ctx_t min_ctx;
-    accumulate_ctx_t acc_ctx;
-
-    radius = depth + blur;
-    if (radius <= 0)
-        return;
-
-    mat4_copy(goxel.image->box, box);
-    if (box_is_null(box))
-        volume_get_box(volume, true, box);
-
-    box_get_dimensions(box, dimensions);
-    box_get_start_pos(box, start_pos);
 
-    if (dimensions[0] <= 0 || dimensions[1] <= 0 || dimensions[2] <= 0)
-        return;
+    for (i = 0; i < 3; i++) {
+        tile_start[i] = max(tile_pos[i], ctx->start_pos[i]);
+        tile_dims[i] = min(tile_pos[i] + n,
+                           ctx->start_pos[i] + ctx->dimensions[i]) -
+                       tile_start[i];
+        if (tile_dims[i] <= 0)
+            return;
+        start_pos[i] = max(tile_start[i] - radius, ctx->start_pos[i]);
+        dimensions[i] = min(tile_start[i] + tile_dims[i] + radius,
+                            ctx->start_pos[i] + ctx->dimensions[i]) -
+                        start_pos[i];
+    }
 
     size = dimensions[0] * dimensions[1] * dimensions[2];
     solid = calloc(size, sizeof(*solid));
     surface = calloc(size, sizeof(*surface));
     colors = malloc(size * sizeof(*colors));
-    sum_r = calloc(size, sizeof(*sum_r));
-    sum_g = calloc(size, sizeof(*sum_g));
-    sum_b = calloc(size, sizeof(*sum_b));
-    sum_n = calloc(size, sizeof(*sum_n));
     min_dist = malloc(size * sizeof(*min_dist));
+    stack = malloc(size * sizeof(*stack));
     visited = calloc(size, sizeof(*visited));
     queue = malloc(size * sizeof(*queue));
-    if (!solid || !surface || !colors || !sum_r || !sum_g || !sum_b ||
-        !sum_n || !min_dist || !visited || !queue)
+    if (!solid || !surface || !colors || !min_dist || !stack || !visited ||
+        !queue)
         goto cleanup;
 
     for (i = 0; i < size; i++)
         min_dist[i] = INT_MAX;
 
-    iter = volume_get_iterator(volume, VOLUME_ITER_VOXELS | VOLUME_ITER_SKIP_EMPTY);
-
     /* Pass 1: classify solids / surfaces and cache colours. */
     for (x = 0; x < dimensions[0]; x++) {
         for (y = 0; y < dimensions[1]; y++) {
@@ -242,10 +286,11 @@ static void apply_color_permeation(volume_t *volume, int depth, int blur)
                 pos[1] = y + start_pos[1];
                 pos[2] = z + start_pos[2];
                 idx = (x * dimensions[1] + y) * dimensions[2] + z;
-                volume_get_at(volume, &iter, pos, colors[idx]);
+                volume_get_at(ctx->volume, &iter, pos, colors[idx]);
                 solid[idx] = voxel_is_solid(colors[idx]);
                 surface[idx] = solid[idx] &&
-                    voxel_is_surface(volume, &iter, pos, start_pos, dimensions);
+                    voxel_is_surface(ctx->volume, &iter, pos,
+                                     ctx->start_pos, ctx->dimensions);
             }
         }
     }
@@ -267,82 +312,131 @@ static void apply_color_permeation(volume_t *volume, int depth, int blur)
     bfs_solid(queue, &q_head, &q_tail, size, radius, solid, dimensions,
               start_pos, visited, visit_token, &min_ctx, on_visit_min_dist);
 
-    /* Pass 2b: per-surface BFS - average colours of nearest surfaces only. */
-    acc_ctx.surface = surface;
-    acc_ctx.min_dist = min_dist;
-    acc_ctx.sum_r = sum_r;
-    acc_ctx.sum_g = sum_g;
-    acc_ctx.sum_b = sum_b;
-    acc_ctx.sum_n = sum_n;
-    for (idx = 0; idx < size; idx++) {
-        if (!surface[idx])
+    /* Pass 2b: average colours of nearest surfaces, and
+     * pass 3: write RGB for non-surface solids of the tile in range. */
+    voxels = malloc(n * n * n * 4);
+    data = volume_get_tile_voxels(ctx->volume, tile_pos, voxels);
+    if (!voxels || !data)
+        goto cleanup;
+    if (data != voxels)
+        memcpy(voxels, data, n * n * n * 4);
+    for (i = 0; i < tile_dims[0] * tile_dims[1] * tile_dims[2]; i++) {
+        aabb_pos(i, tile_start, tile_dims, pos);
+        idx = aabb_index(pos, start_pos, dimensions);
+        if (!solid[idx] || surface[idx])
+            continue;
+        if (min_dist[idx] > radius)
             continue;
+
         visit_token++;
         if (visit_token == 0) {
             memset(visited, 0, (size_t)size);
             visit_token = 1;
         }
-        q_head = 0;
-        q_tail = 0;
-        visited[idx] = visit_token;
-        queue[q_tail].idx = idx;
-        queue[q_tail].dist = 0;
-        q_tail++;
-        acc_ctx.surf_color = colors[idx];
-        bfs_solid(queue, &q_head, &q_tail, size, radius, solid, dimensions,
-                  start_pos, visited, visit_token, &acc_ctx, on_visit_accumulate);
-    }
-
-    /* Pass 3: write RGB for non-surface solids in range. */
-    for (idx = 0; idx < size; idx++) {
-        if (!solid[idx] || surface[idx])
+        nb = sum_nearest_surfaces(idx, min_dist, colors, start_pos,
+                                  dimensions, stack, visited, visit_token,
+                                  sum);
+        if (nb <= 0)
             continue;
-        if (min_dist[idx] > radius || sum_n[idx] <= 0)
-            continue;
-
-        surf_r = sum_r[idx] / (float)sum_n[idx];
-        surf_g = sum_g[idx] / (float)sum_n[idx];
-        surf_b = sum_b[idx] / (float)sum_n[idx];
+        surf_r = (float)sum[0] / (float)nb;
+        surf_g = (float)sum[1] / (float)nb;
+        surf_b = (float)sum[2] / (float)nb;
 
+        v = &voxels[((pos[0] - tile_pos[0]) +
+                     (pos[1] - tile_pos[1]) * n +
+                     (pos[2] - tile_pos[2]) * n * n) * 4];
         if (min_dist[idx] <= depth || blur <= 0) {
-            out[0] = (uint8_t)(surf_r + 0.5f);
-            out[1] = (uint8_t)(surf_g + 0.5f);
-            out[2] = (uint8_t)(surf_b + 0.5f);
+            v[0] = (uint8_t)(surf_r + 0.5f);
+            v[1] = (uint8_t)(surf_g + 0.5f);
+            v[2] = (uint8_t)(surf_b + 0.5f);
         } else {
             t = (float)(min_dist[idx] - depth) / (float)blur;
             if (t < 0.0f)
                 t = 0.0f;
             if (t > 1.0f)
                 t = 1.0f;
-            out[0] = (uint8_t)(surf_r * (1.0f - t) +
-                               (float)colors[idx][0] * t + 0.5f);
-            out[1] = (uint8_t)(surf_g * (1.0f - t) +
-                               (float)colors[idx][1] * t + 0.5f);
-            out[2] = (uint8_t)(surf_b * (1.0f - t) +
-                               (float)colors[idx][2] * t + 0.5f);
+            v[0] = (uint8_t)(surf_r * (1.0f - t) +
+                             (float)colors[idx][0] * t + 0.5f);
+            v[1] = (uint8_t)(surf_g * (1.0f - t) +
+                             (float)colors[idx][1] * t + 0.5f);
+            v[2] = (uint8_t)(surf_b * (1.0f - t) +
+                             (float)colors[idx][2] * t + 0.5f);
         }
-        out[3] = colors[idx][3];
-
-        dz = idx % dimensions[2];
-        dy = (idx / dimensions[2]) % dimensions[1];
-        dx = idx / (dimensions[2] * dimensions[1]);
-        pos[0] = dx + start_pos[0];
-        pos[1] = dy + start_pos[1];
-        pos[2] = dz + start_pos[2];
-        volume_set_at(volume, &iter, pos, out);
+        changed = changed || memcmp(v, colors[idx], 4) != 0;
+    }
+    if (changed) {
+        ctx->out[tile_idx] = voxels;
+        voxels = NULL;
     }
 
 cleanup:
     free(solid);
     free(surface);
     free(colors);
-    free(sum_r);
-    free(sum_g);
-    free(sum_b);
-    free(sum_n);
     free(min_dist);
+    free(stack);
     free(visited);
     free(queue);
+    free(voxels);
+}
+
+void vxl_color_permeation(volume_t *volume, int depth, int blur)
+{
+    float box[4][4];
+    int radius, pos[3], nb_tiles = 0, capacity = 0, batch, nb, i;
+    int (*tiles)[3] = NULL;
+    volume_iterator_t iter;
+    permeation_ctx_t ctx = {
+        .depth = depth,
+        .blur = blur,
+    };
+
+    radius = depth + blur;
+    if (radius <= 0)
+        return;
+
+    mat4_copy(goxel.image->box, box);
+    if (box_is_null(box))
+        volume_get_box(volume, true, box);
+
+    box_get_dimensions(box, ctx.dimensions);
+    box_get_start_pos(box, ctx.start_pos);
+
+    if (ctx.dimensions[0] <= 0 || ctx.dimensions[1] <= 0 ||
+        ctx.dimensions[2] <= 0)
+        return;
+
+    /* Only the tiles with solid voxels can change.  Get their list first,
+     * since we are going to modify the volume. */
+    iter = volume_get_iterator(volume,
+                               VOLUME_ITER_TILES | VOLUME_ITER_SKIP_EMPTY);
+    while (volume_iter(&iter, pos)) {
+        if (nb_tiles == capacity) {
+            capacity = max(capacity * 2, 64);
+            tiles = realloc(tiles, capacity * sizeof(*tiles));
+        }
+        memcpy(tiles[nb_tiles++], pos, sizeof(pos));
+    }
+
+    /* Compute the tiles in parallel from a copy of the original volume,
+     * and write them by batches to limit the memory used. */
+    ctx.volume = volume_copy(volume);
+    ctx.out = calloc(min(nb_tiles, PERMEATION_BATCH_SIZE), sizeof(*ctx.out));
+    for (batch = 0; batch < nb_tiles; batch += PERMEATION_BATCH_SIZE) {
+        nb = min(nb_tiles - batch, PERMEATION_BATCH_SIZE);
+        ctx.tiles = tiles + batch;
+        thread_pool_run(nb, permeation_tile, &ctx);
+        for (i = 0; i < nb; i++) {
+            if (!ctx.out[i])
+                continue;
+            volume_set_tile(volume, ctx.tiles[i], ctx.out[i]);
+            free(ctx.out[i]);
+            ctx.out[i] = NULL;
+        }
+    }
+    volume_delete((volume_t *)ctx.volume);
+    free(tiles);
+    free(ctx.out);
 }
 
 static void apply_fill_upwards(layer_t *layer, const uint8_t color[4])
@@ -445,8 +539,8 @@ static int gui(filter_t *filter_)
                 if (!layer || !layer->volume)
                     return 0;
                 image_history_push(goxel.image);
-                apply_color_permeation(layer->volume, filter->depth,
-                                       filter->blur);
+                vxl_color_permeation(layer->volume, filter->depth,
+                                     filter->blur);
             }
             gui_enabled_end();
             gui_alert_if_disabled_clicked(has_layer, "No layer selected",
@@ -430,6 +430,7 @@ static void field_to_color(const water_layer_settings_t *s, float h,
 
 static void generate_water_layer(volume_t *volume,
                                  const volume_t *bleed_src,
+                                 const float image_box[4][4],
                                  const water_layer_settings_t *settings,
                                  int bleed_distance, float bleed_strength,
                                  float bleed_lightness, float bleed_blur,
@@ -443,16 +444,16 @@ static void generate_water_layer(volume_t *volume,
     uint8_t *src_rgba = NULL;
     uint8_t *src_solid = NULL;
     uint8_t *water_rgba = NULL;
+    uint8_t *sheet = NULL;
     float *bleed_buf = NULL;
     float *bleed_blurred = NULL;
-    volume_iterator_t iter;
     volume_iterator_t bleed_iter;
     float h, strength, dither, t, n, k, fade, w;
 
-    if (!volume || !goxel.image)
+    if (!volume)
         return;
 
-    mat4_copy(goxel.image->box, box);
+    mat4_copy(image_box, box);
     if (box_is_null(box))
         volume_get_box(bleed_src ? bleed_src : volume, true, box);
     if (box_is_null(box))
@@ -470,7 +471,6 @@ static void generate_water_layer(volume_t *volume,
     above_z = bottom_z + 1;
     width = dimensions[0];
     height = dimensions[1];
-    iter = volume_get_iterator(volume, VOLUME_ITER_VOXELS);
 
     radius = bleed_distance;
     strength = clamp(bleed_strength, 0.0f, 1.0f);
@@ -479,8 +479,13 @@ static void generate_water_layer(volume_t *volume,
     search_r = radius + (int)ceilf(dither);
 
     water_rgba = calloc((size_t)width * (size_t)height * 4, 1);
-    if (!water_rgba)
+    /* Final sheet voxels, in volume (x, y) order. */
+    sheet = calloc((size_t)width * (size_t)height * 4, 1);
+    if (!water_rgba || !sheet) {
+        free(water_rgba);
+        free(sheet);
         return;
+    }
 
     if (radius > 0 && bleed_src) {
         src_rgba = calloc((size_t)width * (size_t)height * 4, 1);
@@ -491,6 +496,7 @@ static void generate_water_layer(volume_t *volume,
             free(src_solid);
             free(bleed_buf);
             free(water_rgba);
+            free(sheet);
             return;
         }
         bleed_iter = volume_get_iterator(bleed_src, VOLUME_ITER_VOXELS);
@@ -593,10 +599,7 @@ static void generate_water_layer(volume_t *volume,
                                       bleed_noise);
                     blend_rgb(color, bleed, clamp(w, 0.0f, 1.0f));
                 }
-                pos[0] = start_pos[0] + x;
-                pos[1] = start_pos[1] + y;
-                pos[2] = bottom_z;
-                volume_set_at(volume, &iter, pos, color);
+                memcpy(&sheet[((size_t)y * width + x) * 4], color, 4);
             }
         }
 
@@ -606,22 +609,84 @@ static void generate_water_layer(volume_t *volume,
         for (x = 0; x < width; x++) {
             for (y = 0; y < height; y++) {
                 idx = x * height + y;
-                pos[0] = start_pos[0] + x;
-                pos[1] = start_pos[1] + y;
-                pos[2] = bottom_z;
-                volume_set_at(volume, &iter, pos, &water_rgba[idx * 4]);
+                memcpy(&sheet[((size_t)y * width + x) * 4],
+                       &water_rgba[idx * 4], 4);
             }
         }
     }
 
+    volume_fill_box(volume,
+                    (int[2][3]){{start_pos[0], start_pos[1], bottom_z},
+                                {start_pos[0] + width, start_pos[1] + height,
+                                 bottom_z + 1}},
+                    sheet, false);
+
     free(src_rgba);
     free(src_solid);
     free(bleed_buf);
     free(water_rgba);
+    free(sheet);
 }
 
 /* ---- GUI ----------------------------------------------------------------- */
 
+typedef struct {
+    filter_water_layer_t filter;
+    float box[4][4];
+    int layer_id; // Layer to replace, or zero to create a new one.
+} water_layer_args_t;
+
+static void water_layer_job(filter_job_t *job, void *args_)
+{
+    water_layer_args_t *args = args_;
+    const filter_water_layer_t *filter = &args->filter;
+
+    generate_water_layer(filter_job_get_volume(job, 0),
+                         filter_job_get_volume(job, 1), args->box,
+                         &filter->settings,
+                         filter->bleed_distance, filter->bleed_strength,
+                         filter->bleed_lightness, filter->bleed_blur,
+                         filter->bleed_dithering, filter->bleed_noise);
+}
+
+static void water_layer_commit(filter_job_t *job, void *args_)
+{
+    water_layer_args_t *args = args_;
+    layer_t *layer;
+
+    if (args->layer_id && !layer_find(goxel.image, args->layer_id)) {
+        LOG_W("Water layer target layer has been deleted");
+        return;
+    }
+    image_history_push(goxel.image);
+    if (args->layer_id) {
+        layer = layer_find(goxel.image, args->layer_id);
+    } else {
+        layer = image_ensure_layer_for_generation(
+            goxel.image, "Water layer", args->filter.layer_target);
+    }
+    if (!layer || !layer->volume)
+        return;
+    volume_set(layer->volume, filter_job_get_volume(job, 0));
+}
+
+static filter_job_t *water_layer_job_new(const filter_water_layer_t *filter,
+                                         layer_t *layer)
+{
+    water_layer_args_t args = {.filter = *filter};
+    filter_job_t *job;
+
+    mat4_copy(goxel.image->box, args.box);
+    if (layer) args.layer_id = layer->id;
+    job = filter_job_new((filter_t *)&filter->filter, water_layer_job,
+                         water_layer_commit, &args, sizeof(args));
+    /* The destination is always replaced by the sheet.  Land colours for
+     * bleed come from the merged visible layers, captured now. */
+    filter_job_add_volume(job, NULL, NULL);
+    filter_job_add_volume(job, goxel_get_layers_volume(goxel.image), NULL);
+    return job;
+}
+
 static int gui(filter_t *filter_)
 {
     filter_water_layer_t *filter = (void *)filter_;
@@ -713,30 +778,27 @@ static int gui(filter_t *filter_)
 
     if (gui_button("Reset to defaults", -1, 0))
         reset_to_defaults(filter);
-    if (gui_button_primary("Generate", -1, 0)) {
-        layer_t *layer;
-        const volume_t *bleed_src;
+    if (!filter_job_gui(filter_) && gui_button_primary("Generate", -1, 0)) {
+        layer_t *layer = NULL;
         if (!goxel.image)
             return 0;
-        image_history_push(goxel.image);
-        layer = image_ensure_layer_for_generation(
-            goxel.image, "Water layer", filter->layer_target);
-        if (!layer || !layer->volume)
-            return 0;
-        /* Capture merged visible layers before replace clears them. The
-         * destination layer is usually empty (new child) or about to be
-         * wiped, so land colours for bleed live on other layers. */
-        bleed_src = goxel_get_layers_volume(goxel.image);
-        if (filter->layer_target == LAYER_TARGET_REPLACE)
-            volume_clear(layer->volume);
-        generate_water_layer(layer->volume, bleed_src, s,
-                             filter->bleed_distance, filter->bleed_strength,
-                             filter->bleed_lightness, filter->bleed_blur,
-                             filter->bleed_dithering, filter->bleed_noise);
+        if (filter->layer_target == LAYER_TARGET_REPLACE) {
+            layer = goxel.image->active_layer;
+            if (!layer || !layer->volume)
+                return 0;
+        }
+        filter_job_start(water_layer_job_new(filter, layer));
     }
     return 0;
 }
 
+static int apply(filter_t *filter_, layer_t *layer)
+{
+    if (!layer->volume) return -1;
+    filter_job_run_sync(water_layer_job_new((void *)filter_, layer));
+    return 0;
+}
+
 static void on_open(filter_t *filter_)
 {
     filter_water_layer_t *filter = (void *)filter_;
@@ -745,10 +807,38 @@ static void on_open(filter_t *filter_)
     filter->layer_target = LAYER_TARGET_NEW_LAYER;
 }
 
+#define SETTING(name, type, member) \
+    FILTER_SETTING(name, type, filter_water_layer_t, member)
+
+static const filter_setting_t SETTINGS[] = {
+    SETTING("color", COLOR, settings.color),
+    SETTING("deep_color", COLOR, settings.deep_color),
+    SETTING("foam_color", COLOR, settings.foam_color),
+    SETTING("scale", FLOAT, settings.scale),
+    SETTING("direction_deg", FLOAT, settings.direction_deg),
+    SETTING("stretch", FLOAT, settings.stretch),
+    SETTING("warp", FLOAT, settings.warp),
+    SETTING("detail", FLOAT, settings.detail),
+    SETTING("foam", FLOAT, settings.foam),
+    SETTING("contrast", FLOAT, settings.contrast),
+    SETTING("seed", INT, settings.seed),
+    SETTING("bleed_distance", INT, bleed_distance),
+    SETTING("bleed_strength", FLOAT, bleed_strength),
+    SETTING("bleed_lightness", FLOAT, bleed_lightness),
+    SETTING("bleed_blur", FLOAT, bleed_blur),
+    SETTING("bleed_dithering", FLOAT, bleed_dithering),
+    SETTING("bleed_noise", FLOAT, bleed_noise),
+    {}
+};
+
+#undef SETTING
+
 FILTER_REGISTER(water_layer, filter_water_layer_t,
                 .name = "Water layer",
                 .menu = "effects",
                 .submenu = "generate",
                 .on_open = on_open,
                 .panel_width = 350,
-                .gui_fn = gui, )
+                .gui_fn = gui,
+                .apply_fn = apply,
+                .settings = SETTINGS, )
@@ -20,18 +20,22 @@
 #include "goxel.h"
 #include "file_format.h"
 #include "metadata.h"
+#include "utils/rle.h"
 #include <errno.h>
 
-#define VERSION 2 // Current version of the file format.
+#define VERSION 3 // Current version of the file format.
+// Files without any BLRW chunk are still saved as version 2, so that older
+// versions of goxel can open them.
+#define VERSION_PNG_BLOCKS 2
 
 /*
- * File format, version 2:
+ * File format, version 3:
  *
  * This is inspired by the png format, where the file consists of a list of
  * chunks with different types.
  *
  *  4 bytes magic string        : "GOX "
- *  4 bytes version             : 2
+ *  4 bytes version             : 3 (2 if there is no BLRW chunk)
  *  List of chunks:
  *      4 bytes: type
  *      4 bytes: data length
@@ -54,6 +58,13 @@
  *
  *  BL16: a 16^3 block saved as a 64x64 png image.
  *
+ *  BLRW: a 16^3 block saved as raw voxels (version 3):
+ *      4 bytes: encoding: 0 = raw, 1 = run-length (see utils/rle.h)
+ *      n bytes: the 16^3 RGBA voxels in x, y, z order, encoded.
+ *
+ *  The BL16 and BLRW chunks share the same blocks index, following their
+ *  order in the file.
+ *
  *  LAYR: a layer:
  *      4 bytes: number of blocks.
  *      for each block:
@@ -123,13 +134,61 @@
 // ids get written only once.
 typedef struct {
     UT_hash_handle  hh;
-    void            *v;
+    const volume_t  *volume;    // Volume and position of a tile with
+    int             pos[3];     // this data.
     uint64_t        uid;
     int             index;
 } block_hash_t;
 
+// Table of the blocks read from the BL16 and BLRW chunks, indexed by their order in
+// the file, so that the LAYR chunks can resolve their blocks in O(1).
+// Each block is kept as a volume with a single tile at the origin, so that
+// all the layer tiles referencing the same block share the same data.
+typedef struct {
+    volume_t    **blocks;
+    int         size;
+    int         capacity;
+} block_table_t;
+
 #define CHUNK_BUFF_SIZE (1 << 20) // 1 MiB max buffer size!
 
+// Number of blocks encoded or decoded in parallel before we write them
+// or add them to the volumes.  Bound the memory used for the encoded data.
+#define BLOCKS_BATCH_SIZE 1024
+
+#define BLOCK_VOXELS (TILE_SIZE * TILE_SIZE * TILE_SIZE)
+
+// BLRW chunks encodings.
+enum {
+    BLOCK_ENCODING_RAW = 0,
+    BLOCK_ENCODING_RLE = 1,
+};
+
+// A block voxels and its encoded chunk data, processed by the thread pool.
+// When saving, the voxels are read from the tile at pos in volume.
+typedef struct {
+    uint8_t         *voxels;
+    const volume_t  *volume;
+    int             pos[3];
+    uint8_t         *data;
+    int             size;
+} block_data_t;
+
+// When saving, the tiles stored with a palette are decoded in buf, instead
+// of keeping their decoded voxels in the volume.
+typedef struct {
+    block_data_t *blocks;
+    int         size;
+    uint8_t     *buf;   // BLOCKS_BATCH_SIZE decoded blocks.
+} block_batch_t;
+
+static const uint8_t *block_get_voxels(block_batch_t *batch, int i)
+{
+    const block_data_t *block = &batch->blocks[i];
+    return volume_get_tile_voxels(block->volume, block->pos,
+                                  batch->buf + (size_t)i * BLOCK_VOXELS * 4);
+}
+
 // XXX: should be something in goxel.h
 static const shape_t *SHAPES[] = {
     &shape_sphere,
@@ -333,14 +392,45 @@ static const material_t *get_material(const image_t *img, int idx)
     return NULL;
 }
 
+static void block_encode_png(void *user, int i)
+{
+    block_batch_t *batch = user;
+    block_data_t *block = &batch->blocks[i];
+    block->data = img_write_to_mem(block_get_voxels(batch, i), 64, 64, 4,
+                                   &block->size, png);
+}
+
+// Encode a BLRW chunk data, falling back to raw voxels if the run-length
+// encoding doesn't make it smaller.
+static void block_encode_raw(void *user, int i)
+{
+    block_batch_t *batch = user;
+    block_data_t *block = &batch->blocks[i];
+    const uint8_t *voxels = block_get_voxels(batch, i);
+    int32_t encoding = BLOCK_ENCODING_RLE;
+    int size;
+
+    block->data = malloc(4 + RLE_MAX_SIZE(BLOCK_VOXELS));
+    size = rle_encode_rgba(voxels, BLOCK_VOXELS, block->data + 4);
+    if (size >= BLOCK_VOXELS * 4) {
+        encoding = BLOCK_ENCODING_RAW;
+        size = BLOCK_VOXELS * 4;
+        memcpy(block->data + 4, voxels, size);
+    }
+    memcpy(block->data, &encoding, 4);
+    block->size = 4 + size;
+}
+
 void save_to_file(const image_t *img, const char *path, bool visible_only)
 {
     // XXX: remove all empty blocks before saving.
     LOG_I("Save to %s", path);
     block_hash_t *blocks_table = NULL, *data, *data_tmp;
+    block_batch_t batch = {};
     layer_t *layer;
     chunk_t c;
-    int nb_blocks, index, size, bpos[3], material_idx;
+    int i, nb_blocks, index, size, bpos[3], material_idx;
+    bool raw = goxel.gox_raw_tiles;
     uint64_t uid;
     FILE *out;
     uint8_t *png_file, *preview;
@@ -355,7 +445,7 @@ void save_to_file(const image_t *img, const char *path, bool visible_only)
         return;
     }
     fwrite("GOX ", 4, 1, out);
-    write_int32(out, VERSION);
+    write_int32(out, raw ? VERSION : VERSION_PNG_BLOCKS);
 
     // Write image info.
     chunk_write_start(&c, out, "IMG ");
@@ -363,12 +453,15 @@ void save_to_file(const image_t *img, const char *path, bool visible_only)
         chunk_write_dict_value(&c, out, "box", &img->box, sizeof(img->box));
     chunk_write_finish(&c, out);
 
-    preview = calloc(128 * 128, 4);
-    goxel_render_to_buf(preview, 128, 128, 4);
-    png_file = img_write_to_mem(preview, 128, 128, 4, &size, png);
-    chunk_write_all(out, "PREV", (char*)png_file, size);
-    free(preview);
-    free(png_file);
+    // The preview is optional, we skip it if we cannot render.
+    if (!goxel.headless) {
+        preview = calloc(128 * 128, 4);
+        goxel_render_to_buf(preview, 128, 128, 4);
+        png_file = img_write_to_mem(preview, 128, 128, 4, &size, png);
+        chunk_write_all(out, "PREV", (char*)png_file, size);
+        free(preview);
+        free(png_file);
+    }
 
     // Add all the blocks data into the hash table.
     index = 0;
@@ -376,24 +469,39 @@ void save_to_file(const image_t *img, const char *path, bool visible_only)
         if (visible_only && !layer->visible) continue;
         iter = volume_get_iterator(layer->volume, VOLUME_ITER_TILES);
         while (volume_iter(&iter, bpos)) {
-            volume_get_tile_data(layer->volume, &iter, bpos, &uid);
+            volume_get_tile_id(layer->volume, bpos, &uid);
             HASH_FIND(hh, blocks_table, &uid, sizeof(uid), data);
             if (data) continue;
             data = calloc(1, sizeof(*data));
-            data->v = volume_get_tile_data(layer->volume, &iter, bpos, NULL);
-            assert(data->v);
+            data->volume = layer->volume;
+            memcpy(data->pos, bpos, sizeof(bpos));
             data->uid = uid;
             data->index = index++;
             HASH_ADD(hh, blocks_table, uid, sizeof(data->uid), data);
         }
     }
 
-    // Write all the blocks chunks.
+    // Write all the blocks chunks.  The encoding is done in parallel by
+    // batches, but the chunks are written in the hash table order, so that
+    // the file is the same as with a serial encoding.
+    batch.blocks = calloc(BLOCKS_BATCH_SIZE, sizeof(*batch.blocks));
+    batch.buf = malloc((size_t)BLOCKS_BATCH_SIZE * BLOCK_VOXELS * 4);
     HASH_ITER(hh, blocks_table, data, data_tmp) {
-        png_file = img_write_to_mem((uint8_t*)data->v, 64, 64, 4, &size, png);
-        chunk_write_all(out, "BL16", (char*)png_file, size);
-        free(png_file);
+        batch.blocks[batch.size].volume = data->volume;
+        memcpy(batch.blocks[batch.size++].pos, data->pos, sizeof(data->pos));
+        if (batch.size < BLOCKS_BATCH_SIZE && data->hh.next) continue;
+        thread_pool_run(batch.size, raw ? block_encode_raw : block_encode_png,
+                        &batch);
+        for (i = 0; i < batch.size; i++) {
+            chunk_write_all(out, raw ? "BLRW" : "BL16",
+                            (char*)batch.blocks[i].data,
+                            batch.blocks[i].size);
+            free(batch.blocks[i].data);
+        }
+        batch.size = 0;
     }
+    free(batch.blocks);
+    free(batch.buf);
 
     // Write all the materials.
     DL_FOREACH(img->materials, material) {
@@ -426,7 +534,7 @@ void save_to_file(const image_t *img, const char *path, bool visible_only)
         if (!layer->base_id && !layer->shape) {
             iter = volume_get_iterator(layer->volume, VOLUME_ITER_TILES);
             while (volume_iter(&iter, bpos)) {
-                volume_get_tile_data(layer->volume, &iter, bpos, &uid);
+                volume_get_tile_id(layer->volume, bpos, &uid);
                 HASH_FIND(hh, blocks_table, &uid, sizeof(uid), data);
                 assert(data);
                 chunk_write_int32(&c, out, data->index);
@@ -597,6 +705,7 @@ int gox_iter_infos(const char *path,
     while (chunk_read_start(&c, in)) {
         if (c.error) goto error;
         if (strncmp(c.type, "BL16", 4) == 0) break;
+        if (strncmp(c.type, "BLRW", 4) == 0) break;
         if (strncmp(c.type, "LAYR", 4) == 0) break;
         if (strncmp(c.type, "PREV", 4) == 0) {
             png_file = calloc(1, c.length);
@@ -619,17 +728,171 @@ error:
     return -1;
 }
 
+int gox_iter_chunks(const char *path,
+                    void (*callback)(const char type[4], int size, void *user),
+                    void *user)
+{
+    FILE *in;
+    chunk_t c;
+    char magic[4];
+    int32_t version;
+
+    in = fopen(path, "rb");
+    if (!in) return -1;
+
+    if (fread(magic, 4, 1, in) != 1) goto error;
+    if (strncmp(magic, "GOX ", 4) != 0) goto error;
+    if (!read_int32_checked(in, &version)) goto error;
+
+    while (chunk_read_start(&c, in)) {
+        if (c.error) goto error;
+        callback(c.type, c.length, user);
+        chunk_read(&c, in, NULL, c.length, __LINE__);
+        if (!chunk_read_finish(&c, in)) goto error;
+    }
+    if (c.error) goto error;
+    fclose(in);
+    return version;
+
+error:
+    fclose(in);
+    LOG_W("Cannot read gox file chunks");
+    return -1;
+}
+
 
-static block_hash_t *hash_find_at(block_hash_t *hash, int index)
+static void block_table_add(block_table_t *table, volume_t *block)
+{
+    if (table->size >= table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 256;
+        table->blocks = realloc(table->blocks,
+                                table->capacity * sizeof(*table->blocks));
+    }
+    table->blocks[table->size++] = block;
+}
+
+static void block_table_release(block_table_t *table)
 {
     int i;
-    for (i = 0; i < index; i++) {
-        if (!hash) return NULL;
-        hash = hash->hh.next;
+    for (i = 0; i < table->size; i++)
+        volume_delete(table->blocks[i]);
+    free(table->blocks);
+    memset(table, 0, sizeof(*table));
+}
+
+static void block_decode_png(void *user, int i)
+{
+    block_batch_t *batch = user;
+    block_data_t *block = &batch->blocks[i];
+    int w, h, bpp = 4;
+    block->voxels = img_read_from_mem((const char*)block->data,
+                                      block->size, &w, &h, &bpp);
+    if (block->voxels && (w != 64 || h != 64 || bpp != 4)) {
+        free(block->voxels);
+        block->voxels = NULL;
+    }
+}
+
+static void block_batch_release(block_batch_t *batch)
+{
+    int i;
+    for (i = 0; i < batch->size; i++) {
+        free(batch->blocks[i].data);
+        free(batch->blocks[i].voxels);
+    }
+    free(batch->blocks);
+    memset(batch, 0, sizeof(*batch));
+}
+
+// Decode the pending blocks of a batch in parallel, and add them in order
+// to the blocks table.  Return false if any of the png was invalid.
+static bool block_batch_flush(block_batch_t *batch, block_table_t *table)
+{
+    int i;
+    bool ret = true;
+    block_data_t *block;
+    volume_t *volume;
+
+    thread_pool_run(batch->size, block_decode_png, batch);
+    for (i = 0; i < batch->size; i++) {
+        block = &batch->blocks[i];
+        if (!block->voxels) {
+            ret = false;
+        } else if (ret) {
+            volume = volume_new();
+            volume_write_tile(volume, (int[]){0, 0, 0}, block->voxels);
+            block_table_add(table, volume);
+        }
+        free(block->data);
+        free(block->voxels);
+        memset(block, 0, sizeof(*block));
+    }
+    batch->size = 0;
+    return ret;
+}
+
+// Read a BLRW chunk directly into a new block of the blocks table.
+static bool block_read_raw(chunk_t *c, FILE *in, block_table_t *table)
+{
+    uint8_t voxels[BLOCK_VOXELS * 4];
+    uint8_t *data;
+    int encoding, size;
+    volume_t *volume;
+
+    encoding = chunk_read_int32(c, in, __LINE__);
+    size = c->length - c->pos;
+    if (c->error) return false;
+    if (encoding == BLOCK_ENCODING_RAW && size == sizeof(voxels)) {
+        chunk_read(c, in, (char*)voxels, size, __LINE__);
+    } else if (encoding == BLOCK_ENCODING_RLE &&
+               size <= RLE_MAX_SIZE(BLOCK_VOXELS)) {
+        data = malloc(size);
+        chunk_read(c, in, (char*)data, size, __LINE__);
+        if (!c->error && rle_decode_rgba(data, size, voxels, BLOCK_VOXELS)) {
+            LOG_E("Corrupt block data");
+            c->error = true;
+        }
+        free(data);
+    } else {
+        LOG_E("Unsupported block encoding %d", encoding);
+        return false;
     }
-    return hash;
+    if (c->error) return false;
+    volume = volume_new();
+    volume_write_tile(volume, (int[]){0, 0, 0}, voxels);
+    block_table_add(table, volume);
+    return true;
 }
 
+// Copy a block into a volume at a given position.
+static void block_put(const volume_t *block, volume_t *volume,
+                      const int pos[3])
+{
+    int p[3], x, y, z;
+    uint8_t v[4];
+    volume_accessor_t a1, a2;
+
+    if (volume_is_empty(block)) return;
+    if (    pos[0] % TILE_SIZE == 0 &&
+            pos[1] % TILE_SIZE == 0 &&
+            pos[2] % TILE_SIZE == 0) {
+        volume_copy_tile(block, (int[]){0, 0, 0}, volume, pos);
+        return;
+    }
+    // Unaligned block (shouldn't happen in practice).
+    a1 = volume_get_accessor(block);
+    a2 = volume_get_accessor(volume);
+    for (z = 0; z < TILE_SIZE; z++)
+    for (y = 0; y < TILE_SIZE; y++)
+    for (x = 0; x < TILE_SIZE; x++) {
+        volume_get_at(block, &a1, (int[]){x, y, z}, v);
+        if (!v[3]) continue;
+        p[0] = pos[0] + x;
+        p[1] = pos[1] + y;
+        p[2] = pos[2] + z;
+        volume_set_at(volume, &a2, p, v);
+    }
+}
 
 // Ugly macro that check dict key/value and copy them if needed.
 #define DICT_CPY(key, dst) ({ \
@@ -680,19 +943,17 @@ static void image_clear_gox_content(image_t *img)
 int load_from_file(const char *path, bool replace)
 {
     layer_t *layer;
-    block_hash_t *blocks_table = NULL, *data, *data_tmp;
+    block_table_t blocks_table = {};
+    block_batch_t batch = {};
     FILE *in;
     char magic[4] = {};
-    uint8_t *voxel_data;
     int nb_blocks;
-    int w, h, bpp;
     uint8_t *png_file;
     chunk_t c;
     int i, index, version, x, y, z, material_idx = 0;
     int  dict_value_size;
     char dict_key[256];
     char dict_value[256];
-    uint64_t uid = 1;
     int aabb[2][3];
     camera_t *camera;
     material_t *mat;
@@ -715,8 +976,16 @@ int load_from_file(const char *path, bool replace)
         image_clear_gox_content(goxel.image);
     }
 
+    batch.blocks = calloc(BLOCKS_BATCH_SIZE, sizeof(*batch.blocks));
     while (chunk_read_start(&c, in)) {
         if (c.error) goto error;
+        // The blocks png are decoded by batches, make sure they are all
+        // done before any other chunk that could use them, or any BLRW
+        // block that comes after them in the blocks index.
+        if (    strncmp(c.type, "BL16", 4) != 0 &&
+                !block_batch_flush(&batch, &blocks_table)) {
+            goto error;
+        }
         if (strncmp(c.type, "BL16", 4) == 0) {
             png_file = calloc(1, c.length);
             chunk_read(&c, in, (char*)png_file, c.length, __LINE__);
@@ -724,20 +993,16 @@ int load_from_file(const char *path, bool replace)
                 free(png_file);
                 goto error;
             }
-            bpp = 4;
-            voxel_data = img_read_from_mem((void*)png_file, c.length, &w, &h, &bpp);
-            if (!voxel_data || w != 64 || h != 64 || bpp != 4) {
-                free(voxel_data);
-                free(png_file);
+            batch.blocks[batch.size].data = png_file;
+            batch.blocks[batch.size].size = c.length;
+            batch.size++;
+            if (    batch.size == BLOCKS_BATCH_SIZE &&
+                    !block_batch_flush(&batch, &blocks_table)) {
                 goto error;
             }
-            data = calloc(1, sizeof(*data));
-            data->v = calloc(1, 64 * 64 * 4);
-            memcpy(data->v, voxel_data, 64 * 64 * 4);
-            data->uid = ++uid;
-            HASH_ADD(hh, blocks_table, uid, sizeof(data->uid), data);
-            free(voxel_data);
-            free(png_file);
+
+        } else if (strncmp(c.type, "BLRW", 4) == 0) {
+            if (!block_read_raw(&c, in, &blocks_table)) goto error;
 
         } else if (strncmp(c.type, "LAYR", 4) == 0) {
             layer = image_add_layer(goxel.image, NULL);
@@ -756,9 +1021,9 @@ int load_from_file(const char *path, bool replace)
                 }
                 chunk_read_int32(&c, in, __LINE__);
                 if (c.error) goto error;
-                data = hash_find_at(blocks_table, index);
-                if (!data) goto error;
-                volume_blit(layer->volume, data->v, x, y, z, 16, 16, 16, NULL);
+                if (index >= blocks_table.size) goto error;
+                block_put(blocks_table.blocks[index], layer->volume,
+                          (int[]){x, y, z});
             }
             while ((chunk_read_dict_value(&c, in, dict_key, dict_value,
                                           &dict_value_size, __LINE__))) {
@@ -917,14 +1182,11 @@ int load_from_file(const char *path, bool replace)
         if (!chunk_read_finish(&c, in)) goto error;
     }
     if (c.error) goto error;
+    if (!block_batch_flush(&batch, &blocks_table)) goto error;
 
-    // Free the block hash table.  We do not delete the block data because
-    // they have been used by the volumes.
-    HASH_ITER(hh, blocks_table, data, data_tmp) {
-        HASH_DEL(blocks_table, data);
-        free(data->v);
-        free(data);
-    }
+    // The tiles data are still referenced by the layers volumes.
+    block_table_release(&blocks_table);
+    free(batch.blocks);
 
     if (replace) {
         goxel.image->path = strdup(path);
@@ -965,11 +1227,8 @@ int load_from_file(const char *path, bool replace)
 
 error:
     if (in) fclose(in);
-    HASH_ITER(hh, blocks_table, data, data_tmp) {
-        HASH_DEL(blocks_table, data);
-        free(data->v);
-        free(data);
-    }
+    block_batch_release(&batch);
+    block_table_release(&blocks_table);
     if (replace)
         image_clear_gox_content(goxel.image);
     return -1;
@@ -91,19 +91,58 @@ static int export_as_heightmap(const file_format_t *format, const image_t *image
     return 0;
 }
 
+typedef struct {
+    uint8_t *img;
+    int file_w, file_h, bpp;
+    int max_x, max_y;
+    int start_pos[3];
+} hmap_import_t;
+
+// Fill the heightmap columns that intersect a tile.
+static bool import_hmap_tile(void *user, const int pos[3], uint8_t *voxels)
+{
+    const hmap_import_t *hmap = user;
+    int x, y, z, z0, z1, ix, iy;
+    const uint8_t *c;
+    uint8_t *v;
+    bool changed = false;
+
+    for (y = 0; y < TILE_SIZE; y++) {
+        iy = pos[1] + y - hmap->start_pos[1];
+        if (iy < 0 || iy >= hmap->max_y) continue;
+        for (x = 0; x < TILE_SIZE; x++) {
+            ix = pos[0] + x - hmap->start_pos[0];
+            if (ix < 0 || ix >= hmap->max_x) continue;
+            // Calculate the index into the image array (row-major order)
+            c = hmap->img + ((hmap->file_h - 1 - iy) * hmap->file_w + ix) *
+                            hmap->bpp;
+            // Only the part of the column inside this tile.
+            z0 = max(hmap->start_pos[2], pos[2]);
+            z1 = min(hmap->start_pos[2] + get_hmap_z(c[0]), pos[2] + TILE_SIZE);
+            for (z = z0; z < z1; z++) {
+                v = voxels + (((z - pos[2]) * TILE_SIZE + y) * TILE_SIZE + x) * 4;
+                // Set the block color; force alpha to 255 for full opacity
+                v[0] = c[0];
+                v[1] = c[1];
+                v[2] = c[2];
+                v[3] = 255;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
 static int import_hmap(const file_format_t *format, image_t *image, const char *path)
 {
     volume_t *volume;
-    volume_iterator_t iter = {0};
-    uint8_t *img;
     float box[4][4];
-    int x, y, z, pos[3], dimensions[3], start_pos[3];;
-    int file_w, file_h;
-    uint8_t c[4];
-    int bpp = 0;
+    int dimensions[3], aabb[2][3];
+    hmap_import_t hmap = {};
 
     // Read the image file; file_w and file_h are the original image dimensions
-    img = img_read(path, &file_w, &file_h, &bpp);
+    hmap.img = img_read(path, &hmap.file_w, &hmap.file_h, &hmap.bpp);
+    if (!hmap.img) return -1;
 
     volume = image->active_layer->volume;
     mat4_copy(image->box, box);
@@ -111,40 +150,23 @@ static int import_hmap(const file_format_t *format, image_t *image, const char *
         volume_get_box(volume, true, box);
 
     box_get_dimensions(box, dimensions);
-    box_get_start_pos(box, start_pos);
+    box_get_start_pos(box, hmap.start_pos);
 
     // Determine how many pixels we can map: stop when we exceed either the image or volume bounds
-    int max_x = (dimensions[0] < file_w) ? dimensions[0] : file_w;
-    int max_y = (dimensions[1] < file_h) ? dimensions[1] : file_h;
-
-    // Iterate over the image pixels (which map to x/y coordinates in the volume)
-    for (x = 0; x < max_x; x++) {
-        for (y = 0; y < max_y; y++) {
-            // Calculate the index into the image array (row-major order)
-            int img_y = file_h - 1 - y;
-            int img_index = img_y * file_w + x;
-            c[0] = img[img_index * bpp + 0];
-            c[1] = img[img_index * bpp + 1];
-            c[2] = img[img_index * bpp + 2];
-            c[3] = 255;
-
-            int z_height = get_hmap_z(c[0]);
-            //LOG_D("%i/%i: %u/%u/%u/%u\n", x, y, c[0], c[1], c[2], c[3]);
-
-            // Map the image x,y coordinate to a volume coordinate.
-            pos[0] = x + start_pos[0];
-            pos[1] = y + start_pos[1];
-
-            // Apply this 2D pixel color to any existing block in this position
-            for (z = 0; z < z_height; z++) {
-                pos[2] = z + start_pos[2];
-                // Set the block color; force alpha to 255 for full opacity
-                volume_set_at(volume, &iter, pos, c);
-            }
-        }
-    }
-
-    free(img);
+    hmap.max_x = (dimensions[0] < hmap.file_w) ? dimensions[0] : hmap.file_w;
+    hmap.max_y = (dimensions[1] < hmap.file_h) ? dimensions[1] : hmap.file_h;
+
+    // Each image pixel is a column of voxels: fill the volume one tile at
+    // a time.
+    aabb[0][0] = hmap.start_pos[0];
+    aabb[0][1] = hmap.start_pos[1];
+    aabb[0][2] = hmap.start_pos[2];
+    aabb[1][0] = hmap.start_pos[0] + hmap.max_x;
+    aabb[1][1] = hmap.start_pos[1] + hmap.max_y;
+    aabb[1][2] = hmap.start_pos[2] + get_hmap_z(255);
+    volume_write_tiles(volume, aabb, import_hmap_tile, &hmap);
+
+    free(hmap.img);
     return 0;
 }
 
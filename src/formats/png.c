@@ -25,6 +25,10 @@ static int png_export(const image_t *img, const char *path, int w, int h)
     uint8_t *buf;
     int bpp = img->export_transparent_background ? 4 : 3;
     if (!path) return -1;
+    if (goxel.headless) {
+        LOG_E("Cannot export to png without graphics");
+        return -1;
+    }
     LOG_I("Exporting to file %s", path);
     buf = calloc(w * h, bpp);
     goxel_render_to_buf(buf, w, h, bpp);
@@ -316,27 +316,15 @@ static int *tb_build_heightmap(const volume_t *volume,
                                int zmin, int zmax_excl)
 {
     int *hm;
-    int pos[3], ix, iy, n;
-    uint8_t v[4];
-    volume_iterator_t iter;
+    int ix, iy;
 
-    n = sx * sy;
-    hm = malloc((size_t)n * sizeof(*hm));
+    hm = malloc((size_t)sx * sy * sizeof(*hm));
     if (!hm) return NULL;
-    for (ix = 0; ix < n; ix++)
-        hm[ix] = INT_MIN;
-
-    iter = volume_get_iterator(volume, VOLUME_ITER_VOXELS);
-    while (volume_iter(&iter, pos)) {
-        if (pos[0] < xmin || pos[0] >= xmin + sx) continue;
-        if (pos[1] < ymin || pos[1] >= ymin + sy) continue;
-        if (pos[2] < zmin || pos[2] >= zmax_excl) continue;
-        volume_get_at(volume, &iter, pos, v);
-        if (!voxel_is_solid(v)) continue;
-        ix = pos[0] - xmin;
-        iy = pos[1] - ymin;
-        if (pos[2] > hm[ix + iy * sx])
-            hm[ix + iy * sx] = pos[2];
+    for (iy = 0; iy < sy; iy++) {
+        for (ix = 0; ix < sx; ix++) {
+            hm[ix + iy * sx] = volume_get_column_top(
+                    volume, xmin + ix, ymin + iy, zmin, zmax_excl - 1);
+        }
     }
     return hm;
 }
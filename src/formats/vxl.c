@@ -20,6 +20,7 @@
 
 #include "goxel.h"
 #include "file_format.h"
+#include <errno.h>
 #include <libvxl.h>
 
 #ifdef RGB
@@ -31,46 +32,149 @@
 #define GREEN(c) (((c) >> 8) & 0xFF)
 #define BLUE(c) (((c) >> 16) & 0xFF)
 
+// Color of the solid voxels hidden under the surface, that are not stored
+// in the file (same as libvxl).
+#ifndef DEFAULT_COLOR
+#define DEFAULT_COLOR 0x674028
+#endif
+
+#define TILE_FLOOR(v) ((v) & ~(TILE_SIZE - 1))
+
+/*
+ * The map is decoded directly from the columns spans, by strips of
+ * TILE_SIZE rows, into a dense buffer covering a full row of tiles that is
+ * then copied into the volume with volume_fill_box.  Since the file columns
+ * are stored row by row, each strip only needs a single pass on the data.
+ */
+typedef struct {
+	int size, depth;  // Map size.
+	int pos[3];       // Volume position of the strip origin (tile aligned).
+	int w, d;         // Strip size in x and z (multiples of TILE_SIZE).
+	uint8_t *voxels;  // w * TILE_SIZE * d RGBA values.
+} vxl_strip_t;
+
+static inline void strip_set(vxl_strip_t *strip, int x, int y, int z,
+							 uint32_t color) {
+	int p[3] = {x - strip->size / 2 - strip->pos[0],
+				strip->size / 2 - 1 - y - strip->pos[1],
+				strip->depth / 2 - 1 - z - strip->pos[2]};
+	uint8_t *v = strip->voxels +
+		((p[2] * TILE_SIZE + p[1]) * strip->w + p[0]) * 4;
+	v[0] = BLUE(color);
+	v[1] = GREEN(color);
+	v[2] = RED(color);
+	v[3] = 0xFF;
+}
+
+static void strip_flush(vxl_strip_t *strip, volume_t *volume) {
+	const int aabb[2][3] = {
+		{strip->pos[0], strip->pos[1], strip->pos[2]},
+		{strip->pos[0] + strip->w, strip->pos[1] + TILE_SIZE,
+		 strip->pos[2] + strip->d}};
+	volume_fill_box(volume, aabb, strip->voxels, true);
+	memset(strip->voxels, 0, strip->w * TILE_SIZE * strip->d * 4);
+}
+
+// Decode one column of the map.  Returns a pointer to the next column, or
+// NULL if the data is invalid.
+static const uint8_t* read_column(vxl_strip_t *strip, int x, int y,
+								  const uint8_t* v, const uint8_t* end) {
+	int top_start, top_end, nb_top, nb_bottom, bottom_start, bottom_end, z;
+	const uint8_t* colors;
+	uint32_t color;
+	bool last;
+
+	do {
+		if(v + 4 > end)
+			return NULL;
+		last = v[0] == 0;
+		top_start = v[1];
+		top_end = v[2];
+		nb_top = max(top_end - top_start + 1, 0);
+		nb_bottom = last ? 0 : v[0] - 1 - nb_top;
+		colors = v + 4;
+		// The span is solid down to the air of the next span, or to the
+		// bottom of the map for the last one.
+		if(last) {
+			v = colors + nb_top * 4;
+			bottom_end = strip->depth;
+		} else {
+			v += v[0] * 4;
+			if(v + 4 > end)
+				return NULL;
+			bottom_end = v[3];
+		}
+		bottom_start = bottom_end - nb_bottom;
+		if(v > end || nb_bottom < 0 || bottom_end > strip->depth
+		   || top_start + nb_top > strip->depth
+		   || bottom_start < top_start + nb_top)
+			return NULL;
+
+		for(z = top_start + nb_top; z < bottom_start; z++)
+			strip_set(strip, x, y, z, DEFAULT_COLOR);
+		for(z = top_start; z < top_start + nb_top; z++, colors += 4) {
+			memcpy(&color, colors, 4);
+			strip_set(strip, x, y, z, color);
+		}
+		for(z = bottom_start; z < bottom_end; z++, colors += 4) {
+			memcpy(&color, colors, 4);
+			strip_set(strip, x, y, z, color);
+		}
+	} while(!last);
+	return v;
+}
+
 static int import_vxl(const file_format_t *format, image_t* image, const char* path) {
 	if(!path)
 		return -1;
 
 	int file_size;
-	void* file_data = read_file(path, &file_size);
+	uint8_t* file_data = (uint8_t*)read_file(path, &file_size);
+	if(!file_data)
+		return -1;
 
 	size_t map_size, map_depth;
 
-	if(!libvxl_size(&map_size, &map_depth, file_data, file_size))
+	if(!libvxl_size(&map_size, &map_depth, file_data, file_size)) {
+		free(file_data);
 		return -1;
+	}
 
-	struct libvxl_map map;
+	volume_t* volume = image->active_layer->volume;
 
-	if(!libvxl_create(&map, map_size, map_size, map_depth, file_data,
-					  file_size))
-		return -1;
+	vxl_strip_t strip = {.size = map_size, .depth = map_depth};
+	strip.pos[0] = TILE_FLOOR(-strip.size / 2);
+	strip.w = TILE_FLOOR(strip.size - strip.size / 2 - 1) + TILE_SIZE
+		- strip.pos[0];
+	strip.pos[2] = TILE_FLOOR(strip.depth / 2 - strip.depth);
+	strip.d = TILE_FLOOR(strip.depth / 2 - 1) + TILE_SIZE - strip.pos[2];
+	strip.pos[1] = TILE_FLOOR(strip.size / 2 - 1);
+	strip.voxels = calloc(strip.w * TILE_SIZE * strip.d, 4);
 
-	volume_iterator_t it
-		= volume_get_iterator(image->active_layer->volume, VOLUME_ITER_VOXELS);
-
-	for(size_t x = 0; x < map_size; x++) {
-		for(size_t y = 0; y < map_size; y++) {
-			for(size_t z = 0; z < map_depth; z++) {
-				if(libvxl_map_issolid(&map, x, y, z)) {
-					uint32_t color = libvxl_map_get(&map, x, y, z);
-
-					volume_set_at(image->active_layer->volume, &it,
-								(int[3]) {x - map_size / 2,
-										  map_size / 2 - 1 - y,
-										  map_depth / 2 - 1 - z},
-								(uint8_t[4]) {BLUE(color), GREEN(color),
-											  RED(color), 0xFF});
-				}
-			}
+	const uint8_t* v = file_data;
+	const uint8_t* end = file_data + file_size;
+	int ret = 0;
+
+	for(int y = 0; y < strip.size && v; y++) {
+		if(TILE_FLOOR(strip.size / 2 - 1 - y) != strip.pos[1]) {
+			strip_flush(&strip, volume);
+			strip.pos[1] = TILE_FLOOR(strip.size / 2 - 1 - y);
 		}
+		for(int x = 0; x < strip.size && v; x++)
+			v = read_column(&strip, x, y, v, end);
+	}
+	if(v) {
+		strip_flush(&strip, volume);
+	} else {
+		LOG_E("Invalid vxl file");
+		ret = -1;
 	}
 
-	libvxl_free(&map);
-	
+	free(strip.voxels);
+	free(file_data);
+	if(ret)
+		return ret;
+
 	if(!box_is_null(image->box)) {
 		bbox_from_extents(image->box, vec3_zero, map_size / 2.0F,
 						  map_size / 2.0F, map_depth / 2.0F);
@@ -80,18 +184,8 @@ static int import_vxl(const file_format_t *format, image_t* image, const char* p
 	return 0;
 }
 
-static int export_as_vxl(const file_format_t *format, const image_t* image, const char* path) {
-	if(!path)
-		return -1;
-
-	const volume_t* volume = goxel_get_layers_volume(image);
-
-	int bbox[2][3];
-	if(box_is_null(image->box))
-		return -1;
-	
-	bbox_to_aabb(image->box, bbox);
-
+int vxl_export_voxels(const volume_t* volume, const int bbox[2][3],
+					  const char* path) {
 	struct libvxl_map map;
 	if(!libvxl_create(&map, bbox[1][0] - bbox[0][0], bbox[1][1] - bbox[0][1],
 					  bbox[1][2] - bbox[0][2], NULL, 0))
@@ -117,6 +211,231 @@ static int export_as_vxl(const file_format_t *format, const image_t* image, cons
 	return 0;
 }
 
+/*
+ * Fast export, that writes the vxl columns directly.
+ *
+ * The solid voxels of each column are first gathered from the tiles into a
+ * 64 bits mask, so that the surface voxels (solid voxels with an air
+ * neighbor) can be computed for a whole column with a few bit operations.
+ * The buried voxels are not saved in the file, so only the surface voxels
+ * colors need to be read back from the tiles.
+ */
+typedef struct {
+	int w, h, d;          // Map size.
+	int bbox[2][3];       // Volume box of the map.
+	uint64_t* solid;      // Solid mask of each column (bit z).
+	// Tiles data of the current row of tiles, indexed by x and z.
+	int tiles_pos[3];
+	int tiles_w, tiles_d;
+	const uint8_t** tiles;
+	// Buffer for the row tiles that need to be decoded (palette tiles).
+	uint8_t* tiles_buf;
+} vxl_writer_t;
+
+static uint64_t writer_get_solid(const vxl_writer_t* w, int x, int y) {
+	// Outside of the map counts as air, so that the borders are visible.
+	if(x < 0 || y < 0 || x >= w->w || y >= w->h)
+		return 0;
+	return w->solid[y * w->w + x];
+}
+
+static void writer_fill_solid(vxl_writer_t* w, const volume_t* volume) {
+	volume_iterator_t iter;
+	int bpos[3], x, y, z, vx, vy, vz;
+	const uint8_t* data;
+	uint8_t* buf = malloc(TILE_SIZE * TILE_SIZE * TILE_SIZE * 4);
+
+	w->solid = calloc(w->w * w->h, sizeof(*w->solid));
+	iter = volume_get_iterator(volume, VOLUME_ITER_TILES);
+	while(volume_iter(&iter, bpos)) {
+		data = volume_get_tile_voxels(volume, bpos, buf);
+		if(!data)
+			continue;
+		for(z = 0; z < TILE_SIZE; z++) {
+			vz = w->bbox[1][2] - 1 - (bpos[2] + z);
+			if(vz < 0 || vz >= w->d)
+				continue;
+			for(y = 0; y < TILE_SIZE; y++) {
+				vy = w->bbox[1][1] - 1 - (bpos[1] + y);
+				if(vy < 0 || vy >= w->h)
+					continue;
+				for(x = 0; x < TILE_SIZE; x++) {
+					vx = bpos[0] + x - w->bbox[0][0];
+					if(vx < 0 || vx >= w->w)
+						continue;
+					if(data[((z * TILE_SIZE + y) * TILE_SIZE + x) * 4 + 3])
+						w->solid[vy * w->w + vx] |= 1ULL << vz;
+				}
+			}
+		}
+	}
+	free(buf);
+	// The bottom of the map is always solid in vxl files.
+	for(x = 0; x < w->w * w->h; x++)
+		w->solid[x] |= 1ULL << (w->d - 1);
+}
+
+// Get the tiles data of the row of tiles containing the map row y.
+static void writer_load_tiles(vxl_writer_t* w, const volume_t* volume, int y) {
+	int x, z, i, pos[3];
+
+	pos[1] = TILE_FLOOR(w->bbox[1][1] - 1 - y);
+	if(w->tiles && pos[1] == w->tiles_pos[1])
+		return;
+	w->tiles_pos[0] = TILE_FLOOR(w->bbox[0][0]);
+	w->tiles_pos[1] = pos[1];
+	w->tiles_pos[2] = TILE_FLOOR(w->bbox[0][2]);
+	w->tiles_w = (TILE_FLOOR(w->bbox[1][0] - 1) - w->tiles_pos[0])
+		/ TILE_SIZE + 1;
+	w->tiles_d = (TILE_FLOOR(w->bbox[1][2] - 1) - w->tiles_pos[2])
+		/ TILE_SIZE + 1;
+	if(!w->tiles) {
+		w->tiles = calloc(w->tiles_w * w->tiles_d, sizeof(*w->tiles));
+		w->tiles_buf = malloc((size_t)w->tiles_w * w->tiles_d
+							  * TILE_SIZE * TILE_SIZE * TILE_SIZE * 4);
+	}
+	for(z = 0; z < w->tiles_d; z++) {
+		for(x = 0; x < w->tiles_w; x++) {
+			i = z * w->tiles_w + x;
+			pos[0] = w->tiles_pos[0] + x * TILE_SIZE;
+			pos[2] = w->tiles_pos[2] + z * TILE_SIZE;
+			w->tiles[i] = volume_get_tile_voxels(volume, pos,
+				w->tiles_buf + (size_t)i * TILE_SIZE * TILE_SIZE * TILE_SIZE * 4);
+		}
+	}
+}
+
+static void writer_get_color(const vxl_writer_t* w, int x, int y, int z,
+							 uint8_t out[4]) {
+	int p[3] = {w->bbox[0][0] + x, w->bbox[1][1] - 1 - y,
+				w->bbox[1][2] - 1 - z};
+	const uint8_t* data;
+	uint32_t color;
+
+	data = w->tiles[(TILE_FLOOR(p[2]) - w->tiles_pos[2]) / TILE_SIZE
+					* w->tiles_w
+					+ (TILE_FLOOR(p[0]) - w->tiles_pos[0]) / TILE_SIZE];
+	p[0] -= TILE_FLOOR(p[0]);
+	p[1] -= TILE_FLOOR(p[1]);
+	p[2] -= TILE_FLOOR(p[2]);
+	data = data ? data + ((p[2] * TILE_SIZE + p[1]) * TILE_SIZE + p[0]) * 4
+		: NULL;
+	// The forced bottom voxels might not be in the volume.
+	color = (data && data[3]) ? RGB(data[2], data[1], data[0])
+		: DEFAULT_COLOR;
+	memcpy(out, &color, 4);
+}
+
+// Encode a column into buf, returns the size of the data.
+static int writer_encode_column(const vxl_writer_t* w, int x, int y,
+								uint8_t* buf) {
+	uint64_t solid, surface, hidden;
+	int z = 0, k, air_start, top_start, top_end, bottom_start, size = 0;
+	uint8_t* span;
+
+	solid = writer_get_solid(w, x, y);
+	// Solid voxels with all their neighbors solid are buried.  The voxel
+	// above the top is air, the one below the bottom is solid.
+	hidden = writer_get_solid(w, x - 1, y) & writer_get_solid(w, x + 1, y)
+		& writer_get_solid(w, x, y - 1) & writer_get_solid(w, x, y + 1)
+		& (solid << 1) & ((solid >> 1) | (1ULL << (w->d - 1)));
+	surface = solid & ~hidden;
+
+#define SOLID(z) (((solid) >> (z)) & 1)
+#define SURFACE(z) (((surface) >> (z)) & 1)
+
+	while(z < w->d) {
+		air_start = z;
+		while(z < w->d && !SOLID(z))
+			z++;
+		top_start = z;
+		while(z < w->d && SURFACE(z))
+			z++;
+		top_end = z;
+		while(z < w->d && SOLID(z) && !SURFACE(z))
+			z++;
+		// The bottom colors must be followed by air, otherwise they will be
+		// the top colors of the next span.
+		bottom_start = z;
+		for(k = z; k < w->d && SURFACE(k); k++)
+			;
+		if(k < w->d && !SOLID(k))
+			z = k;
+
+		span = buf + size;
+		span[0] = (z == w->d) ? 0 : 1 + (top_end - top_start)
+			+ (z - bottom_start);
+		span[1] = top_start;
+		span[2] = top_end - 1;
+		span[3] = air_start;
+		size += 4;
+		for(k = top_start; k < top_end; k++, size += 4)
+			writer_get_color(w, x, y, k, buf + size);
+		for(k = bottom_start; k < z; k++, size += 4)
+			writer_get_color(w, x, y, k, buf + size);
+	}
+
+#undef SOLID
+#undef SURFACE
+
+	return size;
+}
+
+int vxl_export_columns(const volume_t* volume, const int bbox[2][3],
+					   const char* path) {
+	vxl_writer_t w = {.w = bbox[1][0] - bbox[0][0],
+					  .h = bbox[1][1] - bbox[0][1],
+					  .d = bbox[1][2] - bbox[0][2]};
+	uint8_t* buf;
+	FILE* file;
+	int x, y, size;
+
+	if(w.w <= 0 || w.h <= 0 || w.d <= 0 || w.d > 64)
+		return -1;
+	memcpy(w.bbox, bbox, sizeof(w.bbox));
+	file = fopen(path, "wb");
+	if(!file) {
+		LOG_E("Cannot save to %s: %s", path, strerror(errno));
+		return -1;
+	}
+
+	writer_fill_solid(&w, volume);
+	// A column has at most one span and one color per voxel.
+	buf = malloc(w.d * 8 + 4);
+	for(y = 0; y < w.h; y++) {
+		writer_load_tiles(&w, volume, y);
+		for(x = 0; x < w.w; x++) {
+			size = writer_encode_column(&w, x, y, buf);
+			fwrite(buf, size, 1, file);
+		}
+	}
+
+	free(buf);
+	free(w.tiles);
+	free(w.tiles_buf);
+	free(w.solid);
+	fclose(file);
+	return 0;
+}
+
+static int export_as_vxl(const file_format_t *format, const image_t* image, const char* path) {
+	if(!path)
+		return -1;
+
+	const volume_t* volume = goxel_get_layers_volume(image);
+
+	int bbox[2][3];
+	if(box_is_null(image->box))
+		return -1;
+	
+	bbox_to_aabb(image->box, bbox);
+
+	// The direct encoder only supports up to 64 voxels deep maps.
+	if(bbox[1][2] - bbox[0][2] <= 64)
+		return vxl_export_columns(volume, bbox, path);
+	return vxl_export_voxels(volume, bbox, path);
+}
+
 FILE_FORMAT_REGISTER(vxl,
     .name = "vxl",
     .exts = {"*.vxl"},
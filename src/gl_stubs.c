@@ -0,0 +1,116 @@
+/* Goxel 3D voxels editor
+ *
+ * copyright (c) 2024-present Guillaume Chereau <guillaume@noctua-software.com>
+ *
+ * Goxel is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Goxel is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * goxel.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stubs of the OpenGL functions used by the core library, linked instead of
+ * libGL into the headless programs (goxel_cli), so that they can run on
+ * machines without any GL driver installed.
+ *
+ * The headless programs never create a GL context, and the code paths that
+ * render check goxel.headless, so none of those should ever be called.
+ *
+ * This file is not part of the core library: it doesn't include the GL
+ * headers, and the functions don't have their real signatures.  If the core
+ * starts to use a new GL function, goxel_cli will fail to link until it is
+ * added here.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void gl_stub_called(const char *name)
+{
+    fprintf(stderr, "%s called without GL context\n", name);
+    abort();
+}
+
+#define STUB(name) \
+    void name(void); \
+    void name(void) { gl_stub_called(#name); }
+
+STUB(glActiveTexture)
+STUB(glAttachShader)
+STUB(glBindAttribLocation)
+STUB(glBindBuffer)
+STUB(glBindFramebuffer)
+STUB(glBindRenderbuffer)
+STUB(glBindTexture)
+STUB(glBlendColor)
+STUB(glBlendEquation)
+STUB(glBlendFunc)
+STUB(glBufferData)
+STUB(glCheckFramebufferStatus)
+STUB(glClear)
+STUB(glClearColor)
+STUB(glCompileShader)
+STUB(glCreateProgram)
+STUB(glCreateShader)
+STUB(glCullFace)
+STUB(glDeleteBuffers)
+STUB(glDeleteFramebuffers)
+STUB(glDeleteProgram)
+STUB(glDeleteRenderbuffers)
+STUB(glDeleteShader)
+STUB(glDeleteTextures)
+STUB(glDepthFunc)
+STUB(glDepthMask)
+STUB(glDisable)
+STUB(glDisableVertexAttribArray)
+STUB(glDrawArrays)
+STUB(glDrawBuffer)
+STUB(glDrawElements)
+STUB(glEnable)
+STUB(glEnableVertexAttribArray)
+STUB(glFramebufferRenderbuffer)
+STUB(glFramebufferTexture2D)
+STUB(glGenBuffers)
+STUB(glGenFramebuffers)
+STUB(glGenRenderbuffers)
+STUB(glGenTextures)
+STUB(glGenerateMipmap)
+STUB(glGetActiveUniform)
+STUB(glGetAttachedShaders)
+STUB(glGetError)
+STUB(glGetIntegerv)
+STUB(glGetProgramInfoLog)
+STUB(glGetProgramiv)
+STUB(glGetShaderInfoLog)
+STUB(glGetShaderiv)
+STUB(glGetString)
+STUB(glGetUniformLocation)
+STUB(glLineWidth)
+STUB(glLinkProgram)
+STUB(glPolygonMode)
+STUB(glReadBuffer)
+STUB(glReadPixels)
+STUB(glRenderbufferStorage)
+STUB(glScissor)
+STUB(glShaderSource)
+STUB(glStencilMask)
+STUB(glTexImage2D)
+STUB(glTexParameterf)
+STUB(glTexParameteri)
+STUB(glUniform1f)
+STUB(glUniform1i)
+STUB(glUniform2fv)
+STUB(glUniform3fv)
+STUB(glUniform4fv)
+STUB(glUniformMatrix4fv)
+STUB(glUseProgram)
+STUB(glVertexAttribPointer)
+STUB(glViewport)
@@ -832,6 +832,12 @@ void goxel_init(void)
 
     goxel_load_recent_files();
 
+    // Can be changed in the settings.
+    goxel.rend.mesh_upload_budget = 64;
+    goxel.history_budget = 1024;
+    goxel.history_spill = true;
+    goxel.history_spill_budget = 4096;
+
     /* Ensure Trenchblocks vox export is registered (also keeps the TU linked). */
     goxel_ensure_vox_trenchblocks_format();
 
@@ -1071,6 +1077,7 @@ int goxel_iter(const inputs_t *inputs)
     sound_iter();
     update_window_title();
 
+    filters_update();
     palette_in_use_update_if_needed();
 
     goxel.frame_count++;
@@ -1878,32 +1885,100 @@ const volume_t *goxel_get_layers_volume_for_snap(const image_t *img)
     return goxel.layers_snap_volume_;
 }
 
+// Recompute the tile of the render volume at a given position, from the
+// layers below the active one, the tool volume and the layers above.
+static void render_volume_update_tile(const image_t *img, const int pos[3])
+{
+    volume_t *render = goxel.render_volume_;
+    const layer_t *active = img->active_layer;
+    const layer_t *layer;
+
+    if (volume_get_tile_id(goxel.render_below_, pos, NULL))
+        volume_copy_tile(goxel.render_below_, pos, render, pos);
+    else
+        volume_clear_tile(render, NULL, pos);
+    volume_merge_tile(render, goxel.tool_volume, pos, MODE_OVER, NULL);
+    for (layer = active->next; layer; layer = layer->next) {
+        if (!layer->volume) continue;
+        if (!layer_effectively_visible(img, layer)) continue;
+        volume_merge_tile(render, layer->volume, pos, MODE_OVER, NULL);
+    }
+}
+
+/*
+ * The render volume is the merge of the layers below the active one (cached
+ * in render_below_), the tool volume and the layers above.  While painting
+ * only the tool volume changes, so we only merge again the tiles that are
+ * different from the last tool volume we used.
+ */
 const volume_t *goxel_get_render_volume(const image_t *img)
 {
-    uint32_t key, k;
-    const volume_t *volume;
-    layer_t *layer;
+    uint32_t key = 0, k;
+    const layer_t *layer, *active;
+    volume_iterator_t iter;
+    int pos[3];
+    uint64_t id1, id2;
+    bool below = true, rebuild = false;
 
     if (!goxel.tool_volume)
         return goxel_get_layers_volume(img);
 
-    key = volume_get_key(goxel_get_layers_volume(img));
-    k = volume_get_key(goxel.tool_volume);
-    key = XXH32(&k, sizeof(k), key);
-    if (key != goxel.render_volume_hash) {
-        image_update(goxel.image);
+    image_update((image_t *)img);
+    active = img->active_layer;
+    if (!active || !active->volume || !layer_effectively_visible(img, active))
+        return goxel_get_layers_volume(img);
+
+    DL_FOREACH(img->layers, layer) {
+        if (!layer->volume) continue;
+        if (!layer_effectively_visible(img, layer)) continue;
+        k = (layer == active) ? 0 : layer_get_key(layer);
+        key = XXH32(&k, sizeof(k), key);
+    }
+
+    if (!goxel.render_volume_) {
+        goxel.render_volume_ = volume_new();
+        goxel.render_below_ = volume_new();
+        goxel.render_tool_ = volume_new();
+        rebuild = true;
+    }
+
+    if (rebuild || key != goxel.render_volume_hash) {
         goxel.render_volume_hash = key;
-        if (!goxel.render_volume_) goxel.render_volume_ = volume_new();
-        volume_clear(goxel.render_volume_);
-        DL_FOREACH(goxel.image->layers, layer) {
+        volume_clear(goxel.render_below_);
+        DL_FOREACH(img->layers, layer) {
+            if (layer == active) below = false;
+            if (!layer->volume) continue;
             if (!layer_effectively_visible(img, layer)) continue;
-            volume = layer->volume;
-            if (goxel.image->active_layer &&
-                    volume == goxel.image->active_layer->volume)
-                volume = goxel.tool_volume;
-            volume_merge(goxel.render_volume_, volume, MODE_OVER, NULL);
+            if (below) {
+                volume_merge(goxel.render_below_, layer->volume, MODE_OVER,
+                             NULL);
+                continue;
+            }
+            if (layer == active) {
+                volume_set(goxel.render_volume_, goxel.render_below_);
+                volume_merge(goxel.render_volume_, goxel.tool_volume,
+                             MODE_OVER, NULL);
+                continue;
+            }
+            volume_merge(goxel.render_volume_, layer->volume, MODE_OVER, NULL);
         }
+        volume_set(goxel.render_tool_, goxel.tool_volume);
+        return goxel.render_volume_;
+    }
+
+    if (volume_get_key(goxel.tool_volume) ==
+            volume_get_key(goxel.render_tool_))
+        return goxel.render_volume_;
+
+    iter = volume_get_union_iterator(goxel.render_tool_, goxel.tool_volume,
+                                     VOLUME_ITER_TILES);
+    while (volume_iter(&iter, pos)) {
+        volume_get_tile_id(goxel.render_tool_, pos, &id1);
+        volume_get_tile_id(goxel.tool_volume, pos, &id2);
+        if (id1 == id2) continue;
+        render_volume_update_tile(img, pos);
     }
+    volume_set(goxel.render_tool_, goxel.tool_volume);
     return goxel.render_volume_;
 }
 
@@ -2118,6 +2193,7 @@ void goxel_render_to_buf(uint8_t *buf, int w, int h, int bpp)
     rend.fbo = fbo->framebuffer;
     rend.scale = 1.0;
     rend.items = NULL;
+    rend.mesh_upload_budget = 0; // We need all the tiles.
 
     // XXX: use goxel_get_render_layers!
     render_volume(&rend, volume, NULL, 0);
@@ -43,6 +43,7 @@
 #include "inputs.h"
 #include "layer.h"
 #include "log.h"
+#include "mask.h"
 #include "material.h"
 #include "volume.h"
 #include "volume_utils.h"
@@ -64,9 +65,11 @@
 #include "utils/gl.h"
 #include "utils/img.h"
 #include "utils/plane.h"
+#include "utils/point_grid.h"
 #include "utils/noise.h"
 #include "utils/sound.h"
 #include "utils/texture.h"
+#include "utils/thread_pool.h"
 #include "utils/vec.h"
 
 #include "brush_textures.h"
@@ -521,6 +524,9 @@ typedef struct goxel
 
     // Flag so that we reinit OpenGL after the context has been killed.
     bool       graphics_initialized;
+    // Set when running without any graphics context (batch mode, cli), so
+    // that we don't try to render anything.
+    bool       headless;
     // We can't reset the graphics in the middle of the gui, so use this.
     // for testing.
     bool       request_test_graphic_release;
@@ -541,7 +547,9 @@ typedef struct goxel
     int        layer_subtree_root_id;
 
     volume_t   *render_volume_; // All the layers + tool volume.
-    uint32_t   render_volume_hash;
+    uint32_t   render_volume_hash;      /* All the layers but the active one. */
+    volume_t   *render_below_;  // Visible layers below the active one.
+    volume_t   *render_tool_;   // Tool volume merged into render_volume_.
 
     layer_t    *render_layers;
     uint32_t   render_layers_hash;      /* Structural: image + focus + active (no tool). */
@@ -677,6 +685,18 @@ typedef struct goxel
 
     // Last save path specified in the Export panel
     const char* last_export_panel_path;
+
+    // Save the gox blocks as raw voxels (BLRW chunks) instead of png.
+    // Faster to save and load, but older versions cannot open the files.
+    bool gox_raw_tiles;
+
+    // Max memory of the undo history in MiB, zero for no limit.  The oldest
+    // steps are moved to disk (or dropped if history_spill is not set) when
+    // we go over.
+    int history_budget;
+    bool history_spill;
+    // Max size of the steps on disk in MiB, zero for no limit.
+    int history_spill_budget;
 } goxel_t;
 
 // the global goxel instance.
@@ -803,6 +823,27 @@ int gox_iter_infos(const char *path,
                                    void *value, void *user),
                    void *user);
 
+// Iter the chunks types and sizes of a gox file, without reading their data.
+// Returns the file version, or -1 in case of error.
+int gox_iter_chunks(const char *path,
+                    void (*callback)(const char type[4], int size, void *user),
+                    void *user);
+
+// Export a volume box as a vxl map, encoding the columns directly from the
+// tiles.  Only supports maps up to 64 voxels deep, returns -1 otherwise.
+int vxl_export_columns(const volume_t *volume, const int bbox[2][3],
+                       const char *path);
+
+// Same as vxl_export_columns, but setting all the voxels one by one with
+// libvxl.  Much slower, kept as a reference for the benchmarks.
+int vxl_export_voxels(const volume_t *volume, const int bbox[2][3],
+                      const char *path);
+
+// Give the solid voxels under the surface the average color of their
+// nearest surface voxels, up to depth + blur voxels deep, inside the image
+// box (or the volume box if not set).  Used by the vxl utils filter.
+void vxl_color_permeation(volume_t *volume, int depth, int blur);
+
 // Section: box_edit
 /*
  * Function: gox_edit
@@ -868,5 +909,36 @@ void goxel_rotate_90(int direction, bool current_layer_only);
  * Run all the unit tests */
 void tests_run(void);
 
+// Section: benchmarks
+
+/* Function: bench_run
+ * Run the performance benchmarks and log the timings
+ *
+ * Parameters:
+ *   size      - Size along x and y of the synthetic maps, 0 for the
+ *               default of 512.
+ *   json_path - If not NULL, also write the results in a JSON file.
+ *
+ * Returns:
+ *   0 on success, or -1 if the JSON file could not be written.
+ */
+int bench_run(int size, const char *json_path);
+
+// Section: batch
+
+/* Function: batch_run
+ * Load an image, apply the filters listed in an ini file, and export the
+ * result, without using the gui.  See batch.c for the file format.
+ *
+ * Parameters:
+ *   path   - Path of the ini file.
+ *   input  - File to load first, or NULL to start from the current image.
+ *   output - File to export to.  The format depends on the extension.
+ *
+ * Returns:
+ *   0 on success.
+ */
+int batch_run(const char *path, const char *input, const char *output);
+
 
 #endif // GOXEL_H
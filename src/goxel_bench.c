@@ -0,0 +1,52 @@
+/* goxel_bench - Run the performance benchmarks without any window.
+ *
+ * Usage: goxel_bench [--size=N] [--json=FILE]
+ *
+ * The synthetic maps are N x N x 64 voxels (512 by default), and the
+ * results can be saved as JSON to compare them between builds.
+ */
+
+#include "goxel.h"
+
+#include <getopt.h>
+
+static void print_help(void)
+{
+    printf("Usage: goxel_bench [OPTION...]\n");
+    printf("Run the goxel performance benchmarks\n");
+    printf("\n");
+    printf("      --size=N            Size of the synthetic maps (512)\n");
+    printf("      --json=FILENAME     Save the results in a JSON file\n");
+    printf("      --help              Give this help list\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c, ret, size = 0;
+    const char *json = NULL;
+    const struct option options[] = {
+        {"size", required_argument, NULL, 's'},
+        {"json", required_argument, NULL, 'j'},
+        {"help", no_argument, NULL, 'h'},
+        {}
+    };
+
+    while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (c) {
+        case 's': size = atoi(optarg); break;
+        case 'j': json = optarg; break;
+        case 'h': print_help(); return 0;
+        default: return -1;
+        }
+    }
+    if (size < 0) {
+        print_help();
+        return -1;
+    }
+
+    goxel.headless = true;
+    goxel_init();
+    ret = bench_run(size, json);
+    goxel_release();
+    return ret ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+/* goxel_cli - Headless version of goxel, to convert and generate files on
+ * machines without display or GPU.
+ *
+ * Usage: goxel_cli [--batch=FILE] [--script=FILE] [-e OUTPUT] [INPUT]
+ *
+ * Never creates any window or GL context, so the functions that need to
+ * render (like the png export) fail, and the gox files are saved without
+ * preview.
+ */
+
+#include "goxel.h"
+#include "script.h"
+
+#include <getopt.h>
+
+static void print_help(void)
+{
+    printf("Usage: goxel_cli [OPTION...] [INPUT]\n");
+    printf("Headless goxel, to convert or generate files\n");
+    printf("\n");
+    printf("  -e, --export=FILENAME   Export the image to a file\n");
+    printf("      --batch=FILENAME    Apply the filters of an ini file\n");
+    printf("      --script=FILENAME   Run a script\n");
+    printf("      --help              Give this help list\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c, ret = 0;
+    const char *input = NULL, *export = NULL, *batch = NULL, *script = NULL;
+    const struct option options[] = {
+        {"export", required_argument, NULL, 'e'},
+        {"batch", required_argument, NULL, 'b'},
+        {"script", required_argument, NULL, 's'},
+        {"help", no_argument, NULL, 'h'},
+        {}
+    };
+
+    while ((c = getopt_long(argc, argv, "e:", options, NULL)) != -1) {
+        switch (c) {
+        case 'e': export = optarg; break;
+        case 'b': batch = optarg; break;
+        case 's': script = optarg; break;
+        case 'h': print_help(); return 0;
+        default: return -1;
+        }
+    }
+    if (optind < argc) input = argv[optind];
+    if (!batch && !script && !(input && export)) {
+        print_help();
+        return -1;
+    }
+
+    goxel.headless = true;
+    goxel_init();
+    if (batch) {
+        ret = batch_run(batch, input, export);
+        goto end;
+    }
+    if (input && goxel_import_file(input, NULL)) {
+        LOG_E("Cannot load %s", input);
+        ret = -1;
+        goto end;
+    }
+    if (script) {
+        ret = script_run_from_file(script, 0, NULL);
+        if (ret) goto end;
+    }
+    if (export)
+        ret = goxel_export_to_file(export, NULL);
+end:
+    goxel_release();
+    return ret ? 1 : 0;
+}
@@ -2,7 +2,8 @@
  *
  * Usage: goxel_info <file.gox>
  *
- * Prints JSON to stdout describing layers, cameras, materials, and image box.
+ * Prints JSON to stdout describing the file chunks, layers, cameras, materials,
+ * and image box.
  */
 
 #include "goxel.h"
@@ -35,6 +36,31 @@ static void print_mat4(const float m[4][4]) {
     printf("]");
 }
 
+// Number and total size of the chunks of each type in the file.
+typedef struct {
+    int nb;
+    struct {
+        char type[5];
+        int count;
+        long size;
+    } types[64];
+} chunks_stats_t;
+
+static void chunk_callback(const char type[4], int size, void *user) {
+    chunks_stats_t *stats = user;
+    int i;
+    for (i = 0; i < stats->nb; i++) {
+        if (memcmp(stats->types[i].type, type, 4) == 0) break;
+    }
+    if (i == stats->nb) {
+        if (stats->nb == 64) return;
+        memcpy(stats->types[i].type, type, 4);
+        stats->nb++;
+    }
+    stats->types[i].count++;
+    stats->types[i].size += size;
+}
+
 static void log_to_stderr(void *user, const char *msg) {
     (void)user;
     fprintf(stderr, "%s\n", msg);
@@ -59,9 +85,22 @@ int main(int argc, char **argv) {
     }
 
     image_t *img = goxel.image;
+    chunks_stats_t chunks = {};
+    int version = gox_iter_chunks(argv[1], chunk_callback, &chunks);
 
     printf("{");
 
+    // File version and chunks (BL16 / BLRW for the blocks data).
+    printf("\"version\":%d", version);
+    printf(",\"chunks\":{");
+    for (int i = 0; i < chunks.nb; i++) {
+        if (i) printf(",");
+        print_json_string(chunks.types[i].type);
+        printf(":{\"count\":%d,\"size\":%ld}",
+               chunks.types[i].count, chunks.types[i].size);
+    }
+    printf("},");
+
     // Image box
     printf("\"box\":");
     if (!box_is_null(img->box))
@@ -2046,6 +2046,11 @@ void gui_text_wrapped(const char *label, ...)
     ImGui::PopTextWrapPos();
 }
 
+void gui_progress_bar(float fraction, const char *label)
+{
+    ImGui::ProgressBar(fraction, ImVec2(-1, ITEM_HEIGHT), label);
+}
+
 void gui_dummy(int w, int h)
 {
     ImGui::Dummy(ImVec2(w, h));
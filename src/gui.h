@@ -148,6 +148,8 @@ void gui_layers_request_scroll_to_active(void);
 bool gui_collapsing_header(const char *label, bool default_opened);
 void gui_text(const char *label, ...);
 void gui_text_wrapped(const char *label, ...);
+/* Full width progress bar, fraction from 0 to 1.  label can be NULL. */
+void gui_progress_bar(float fraction, const char *label);
 bool gui_button(const char *label, float w, int icon);
 /* Like gui_button, but styled with the theme accent (selected) color. */
 bool gui_button_primary(const char *label, float w, int icon);
@@ -18,6 +18,27 @@
 
 #include "goxel.h"
 
+static void history_section(void)
+{
+    image_t *img = goxel.image, *hist;
+    int i = 0;
+
+    gui_text("Total: %.1fM (max %dM)",
+             image_history_get_mem(img) / (double)(1 << 20),
+             goxel.history_budget);
+    gui_text("Disk: %.1fM (max %dM)",
+             image_history_get_spill_size() / (double)(1 << 20),
+             goxel.history_spill_budget);
+    DL_FOREACH2(img->history, hist, history_next) {
+        if (hist == img) {
+            gui_text("%d: current", i++);
+            continue;
+        }
+        gui_text("%d: %.1fM", i++,
+                 image_history_get_step_mem(img, hist) / (double)(1 << 20));
+    }
+}
+
 void gui_debug_panel(void)
 {
     volume_global_stats_t stats;
@@ -27,12 +48,18 @@ void gui_debug_panel(void)
     gui_text("Nb volumes: %d", stats.nb_volumes);
     gui_text("Nb tiles: %d", stats.nb_tiles);
     gui_text("Mem: %dM", (int)(stats.mem / (1 << 20)));
+    gui_text("Uniform tiles: %d", stats.nb_uniform_tiles);
+    gui_text("Palette tiles: %d", stats.nb_palette_tiles);
+    gui_text("Mem saved: %dM", (int)(stats.mem_saved / (1 << 20)));
 
     if (!DEFINED(GLES2)) {
         gui_checkbox_flag("Show wireframe", &goxel.view_effects,
                           EFFECT_WIREFRAME, NULL);
     }
 
+    if (gui_section_begin("Undo history", GUI_SECTION_COLLAPSABLE_CLOSED)) {
+        history_section();
+    } gui_section_end();
     if (gui_button("Clear undo history", -1, 0)) {
         image_history_resize(goxel.image, 0);
     }
@@ -111,6 +111,36 @@ int gui_settings_popup(void *data)
         gui_text("Progs: %s/progs", sys_get_user_dir());
     } gui_section_end();
 
+    if (gui_section_begin("Files", GUI_SECTION_COLLAPSABLE_CLOSED)) {
+        gui_checkbox("Save gox blocks raw", &goxel.gox_raw_tiles,
+                     "Faster to save and load, but bigger files that "
+                     "older versions of goxel cannot open.");
+    } gui_section_end();
+
+    if (gui_section_begin("Undo", GUI_SECTION_COLLAPSABLE_CLOSED)) {
+        gui_input_int("Max memory (MiB)", &goxel.history_budget, 0, 65536);
+        gui_tooltip_if_hovered(
+                "The oldest undo steps are dropped when the history uses "
+                "more memory.  Zero for no limit.");
+        gui_checkbox("Keep old steps on disk", &goxel.history_spill,
+                     "Move the oldest undo steps to a temporary file "
+                     "instead of dropping them.");
+        gui_input_int("Max disk (MiB)", &goxel.history_spill_budget,
+                      0, 1 << 20);
+        gui_tooltip_if_hovered(
+                "The oldest undo steps on disk are dropped when the file "
+                "gets bigger.  Zero for no limit.");
+    } gui_section_end();
+
+    if (gui_section_begin("Render", GUI_SECTION_COLLAPSABLE_CLOSED)) {
+        gui_input_int("Tiles per frame", &goxel.rend.mesh_upload_budget,
+                      0, 4096);
+        gui_tooltip_if_hovered(
+                "Max number of new tiles shown per frame, the others are "
+                "computed in the background.  Zero to wait for all the "
+                "tiles.");
+    } gui_section_end();
+
     if (gui_section_begin("Shortcuts", GUI_SECTION_COLLAPSABLE_CLOSED)) {
         gui_columns(2);
         gui_separator();
@@ -142,6 +172,32 @@ static int settings_ini_handler(void *user, const char *section,
             return 1;
         }
     }
+    if (strcmp(section, "files") == 0) {
+        if (strcmp(name, "gox_raw_tiles") == 0) {
+            goxel.gox_raw_tiles = atoi(value) != 0;
+            return 1;
+        }
+    }
+    if (strcmp(section, "undo") == 0) {
+        if (strcmp(name, "history_budget") == 0) {
+            goxel.history_budget = atoi(value);
+            return 1;
+        }
+        if (strcmp(name, "history_spill") == 0) {
+            goxel.history_spill = atoi(value) != 0;
+            return 1;
+        }
+        if (strcmp(name, "history_spill_budget") == 0) {
+            goxel.history_spill_budget = atoi(value);
+            return 1;
+        }
+    }
+    if (strcmp(section, "render") == 0) {
+        if (strcmp(name, "mesh_upload_budget") == 0) {
+            goxel.rend.mesh_upload_budget = atoi(value);
+            return 1;
+        }
+    }
     if (strcmp(section, "shortcuts") == 0) {
         if ((a = action_get_by_name(name))) {
             strncpy(a->shortcut, value, sizeof(a->shortcut) - 1);
@@ -188,6 +244,17 @@ void settings_save(void)
     fprintf(file, "theme=%s\n", theme_get()->name);
     fprintf(file, "hide_box=%d\n", goxel.hide_box ? 1 : 0);
 
+    fprintf(file, "[files]\n");
+    fprintf(file, "gox_raw_tiles=%d\n", goxel.gox_raw_tiles ? 1 : 0);
+
+    fprintf(file, "[undo]\n");
+    fprintf(file, "history_budget=%d\n", goxel.history_budget);
+    fprintf(file, "history_spill=%d\n", goxel.history_spill ? 1 : 0);
+    fprintf(file, "history_spill_budget=%d\n", goxel.history_spill_budget);
+
+    fprintf(file, "[render]\n");
+    fprintf(file, "mesh_upload_budget=%d\n", goxel.rend.mesh_upload_budget);
+
     fprintf(file, "[shortcuts]\n");
     actions_iter(shortcut_save_callback, file);
 
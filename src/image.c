@@ -18,8 +18,11 @@
 
 #include "goxel.h"
 #include "metadata.h"
+#include "utils/rle.h"
 #include "xxhash.h"
 
+#include "../ext_src/stb/stb_ds.h"
+
 /* UI session: id of layer solo-focused in the layers panel (0 = none).
  * g_focused_via_shift: true if that focus was applied with Shift (framed). */
 static int g_focused_layer_id = 0;
@@ -925,9 +928,297 @@ static image_t *image_snap(image_t *other)
     custom_objects_copy_list(&img->custom_objects, other->custom_objects);
 
     img->history = img->history_next = img->history_prev = NULL;
+    img->history_mem_key = 0;
+    img->history_spill = NULL;
     return img;
 }
 
+/*
+ * Spill of the old history steps to disk.
+ *
+ * The tiles of a spilled step are saved rle compressed in a temporary file
+ * shared by all the images, and its layers volumes are cleared.  A tile
+ * data is only saved once, even if several steps use it, since its id
+ * changes as soon as its voxels change.  The entries are ref counted by the
+ * spilled steps, and the space of the released ones is reused for the next
+ * tiles.  The file is closed when it becomes empty.
+ */
+
+typedef struct {
+    UT_hash_handle  hh;
+    uint64_t        id;     // Tile data id.
+    int64_t         offset;
+    int64_t         size;
+    int             ref;    // Number of spilled tiles using it.
+} spill_entry_t;
+
+// Free space in the file.
+typedef struct {
+    int64_t         offset;
+    int64_t         size;
+} spill_hole_t;
+
+typedef struct {
+    int             layer;  // Index of the layer in the step.
+    int             pos[3];
+    uint64_t        id;
+} spilled_tile_t;
+
+struct history_spill {
+    spilled_tile_t  *tiles; // stb array.
+};
+
+static struct {
+    FILE            *file;
+    int64_t         size;
+    int64_t         used;   // Size minus the holes.
+    spill_entry_t   *entries;
+    spill_hole_t    *holes; // stb array, sorted by offset.
+} g_spill = {};
+
+// Find some space in the file, using the first hole big enough.
+static int64_t spill_alloc(int64_t size)
+{
+    spill_hole_t *hole;
+    int64_t ret;
+    int i;
+
+    g_spill.used += size;
+    for (i = 0; i < arrlen(g_spill.holes); i++) {
+        hole = &g_spill.holes[i];
+        if (hole->size < size) continue;
+        ret = hole->offset;
+        hole->offset += size;
+        hole->size -= size;
+        if (hole->size == 0) arrdel(g_spill.holes, i);
+        return ret;
+    }
+    ret = g_spill.size;
+    g_spill.size += size;
+    return ret;
+}
+
+static void spill_release(int64_t offset, int64_t size)
+{
+    spill_hole_t *holes;
+    int i, n;
+
+    g_spill.used -= size;
+    for (i = 0; i < arrlen(g_spill.holes); i++) {
+        if (g_spill.holes[i].offset > offset) break;
+    }
+    arrins(g_spill.holes, i, ((spill_hole_t){offset, size}));
+    holes = g_spill.holes;
+    // Merge with the next and previous holes.
+    if (i + 1 < arrlen(holes) &&
+            holes[i].offset + holes[i].size == holes[i + 1].offset) {
+        holes[i].size += holes[i + 1].size;
+        arrdel(holes, i + 1);
+    }
+    if (i > 0 && holes[i - 1].offset + holes[i - 1].size == holes[i].offset) {
+        holes[i - 1].size += holes[i].size;
+        arrdel(holes, i);
+    }
+    // A hole at the end just shrinks the file.
+    n = arrlen(holes);
+    if (n && holes[n - 1].offset + holes[n - 1].size == g_spill.size) {
+        g_spill.size = holes[n - 1].offset;
+        arrsetlen(holes, n - 1);
+    }
+    g_spill.holes = holes;
+    if (g_spill.size == 0 && g_spill.file) {
+        fclose(g_spill.file);
+        g_spill.file = NULL;
+    }
+}
+
+// fseek only takes a long offset, that is 32 bits on Windows.
+static int spill_seek(int64_t offset)
+{
+#ifdef WIN32
+    return _fseeki64(g_spill.file, offset, SEEK_SET);
+#else
+    if ((off_t)offset != offset) return -1;
+    return fseeko(g_spill.file, offset, SEEK_SET);
+#endif
+}
+
+static int spill_write_tile(uint64_t id, const uint8_t *voxels)
+{
+    const int n = TILE_SIZE * TILE_SIZE * TILE_SIZE;
+    spill_entry_t *entry;
+    uint8_t *buf;
+    int64_t offset;
+    int size, ret = 0;
+
+    HASH_FIND(hh, g_spill.entries, &id, sizeof(id), entry);
+    if (entry) {
+        entry->ref++;
+        return 0;
+    }
+    if (!g_spill.file) g_spill.file = sys_tmpfile();
+    if (!g_spill.file) {
+        LOG_E("Cannot create the undo history file");
+        return -1;
+    }
+    buf = malloc(RLE_MAX_SIZE(n));
+    size = rle_encode_rgba(voxels, n, buf);
+    offset = spill_alloc(size);
+    if (spill_seek(offset) ||
+            fwrite(buf, size, 1, g_spill.file) != 1) {
+        LOG_E("Cannot write the undo history file");
+        spill_release(offset, size);
+        ret = -1;
+    } else {
+        entry = calloc(1, sizeof(*entry));
+        entry->id = id;
+        entry->offset = offset;
+        entry->size = size;
+        entry->ref = 1;
+        HASH_ADD(hh, g_spill.entries, id, sizeof(entry->id), entry);
+    }
+    free(buf);
+    return ret;
+}
+
+static void spill_unref_tile(uint64_t id)
+{
+    spill_entry_t *entry;
+
+    HASH_FIND(hh, g_spill.entries, &id, sizeof(id), entry);
+    assert(entry);
+    if (!entry || --entry->ref > 0) return;
+    HASH_DEL(g_spill.entries, entry);
+    spill_release(entry->offset, entry->size);
+    free(entry);
+}
+
+static int spill_read_tile(uint64_t id, uint8_t *voxels)
+{
+    const int n = TILE_SIZE * TILE_SIZE * TILE_SIZE;
+    spill_entry_t *entry;
+    uint8_t *buf;
+    int ret = 0;
+
+    HASH_FIND(hh, g_spill.entries, &id, sizeof(id), entry);
+    if (!entry) return -1;
+    buf = malloc(entry->size);
+    if (spill_seek(entry->offset) ||
+            fread(buf, entry->size, 1, g_spill.file) != 1 ||
+            rle_decode_rgba(buf, entry->size, voxels, n)) {
+        LOG_E("Cannot read the undo history file");
+        ret = -1;
+    }
+    free(buf);
+    return ret;
+}
+
+static void spill_delete(history_spill_t *spill)
+{
+    int i;
+    for (i = 0; i < arrlen(spill->tiles); i++)
+        spill_unref_tile(spill->tiles[i].id);
+    arrfree(spill->tiles);
+    free(spill);
+}
+
+static void history_spill_free(image_t *img)
+{
+    if (!img->history_spill) return;
+    spill_delete(img->history_spill);
+    img->history_spill = NULL;
+}
+
+int64_t image_history_get_spill_size(void)
+{
+    return g_spill.used;
+}
+
+int64_t image_history_get_spill_file_size(void)
+{
+    return g_spill.size;
+}
+
+// Save all the tiles of a step and clear its volumes.
+static int history_page_out(image_t *step)
+{
+    history_spill_t *spill;
+    layer_t *layer;
+    volume_iterator_t iter;
+    spilled_tile_t tile;
+    const uint8_t *voxels;
+    uint8_t *buf;
+    int i = 0, ret = 0;
+
+    assert(!step->history_spill);
+    spill = calloc(1, sizeof(*spill));
+    buf = malloc(TILE_SIZE * TILE_SIZE * TILE_SIZE * 4);
+    DL_FOREACH(step->layers, layer) {
+        iter = volume_get_iterator(layer->volume, VOLUME_ITER_TILES);
+        while (ret == 0 && volume_iter(&iter, tile.pos)) {
+            tile.layer = i;
+            volume_get_tile_id(layer->volume, tile.pos, &tile.id);
+            if (tile.id == 0) continue; // Empty.
+            voxels = volume_get_tile_voxels(layer->volume, tile.pos, buf);
+            ret = spill_write_tile(tile.id, voxels);
+            if (ret == 0) arrput(spill->tiles, tile);
+        }
+        i++;
+    }
+    free(buf);
+    if (ret) {
+        spill_delete(spill);
+        return ret;
+    }
+    DL_FOREACH(step->layers, layer)
+        volume_clear(layer->volume);
+    step->history_spill = spill;
+    return 0;
+}
+
+// Load back the tiles of a spilled step.  The tiles that an other image
+// still has at the same position are shared with it instead of read.
+static int history_page_in(image_t *step, const image_t *other)
+{
+    history_spill_t *spill = step->history_spill;
+    const spilled_tile_t *tile;
+    layer_t *layer, *other_layer;
+    volume_t **volumes = NULL, **others = NULL;
+    uint8_t *buf;
+    uint64_t id;
+    int i, ret = 0;
+
+    DL_FOREACH(step->layers, layer) {
+        other_layer = img_get_layer(other, layer->id);
+        arrput(volumes, volume_new());
+        arrput(others, other_layer ? other_layer->volume : NULL);
+    }
+    buf = malloc(TILE_SIZE * TILE_SIZE * TILE_SIZE * 4);
+    for (i = 0; ret == 0 && i < arrlen(spill->tiles); i++) {
+        tile = &spill->tiles[i];
+        if (others[tile->layer] &&
+                volume_get_tile_id(others[tile->layer], tile->pos, &id) &&
+                id == tile->id) {
+            volume_copy_tile(others[tile->layer], tile->pos,
+                             volumes[tile->layer], tile->pos);
+            continue;
+        }
+        ret = spill_read_tile(tile->id, buf);
+        if (ret == 0) volume_write_tile(volumes[tile->layer], tile->pos, buf);
+    }
+    free(buf);
+
+    i = 0;
+    DL_FOREACH(step->layers, layer) {
+        if (ret == 0) volume_set(layer->volume, volumes[i]);
+        volume_delete(volumes[i++]);
+    }
+    arrfree(volumes);
+    arrfree(others);
+    if (ret == 0) history_spill_free(step);
+    return ret;
+}
+
 
 void image_delete(image_t *img)
 {
@@ -958,6 +1249,7 @@ void image_delete(image_t *img)
         material_delete(mat);
     }
     custom_objects_free_list(&img->custom_objects);
+    history_spill_free(img);
 
     // Path is shared between images and snaps!
     // XXX: find a better way.
@@ -1849,6 +2141,13 @@ static void debug_print_history(image_t *img)
 static void debug_print_history(image_t *img) {}
 #endif
 
+static void history_apply_budget(image_t *img)
+{
+    if (goxel.history_budget > 0)
+        image_history_trim(img, (int64_t)goxel.history_budget << 20,
+                           (int64_t)goxel.history_spill_budget << 20);
+}
+
 void image_history_push(image_t *img)
 {
     image_t *snap;
@@ -1867,30 +2166,131 @@ void image_history_push(image_t *img)
     DL_APPEND2(img->history, snap, history_prev, history_next);
     DL_APPEND2(img->history, img,  history_prev, history_next);
     debug_print_history(img);
+
+    history_apply_budget(img);
+}
+
+static void history_drop_oldest(image_t *img)
+{
+    image_t *hist = img->history;
+    assert(hist != img);
+    DL_DELETE2(img->history, hist, history_prev, history_next);
+    image_delete(hist);
 }
 
 void image_history_resize(image_t *img, int size)
 {
     int i, nb = 0;
     image_t *hist;
-    layer_t *layer, *layer_tmp;
 
     // First cound the size of the history to compute how many we are going
     // to remove.
     for (hist = img->history; hist != img; hist = hist->history_next) nb++;
     nb = max(0, nb - size);
-    for (i = 0; i < nb; i++) {
-        hist = img->history;
-
-        // XXX: do that in a function!
-        DL_FOREACH_SAFE(hist->layers, layer, layer_tmp) {
-            assert(layer);
-            DL_DELETE(hist->layers, layer);
-            layer_delete(layer);
-        }
-        DL_DELETE2(img->history, hist, history_prev, history_next);
-        free(hist);
+    for (i = 0; i < nb; i++)
+        history_drop_oldest(img);
+}
+
+int64_t image_history_get_step_mem(image_t *img, image_t *step)
+{
+    image_t *next;
+    const layer_t *layer, *other;
+    uint32_t key, k;
+
+    // The volumes of a spilled step are empty.
+    if (step == img || step->history_spill) return 0;
+    // The last redo step has no next, compare it to the current image.
+    next = step->history_next ?: img;
+    key = image_get_key(step);
+    k = image_get_key(next);
+    key = XXH32(&k, sizeof(k), key);
+    if (key == step->history_mem_key) return step->history_mem;
+
+    step->history_mem = 0;
+    DL_FOREACH(step->layers, layer) {
+        other = img_get_layer(next, layer->id);
+        step->history_mem += volume_get_unshared_mem(
+                layer->volume, other ? other->volume : NULL);
     }
+    step->history_mem_key = key;
+    return step->history_mem;
+}
+
+int64_t image_history_get_mem(image_t *img)
+{
+    image_t *hist;
+    int64_t ret = 0;
+
+    DL_FOREACH2(img->history, hist, history_next)
+        ret += image_history_get_step_mem(img, hist);
+    return ret;
+}
+
+// Memory of the steps next to the current image, that we don't spill so
+// that a single undo or redo doesn't have to read the file.
+static int64_t history_get_kept_mem(image_t *img)
+{
+    int64_t ret = 0;
+    if (img->history != img)
+        ret += image_history_get_step_mem(img, img->history_prev);
+    if (img->history_next)
+        ret += image_history_get_step_mem(img, img->history_next);
+    return ret;
+}
+
+// The oldest undo step, or else the newest redo step, not spilled yet.
+static image_t *history_get_step_to_spill(image_t *img)
+{
+    image_t *hist;
+
+    for (hist = img->history; hist != img && hist != img->history_prev;
+         hist = hist->history_next) {
+        if (!hist->history_spill) return hist;
+    }
+    if (!img->history_next) return NULL;
+    for (hist = img->history->history_prev; hist != img->history_next;
+         hist = hist->history_prev) {
+        if (!hist->history_spill) return hist;
+    }
+    return NULL;
+}
+
+void image_history_trim(image_t *img, int64_t budget, int64_t disk_budget)
+{
+    int64_t mem = image_history_get_mem(img), keep = 0;
+    image_t *hist;
+    int nb = 0;
+
+    // Spilling a step changes the memory of the step before it, so we
+    // recompute the total every time.
+    if (goxel.history_spill) keep = history_get_kept_mem(img);
+    while (goxel.history_spill && mem - keep > budget) {
+        hist = history_get_step_to_spill(img);
+        if (!hist || history_page_out(hist)) break;
+        mem = image_history_get_mem(img);
+        keep = history_get_kept_mem(img);
+        nb++;
+    }
+    if (nb) LOG_D("Spill %d undo steps (%d MiB left)", nb, (int)(mem >> 20));
+
+    // The spilled steps are the oldest ones, drop them if the file gets
+    // too big.
+    nb = 0;
+    while (disk_budget > 0 && g_spill.used > disk_budget &&
+           img->history != img && img->history->history_spill) {
+        history_drop_oldest(img);
+        nb++;
+    }
+    if (nb) LOG_D("Drop %d spilled undo steps (%d MiB on disk)", nb,
+                  (int)(g_spill.used >> 20));
+
+    nb = 0;
+    while (mem - keep > budget && img->history != img) {
+        mem -= image_history_get_step_mem(img, img->history);
+        history_drop_oldest(img);
+        nb++;
+    }
+    if (nb) LOG_D("Drop %d undo steps (%d MiB left)", nb, (int)(mem >> 20));
 }
 
 // XXX: not clear what this is doing.  We should try to remove it.
@@ -1907,10 +2307,19 @@ static void swap(image_t *a, image_t *b)
 void image_undo(image_t *img)
 {
     image_t *prev = img->history_prev;
+    bool paged_in = false;
+
     if (img->history == img) {
         LOG_D("No more undo");
         return;
     }
+    if (prev->history_spill) {
+        if (history_page_in(prev, img)) {
+            LOG_E("Cannot undo");
+            return;
+        }
+        paged_in = true;
+    }
     DL_DELETE2(img->history, img, history_prev, history_next);
     DL_PREPEND_ELEM2(img->history, prev, img, history_prev, history_next);
     swap(img, prev);
@@ -1921,19 +2330,32 @@ void image_undo(image_t *img)
         camera_set(img->active_camera, prev->active_camera);
     }
 
+    // The loaded step is back in memory, spill the steps that are not next
+    // to the current one anymore.
+    if (paged_in) history_apply_budget(img);
     debug_print_history(img);
 }
 
 void image_redo(image_t *img)
 {
     image_t *next = img->history_next;
+    bool paged_in = false;
+
     if (!next) {
         LOG_D("No more redo");
         return;
     }
+    if (next->history_spill) {
+        if (history_page_in(next, img)) {
+            LOG_E("Cannot redo");
+            return;
+        }
+        paged_in = true;
+    }
     DL_DELETE2(img->history, next, history_prev, history_next);
     DL_PREPEND_ELEM2(img->history, img, next, history_prev, history_next);
     swap(img, next);
+    if (paged_in) history_apply_budget(img);
     debug_print_history(img);
 }
 
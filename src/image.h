@@ -41,6 +41,7 @@ typedef struct {
 } image_recent_color_t;
 
 typedef struct history history_t;
+typedef struct history_spill history_spill_t;
 
 struct painter; /* see volume_utils.h (painter_t) */
 
@@ -86,6 +87,11 @@ struct image {
 
     image_t *history;
     image_t *history_next, *history_prev;
+    // Cache of image_history_get_step_mem.
+    int64_t history_mem;
+    uint32_t history_mem_key;
+    // Set if the step tiles have been moved to disk.
+    history_spill_t *history_spill;
 };
 
 image_t *image_new(void);
@@ -183,6 +189,26 @@ void image_history_push(image_t *img);
 void image_undo(image_t *img);
 void image_redo(image_t *img);
 void image_history_resize(image_t *img, int size);
+/* Memory of the tiles that a history step keeps alive and that the next
+ * step (or the current image) doesn't share: what we free by dropping the
+ * step if it is the oldest one.  Cached until the steps change. */
+int64_t image_history_get_step_mem(image_t *img, image_t *step);
+/* Total memory kept alive by the undo and redo steps. */
+int64_t image_history_get_mem(image_t *img);
+/* Move the oldest undo steps, then the newest redo steps, to disk (if
+ * goxel.history_spill is set, else drop the oldest steps) until the history
+ * uses at most budget bytes of memory.  The steps next to the current image
+ * stay in memory.  The steps are loaded back by image_undo and image_redo.
+ * The oldest spilled steps are dropped while the file is bigger than
+ * disk_budget bytes (zero for no limit).  Called by image_history_push,
+ * image_undo and image_redo with goxel.history_budget and
+ * goxel.history_spill_budget. */
+void image_history_trim(image_t *img, int64_t budget, int64_t disk_budget);
+/* Size of the spilled tiles on disk, for all the images. */
+int64_t image_history_get_spill_size(void);
+/* Size of the spill file, including the free space left by the released
+ * tiles. */
+int64_t image_history_get_spill_file_size(void);
 
 bool image_layer_can_edit(const image_t *img, const layer_t *layer);
 
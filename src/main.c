@@ -131,6 +131,8 @@ typedef struct
     char *input;
     char *export;
     float scale;
+    bool bench;
+    const char *batch;
 
     const char *script;
     int script_args_nb;
@@ -140,6 +142,8 @@ typedef struct
 #define OPT_HELP 1
 #define OPT_VERSION 2
 #define OPT_SCRIPT 3
+#define OPT_BENCH 4
+#define OPT_BATCH 5
 
 typedef struct {
     const char *name;
@@ -155,6 +159,9 @@ static const gox_option_t OPTIONS[] = {
     {"scale", 's', required_argument, "FLOAT", .help="Set UI scale"},
     {"script", OPT_SCRIPT, required_argument, "FILENAME",
         .help="Run a script and exit"},
+    {"bench", OPT_BENCH, .help="Run the benchmarks and exit"},
+    {"batch", OPT_BATCH, required_argument, "FILENAME",
+        .help="Apply the filters of an ini file to INPUT, export and exit"},
     {"help", OPT_HELP, .help="Give this help list"},
     {"version", OPT_VERSION, .help="Print program version"},
     {}
@@ -220,6 +227,12 @@ static void parse_options(int argc, char **argv, args_t *args)
         case OPT_SCRIPT:
             args->script = optarg;
             break;
+        case OPT_BENCH:
+            args->bench = true;
+            break;
+        case OPT_BATCH:
+            args->batch = optarg;
+            break;
         case '?':
             exit(-1);
         }
@@ -402,6 +415,16 @@ int main(int argc, char **argv)
 
     g_scale = args.scale;
 
+    // The batch mode doesn't need any window or GL context, so that it can
+    // run on machines without display.
+    if (args.batch) {
+        goxel.headless = true;
+        goxel_init();
+        ret = batch_run(args.batch, args.input, args.export);
+        goxel_release();
+        return ret;
+    }
+
     glfwSetErrorCallback(on_glfw_error);
     glfwInit();
     glfwWindowHint(GLFW_SAMPLES, 4);
@@ -434,6 +457,11 @@ int main(int argc, char **argv)
         goxel_reset();
     }
 
+    if (args.bench) {
+        bench_run(0, NULL);
+        goto end;
+    }
+
     if (!args.input && !args.script && !args.export)
         goxel_open_most_recent_file();
 
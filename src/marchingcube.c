@@ -268,6 +268,7 @@ int volume_generate_vertices_mc(const volume_t *volume, const int block_pos[3],
 
     *size = 3;      // Triangles.
     *subdivide = MC_VOXEL_SUB_POS;
+    if (volume_block_is_hidden(volume, block_pos, effects)) return 0;
 
     // To speed things up we first get the voxel cube around the block.
     data = malloc((N + 2) * (N + 2) * (N + 2) * 4);
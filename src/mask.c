@@ -0,0 +1,443 @@
+/* Goxel 3D voxels editor
+ *
+ * copyright (c) 2024-present Guillaume Chereau <guillaume@noctua-software.com>
+ *
+ * Goxel is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * Goxel is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * goxel.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mask.h"
+#include "uthash.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N TILE_SIZE
+#define NB_WORDS (N * N * N / 64)
+
+typedef struct {
+    int         ref;
+    uint64_t    bits[NB_WORDS]; // Bit x + y * N + z * N * N.
+} mask_data_t;
+
+struct mask_tile
+{
+    UT_hash_handle  hh;     // The hash table of pos -> tiles in a mask.
+    mask_data_t     *data;
+    int             pos[3];
+};
+
+struct mask
+{
+    mask_tile_t *tiles;
+    int *tiles_ref;   // Used to implement copy on write of the tiles.
+    uint64_t key;     // Two masks with the same key have the same value.
+    uint64_t gen;     // Changes when the tiles pointers become invalid.
+};
+
+static uint64_t g_uid = 2; // Global id counter.
+
+// Masks can be created from the filters background jobs too.
+static uint64_t new_uid(void)
+{
+    return __atomic_fetch_add(&g_uid, 1, __ATOMIC_RELAXED);
+}
+
+static void tile_pos(const int pos[3], int out[3])
+{
+    out[0] = pos[0] & ~(int)(N - 1);
+    out[1] = pos[1] & ~(int)(N - 1);
+    out[2] = pos[2] & ~(int)(N - 1);
+}
+
+static bool data_is_empty(const mask_data_t *data)
+{
+    int i;
+    for (i = 0; i < NB_WORDS; i++) {
+        if (data->bits[i]) return false;
+    }
+    return true;
+}
+
+static mask_tile_t *tile_new(const int pos[3], mask_data_t *data)
+{
+    mask_tile_t *tile = calloc(1, sizeof(*tile));
+    memcpy(tile->pos, pos, sizeof(tile->pos));
+    if (!data) {
+        data = calloc(1, sizeof(*data));
+    }
+    tile->data = data;
+    data->ref++;
+    return tile;
+}
+
+static void tile_delete(mask_tile_t *tile)
+{
+    if (--tile->data->ref == 0) free(tile->data);
+    free(tile);
+}
+
+// Copy the data if there are any other tiles having reference to it.
+static void tile_prepare_write(mask_tile_t *tile)
+{
+    mask_data_t *data;
+    if (tile->data->ref == 1) return;
+    tile->data->ref--;
+    data = malloc(sizeof(*data));
+    memcpy(data, tile->data, sizeof(*data));
+    data->ref = 1;
+    tile->data = data;
+}
+
+static void mask_prepare_write(mask_t *mask)
+{
+    mask_tile_t *tiles, *tile, *new_tile;
+    assert(*mask->tiles_ref > 0);
+    mask->key = new_uid();
+    if (*mask->tiles_ref == 1)
+        return;
+    (*mask->tiles_ref)--;
+    mask->tiles_ref = calloc(1, sizeof(*mask->tiles_ref));
+    *mask->tiles_ref = 1;
+    tiles = mask->tiles;
+    mask->tiles = NULL;
+    for (tile = tiles; tile; tile = tile->hh.next) {
+        new_tile = tile_new(tile->pos, tile->data);
+        HASH_ADD(hh, mask->tiles, pos, sizeof(new_tile->pos), new_tile);
+    }
+    mask->gen = new_uid();
+}
+
+static mask_tile_t *mask_add_tile(mask_t *mask, const int pos[3],
+                                  mask_data_t *data)
+{
+    mask_tile_t *tile = tile_new(pos, data);
+    HASH_ADD(hh, mask->tiles, pos, sizeof(tile->pos), tile);
+    mask->gen = new_uid();
+    return tile;
+}
+
+static void mask_remove_tile(mask_t *mask, mask_tile_t *tile)
+{
+    HASH_DEL(mask->tiles, tile);
+    tile_delete(tile);
+    mask->gen = new_uid();
+}
+
+static mask_tile_t *mask_get_tile(const mask_t *mask, mask_accessor_t *acc,
+                                  const int pos[3])
+{
+    mask_tile_t *tile;
+    int p[3];
+
+    tile_pos(pos, p);
+    if (acc && acc->mask == mask && acc->gen == mask->gen &&
+            memcmp(acc->tile_pos, p, sizeof(p)) == 0) {
+        return acc->tile;
+    }
+    HASH_FIND(hh, mask->tiles, p, sizeof(p), tile);
+    if (acc) {
+        acc->mask = mask;
+        acc->tile = tile;
+        acc->gen = mask->gen;
+        memcpy(acc->tile_pos, p, sizeof(p));
+    }
+    return tile;
+}
+
+mask_t *mask_new(void)
+{
+    mask_t *mask = calloc(1, sizeof(*mask));
+    mask->tiles_ref = calloc(1, sizeof(*mask->tiles_ref));
+    *mask->tiles_ref = 1;
+    mask->key = 1; // Empty mask key.
+    mask->gen = new_uid();
+    return mask;
+}
+
+mask_t *mask_copy(const mask_t *other)
+{
+    mask_t *mask = calloc(1, sizeof(*mask));
+    mask->tiles = other->tiles;
+    mask->tiles_ref = other->tiles_ref;
+    (*mask->tiles_ref)++;
+    mask->key = other->key;
+    mask->gen = new_uid();
+    return mask;
+}
+
+static void mask_release_tiles(mask_t *mask)
+{
+    mask_tile_t *tile, *tmp;
+    if (--(*mask->tiles_ref) > 0) return;
+    HASH_ITER(hh, mask->tiles, tile, tmp) {
+        HASH_DEL(mask->tiles, tile);
+        tile_delete(tile);
+    }
+    free(mask->tiles_ref);
+}
+
+void mask_delete(mask_t *mask)
+{
+    if (!mask) return;
+    mask_release_tiles(mask);
+    free(mask);
+}
+
+void mask_clear(mask_t *mask)
+{
+    mask_release_tiles(mask);
+    mask->tiles = NULL;
+    mask->tiles_ref = calloc(1, sizeof(*mask->tiles_ref));
+    *mask->tiles_ref = 1;
+    mask->key = 1;
+    mask->gen = new_uid();
+}
+
+void mask_set(mask_t *mask, const mask_t *other)
+{
+    if (mask->tiles_ref == other->tiles_ref) {
+        mask->key = other->key;
+        return;
+    }
+    mask_release_tiles(mask);
+    mask->tiles = other->tiles;
+    mask->tiles_ref = other->tiles_ref;
+    (*mask->tiles_ref)++;
+    mask->key = other->key;
+    mask->gen = new_uid();
+}
+
+uint64_t mask_get_key(const mask_t *mask)
+{
+    return mask->key;
+}
+
+bool mask_get_at(const mask_t *mask, mask_accessor_t *acc, const int pos[3])
+{
+    const mask_tile_t *tile = mask_get_tile(mask, acc, pos);
+    int i;
+    if (!tile) return false;
+    i = (pos[0] - tile->pos[0]) +
+        (pos[1] - tile->pos[1]) * N +
+        (pos[2] - tile->pos[2]) * N * N;
+    return (tile->data->bits[i / 64] >> (i % 64)) & 1;
+}
+
+void mask_set_at(mask_t *mask, mask_accessor_t *acc, const int pos[3],
+                 bool value)
+{
+    mask_tile_t *tile;
+    int i, p[3];
+    uint64_t bit;
+
+    // Don't change the key if the value doesn't change.
+    if (mask_get_at(mask, acc, pos) == value) return;
+    mask_prepare_write(mask);
+    tile = mask_get_tile(mask, acc, pos);
+    if (!tile) {
+        tile_pos(pos, p);
+        tile = mask_add_tile(mask, p, NULL);
+    }
+    tile_prepare_write(tile);
+    i = (pos[0] - tile->pos[0]) +
+        (pos[1] - tile->pos[1]) * N +
+        (pos[2] - tile->pos[2]) * N * N;
+    bit = (uint64_t)1 << (i % 64);
+    if (value)
+        tile->data->bits[i / 64] |= bit;
+    else
+        tile->data->bits[i / 64] &= ~bit;
+}
+
+bool mask_is_empty(const mask_t *mask)
+{
+    const mask_tile_t *tile;
+    if (!mask) return true;
+    for (tile = mask->tiles; tile; tile = tile->hh.next) {
+        if (!data_is_empty(tile->data)) return false;
+    }
+    return true;
+}
+
+int mask_count(const mask_t *mask)
+{
+    const mask_tile_t *tile;
+    int i, ret = 0;
+    for (tile = mask->tiles; tile; tile = tile->hh.next) {
+        for (i = 0; i < NB_WORDS; i++)
+            ret += __builtin_popcountll(tile->data->bits[i]);
+    }
+    return ret;
+}
+
+void mask_iter(const mask_t *mask,
+               void (*func)(void *user, const int pos[3]), void *user)
+{
+    const mask_tile_t *tile;
+    uint64_t word;
+    int i, b, k, pos[3];
+
+    for (tile = mask->tiles; tile; tile = tile->hh.next) {
+        for (i = 0; i < NB_WORDS; i++) {
+            for (word = tile->data->bits[i]; word; word &= word - 1) {
+                b = __builtin_ctzll(word);
+                k = i * 64 + b;
+                pos[0] = tile->pos[0] + k % N;
+                pos[1] = tile->pos[1] + k / N % N;
+                pos[2] = tile->pos[2] + k / (N * N);
+                func(user, pos);
+            }
+        }
+    }
+}
+
+static void bbox_add_pos(void *user, const int pos[3])
+{
+    int (*bbox)[3] = user;
+    int i;
+    for (i = 0; i < 3; i++) {
+        if (pos[i] < bbox[0][i]) bbox[0][i] = pos[i];
+        if (pos[i] + 1 > bbox[1][i]) bbox[1][i] = pos[i] + 1;
+    }
+}
+
+bool mask_get_bbox(const mask_t *mask, int bbox[2][3])
+{
+    int ret[2][3] = {{INT_MAX, INT_MAX, INT_MAX},
+                     {INT_MIN, INT_MIN, INT_MIN}};
+    bool empty;
+
+    mask_iter(mask, bbox_add_pos, ret);
+    empty = ret[0][0] >= ret[1][0];
+    if (empty) memset(ret, 0, sizeof(ret));
+    memcpy(bbox, ret, sizeof(ret));
+    return !empty;
+}
+
+void mask_union(mask_t *mask, const mask_t *other)
+{
+    const mask_tile_t *src;
+    mask_tile_t *tile;
+    int i;
+
+    if (mask->tiles_ref == other->tiles_ref || !other->tiles) return;
+    mask_prepare_write(mask);
+    for (src = other->tiles; src; src = src->hh.next) {
+        HASH_FIND(hh, mask->tiles, src->pos, sizeof(src->pos), tile);
+        if (!tile) {
+            mask_add_tile(mask, src->pos, src->data);
+            continue;
+        }
+        if (tile->data == src->data) continue;
+        tile_prepare_write(tile);
+        for (i = 0; i < NB_WORDS; i++)
+            tile->data->bits[i] |= src->data->bits[i];
+    }
+}
+
+void mask_intersect(mask_t *mask, const mask_t *other)
+{
+    const mask_tile_t *src;
+    mask_tile_t *tile, *tmp;
+    int i;
+
+    if (mask->tiles_ref == other->tiles_ref) return;
+    mask_prepare_write(mask);
+    HASH_ITER(hh, mask->tiles, tile, tmp) {
+        HASH_FIND(hh, other->tiles, tile->pos, sizeof(tile->pos), src);
+        if (src && src->data == tile->data) continue;
+        if (src) {
+            tile_prepare_write(tile);
+            for (i = 0; i < NB_WORDS; i++)
+                tile->data->bits[i] &= src->data->bits[i];
+        }
+        if (!src || data_is_empty(tile->data))
+            mask_remove_tile(mask, tile);
+    }
+}
+
+void mask_subtract(mask_t *mask, const mask_t *other)
+{
+    const mask_tile_t *src;
+    mask_tile_t *tile;
+    int i;
+
+    if (mask->tiles_ref == other->tiles_ref) {
+        mask_clear(mask);
+        return;
+    }
+    if (!other->tiles) return;
+    mask_prepare_write(mask);
+    for (src = other->tiles; src; src = src->hh.next) {
+        HASH_FIND(hh, mask->tiles, src->pos, sizeof(src->pos), tile);
+        if (!tile) continue;
+        if (tile->data != src->data) {
+            tile_prepare_write(tile);
+            for (i = 0; i < NB_WORDS; i++)
+                tile->data->bits[i] &= ~src->data->bits[i];
+        }
+        if (tile->data == src->data || data_is_empty(tile->data))
+            mask_remove_tile(mask, tile);
+    }
+}
+
+void mask_from_volume(mask_t *mask, const volume_t *volume)
+{
+    volume_iterator_t iter;
+    const uint8_t *voxels;
+    uint8_t *buf = malloc(N * N * N * 4);
+    mask_data_t *data = NULL;
+    int i, pos[3];
+
+    mask_clear(mask);
+    iter = volume_get_iterator(volume,
+                               VOLUME_ITER_TILES | VOLUME_ITER_SKIP_EMPTY);
+    while (volume_iter(&iter, pos)) {
+        voxels = volume_get_tile_voxels(volume, pos, buf);
+        if (!voxels) continue;
+        if (!data) data = calloc(1, sizeof(*data));
+        for (i = 0; i < N * N * N; i++) {
+            if (voxels[i * 4 + 3])
+                data->bits[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+        if (data_is_empty(data)) continue;
+        if (mask->key == 1) mask_prepare_write(mask);
+        mask_add_tile(mask, pos, data);
+        data = NULL;
+    }
+    free(data);
+    free(buf);
+}
+
+void mask_to_volume(const mask_t *mask, volume_t *volume,
+                    const uint8_t color[4])
+{
+    const mask_tile_t *tile;
+    uint8_t *voxels;
+    int i;
+
+    volume_clear(volume);
+    voxels = malloc(N * N * N * 4);
+    for (tile = mask->tiles; tile; tile = tile->hh.next) {
+        for (i = 0; i < N * N * N; i++) {
+            if ((tile->data->bits[i / 64] >> (i % 64)) & 1)
+                memcpy(voxels + i * 4, color, 4);
+            else
+                memset(voxels + i * 4, 0, 4);
+        }
+        volume_write_tile(volume, tile->pos, voxels);
+    }
+    free(voxels);
+}
@@ -0,0 +1,166 @@
+/* Goxel 3D voxels editor
+ *
+ * copyright (c) 2024-present Guillaume Chereau <guillaume@noctua-software.com>
+ *
+ * Goxel is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * Goxel is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * goxel.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MASK_H
+#define MASK_H
+
+#include "volume.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Type: mask_t
+ * Opaque type that represents a set of voxels positions.
+ *
+ * Like a volume, but with only one bit per voxel, so a tile only takes
+ * 512 bytes.  Use it instead of a volume for selections and visited sets,
+ * where we only need to know if a voxel is set or not.
+ *
+ * The tiles are shared between copies with copy on write, and two masks
+ * with the same key have the same value, like volumes.
+ */
+typedef struct mask mask_t;
+
+typedef struct mask_tile mask_tile_t;
+
+/* Type: mask_accessor_t
+ * Cache of the last tile accessed in a mask, to speed up successive
+ * accesses to the same mask.  Initialize it to zero.
+ */
+typedef struct {
+    const mask_t *mask;
+    mask_tile_t *tile;
+    int tile_pos[3];
+    uint64_t gen;
+} mask_accessor_t;
+
+/*
+ * Function: mask_new
+ * Create a new empty mask.
+ */
+mask_t *mask_new(void);
+
+/*
+ * Function: mask_copy
+ * Create a copy of a mask.  The tiles are only copied when modified.
+ */
+mask_t *mask_copy(const mask_t *other);
+
+/*
+ * Function: mask_delete
+ * Delete a mask.  Can be called with NULL.
+ */
+void mask_delete(mask_t *mask);
+
+/*
+ * Function: mask_clear
+ * Unset all the voxels of a mask.
+ */
+void mask_clear(mask_t *mask);
+
+/*
+ * Function: mask_set
+ * Set a mask to the value of an other one.
+ */
+void mask_set(mask_t *mask, const mask_t *other);
+
+/*
+ * Function: mask_get_key
+ * Return a value that is guaranteed to change when the mask change.
+ */
+uint64_t mask_get_key(const mask_t *mask);
+
+/*
+ * Function: mask_get_at
+ * Check if a voxel is set.
+ *
+ * Parameters:
+ *   mask   - A mask.
+ *   acc    - An accessor to speed up successive calls, or NULL.
+ *   pos    - Position of the voxel.
+ */
+bool mask_get_at(const mask_t *mask, mask_accessor_t *acc,
+                 const int pos[3]);
+
+/*
+ * Function: mask_set_at
+ * Set or unset a voxel.
+ */
+void mask_set_at(mask_t *mask, mask_accessor_t *acc, const int pos[3],
+                 bool value);
+
+/*
+ * Function: mask_is_empty
+ * Return true if no voxel is set.  Can be called with NULL.
+ */
+bool mask_is_empty(const mask_t *mask);
+
+/*
+ * Function: mask_count
+ * Return the number of voxels set.
+ */
+int mask_count(const mask_t *mask);
+
+/*
+ * Function: mask_get_bbox
+ * Get the exact bounding box of the set voxels.
+ *
+ * Returns:
+ *   false if the mask is empty, in which case the bbox is all zero.
+ */
+bool mask_get_bbox(const mask_t *mask, int bbox[2][3]);
+
+/*
+ * Function: mask_iter
+ * Call a function for each voxel set, one tile after the other.
+ */
+void mask_iter(const mask_t *mask,
+               void (*func)(void *user, const int pos[3]), void *user);
+
+/*
+ * Function: mask_union
+ * Set all the voxels that are set in an other mask.
+ */
+void mask_union(mask_t *mask, const mask_t *other);
+
+/*
+ * Function: mask_intersect
+ * Unset all the voxels that are not set in an other mask.
+ */
+void mask_intersect(mask_t *mask, const mask_t *other);
+
+/*
+ * Function: mask_subtract
+ * Unset all the voxels that are set in an other mask.
+ */
+void mask_subtract(mask_t *mask, const mask_t *other);
+
+/*
+ * Function: mask_from_volume
+ * Set a mask to the non transparent voxels of a volume.
+ */
+void mask_from_volume(mask_t *mask, const volume_t *volume);
+
+/*
+ * Function: mask_to_volume
+ * Set a volume to the voxels of a mask, with a given color.
+ */
+void mask_to_volume(const mask_t *mask, volume_t *volume,
+                    const uint8_t color[4]);
+
+#endif // MASK_H
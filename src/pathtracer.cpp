@@ -29,6 +29,7 @@
 #define STB_IMAGE_STATIC
 
 #include "../ext_src/yocto/yocto_bvh.h"
+#include "../ext_src/yocto/yocto_parallel.h"
 #include "../ext_src/yocto/yocto_scene.h"
 #include "../ext_src/yocto/yocto_trace.h"
 
@@ -39,6 +40,7 @@
 #include <iterator>
 #include <future>
 #include <deque>
+#include <unordered_map>
 
 extern "C" {
 #include "goxel.h"
@@ -60,6 +62,30 @@ enum {
     CHANGE_MATERIAL     = 1 << 7,
 };
 
+// Key of a tile shape: the data ids of the tile and all its neighbors, and
+// the effects that change the vertices, like the render items.
+struct tile_shape_key_t {
+    uint64_t ids[27];
+    int effects;
+
+    bool operator==(const tile_shape_key_t &other) const {
+        return memcmp(this, &other, sizeof(*this)) == 0;
+    }
+};
+
+struct tile_shape_key_hash_t {
+    size_t operator()(const tile_shape_key_t &key) const {
+        return XXH32(&key, sizeof(key), 0);
+    }
+};
+
+// Cached shape of a tile.  The shapes don't depend on the tile position, so
+// all the tiles with the same key use the same one.
+struct tile_shape_t {
+    int      shape;     // Index in the scene shapes.
+    uint64_t gen;       // Last scene update that used it.
+};
+
 struct pathtracer_internal {
 
     // Different hash keys to quickly check for state changes.
@@ -85,6 +111,17 @@ struct pathtracer_internal {
     float exposure;
 
     int trace_sample;
+
+    // The tiles shapes, kept between the scene updates so that we only
+    // rebuild the shapes of the tiles that changed.  The scene shapes (and
+    // their bvhs) start with the nb_tile_slots tiles slots, the unused ones
+    // being listed in free_slots.
+    unordered_map<tile_shape_key_t, tile_shape_t, tile_shape_key_hash_t>
+        tile_shapes;
+    int nb_tile_slots;
+    vector<int> free_slots;
+    uint64_t gen;
+    uint32_t instances_key; // To know if we can refit the bvh.
 };
 
 // Add a material to the scene and return its id.
@@ -106,7 +143,7 @@ static int add_material(pathtracer_t *pt, const material_t *mat,
 }
 
 static shape_data create_shape_for_tile(
-        const volume_t *volume, const int tile_pos[3])
+        const volume_t *volume, const int tile_pos[3], int effects)
 {
     voxel_vertex_t* vertices;
     int i, nb, size, subdivide;
@@ -115,9 +152,8 @@ static shape_data create_shape_for_tile(
     vertices = (voxel_vertex_t*)calloc(
                 TILE_SIZE * TILE_SIZE * TILE_SIZE * 6 * 4,
                 sizeof(*vertices));
-    nb = volume_generate_vertices(volume, tile_pos,
-                                goxel.rend.settings.effects,
-                                vertices, &size, &subdivide);
+    nb = volume_generate_vertices(volume, tile_pos, effects,
+                                  vertices, &size, &subdivide);
     if (!nb) goto end;
 
     // Set vertices data.
@@ -228,6 +264,112 @@ static int check_changes(pathtracer_t *pt)
 }
 
 
+static tile_shape_key_t get_tile_shape_key(
+        const volume_t *volume, const int tile_pos[3], int effects)
+{
+    tile_shape_key_t key;
+    int p[3], i, x, y, z;
+
+    memset(&key, 0, sizeof(key));
+    key.effects = effects & (EFFECT_MARCHING_CUBES | EFFECT_MC_SMOOTH);
+    for (i = 0, z = -1; z <= 1; z++)
+    for (y = -1; y <= 1; y++)
+    for (x = -1; x <= 1; x++, i++) {
+        p[0] = tile_pos[0] + x * TILE_SIZE;
+        p[1] = tile_pos[1] + y * TILE_SIZE;
+        p[2] = tile_pos[2] + z * TILE_SIZE;
+        volume_get_tile_id(volume, p, &key.ids[i]);
+    }
+    return key;
+}
+
+// Add the instances of all the visible tiles, only creating the shapes of
+// the tiles we didn't have yet.  The shapes not used anymore are released.
+static void add_tiles(pathtracer_t *pt)
+{
+    struct visible_tile_t {
+        const volume_t *volume;
+        const layer_t *layer;
+        int pos[3];
+        tile_shape_t *tile;
+    };
+    pathtracer_internal_t *p = pt->p;
+    const int effects = goxel.rend.settings.effects;
+    const layer_t *layers, *layer;
+    volume_iterator_t iter;
+    tile_shape_key_t key;
+    tile_shape_t *tile;
+    vector<visible_tile_t> tiles;
+    vector<int> new_tiles;
+    int tile_pos[3], slot;
+
+    p->gen++;
+    layers = goxel_get_render_layers(false);
+    DL_FOREACH(layers, layer) {
+        if (!layer->visible || !layer->volume) continue;
+        iter = volume_get_iterator(layer->volume,
+                        VOLUME_ITER_TILES | VOLUME_ITER_INCLUDES_NEIGHBORS);
+        while (volume_iter(&iter, tile_pos)) {
+            key = get_tile_shape_key(layer->volume, tile_pos, effects);
+            auto found = p->tile_shapes.find(key);
+            if (found != p->tile_shapes.end()) {
+                tile = &found->second;
+            } else {
+                if (!p->free_slots.empty()) {
+                    slot = p->free_slots.back();
+                    p->free_slots.pop_back();
+                } else {
+                    slot = p->nb_tile_slots++;
+                }
+                tile = &p->tile_shapes[key];
+                tile->shape = slot;
+                new_tiles.push_back(tiles.size());
+            }
+            tile->gen = p->gen;
+            tiles.push_back({layer->volume, layer,
+                             {tile_pos[0], tile_pos[1], tile_pos[2]}, tile});
+        }
+    }
+
+    // Create the new shapes and their bvh in parallel.
+    p->scene.shapes.resize(p->nb_tile_slots);
+    p->bvh.bvh.shapes.resize(p->nb_tile_slots);
+    parallel_for(new_tiles.size(), [&](size_t i) {
+        const visible_tile_t &t = tiles[new_tiles[i]];
+        shape_data &shape = p->scene.shapes[t.tile->shape];
+        shape = create_shape_for_tile(t.volume, t.pos, effects);
+        if (shape.positions.empty()) return;
+        p->bvh.bvh.shapes[t.tile->shape] = make_shape_bvh(
+                shape, p->params.highqualitybvh);
+    });
+
+    // The empty shapes don't get any instance, but we keep them so that we
+    // know we don't need to create them again.
+    for (const visible_tile_t &t : tiles) {
+        if (p->scene.shapes[t.tile->shape].positions.empty()) continue;
+        p->scene.instances.push_back({
+            .frame = translation_frame({
+                    (float)t.pos[0], (float)t.pos[1], (float)t.pos[2]}),
+            .shape = t.tile->shape,
+            .material = add_material(pt, t.layer->material,
+                                     t.layer->opacity),
+        });
+    }
+
+    // Release the shapes of the tiles we don't have anymore.
+    for (auto it = p->tile_shapes.begin(); it != p->tile_shapes.end();) {
+        if (it->second.gen == p->gen) {
+            ++it;
+            continue;
+        }
+        slot = it->second.shape;
+        p->scene.shapes[slot] = {};
+        p->bvh.bvh.shapes[slot] = {};
+        p->free_slots.push_back(slot);
+        it = p->tile_shapes.erase(it);
+    }
+}
+
 static void update_camera(pathtracer_t *pt)
 {
     camera_data *cam;
@@ -263,14 +405,49 @@ static void update_camera(pathtracer_t *pt)
     }
 }
 
+// Build the instances bvh, reusing the shapes bvhs.  Yocto doesn't give
+// access to its generic bvh builder, but the bvh of a shape made of lines of
+// zero radius is built from the lines bounding boxes, so we make one line
+// per instance going from the min to the max corner of its bounding box.
+static void update_instances_bvh(pathtracer_t *pt)
+{
+    pathtracer_internal_t *p = pt->p;
+    shape_data lines = {};
+    bbox3f bbox;
+    uint32_t key = 0;
+    int i;
+
+    if (p->params.embreebvh) {
+        p->bvh = make_trace_bvh(p->scene, p->params);
+        return;
+    }
+
+    // If we have the same instances we only need to refit the bvh.
+    for (const instance_data &instance : p->scene.instances)
+        key = XXH32(&instance.frame, sizeof(instance.frame), key);
+    if (key == p->instances_key && !p->bvh.bvh.bvh.nodes.empty()) {
+        update_scene_bvh(p->bvh.bvh, p->scene, {}, {});
+        return;
+    }
+    p->instances_key = key;
+
+    for (i = 0; i < (int)p->scene.instances.size(); i++) {
+        const instance_data &instance = p->scene.instances[i];
+        bbox = transform_bbox(instance.frame,
+                    p->bvh.bvh.shapes[instance.shape].bvh.nodes[0].bbox);
+        lines.positions.push_back(bbox.min);
+        lines.positions.push_back(bbox.max);
+        lines.radius.push_back(0);
+        lines.radius.push_back(0);
+        lines.lines.push_back({i * 2, i * 2 + 1});
+    }
+    p->bvh.bvh.bvh = make_shape_bvh(lines, p->params.highqualitybvh).bvh;
+}
+
 static void update_scene(pathtracer_t *pt)
 {
-    volume_iterator_t iter;
-    const volume_t *volume;
-    int tile_pos[3];
-    shape_data shape;
     pathtracer_internal_t *p = pt->p;
-    const layer_t *layers, *layer;
+    int i;
     float light_dir[3];
     float ke;
     const float d = 10000;
@@ -280,29 +457,17 @@ static void update_scene(pathtracer_t *pt)
     vec4f color;
     image_data image;
 
-    p->scene = {};
+    // Everything but the tiles shapes is recreated.
+    p->scene.cameras.clear();
+    p->scene.instances.clear();
+    p->scene.environments.clear();
+    p->scene.shapes.resize(p->nb_tile_slots);
+    p->scene.textures.clear();
+    p->scene.materials.clear();
+    p->bvh.bvh.shapes.resize(p->nb_tile_slots);
     p->lights = {};
 
-    layers = goxel_get_render_layers(false);
-    DL_FOREACH(layers, layer) {
-        if (!layer->visible || !layer->volume) continue;
-        volume = layer->volume;
-        iter = volume_get_iterator(volume,
-                        VOLUME_ITER_TILES | VOLUME_ITER_INCLUDES_NEIGHBORS);
-        while (volume_iter(&iter, tile_pos)) {
-            shape = create_shape_for_tile(volume, tile_pos);
-            if (shape.positions.empty()) continue;
-            p->scene.shapes.push_back(shape);
-            p->scene.instances.push_back({
-                .frame = translation_frame({
-                        (float)tile_pos[0],
-                        (float)tile_pos[1],
-                        (float)tile_pos[2]}),
-                .shape = (int)(p->scene.shapes.size() - 1),
-                .material = add_material(pt, layer->material, layer->opacity),
-            });
-        }
-    }
+    add_tiles(pt);
 
     // Add the floor.
     if (pt->floor.type != PT_FLOOR_NONE) {
@@ -378,7 +543,13 @@ static void update_scene(pathtracer_t *pt)
         .material = (int)p->scene.materials.size() - 1,
     });
 
-    p->bvh = make_trace_bvh(p->scene, p->params);
+    // The floor and light shapes are not cached.
+    p->bvh.bvh.shapes.resize(p->scene.shapes.size());
+    for (i = p->nb_tile_slots; i < (int)p->scene.shapes.size(); i++) {
+        p->bvh.bvh.shapes[i] = make_shape_bvh(p->scene.shapes[i],
+                                              p->params.highqualitybvh);
+    }
+    update_instances_bvh(pt);
     p->lights = make_trace_lights(p->scene, p->params);
 }
 
@@ -455,6 +455,106 @@ void render_deinit(void)
 
 // A global buffer large enough to contain all the vertices for any tile.
 static voxel_vertex_t* g_vertices_buffer = NULL;
+#define MAX_TILE_VERTICES (TILE_SIZE * TILE_SIZE * TILE_SIZE * 6 * 4)
+
+/*
+ * Background meshing of the tiles.
+ *
+ * When the renderer has a mesh upload budget, we only create up to this
+ * number of new tiles items per frame.  The first missing tiles are meshed
+ * immediately, the others are meshed by background threads, and are not
+ * rendered until their vertices are ready and uploaded in a later frame.
+ *
+ * Each job owns a small volume with only the 27 tiles around the meshed one
+ * (sharing the tiles data), so that the threads never access the volumes
+ * used by the rest of the code.
+ */
+typedef struct mesh_job mesh_job_t;
+struct mesh_job
+{
+    UT_hash_handle  hh;         // Hash of key -> job.
+    tile_item_key_t key;
+    int             pos[3];
+    int             effects;
+    volume_t        *volume;    // The tiles around pos.
+    int             frame;      // Last frame the tile was needed.
+    bool            done;       // Set by the thread when finished.
+
+    voxel_vertex_t  *vertices;
+    int             nb_elements;
+    int             size;
+    int             subdivide;
+};
+
+static mesh_job_t *g_mesh_jobs = NULL;
+static int g_frame = 0;
+static int g_mesh_uploads = 0; // Number of uploads in the current frame.
+
+static void mesh_job_run(void *user)
+{
+    // Each thread gets its own vertices buffer.
+    static __thread voxel_vertex_t *buffer = NULL;
+    mesh_job_t *job = user;
+    if (!buffer) buffer = calloc(MAX_TILE_VERTICES, sizeof(*buffer));
+    job->nb_elements = volume_generate_vertices(
+            job->volume, job->pos, job->effects, buffer,
+            &job->size, &job->subdivide);
+    if (job->nb_elements) {
+        job->vertices = malloc(job->nb_elements * job->size *
+                               sizeof(*job->vertices));
+        memcpy(job->vertices, buffer,
+               job->nb_elements * job->size * sizeof(*job->vertices));
+    }
+    __atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+}
+
+static mesh_job_t *mesh_job_new(const volume_t *volume, const int pos[3],
+                                int effects, const tile_item_key_t *key)
+{
+    mesh_job_t *job;
+    int x, y, z, p[3];
+
+    job = calloc(1, sizeof(*job));
+    job->key = *key;
+    memcpy(job->pos, pos, sizeof(job->pos));
+    job->effects = effects;
+    job->frame = g_frame;
+    job->volume = volume_new();
+    for (z = -1; z <= 1; z++)
+    for (y = -1; y <= 1; y++)
+    for (x = -1; x <= 1; x++) {
+        p[0] = pos[0] + x * TILE_SIZE;
+        p[1] = pos[1] + y * TILE_SIZE;
+        p[2] = pos[2] + z * TILE_SIZE;
+        if (volume_get_tile_id(volume, p, NULL))
+            volume_copy_tile(volume, p, job->volume, p);
+    }
+    HASH_ADD(hh, g_mesh_jobs, key, sizeof(job->key), job);
+    thread_pool_submit(mesh_job_run, job);
+    return job;
+}
+
+static void mesh_job_delete(mesh_job_t *job)
+{
+    HASH_DEL(g_mesh_jobs, job);
+    volume_delete(job->volume);
+    free(job->vertices);
+    free(job);
+}
+
+// Called once per frame: remove the finished jobs of tiles that are not
+// rendered anymore.
+static void mesh_jobs_update(void)
+{
+    mesh_job_t *job, *tmp;
+    g_frame++;
+    g_mesh_uploads = 0;
+    HASH_ITER(hh, g_mesh_jobs, job, tmp) {
+        if (g_frame - job->frame < 2) continue;
+        if (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) continue;
+        mesh_job_delete(job);
+    }
+}
 
 // Used for the cache.
 static int item_delete(void *item_)
@@ -465,13 +565,16 @@ static int item_delete(void *item_)
     return 0;
 }
 
+// Return NULL if the tile is being meshed in the background.
 static render_item_t *get_item_for_tile(
+        const renderer_t *rend,
         const volume_t *volume,
         volume_iterator_t *iter,
         const int tile_pos[3],
         int effects, float smoothness)
 {
     render_item_t *item;
+    mesh_job_t *job;
     const int effects_mask = EFFECT_MARCHING_CUBES | EFFECT_MC_SMOOTH;
     uint64_t tile_data_id;
     int p[3], i, x, y, z;
@@ -487,21 +590,58 @@ static render_item_t *get_item_for_tile(
         p[0] = tile_pos[0] + x * TILE_SIZE;
         p[1] = tile_pos[1] + y * TILE_SIZE;
         p[2] = tile_pos[2] + z * TILE_SIZE;
-        volume_get_tile_data(volume, NULL, p, &tile_data_id);
+        volume_get_tile_id(volume, p, &tile_data_id);
         key.ids[i] = tile_data_id;
     }
 
     item = cache_get(g_items_cache, &key, sizeof(key));
     if (item) return item;
 
+    if (rend->mesh_upload_budget > 0) {
+        HASH_FIND(hh, g_mesh_jobs, &key, sizeof(key), job);
+        // While we are under budget, mesh the new tiles immediately so that
+        // small edits don't make any tile disappear.
+        if (!job && g_mesh_uploads < rend->mesh_upload_budget) {
+            g_mesh_uploads++;
+            goto generate;
+        }
+        if (!job) {
+            mesh_job_new(volume, tile_pos, effects, &key);
+            return NULL;
+        }
+        job->frame = g_frame;
+        if (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) return NULL;
+        if (g_mesh_uploads >= rend->mesh_upload_budget) return NULL;
+        g_mesh_uploads++;
+
+        item = calloc(1, sizeof(*item));
+        item->key = key;
+        item->nb_elements = job->nb_elements;
+        item->size = job->size;
+        item->subdivide = job->subdivide;
+        if (item->nb_elements > BATCH_QUAD_COUNT) {
+            LOG_W("Too many quads!");
+            item->nb_elements = BATCH_QUAD_COUNT;
+        }
+        GL(glGenBuffers(1, &item->vertex_buffer));
+        GL(glBindBuffer(GL_ARRAY_BUFFER, item->vertex_buffer));
+        if (item->nb_elements != 0) {
+            GL(glBufferData(GL_ARRAY_BUFFER,
+                    item->nb_elements * item->size * sizeof(*job->vertices),
+                    job->vertices, GL_STATIC_DRAW));
+        }
+        mesh_job_delete(job);
+        goto end;
+    }
+
+generate:
     item = calloc(1, sizeof(*item));
     item->key = key;
     GL(glGenBuffers(1, &item->vertex_buffer));
     GL(glBindBuffer(GL_ARRAY_BUFFER, item->vertex_buffer));
     if (!g_vertices_buffer)
-        g_vertices_buffer = calloc(
-                TILE_SIZE * TILE_SIZE * TILE_SIZE * 6 * 4,
-                sizeof(*g_vertices_buffer));
+        g_vertices_buffer = calloc(MAX_TILE_VERTICES,
+                                   sizeof(*g_vertices_buffer));
     item->nb_elements = volume_generate_vertices(
             volume, tile_pos, effects, g_vertices_buffer,
             &item->size, &item->subdivide);
@@ -515,6 +655,7 @@ static render_item_t *get_item_for_tile(
                 g_vertices_buffer, GL_STATIC_DRAW));
     }
 
+end:
     cache_add(g_items_cache, &key, sizeof(key), item,
               item->nb_elements * item->size * sizeof(*g_vertices_buffer),
               item_delete);
@@ -555,9 +696,9 @@ static void render_tile_(renderer_t *rend, volume_t *volume,
     int attr;
     float tile_id_f[2];
 
-    item = get_item_for_tile(volume, iter, tile_pos, effects,
+    item = get_item_for_tile(rend, volume, iter, tile_pos, effects,
                               rend->settings.smoothness);
-    if (item->nb_elements == 0) return;
+    if (!item || item->nb_elements == 0) return;
     GL(glBindBuffer(GL_ARRAY_BUFFER, item->vertex_buffer));
     if (gl_has_uniform(shader, "u_tile_id")) {
         tile_id_f[1] = ((tile_id >> 8) & 0xff) / 255.0;
@@ -1213,6 +1354,9 @@ void render_submit(renderer_t *rend, const float viewport[4],
     bool shadow = rend->settings.shadow &&
         !(rend->settings.effects & (EFFECT_RENDER_POS | EFFECT_SHADOW_MAP));
 
+    if (rend->mesh_upload_budget > 0)
+        mesh_jobs_update();
+
     if (shadow) {
         GL(glDisable(GL_SCISSOR_TEST));
         render_shadow_map(rend, shadow_mvp);
@@ -77,6 +77,11 @@ struct renderer
 
     render_settings_t settings;
 
+    // If set, max number of new tiles meshes uploaded per frame, the other
+    // tiles are meshed in the background and not rendered until ready.
+    // Zero to mesh all the tiles immediately.
+    int mesh_upload_budget;
+
     render_item_t    *items;
 };
 
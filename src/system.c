@@ -130,6 +130,20 @@ int sys_delete_file(const char *path)
     return remove(path);
 }
 
+FILE *sys_tmpfile(void)
+{
+#ifdef WIN32
+    wchar_t dir[MAX_PATH], path[MAX_PATH];
+    if (!GetTempPathW(MAX_PATH, dir) ||
+            !GetTempFileNameW(dir, L"gox", 0, path))
+        return NULL;
+    // 'D': delete the file when it gets closed.
+    return _wfopen(path, L"w+bD");
+#else
+    return tmpfile();
+#endif
+}
+
 double sys_get_time(void)
 {
     struct timeval now;
@@ -26,6 +26,7 @@
 #define SYSTEM_H
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdint.h>
 
 /*
@@ -86,6 +87,13 @@ int sys_delete_file(const char *path);
  */
 const char *sys_get_user_dir(void);
 
+/*
+ * Function: sys_tmpfile
+ * Same as tmpfile, but in the user temporary directory on Windows, where
+ * tmpfile tries to create the file at the root of the drive.
+ */
+FILE *sys_tmpfile(void);
+
 /*
  * Function: sys_make_dir
  * Create all the directories parent of a given file path if they do not
@@ -20,6 +20,9 @@
 
 #include "utils/b64.h"
 
+#include <limits.h>
+#include <unistd.h>
+
 #define TEST(cond) \
     do { \
         if (!(cond)) { \
@@ -44,7 +47,8 @@ static void test_file(const char *b64_data, uint32_t crc32)
     free(data);
     err = goxel_import_file("/tmp/goxel_test.gox", NULL);
     TEST(err == 0);
-    TEST(volume_crc32(goxel.image->active_layer->volume) == crc32);
+    // The loader leaves no active layer: check the last added one.
+    TEST(volume_crc32(goxel.image->layers->prev->volume) == crc32);
     image_delete(goxel.image);
     goxel.image = image_new();
 }
@@ -127,6 +131,1138 @@ static void test_load_corrupt(void)
     TEST(err != 0);
 }
 
+// Save an image with the blocks as BLRW chunks and load it back.
+static void test_save_raw_tiles(void)
+{
+    image_t *img;
+    volume_t *volume;
+    volume_accessor_t accessor;
+    int x, y, z, err;
+    uint32_t crc;
+    uint8_t v[4];
+    bool raw_tiles = goxel.gox_raw_tiles;
+
+    if (DEFINED(WIN32)) return; // Don't test on Windows for the moment!
+    img = image_new();
+    volume = img->layers->volume;
+    accessor = volume_get_accessor(volume);
+    // Uniform, sparse and noisy tiles, to test the rle runs, literals and
+    // the fallback to raw voxels.
+    for (z = 0; z < 20; z++)
+    for (y = 0; y < 20; y++)
+    for (x = 0; x < 48; x++) {
+        memcpy(v, (uint8_t[]){x * 5, y * 11, z * 13, 255}, 4);
+        if (x < 16) memcpy(v, (uint8_t[]){255, 0, 0, 255}, 4);
+        else if (x < 32 && (x * 7 + y * 3 + z) % 5) continue;
+        volume_set_at(volume, &accessor, (int[]){x, y, z}, v);
+    }
+    crc = volume_crc32(volume);
+
+    goxel.gox_raw_tiles = true;
+    save_to_file(img, "/tmp/goxel_test.gox", false);
+    goxel.gox_raw_tiles = raw_tiles;
+    image_delete(img);
+
+    err = goxel_import_file("/tmp/goxel_test.gox", NULL);
+    TEST(err == 0);
+    TEST(volume_crc32(goxel.image->layers->prev->volume) == crc);
+    image_delete(goxel.image);
+    goxel.image = image_new();
+}
+
+static void on_gox_chunk(const char type[4], int size, void *user)
+{
+    if (strncmp(type, "PREV", 4) == 0) (*(int *)user)++;
+}
+
+// Saving in batch mode must not try to render the preview, since there is
+// no GL context.
+static void test_save_headless(void)
+{
+    image_t *img;
+    bool headless = goxel.headless;
+    uint32_t crc;
+    int nb_prev = 0;
+
+    if (DEFINED(WIN32)) return;
+    img = image_new();
+    volume_set_at(img->layers->volume, NULL, (int[]){1, 2, 3},
+                  (uint8_t[]){10, 20, 30, 255});
+    crc = volume_crc32(img->layers->volume);
+    goxel.headless = true;
+    save_to_file(img, "/tmp/goxel_test.gox", false);
+    goxel.headless = headless;
+    image_delete(img);
+
+    TEST(gox_iter_chunks("/tmp/goxel_test.gox", on_gox_chunk, &nb_prev) > 0);
+    TEST(nb_prev == 0);
+    TEST(goxel_import_file("/tmp/goxel_test.gox", NULL) == 0);
+    TEST(volume_crc32(goxel.image->layers->prev->volume) == crc);
+    image_delete(goxel.image);
+    goxel.image = image_new();
+}
+
+// Saving must not keep the decoded voxels of the palette tiles.
+static void test_save_palette_tiles(void)
+{
+    const int bbox[2][3] = {{0, 0, 0}, {2 * TILE_SIZE, TILE_SIZE, TILE_SIZE}};
+    volume_global_stats_t stats0, stats;
+    image_t *img;
+    uint8_t *tile, *v;
+    bool raw_tiles = goxel.gox_raw_tiles;
+    int i;
+
+    if (DEFINED(WIN32)) return;
+    img = image_new();
+    tile = malloc(TILE_SIZE * TILE_SIZE * TILE_SIZE * 4);
+    for (i = 0; i < TILE_SIZE * TILE_SIZE * TILE_SIZE; i++) {
+        v = tile + i * 4;
+        memcpy(v, (uint8_t[]){i % 7 * 30, 10, 20, i % 3 ? 255 : 0}, 4);
+    }
+    volume_write_tile(img->layers->volume, (int[]){0, 0, 0}, tile);
+    tile[3] = 255;
+    volume_write_tile(img->layers->volume, (int[]){TILE_SIZE, 0, 0}, tile);
+    free(tile);
+
+    volume_get_global_stats(&stats0);
+    TEST(stats0.nb_palette_tiles >= 2);
+    save_to_file(img, "/tmp/goxel_test.gox", false);
+    goxel.gox_raw_tiles = !raw_tiles;
+    save_to_file(img, "/tmp/goxel_test.gox", false);
+    goxel.gox_raw_tiles = raw_tiles;
+    TEST(vxl_export_columns(img->layers->volume, bbox,
+                            "/tmp/goxel_test.vxl") == 0);
+    volume_get_global_stats(&stats);
+    TEST(stats.mem == stats0.mem);
+    TEST(stats.nb_palette_tiles == stats0.nb_palette_tiles);
+    image_delete(img);
+}
+
+// Check volume_fill_box against setting the voxels one by one.
+static void test_volume_fill_box(void)
+{
+    const int aabb[2][3] = {{-5, 3, -20}, {30, 17, 9}};
+    int size[3], x, y, z, i, skip_empty;
+    volume_t *ref, *volume;
+    uint8_t *data, *v;
+    volume_accessor_t accessor;
+
+    for (i = 0; i < 3; i++) size[i] = aabb[1][i] - aabb[0][i];
+    data = calloc(size[0] * size[1] * size[2], 4);
+    for (i = 0, v = data; i < size[0] * size[1] * size[2]; i++, v += 4) {
+        v[0] = i * 7;
+        v[1] = i * 13;
+        v[2] = i >> 4;
+        v[3] = (i % 3) ? 255 : 0;
+    }
+    for (skip_empty = 0; skip_empty < 2; skip_empty++) {
+        ref = volume_new();
+        accessor = volume_get_accessor(ref);
+        for (z = -30; z < 30; z++)
+        for (x = -30; x < 30; x++)
+            volume_set_at(ref, &accessor, (int[]){x, 8, z},
+                          (uint8_t[]){255, 0, 0, 255});
+        volume = volume_copy(ref);
+
+        v = data;
+        for (z = aabb[0][2]; z < aabb[1][2]; z++)
+        for (y = aabb[0][1]; y < aabb[1][1]; y++)
+        for (x = aabb[0][0]; x < aabb[1][0]; x++, v += 4) {
+            if (skip_empty && !v[3]) continue;
+            volume_set_at(ref, &accessor, (int[]){x, y, z}, v);
+        }
+        volume_fill_box(volume, aabb, data, skip_empty);
+        TEST(volume_crc32(volume) == volume_crc32(ref));
+        volume_delete(ref);
+        volume_delete(volume);
+    }
+    free(data);
+}
+
+// Uniform tiles must give the same results as the same voxels set one by
+// one.
+static void test_uniform_tiles(void)
+{
+    const uint8_t red[4] = {255, 0, 0, 255};
+    const uint8_t blue[4] = {0, 0, 255, 255};
+    const int n = TILE_SIZE * TILE_SIZE * TILE_SIZE;
+    const int size[3] = {TILE_SIZE + 2, TILE_SIZE + 2, TILE_SIZE + 2};
+    volume_global_stats_t stats0, stats;
+    volume_t *volume, *ref, *copy;
+    volume_iterator_t iter;
+    uint8_t *tile, *data1, *data2, v[4];
+    voxel_vertex_t *vertices;
+    int i, x, y, z, p[3], nb1, nb2, vsize, subdivide, effects;
+
+    tile = malloc(n * 4);
+    data1 = malloc(size[0] * size[1] * size[2] * 4);
+    data2 = malloc(size[0] * size[1] * size[2] * 4);
+    vertices = calloc(n * 6 * 4, sizeof(*vertices));
+    volume_get_global_stats(&stats0);
+
+    // A 3x3x3 tiles red cube.
+    volume = volume_new();
+    ref = volume_new();
+    for (i = 0; i < n; i++) memcpy(tile + i * 4, red, 4);
+    for (z = -1; z <= 1; z++)
+    for (y = -1; y <= 1; y++)
+    for (x = -1; x <= 1; x++) {
+        p[0] = x * TILE_SIZE;
+        p[1] = y * TILE_SIZE;
+        p[2] = z * TILE_SIZE;
+        volume_write_tile(volume, p, tile);
+    }
+    for (z = -TILE_SIZE; z < 2 * TILE_SIZE; z++)
+    for (y = -TILE_SIZE; y < 2 * TILE_SIZE; y++)
+    for (x = -TILE_SIZE; x < 2 * TILE_SIZE; x++)
+        volume_set_at(ref, NULL, (int[]){x, y, z}, red);
+    volume_get_global_stats(&stats);
+    TEST(stats.nb_uniform_tiles == stats0.nb_uniform_tiles + 27);
+    TEST(stats.mem_saved > stats0.mem_saved);
+    TEST(volume_get_tile_uniform(volume, (int[]){0, 0, 0}, v));
+    TEST(memcmp(v, red, 4) == 0);
+    TEST(!volume_get_tile_uniform(ref, (int[]){0, 0, 0}, v));
+    TEST(volume_crc32(volume) == volume_crc32(ref));
+
+    // Same vertices and reads.
+    for (effects = 0; effects < 2; effects++)
+    for (z = -1; z <= 1; z++)
+    for (y = -1; y <= 1; y++)
+    for (x = -1; x <= 1; x++) {
+        p[0] = x * TILE_SIZE;
+        p[1] = y * TILE_SIZE;
+        p[2] = z * TILE_SIZE;
+        nb1 = volume_generate_vertices(
+                volume, p, effects ? EFFECT_MARCHING_CUBES : 0, vertices,
+                &vsize, &subdivide);
+        nb2 = volume_generate_vertices(
+                ref, p, effects ? EFFECT_MARCHING_CUBES : 0, vertices,
+                &vsize, &subdivide);
+        TEST(nb1 == nb2);
+        if (x == 0 && y == 0 && z == 0) TEST(nb1 == 0);
+        p[0] -= 1;
+        p[1] -= 1;
+        p[2] -= 1;
+        volume_read(volume, p, size, data1);
+        volume_read(ref, p, size, data2);
+        TEST(memcmp(data1, data2, size[0] * size[1] * size[2] * 4) == 0);
+    }
+
+    // Writing to a copy expands its tile only.
+    copy = volume_copy(volume);
+    volume_set_at(copy, NULL, (int[]){1, 2, 3}, red);
+    TEST(volume_get_tile_uniform(copy, (int[]){0, 0, 0}, v));
+    volume_set_at(copy, NULL, (int[]){1, 2, 3}, blue);
+    TEST(!volume_get_tile_uniform(copy, (int[]){0, 0, 0}, v));
+    TEST(volume_get_tile_uniform(volume, (int[]){0, 0, 0}, v));
+    volume_get_at(copy, NULL, (int[]){1, 2, 3}, v);
+    TEST(memcmp(v, blue, 4) == 0);
+    volume_get_at(copy, NULL, (int[]){2, 2, 3}, v);
+    TEST(memcmp(v, red, 4) == 0);
+    volume_set_at(ref, NULL, (int[]){1, 2, 3}, blue);
+    TEST(volume_crc32(copy) == volume_crc32(ref));
+    volume_delete(copy);
+
+    // The uniform empty tiles are skipped by the iterators.
+    memset(tile, 0, n * 4);
+    volume_set_tile(volume, (int[]){0, 0, 2 * TILE_SIZE}, tile);
+    TEST(volume_get_tiles_count(volume) == 28);
+    iter = volume_get_iterator(volume, VOLUME_ITER_TILES |
+                                       VOLUME_ITER_SKIP_EMPTY);
+    for (i = 0; volume_iter(&iter, p); i++);
+    TEST(i == 27);
+
+    volume_delete(volume);
+    volume_delete(ref);
+    volume_get_global_stats(&stats);
+    TEST(stats.nb_uniform_tiles == stats0.nb_uniform_tiles);
+    TEST(stats.nb_uniform_blocks == stats0.nb_uniform_blocks);
+    free(vertices);
+    free(data1);
+    free(data2);
+    free(tile);
+}
+
+// Set a tile of both volumes, with nb_colors different values.
+static void test_palette_set_tile(volume_t *volume, volume_t *ref,
+                                  const int pos[3], int nb_colors)
+{
+    uint8_t *tile = malloc(TILE_SIZE * TILE_SIZE * TILE_SIZE * 4), *v;
+    int i, x, y, z;
+
+    for (i = 0, z = 0; z < TILE_SIZE; z++)
+    for (y = 0; y < TILE_SIZE; y++)
+    for (x = 0; x < TILE_SIZE; x++, i++) {
+        v = tile + i * 4;
+        v[0] = (i * 7) % nb_colors;
+        v[1] = (i * 7) % nb_colors / 256;
+        v[2] = 10;
+        v[3] = v[0] % 5 ? 255 : 0;
+        volume_set_at(ref, NULL,
+                      (int[]){pos[0] + x, pos[1] + y, pos[2] + z}, v);
+    }
+    volume_write_tile(volume, pos, tile);
+    TEST(memcmp(volume_get_tile_data(volume, NULL, pos, NULL), tile,
+                TILE_SIZE * TILE_SIZE * TILE_SIZE * 4) == 0);
+    free(tile);
+}
+
+// The palette tiles must give the same results as the RGBA tiles.
+static void test_palette_tiles(void)
+{
+    const int size[3] = {TILE_SIZE + 2, TILE_SIZE + 2, TILE_SIZE + 2};
+    volume_global_stats_t stats0, stats;
+    volume_t *volume, *ref, *copy;
+    volume_accessor_t accessor;
+    uint8_t *data1, *data2, *buf, v1[4], v2[4];
+    const uint8_t *voxels;
+    int i, x, y, z, p[3];
+
+    data1 = malloc(size[0] * size[1] * size[2] * 4);
+    data2 = malloc(size[0] * size[1] * size[2] * 4);
+    buf = malloc(TILE_SIZE * TILE_SIZE * TILE_SIZE * 4);
+    volume_get_global_stats(&stats0);
+    volume = volume_new();
+    ref = volume_new();
+
+    // 4 bits, 8 bits and RGBA tiles.
+    test_palette_set_tile(volume, ref, (int[]){0, 0, 0}, 10);
+    test_palette_set_tile(volume, ref, (int[]){TILE_SIZE, 0, 0}, 200);
+    test_palette_set_tile(volume, ref, (int[]){0, TILE_SIZE, 0}, 1000);
+    volume_get_global_stats(&stats);
+    TEST(stats.nb_palette_tiles == stats0.nb_palette_tiles + 2);
+    TEST(volume_crc32(volume) == volume_crc32(ref));
+
+    accessor = volume_get_accessor(volume);
+    for (z = -1; z < TILE_SIZE + 1; z++)
+    for (y = -1; y < 2 * TILE_SIZE + 1; y++)
+    for (x = -1; x < 2 * TILE_SIZE + 1; x++) {
+        volume_get_at(volume, &accessor, (int[]){x, y, z}, v1);
+        volume_get_at(ref, NULL, (int[]){x, y, z}, v2);
+        TEST(memcmp(v1, v2, 4) == 0);
+    }
+    for (i = 0; i < 2; i++) {
+        p[0] = i * TILE_SIZE;
+        p[1] = 0;
+        p[2] = 0;
+        voxels = volume_get_tile_voxels(volume, p, buf);
+        TEST(memcmp(voxels, volume_get_tile_data(ref, NULL, p, NULL),
+                    TILE_SIZE * TILE_SIZE * TILE_SIZE * 4) == 0);
+        p[0] -= 1;
+        p[1] -= 1;
+        p[2] -= 1;
+        volume_read(volume, p, size, data1);
+        volume_read(ref, p, size, data2);
+        TEST(memcmp(data1, data2, size[0] * size[1] * size[2] * 4) == 0);
+    }
+
+    // Setting the voxels keeps the palette until it is full.  The copy
+    // still has the previous values.
+    copy = volume_copy(volume);
+    for (i = 0; i < 6; i++) {
+        volume_set_at(volume, NULL, (int[]){i, 1, 2},
+                      (uint8_t[]){100 + i, 0, 0, 255});
+        volume_set_at(ref, NULL, (int[]){i, 1, 2},
+                      (uint8_t[]){100 + i, 0, 0, 255});
+    }
+    volume_get_global_stats(&stats);
+    TEST(stats.nb_palette_tiles == stats0.nb_palette_tiles + 3);
+    TEST(volume_crc32(volume) == volume_crc32(ref));
+    volume_set_at(volume, NULL, (int[]){8, 1, 2}, (uint8_t[]){1, 2, 3, 255});
+    volume_set_at(ref, NULL, (int[]){8, 1, 2}, (uint8_t[]){1, 2, 3, 255});
+    volume_get_global_stats(&stats);
+    TEST(stats.nb_palette_tiles == stats0.nb_palette_tiles + 2);
+    TEST(volume_crc32(volume) == volume_crc32(ref));
+    volume_get_at(copy, NULL, (int[]){0, 1, 2}, v1);
+    TEST(v1[0] != 100);
+    volume_delete(copy);
+
+    // Disabled.
+    volume_set_palette_tiles(false);
+    test_palette_set_tile(volume, ref, (int[]){0, 0, TILE_SIZE}, 10);
+    volume_set_palette_tiles(true);
+    volume_get_global_stats(&stats);
+    TEST(stats.nb_palette_tiles == stats0.nb_palette_tiles + 1);
+    TEST(volume_crc32(volume) == volume_crc32(ref));
+
+    volume_delete(volume);
+    volume_delete(ref);
+    volume_get_global_stats(&stats);
+    TEST(stats.nb_palette_tiles == stats0.nb_palette_tiles);
+    TEST(stats.mem_saved == stats0.mem_saved);
+    free(buf);
+    free(data1);
+    free(data2);
+}
+
+typedef struct {
+    int nb;
+    int pos[16][3];
+} test_dirty_tiles_t;
+
+static void test_dirty_tiles_callback(void *user, const int pos[3])
+{
+    test_dirty_tiles_t *dirty = user;
+    int i;
+    for (i = 0; i < dirty->nb; i++) {
+        if (memcmp(dirty->pos[i], pos, sizeof(dirty->pos[i])) == 0) return;
+    }
+    if (dirty->nb == ARRAY_SIZE(dirty->pos)) return;
+    memcpy(dirty->pos[dirty->nb++], pos, sizeof(dirty->pos[0]));
+}
+
+// Get the number of dirty tiles since a key, or -1 if unknown.
+static int test_count_dirty_tiles(const volume_t *volume, uint64_t key)
+{
+    test_dirty_tiles_t dirty = {};
+    if (!volume_get_dirty_tiles(volume, key, test_dirty_tiles_callback,
+                                &dirty))
+        return -1;
+    return dirty.nb;
+}
+
+static void test_volume_dirty_tiles(void)
+{
+    volume_t *volume, *other;
+    volume_accessor_t accessor;
+    uint8_t tile[TILE_SIZE * TILE_SIZE * TILE_SIZE * 4] = {};
+    const uint8_t red[4] = {255, 0, 0, 255};
+    const uint8_t empty[4] = {};
+    uint64_t key, key2;
+    int i;
+
+    volume = volume_new();
+    accessor = volume_get_accessor(volume);
+    for (i = 0; i < 8; i++)
+        volume_set_at(volume, &accessor, (int[]){i * TILE_SIZE, 0, 0}, red);
+    TEST(test_count_dirty_tiles(volume, 1) == 8);
+
+    key = volume_get_key(volume);
+    TEST(test_count_dirty_tiles(volume, key) == 0);
+    volume_set_at(volume, &accessor, (int[]){1, 2, 3}, red);
+    volume_set_at(volume, &accessor, (int[]){-1, 0, 0}, red);
+    TEST(test_count_dirty_tiles(volume, key) == 2);
+
+    // Removed tiles.
+    key2 = volume_get_key(volume);
+    volume_clear_tile(volume, NULL, (int[]){TILE_SIZE * 2, 0, 0});
+    volume_write_tile(volume, (int[]){TILE_SIZE * 3, 0, 0}, tile);
+    TEST(test_count_dirty_tiles(volume, key2) == 2);
+    TEST(test_count_dirty_tiles(volume, key) == 4);
+
+    // Cleared voxels, the tile is then removed without changing the key.
+    key = volume_get_key(volume);
+    volume_set_at(volume, &accessor, (int[]){TILE_SIZE * 4, 0, 0}, empty);
+    volume_remove_empty_tiles(volume, false);
+    TEST(test_count_dirty_tiles(volume, key) == 1);
+
+    // Copies keep the history, but not volume_set or volume_clear.
+    other = volume_copy(volume);
+    TEST(test_count_dirty_tiles(other, key) == 1);
+    volume_set(other, volume);
+    TEST(test_count_dirty_tiles(other, key) == -1);
+    key = volume_get_key(other);
+    volume_set_at(other, NULL, (int[]){0, 100, 0}, red);
+    TEST(test_count_dirty_tiles(other, key) == 1);
+    volume_clear(other);
+    TEST(test_count_dirty_tiles(other, key) == -1);
+
+    volume_delete(other);
+    volume_delete(volume);
+}
+
+// Naive version of volume_get_column_top.
+static int test_column_top(const volume_t *volume, int x, int y,
+                           int z_min, int z_max)
+{
+    int z;
+    for (z = z_max; z >= z_min; z--) {
+        if (volume_get_alpha_at(volume, NULL, (int[]){x, y, z})) return z;
+    }
+    return INT_MIN;
+}
+
+static void test_check_columns_top(const volume_t *volume)
+{
+    const int ranges[][2] = {{-40, 40}, {-5, 5}, {3, 20}, {-40, -20}};
+    int x, y, i;
+    for (y = -20; y < 20; y++)
+    for (x = -20; x < 20; x++)
+    for (i = 0; i < ARRAY_SIZE(ranges); i++) {
+        TEST(volume_get_column_top(volume, x, y, ranges[i][0], ranges[i][1])
+             == test_column_top(volume, x, y, ranges[i][0], ranges[i][1]));
+    }
+}
+
+static void test_volume_column_top(void)
+{
+    volume_t *volume, *other;
+    volume_accessor_t accessor;
+    uint8_t tile[TILE_SIZE * TILE_SIZE * TILE_SIZE * 4] = {};
+    const uint8_t red[4] = {255, 0, 0, 255};
+    const uint8_t empty[4] = {};
+    int x, y, z;
+
+    volume = volume_new();
+    TEST(volume_get_column_top(volume, 0, 0, -100, 100) == INT_MIN);
+    accessor = volume_get_accessor(volume);
+    for (y = -20; y < 20; y++)
+    for (x = -20; x < 20; x++) {
+        for (z = -30; z < (x * 7 + y * 3) % 25; z++) {
+            if ((x + y + z) % 5 == 0) continue;
+            volume_set_at(volume, &accessor, (int[]){x, y, z}, red);
+        }
+    }
+    test_check_columns_top(volume);
+
+    // The cached columns are updated after each kind of change.
+    volume_set_at(volume, &accessor, (int[]){3, 4, 35}, red);
+    volume_set_at(volume, &accessor, (int[]){-7, 2, 10}, empty);
+    test_check_columns_top(volume);
+    volume_clear_tile(volume, NULL, (int[]){0, 0, 0});
+    test_check_columns_top(volume);
+    memset(tile, 255, sizeof(tile));
+    volume_write_tile(volume, (int[]){-16, -16, 16}, tile);
+    test_check_columns_top(volume);
+    volume_write_tile(volume, (int[]){-16, -16, 16}, NULL);
+    test_check_columns_top(volume);
+
+    // Copies don't share the cache.
+    other = volume_copy(volume);
+    volume_set_at(other, NULL, (int[]){1, 1, 30}, red);
+    test_check_columns_top(other);
+    test_check_columns_top(volume);
+    volume_set(volume, other);
+    test_check_columns_top(volume);
+    volume_clear(volume);
+    TEST(volume_get_column_top(volume, 1, 1, -100, 100) == INT_MIN);
+
+    volume_delete(other);
+    volume_delete(volume);
+}
+
+// Naive version of the point grid queries.
+static int test_nearest_point(const int (*points)[2], int nb, int x, int y,
+                              int max_dist, bool cheb, int64_t *dist)
+{
+    int i, ret = -1;
+    int64_t dx, dy, d, best;
+
+    best = cheb ? max_dist : (int64_t)max_dist * max_dist;
+    for (i = 0; i < nb; i++) {
+        dx = llabs((int64_t)points[i][0] - x);
+        dy = llabs((int64_t)points[i][1] - y);
+        d = cheb ? max(dx, dy) : dx * dx + dy * dy;
+        if (d > best || (d == best && ret != -1)) continue;
+        best = d;
+        ret = i;
+    }
+    if (ret != -1) *dist = best;
+    return ret;
+}
+
+static void test_point_grid(void)
+{
+    const int cell_sizes[] = {1, 5, 16};
+    const int max_dists[] = {0, 3, 10, 1000};
+    int points[300][2], ids[300], n, i, j, k, c, x, y, ret, d;
+    int64_t d2, expected_d;
+    uint32_t r = 1;
+    point_grid_t *grid;
+
+    for (i = 0; i < ARRAY_SIZE(points); i++) {
+        r = r * 1103515245 + 12345;
+        points[i][0] = (int)(r >> 16) % 80 - 40;
+        r = r * 1103515245 + 12345;
+        points[i][1] = (int)(r >> 16) % 60 - 20;
+    }
+    // Some duplicated points.
+    memcpy(points[200], points[0], 50 * sizeof(points[0]));
+
+    for (c = 0; c < ARRAY_SIZE(cell_sizes); c++) {
+        grid = point_grid_new(cell_sizes[c]);
+        TEST(point_grid_nearest(grid, 0, 0, 100, NULL) == -1);
+        TEST(point_grid_query(grid, 0, 0, 100, ids, 300) == 0);
+        // Add the points in two steps, to test the update of the grid.
+        for (n = 0; n < 300; n += 150) {
+            for (i = n; i < n + 150; i++)
+                point_grid_add(grid, points[i][0], points[i][1]);
+            for (y = -60; y < 60; y += 3)
+            for (x = -60; x < 60; x += 3)
+            for (j = 0; j < ARRAY_SIZE(max_dists); j++) {
+                ret = point_grid_nearest(grid, x, y, max_dists[j], &d2);
+                TEST(ret == test_nearest_point(points, n + 150, x, y,
+                                               max_dists[j], false,
+                                               &expected_d));
+                TEST(ret == -1 || d2 == expected_d);
+                ret = point_grid_nearest_cheb(grid, x, y, max_dists[j], &d);
+                TEST(ret == test_nearest_point(points, n + 150, x, y,
+                                               max_dists[j], true,
+                                               &expected_d));
+                TEST(ret == -1 || d == expected_d);
+
+                ret = point_grid_query(grid, x, y, max_dists[j], ids, 300);
+                for (i = 0, k = 0; i < n + 150; i++) {
+                    if (abs(points[i][0] - x) > max_dists[j]) continue;
+                    if (abs(points[i][1] - y) > max_dists[j]) continue;
+                    TEST(k < ret && ids[k] == i);
+                    k++;
+                }
+                TEST(k == ret);
+            }
+        }
+        point_grid_delete(grid);
+    }
+}
+
+typedef struct {
+    volume_t *volume;
+    int done;
+} test_detached_copy_t;
+
+static void test_detached_copy_func(void *user)
+{
+    test_detached_copy_t *data = user;
+    volume_accessor_t accessor = volume_get_accessor(data->volume);
+    const uint8_t blue[4] = {0, 0, 255, 255};
+    int x, y, z;
+
+    for (z = 0; z < 32; z++)
+    for (y = 0; y < 32; y++)
+    for (x = 0; x < 32; x++) {
+        if ((x + y + z) % 2 == 0)
+            volume_set_at(data->volume, &accessor, (int[]){x, y, z}, blue);
+    }
+    __atomic_store_n(&data->done, 1, __ATOMIC_RELEASE);
+}
+
+// A detached copy can be modified from an other thread while the original
+// is also modified, and none of them sees the changes of the other.
+static void test_volume_copy_detached(void)
+{
+    volume_t *volume;
+    volume_accessor_t accessor;
+    test_detached_copy_t data = {};
+    const uint8_t red[4] = {255, 0, 0, 255};
+    const uint8_t green[4] = {0, 255, 0, 255};
+    const uint8_t blue[4] = {0, 0, 255, 255};
+    uint8_t v[4];
+    int x, y, z;
+
+    volume = volume_new();
+    accessor = volume_get_accessor(volume);
+    for (z = 0; z < 32; z++)
+    for (y = 0; y < 32; y++)
+    for (x = 0; x < 32; x++)
+        volume_set_at(volume, &accessor, (int[]){x, y, z}, red);
+    data.volume = volume_copy_detached(volume);
+    TEST(volume_get_key(data.volume) == volume_get_key(volume));
+
+    thread_pool_spawn(test_detached_copy_func, &data);
+    for (x = 0; x < 32; x++)
+        volume_set_at(volume, &accessor, (int[]){x, 5, 5}, green);
+    while (!__atomic_load_n(&data.done, __ATOMIC_ACQUIRE))
+        usleep(1000);
+
+    for (z = 0; z < 32; z++)
+    for (y = 0; y < 32; y++)
+    for (x = 0; x < 32; x++) {
+        volume_get_at(data.volume, NULL, (int[]){x, y, z}, v);
+        TEST(memcmp(v, (x + y + z) % 2 ? red : blue, 4) == 0);
+        volume_get_at(volume, NULL, (int[]){x, y, z}, v);
+        TEST(memcmp(v, (y == 5 && z == 5) ? green : red, 4) == 0);
+    }
+    volume_delete(data.volume);
+    volume_delete(volume);
+}
+
+// Check the mask operations against a naive version with volumes.
+static void test_mask(void)
+{
+    const uint8_t white[4] = {255, 255, 255, 255};
+    mask_t *a, *b, *c;
+    volume_t *va, *vb, *v;
+    int x, y, z, pos[3], count = 0;
+    uint64_t key;
+    uint32_t r = 1;
+
+    a = mask_new();
+    b = mask_new();
+    va = volume_new();
+    vb = volume_new();
+    TEST(mask_is_empty(a));
+    for (z = -20; z < 20; z++)
+    for (y = -20; y < 20; y++)
+    for (x = -20; x < 20; x++) {
+        pos[0] = x; pos[1] = y; pos[2] = z;
+        r = r * 1103515245 + 12345;
+        if ((r >> 16) % 3 == 0) {
+            mask_set_at(a, NULL, pos, true);
+            volume_set_at(va, NULL, pos, white);
+            count++;
+        }
+        if (x * x + y * y + z * z < 15 * 15) {
+            mask_set_at(b, NULL, pos, true);
+            volume_set_at(vb, NULL, pos, white);
+        }
+    }
+    volume_remove_empty_tiles(va, false);
+    TEST(mask_count(a) == count);
+    TEST(!mask_is_empty(a));
+
+    // Copy on write and keys.
+    c = mask_copy(a);
+    key = mask_get_key(c);
+    TEST(key == mask_get_key(a));
+    mask_set_at(c, NULL, (int[]){100, 0, 0}, true);
+    TEST(mask_get_key(c) != key);
+    TEST(!mask_get_at(a, NULL, (int[]){100, 0, 0}));
+    mask_set_at(c, NULL, (int[]){100, 0, 0}, false);
+    TEST(mask_count(c) == count);
+
+    // Conversion to volume.
+    v = volume_new();
+    mask_to_volume(a, v, white);
+    TEST(volume_crc32(v) == volume_crc32(va));
+    mask_from_volume(c, va);
+    TEST(mask_count(c) == count);
+
+    mask_set(c, a);
+    mask_union(c, b);
+    volume_set(v, va);
+    volume_merge(v, vb, MODE_OVER, NULL);
+    mask_to_volume(c, va, white);
+    TEST(volume_crc32(va) == volume_crc32(v));
+
+    mask_set(c, a);
+    mask_intersect(c, b);
+    mask_to_volume(a, va, white);
+    volume_set(v, va);
+    volume_merge(v, vb, MODE_INTERSECT, NULL);
+    mask_to_volume(c, va, white);
+    TEST(volume_crc32(va) == volume_crc32(v));
+
+    mask_set(c, a);
+    mask_subtract(c, b);
+    mask_to_volume(a, va, white);
+    volume_set(v, va);
+    volume_merge(v, vb, MODE_SUB, NULL);
+    mask_to_volume(c, va, white);
+    TEST(volume_crc32(va) == volume_crc32(v));
+
+    mask_subtract(c, c);
+    TEST(mask_is_empty(c));
+    mask_subtract(b, b);
+    TEST(mask_is_empty(b) && mask_count(b) == 0);
+
+    mask_delete(a);
+    mask_delete(b);
+    mask_delete(c);
+    volume_delete(va);
+    volume_delete(vb);
+    volume_delete(v);
+}
+
+static bool test_flood_fill_cond(void *user, const uint8_t v[4])
+{
+    return v[3] == 0;
+}
+
+// Check volume_flood_fill against a simple breadth first search.
+// The color permeation as it was before it was computed per tile: one BFS
+// from each surface voxel over the whole box.  Kept to check that the
+// results didn't change.
+static void test_permeation_reference(volume_t *volume, const int start[3],
+                                      const int dims[3], int depth, int blur)
+{
+    static const int offsets[6][3] = {
+        {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1},
+    };
+    const int radius = depth + blur;
+    const int size = dims[0] * dims[1] * dims[2];
+    uint8_t (*colors)[4] = malloc(size * sizeof(*colors));
+    bool *solid = calloc(size, sizeof(*solid));
+    bool *surface = calloc(size, sizeof(*surface));
+    int *min_dist = malloc(size * sizeof(*min_dist));
+    int (*queue)[2] = malloc(size * sizeof(*queue));
+    int *visited = calloc(size, sizeof(*visited));
+    float (*sum)[3] = calloc(size, sizeof(*sum));
+    int *sum_n = calloc(size, sizeof(*sum_n));
+    int i, j, k, idx, nidx, dist, head, tail, token = 0, p[3], np[3];
+    float s[3], t;
+    uint8_t out[4];
+
+#define IDX(p) (((p)[0] * dims[1] + (p)[1]) * dims[2] + (p)[2])
+#define INSIDE(p) ((p)[0] >= 0 && (p)[0] < dims[0] && (p)[1] >= 0 && \
+                   (p)[1] < dims[1] && (p)[2] >= 0 && (p)[2] < dims[2])
+    for (p[0] = 0; p[0] < dims[0]; p[0]++)
+    for (p[1] = 0; p[1] < dims[1]; p[1]++)
+    for (p[2] = 0; p[2] < dims[2]; p[2]++) {
+        volume_get_at(volume, NULL, (int[]){p[0] + start[0], p[1] + start[1],
+                      p[2] + start[2]}, colors[IDX(p)]);
+        solid[IDX(p)] = voxel_is_solid(colors[IDX(p)]);
+        min_dist[IDX(p)] = INT_MAX;
+    }
+    for (p[0] = 0; p[0] < dims[0]; p[0]++)
+    for (p[1] = 0; p[1] < dims[1]; p[1]++)
+    for (p[2] = 0; p[2] < dims[2]; p[2]++) {
+        if (!solid[IDX(p)]) continue;
+        for (j = 0; j < 6; j++) {
+            for (k = 0; k < 3; k++) np[k] = p[k] + offsets[j][k];
+            if (INSIDE(np) && !solid[IDX(np)]) surface[IDX(p)] = true;
+        }
+    }
+
+    // Run a BFS from each surface, first to get the min distances, then to
+    // sum the colors of the nearest surfaces.
+    for (k = 0; k < 2; k++)
+    for (i = 0; i < size; i++) {
+        if (!surface[i]) continue;
+        token++;
+        head = tail = 0;
+        visited[i] = token;
+        queue[tail][0] = i;
+        queue[tail++][1] = 0;
+        while (head < tail) {
+            idx = queue[head][0];
+            dist = queue[head++][1];
+            if (k == 0) {
+                min_dist[idx] = min(min_dist[idx], dist);
+            } else if (dist > 0 && !surface[idx] && dist == min_dist[idx]) {
+                for (j = 0; j < 3; j++) sum[idx][j] += colors[i][j];
+                sum_n[idx]++;
+            }
+            if (dist >= radius) continue;
+            p[0] = idx / (dims[2] * dims[1]);
+            p[1] = (idx / dims[2]) % dims[1];
+            p[2] = idx % dims[2];
+            for (j = 0; j < 6; j++) {
+                np[0] = p[0] + offsets[j][0];
+                np[1] = p[1] + offsets[j][1];
+                np[2] = p[2] + offsets[j][2];
+                if (!INSIDE(np)) continue;
+                nidx = IDX(np);
+                if (!solid[nidx] || visited[nidx] == token) continue;
+                visited[nidx] = token;
+                queue[tail][0] = nidx;
+                queue[tail++][1] = dist + 1;
+            }
+        }
+    }
+
+    for (p[0] = 0; p[0] < dims[0]; p[0]++)
+    for (p[1] = 0; p[1] < dims[1]; p[1]++)
+    for (p[2] = 0; p[2] < dims[2]; p[2]++) {
+        idx = IDX(p);
+        if (!solid[idx] || surface[idx]) continue;
+        if (min_dist[idx] > radius || sum_n[idx] <= 0) continue;
+        for (j = 0; j < 3; j++) s[j] = sum[idx][j] / (float)sum_n[idx];
+        t = 0;
+        if (min_dist[idx] > depth && blur > 0)
+            t = clamp((float)(min_dist[idx] - depth) / (float)blur, 0, 1);
+        for (j = 0; j < 3; j++) {
+            out[j] = (t == 0) ? (uint8_t)(s[j] + 0.5f) :
+                (uint8_t)(s[j] * (1.0f - t) + (float)colors[idx][j] * t +
+                          0.5f);
+        }
+        out[3] = colors[idx][3];
+        volume_set_at(volume, NULL, (int[]){p[0] + start[0], p[1] + start[1],
+                      p[2] + start[2]}, out);
+    }
+#undef IDX
+#undef INSIDE
+    free(colors);
+    free(solid);
+    free(surface);
+    free(min_dist);
+    free(queue);
+    free(visited);
+    free(sum);
+    free(sum_n);
+}
+
+static void test_color_permeation(void)
+{
+    const int params[][2] = {{1, 0}, {2, 2}, {3, 5}, {0, 6}};
+    float prev_box[4][4], box[4][4];
+    volume_t *volume, *ref;
+    int i, x, y, z, h, start[3], dims[3];
+    uint8_t c[4];
+
+    mat4_copy(goxel.image->box, prev_box);
+    volume = volume_new();
+    for (y = 0; y < 40; y++)
+    for (x = 0; x < 40; x++) {
+        h = 12 + 6 * sin(x / 5.0) * cos(y / 7.0);
+        for (z = 0; z < h; z++) {
+            if ((x * 7 + y * 13 + z * 5) % 23 == 0) continue; // Caves.
+            c[0] = (x * 37 + z * 11) % 256;
+            c[1] = (y * 53 + z * 3) % 256;
+            c[2] = (x * y + z) % 256;
+            c[3] = 255;
+            volume_set_at(volume, NULL, (int[]){x, y, z}, c);
+        }
+    }
+
+    for (i = 0; i < ARRAY_SIZE(params) * 2; i++) {
+        // Without an image box, then with one smaller than the volume.
+        if (i % 2 == 0) {
+            mat4_copy(mat4_zero, goxel.image->box);
+            volume_get_box(volume, true, box);
+        } else {
+            bbox_from_extents(box, VEC(20, 20, 8), 14, 14, 8);
+            mat4_copy(box, goxel.image->box);
+        }
+        box_get_start_pos(box, start);
+        box_get_dimensions(box, dims);
+        ref = volume_copy(volume);
+        test_permeation_reference(ref, start, dims, params[i / 2][0],
+                                  params[i / 2][1]);
+        vxl_color_permeation(volume, params[i / 2][0], params[i / 2][1]);
+        TEST(volume_crc32(volume) == volume_crc32(ref));
+        volume_set(volume, ref);
+        volume_delete(ref);
+    }
+    volume_delete(volume);
+    mat4_copy(prev_box, goxel.image->box);
+}
+
+static void test_flood_fill(void)
+{
+    const int aabb[2][3] = {{-20, -20, -5}, {20, 20, 5}};
+    const int dirs[6][3] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0},
+                            {0, 0, 1}, {0, 0, -1}};
+    volume_t *volume = volume_new();
+    mask_t *ref = mask_new(), *region = mask_new(), *tmp;
+    int (*queue)[3], n, i, d, x, y, z, p[3], connectivity;
+    uint32_t r = 1;
+
+    // Random walls, with some holes.
+    for (z = -6; z < 6; z++)
+    for (y = -21; y < 21; y++)
+    for (x = -21; x < 21; x++) {
+        r = r * 1103515245 + 12345;
+        if ((x % 7 == 0 || y % 5 == 0 || (r >> 16) % 8 == 0) &&
+                (r >> 20) % 3 != 0)
+            volume_set_at(volume, NULL, (int[]){x, y, z},
+                          (uint8_t[]){255, 0, 0, 255});
+    }
+    volume_set_at(volume, NULL, (int[]){1, 1, 1}, (uint8_t[]){0, 0, 0, 0});
+
+    queue = malloc(41 * 41 * 11 * sizeof(*queue));
+    for (connectivity = 4; connectivity <= 6; connectivity += 2) {
+        mask_clear(ref);
+        n = 0;
+        memcpy(queue[n++], (int[]){1, 1, 1}, sizeof(queue[0]));
+        mask_set_at(ref, NULL, queue[0], true);
+        for (i = 0; i < n; i++) {
+            for (d = 0; d < connectivity; d++) {
+                for (x = 0; x < 3; x++) p[x] = queue[i][x] + dirs[d][x];
+                if (p[0] < aabb[0][0] || p[0] >= aabb[1][0] ||
+                    p[1] < aabb[0][1] || p[1] >= aabb[1][1] ||
+                    p[2] < aabb[0][2] || p[2] >= aabb[1][2]) continue;
+                if (mask_get_at(ref, NULL, p)) continue;
+                if (volume_get_alpha_at(volume, NULL, p)) continue;
+                mask_set_at(ref, NULL, p, true);
+                memcpy(queue[n++], p, sizeof(p));
+            }
+        }
+        volume_flood_fill(volume, (int[]){1, 1, 1}, aabb, connectivity,
+                          test_flood_fill_cond, NULL, region);
+        TEST(mask_count(region) == n);
+        tmp = mask_copy(ref);
+        mask_subtract(tmp, region);
+        TEST(mask_is_empty(tmp));
+        mask_delete(tmp);
+    }
+    TEST(n > 100);
+    free(queue);
+    mask_delete(ref);
+    mask_delete(region);
+    volume_delete(volume);
+}
+
+// Check voxels_combine against voxel_combine for all the modes.
+static void test_voxels_combine(void)
+{
+    const int n = 1001;
+    const uint8_t color[4] = {255, 128, 10, 200};
+    const uint8_t alphas[] = {0, 0, 255, 255, 1, 128, 254};
+    uint8_t *a, *b, *out, v[4], c[4];
+    uint32_t r = 1;
+    int i, j, mode, use_color;
+
+    a = malloc(n * 4);
+    b = malloc(n * 4);
+    out = malloc(n * 4);
+    for (i = 0; i < n * 4; i++) {
+        r = r * 1103515245 + 12345;
+        a[i] = r >> 16;
+        b[i] = r >> 24;
+        // Mostly opaque or transparent voxels, like in real volumes.
+        if (i % 4 == 3) {
+            a[i] = alphas[(r >> 8) % ARRAY_SIZE(alphas)];
+            b[i] = (i / 4 % 64 < 32) ? 255 * (i / 16 % 2) :
+                   alphas[(r >> 12) % ARRAY_SIZE(alphas)];
+        }
+    }
+    for (mode = MODE_OVER; mode <= MODE_MULT_ALPHA; mode++)
+    for (use_color = 0; use_color < 2; use_color++) {
+        voxels_combine(a, b, mode, use_color ? color : NULL, out, n);
+        for (i = 0; i < n; i++) {
+            memcpy(c, b + i * 4, 4);
+            if (use_color) {
+                for (j = 0; j < 4; j++) c[j] = (int)c[j] * color[j] / 255;
+            }
+            voxel_combine(a + i * 4, c, mode, v);
+            TEST(memcmp(v, out + i * 4, 4) == 0);
+        }
+    }
+    free(a);
+    free(b);
+    free(out);
+}
+
+// Check volume_op against the crc of volumes generated by the old serial
+// implementation.  The ops are applied one after the other, with all the
+// painter options that change the voxels.
+static void test_volume_op(void)
+{
+    const struct {
+        int         mode;
+        const shape_t *shape;
+        float       pos[3];
+        float       size;
+        uint8_t     color[4];
+        float       smoothness;
+        float       dithering;
+        int         symmetry;
+        bool        noise;
+        bool        color_inherit;
+        uint32_t    crc;
+    } ops[] = {
+        {MODE_OVER, &shape_sphere, {5, 3, 2}, 20, {200, 100, 50, 255},
+         .crc = 0x209a87f2},
+        {MODE_OVER, &shape_cube, {30, 0, 0}, 12, {20, 200, 50, 180},
+         .smoothness = 1, .crc = 0x2029d159},
+        {MODE_SUB, &shape_cylinder, {0, 10, 0}, 8, {255, 255, 255, 255},
+         .dithering = 1.5, .crc = 0x22297c54},
+        {MODE_PAINT, &shape_sphere, {10, -10, 5}, 15, {0, 0, 255, 255},
+         .noise = true, .crc = 0x830ee5dc},
+        {MODE_OVER, &shape_sphere, {-30, 5, 5}, 6, {255, 0, 255, 255},
+         .symmetry = 1, .crc = 0x8c5452a4},
+        {MODE_MAX, &shape_cube, {0, 0, 20}, 10, {255, 255, 0, 128},
+         .color_inherit = true, .crc = 0xa6e7c690},
+        {MODE_SUB_CLAMP, &shape_sphere, {15, 15, 0}, 10, {0, 0, 0, 200},
+         .smoothness = 1, .crc = 0x3abd0ef9},
+        {MODE_INTERSECT, &shape_cube, {0, 0, 0}, 25, {255, 255, 255, 255},
+         .crc = 0x94ce1483},
+    };
+    volume_t *volume = volume_new();
+    painter_t painter;
+    float box[4][4];
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(ops); i++) {
+        painter = (painter_t) {
+            .mode = ops[i].mode,
+            .shape = ops[i].shape,
+            .color = {ops[i].color[0], ops[i].color[1], ops[i].color[2],
+                      ops[i].color[3]},
+            .smoothness = ops[i].smoothness,
+            .dithering = ops[i].dithering,
+            .symmetry = ops[i].symmetry,
+            .color_inherit = ops[i].color_inherit,
+            .noise_enabled = ops[i].noise,
+            .noise_intensity = 50,
+            .noise_saturation = 30,
+            .noise_coverage = 70,
+        };
+        mat4_set_identity(box);
+        mat4_itranslate(box, ops[i].pos[0], ops[i].pos[1], ops[i].pos[2]);
+        mat4_iscale(box, ops[i].size, ops[i].size, ops[i].size);
+        volume_op(volume, &painter, box);
+        TEST(volume_crc32(volume) == ops[i].crc);
+    }
+    volume_delete(volume);
+}
+
+// Fill a sphere of voxels of a given color.
+static void test_fill_sphere(volume_t *volume, const int c[3], int r,
+                             const uint8_t color[4])
+{
+    int x, y, z;
+    volume_accessor_t accessor = volume_get_accessor(volume);
+    for (z = -r; z <= r; z++)
+    for (y = -r; y <= r; y++)
+    for (x = -r; x <= r; x++) {
+        if (x * x + y * y + z * z > r * r) continue;
+        volume_set_at(volume, &accessor,
+                      (int[]){c[0] + x, c[1] + y, c[2] + z}, color);
+    }
+}
+
+// Check the incremental render volume against a full merge of the layers.
+static void test_render_volume_check(image_t *img)
+{
+    volume_t *ref = volume_new();
+    const layer_t *layer;
+
+    DL_FOREACH(img->layers, layer) {
+        if (!layer_effectively_visible(img, layer)) continue;
+        volume_merge(ref, layer == img->active_layer ?
+                     goxel.tool_volume : layer->volume, MODE_OVER, NULL);
+    }
+    TEST(volume_crc32(goxel_get_render_volume(img)) == volume_crc32(ref));
+    volume_delete(ref);
+}
+
+static void test_render_volume(void)
+{
+    image_t *img;
+    layer_t *below, *active, *above;
+
+    img = image_new();
+    below = img->active_layer;
+    active = image_add_layer(img, NULL);
+    above = image_add_layer(img, NULL);
+    img->active_layer = active;
+
+    test_fill_sphere(below->volume, (int[]){0, 0, 0}, 20,
+                     (uint8_t[]){255, 0, 0, 255});
+    test_fill_sphere(active->volume, (int[]){10, 0, 0}, 12,
+                     (uint8_t[]){0, 255, 0, 255});
+    // Semi transparent voxels so that the merge order matters.
+    test_fill_sphere(above->volume, (int[]){0, 10, 0}, 15,
+                     (uint8_t[]){0, 0, 255, 100});
+
+    goxel.tool_volume = volume_copy(active->volume);
+    test_render_volume_check(img);
+
+    // Paint a few dabs, some in new tiles.
+    test_fill_sphere(goxel.tool_volume, (int[]){0, 12, 5}, 4,
+                     (uint8_t[]){255, 255, 0, 180});
+    test_render_volume_check(img);
+    test_fill_sphere(goxel.tool_volume, (int[]){50, 50, 50}, 3,
+                     (uint8_t[]){255, 255, 255, 255});
+    test_render_volume_check(img);
+
+    // Remove the dabs, this removes some tiles from the tool volume.
+    volume_set(goxel.tool_volume, active->volume);
+    test_render_volume_check(img);
+
+    // Changing an other layer updates everything.
+    above->visible = false;
+    test_render_volume_check(img);
+    test_fill_sphere(below->volume, (int[]){-20, 0, 0}, 5,
+                     (uint8_t[]){0, 255, 255, 255});
+    test_render_volume_check(img);
+
+    volume_delete(goxel.tool_volume);
+    goxel.tool_volume = NULL;
+    image_delete(img);
+}
+
 static void test_delete_layer_subtree_undo(void)
 {
     image_t *img;
@@ -166,6 +1302,253 @@ static void test_delete_layer_subtree_undo(void)
     image_delete(img);
 }
 
+// Each step rewrites the same tile with many colors, so that each undo step
+// keeps one full tile alive.
+static void test_history_budget(void)
+{
+    image_t *img;
+    image_t *steps[3];
+    volume_global_stats_t stats0, stats;
+    uint8_t *voxels, v[4];
+    int i, k, budget = goxel.history_budget;
+    bool spill = goxel.history_spill;
+    int64_t mem;
+
+    goxel.history_budget = 0;
+    goxel.history_spill = false;
+    voxels = malloc(TILE_SIZE * TILE_SIZE * TILE_SIZE * 4);
+    img = image_new();
+    for (k = 0; k < 3; k++) {
+        image_history_push(img);
+        steps[k] = img->history_prev;
+        for (i = 0; i < TILE_SIZE * TILE_SIZE * TILE_SIZE; i++) {
+            voxels[i * 4 + 0] = i;
+            voxels[i * 4 + 1] = i >> 8;
+            voxels[i * 4 + 2] = k;
+            voxels[i * 4 + 3] = 255;
+        }
+        volume_write_tile(img->active_layer->volume, (int[]){0, 0, 0},
+                          voxels);
+    }
+    mem = image_history_get_step_mem(img, steps[1]);
+    TEST(image_history_get_step_mem(img, steps[0]) == 0);
+    TEST(mem >= TILE_SIZE * TILE_SIZE * TILE_SIZE * 4);
+    TEST(image_history_get_step_mem(img, steps[2]) == mem);
+    TEST(image_history_get_mem(img) == 2 * mem);
+
+    // Dropping the two oldest steps frees one tile.
+    volume_get_global_stats(&stats0);
+    image_history_trim(img, mem, 0);
+    volume_get_global_stats(&stats);
+    TEST(img->history == steps[2]);
+    TEST(stats0.mem - stats.mem == mem);
+    TEST(image_history_get_mem(img) == mem);
+
+    image_undo(img);
+    volume_get_at(img->active_layer->volume, NULL, (int[]){0, 0, 0}, v);
+    TEST(v[2] == 1);
+    image_undo(img); // No more undo.
+    volume_get_at(img->active_layer->volume, NULL, (int[]){0, 0, 0}, v);
+    TEST(v[2] == 1);
+
+    image_delete(img);
+    free(voxels);
+    goxel.history_budget = budget;
+    goxel.history_spill = spill;
+}
+
+// Same as test_history_budget, but the old steps go to disk.
+static void test_history_spill(void)
+{
+    const int n = TILE_SIZE * TILE_SIZE * TILE_SIZE;
+    image_t *img;
+    image_t *steps[3];
+    volume_global_stats_t stats0, stats;
+    uint8_t *voxels, *buf, v[4];
+    const uint8_t *data;
+    int i, k, budget = goxel.history_budget;
+    bool spill = goxel.history_spill;
+    int64_t mem, spill_size = image_history_get_spill_size();
+
+    goxel.history_budget = 0;
+    goxel.history_spill = true;
+    voxels = malloc(n * 4);
+    buf = malloc(n * 4);
+    img = image_new();
+    for (k = 0; k < 3; k++) {
+        image_history_push(img);
+        steps[k] = img->history_prev;
+        for (i = 0; i < n; i++) {
+            voxels[i * 4 + 0] = i;
+            voxels[i * 4 + 1] = i >> 8;
+            voxels[i * 4 + 2] = k;
+            voxels[i * 4 + 3] = 255;
+        }
+        volume_write_tile(img->active_layer->volume, (int[]){0, 0, 0},
+                          voxels);
+    }
+    mem = image_history_get_step_mem(img, steps[1]);
+
+    // The steps stay in the history, but only the one next to the current
+    // image uses memory.
+    volume_get_global_stats(&stats0);
+    image_history_trim(img, 0, 0);
+    volume_get_global_stats(&stats);
+    TEST(img->history == steps[0]);
+    TEST(stats0.mem - stats.mem == mem);
+    TEST(image_history_get_mem(img) == mem);
+    TEST(image_history_get_spill_size() > spill_size);
+
+    for (k = 2; k >= 0; k--) {
+        image_undo(img);
+        data = volume_get_tile_voxels(img->active_layer->volume,
+                                      (int[]){0, 0, 0}, buf);
+        if (k == 0) {
+            TEST(volume_is_empty(img->active_layer->volume));
+            continue;
+        }
+        TEST(data != NULL);
+        for (i = 0; i < n; i++) {
+            TEST(data[i * 4 + 0] == (uint8_t)i);
+            TEST(data[i * 4 + 2] == k - 1);
+        }
+    }
+    // The steps loaded back release their tiles.
+    TEST(image_history_get_spill_size() == spill_size);
+    for (k = 0; k < 3; k++) image_redo(img);
+    volume_get_at(img->active_layer->volume, NULL, (int[]){0, 0, 0}, v);
+    TEST(v[2] == 2);
+    TEST(image_history_get_spill_size() == spill_size);
+
+    // Over the disk budget the spilled steps get dropped, and their tiles
+    // removed from the file.  The last step stays in memory.
+    image_history_trim(img, 0, 1);
+    TEST(img->history == steps[2]);
+    TEST(image_history_get_spill_size() == 0);
+    volume_get_at(img->active_layer->volume, NULL, (int[]){0, 0, 0}, v);
+    TEST(v[2] == 2);
+
+    image_delete(img);
+    TEST(image_history_get_spill_size() == 0);
+    free(voxels);
+    free(buf);
+    goxel.history_budget = budget;
+    goxel.history_spill = spill;
+}
+
+// The space of the released tiles is reused, and the file shrinks once the
+// last tiles are released.
+static void test_history_spill_file(void)
+{
+    const int n = TILE_SIZE * TILE_SIZE * TILE_SIZE;
+    image_t *img;
+    uint8_t *voxels;
+    int i, k, budget = goxel.history_budget;
+    bool spill = goxel.history_spill;
+    int64_t size = 0;
+
+    goxel.history_budget = 0;
+    goxel.history_spill = true;
+    TEST(image_history_get_spill_file_size() == 0);
+    voxels = malloc(n * 4);
+    img = image_new();
+    // The tiles only differ by a constant channel, so they all have the
+    // same encoded size.  The last undo step is never spilled.
+    for (k = 0; k < 6; k++) {
+        if (k == 5) image_history_resize(img, 3);
+        image_history_push(img);
+        for (i = 0; i < n; i++) {
+            voxels[i * 4 + 0] = i;
+            voxels[i * 4 + 1] = i >> 8;
+            voxels[i * 4 + 2] = k;
+            voxels[i * 4 + 3] = 255;
+        }
+        volume_write_tile(img->active_layer->volume, (int[]){0, 0, 0},
+                          voxels);
+        image_history_trim(img, 0, 0);
+        // After the first step (empty), each step adds one tile.
+        if (k == 2) size = image_history_get_spill_file_size();
+    }
+    // The tile of the dropped step 1 got reused by step 4.
+    TEST(size > 0);
+    TEST(image_history_get_spill_file_size() == 3 * size);
+    TEST(image_history_get_spill_size() == 3 * size);
+
+    // Dropping the steps 2 and 3 merges their holes at the end of the file.
+    image_history_resize(img, 2);
+    TEST(image_history_get_spill_file_size() == size);
+    TEST(image_history_get_spill_size() == size);
+    image_history_resize(img, 0);
+    TEST(image_history_get_spill_file_size() == 0);
+
+    image_delete(img);
+    free(voxels);
+    goxel.history_budget = budget;
+    goxel.history_spill = spill;
+}
+
+static int test_count_history_in_memory(image_t *img)
+{
+    image_t *hist;
+    int ret = 0;
+    DL_FOREACH2(img->history, hist, history_next) {
+        if (hist != img && !hist->history_spill) ret++;
+    }
+    return ret;
+}
+
+// Undo and redo spill the steps they move away from, so that only the
+// steps next to the current image stay in memory.
+static void test_history_spill_undo(void)
+{
+    const int n = TILE_SIZE * TILE_SIZE * TILE_SIZE;
+    image_t *img;
+    uint8_t *voxels, v[4];
+    int i, j, k, budget = goxel.history_budget;
+    bool spill = goxel.history_spill;
+    int64_t spill_size = image_history_get_spill_size();
+
+    // 1 MiB, smaller than the 80 RGBA tiles of a step.
+    goxel.history_budget = 1;
+    goxel.history_spill = true;
+    voxels = malloc(n * 4);
+    img = image_new();
+    for (k = 0; k < 6; k++) {
+        image_history_push(img);
+        for (j = 0; j < 80; j++) {
+            for (i = 0; i < n; i++) {
+                voxels[i * 4 + 0] = i;
+                voxels[i * 4 + 1] = i >> 8;
+                voxels[i * 4 + 2] = k;
+                voxels[i * 4 + 3] = 255;
+            }
+            volume_write_tile(img->active_layer->volume,
+                              (int[]){j * TILE_SIZE, 0, 0}, voxels);
+        }
+    }
+    TEST(test_count_history_in_memory(img) == 1);
+
+    for (k = 4; k >= 0; k--) {
+        image_undo(img);
+        TEST(test_count_history_in_memory(img) <= 2);
+        volume_get_at(img->active_layer->volume, NULL,
+                      (int[]){79 * TILE_SIZE, 0, 0}, v);
+        TEST(v[2] == k);
+    }
+    for (k = 1; k < 6; k++) {
+        image_redo(img);
+        TEST(test_count_history_in_memory(img) <= 2);
+        volume_get_at(img->active_layer->volume, NULL, (int[]){0, 0, 0}, v);
+        TEST(v[2] == k);
+    }
+
+    image_delete(img);
+    TEST(image_history_get_spill_size() == spill_size);
+    free(voxels);
+    goxel.history_budget = budget;
+    goxel.history_spill = spill;
+}
+
 static layer_t *test_find_layer_by_name(image_t *img, const char *name)
 {
     layer_t *layer;
@@ -309,13 +1692,102 @@ static void test_merge_children_updates_clone(void)
     image_delete(img);
 }
 
+// Set the filters settings from text, as done by the batch mode.
+static void test_filter_set_setting(void)
+{
+    filter_t *filter = filter_get("shadows_from_sun");
+    const filter_setting_t *setting;
+    const uint8_t *color;
+
+    TEST(filter && filter->apply_fn);
+    TEST(!filter_get("filter_open_shadows_from_sun"));
+    filter->on_open(filter);
+    TEST(filter_set_setting(filter, "strength", "0.5") == 0);
+    TEST(filter_set_setting(filter, "strength", "half") == -1);
+    TEST(filter_set_setting(filter, "strength", "0.5x") == -1);
+    TEST(filter_set_setting(filter, "shadow_blur_blocks", "3") == 0);
+    TEST(filter_set_setting(filter, "shadow_blur_blocks", "3.5") == -1);
+    TEST(filter_set_setting(filter, "shadow_blur_blocks", "99999999999") == -1);
+    TEST(filter_set_setting(filter, "wrap_shadows", "true") == 0);
+    TEST(filter_set_setting(filter, "wrap_shadows", "maybe") == -1);
+    TEST(filter_set_setting(filter, "unknown", "1") == -1);
+    filter->on_open(filter);
+
+    filter = filter_get("terrain_coloring");
+    TEST(filter);
+    TEST(filter_set_setting(filter, "color_water", "40, 90, 120") == 0);
+    TEST(filter_set_setting(filter, "color_water", "40,90,120,128") == 0);
+    TEST(filter_set_setting(filter, "color_water", "40,90") == -1);
+    TEST(filter_set_setting(filter, "color_water", "40,90,300") == -1);
+    TEST(filter_set_setting(filter, "color_water", "40,90,120x") == -1);
+    TEST(filter_set_setting(filter, "color_water", "40,90,120,128,") == -1);
+    TEST(filter_set_setting(filter, "color_water", "40,90,120,1,2") == -1);
+    // A failure doesn't change the color.
+    for (setting = filter->settings; strcmp(setting->name, "color_water");
+         setting++) {}
+    color = (uint8_t *)filter + setting->offset;
+    TEST(filter_set_setting(filter, "color_water", "1,2,3,4") == 0);
+    TEST(filter_set_setting(filter, "color_water", "10,20,300") == -1);
+    TEST(memcmp(color, (uint8_t[]){1, 2, 3, 4}, 4) == 0);
+    filter->on_open(filter);
+}
+
+// Generation filters run as jobs, committed in a single undo step.
+static void test_filter_job_sync(void)
+{
+    image_t *img = goxel.image;
+    filter_t *filter = filter_get("water_layer");
+    float prev_box[4][4];
+    layer_t *layer;
+    int id;
+
+    TEST(filter && filter->apply_fn);
+    mat4_copy(img->box, prev_box);
+    bbox_from_extents(img->box, VEC(8, 8, 4), 8, 8, 4);
+    image_history_push(img);
+    layer = image_add_layer(img, NULL);
+    id = layer->id;
+    filter->on_open(filter);
+    TEST(filter->apply_fn(filter, layer) == 0);
+    layer = layer_find(img, id);
+    TEST(layer && !volume_is_empty(layer->volume));
+    image_undo(img);
+    layer = layer_find(img, id);
+    TEST(layer && volume_is_empty(layer->volume));
+    image_undo(img);
+    TEST(!layer_find(img, id));
+    mat4_copy(prev_box, img->box);
+}
+
 void tests_run(void)
 {
     test_delete_layer_subtree_undo();
+    test_history_budget();
+    test_history_spill();
+    test_history_spill_file();
+    test_history_spill_undo();
     test_duplicate_layer_subtree();
     test_clone_layer_subtree();
     test_merge_children_updates_clone();
     test_load_file_v2();
     test_load_file_v1_with_preview();
     test_load_corrupt();
+    test_save_raw_tiles();
+    test_save_headless();
+    test_save_palette_tiles();
+    test_volume_fill_box();
+    test_uniform_tiles();
+    test_palette_tiles();
+    test_render_volume();
+    test_volume_dirty_tiles();
+    test_volume_column_top();
+    test_point_grid();
+    test_volume_copy_detached();
+    test_volume_op();
+    test_voxels_combine();
+    test_mask();
+    test_flood_fill();
+    test_color_permeation();
+    test_filter_set_setting();
+    test_filter_job_sync();
 }
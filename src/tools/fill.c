@@ -38,23 +38,6 @@ typedef struct {
     } gestures;
 } tool_fill_t;
 
-#include "uthash.h"
-
-typedef struct queue_node {
-    int pos[3];
-    struct queue_node *next;
-} queue_node_t;
-
-typedef struct {
-    queue_node_t *head;
-    queue_node_t *tail;
-} queue_t;
-
-typedef struct visited_voxel {
-    int pos[3];              // key
-    UT_hash_handle hh;
-} visited_voxel_t;
-
 static bool rgba_is_empty(const uint8_t rgba[4])
 {
     return rgba[3] == 0;
@@ -72,111 +55,21 @@ static bool color_within_threshold(const uint8_t color[4],
     return diff <= threshold;
 }
 
-static void queue_init(queue_t *queue)
-{
-    queue->head = NULL;
-    queue->tail = NULL;
-}
-
-static bool queue_is_empty(const queue_t *queue)
-{
-    return queue->head == NULL;
-}
-
-static bool queue_push(queue_t *queue, const int pos[3])
-{
-    queue_node_t *node = malloc(sizeof(*node));
-    if (!node) return false;
-
-    node->pos[0] = pos[0];
-    node->pos[1] = pos[1];
-    node->pos[2] = pos[2];
-    node->next = NULL;
-
-    if (queue->tail) {
-        queue->tail->next = node;
-    } else {
-        queue->head = node;
-    }
-
-    queue->tail = node;
-    return true;
-}
-
-static bool queue_pop(queue_t *queue, int out[3])
-{
-    queue_node_t *node;
-
-    if (!queue->head) return false;
-
-    node = queue->head;
-    out[0] = node->pos[0];
-    out[1] = node->pos[1];
-    out[2] = node->pos[2];
-
-    queue->head = node->next;
-    if (!queue->head) {
-        queue->tail = NULL;
-    }
-
-    free(node);
-    return true;
-}
-
-static void queue_destroy(queue_t *queue)
-{
-    int tmp[3];
-    while (queue_pop(queue, tmp)) {
-        // Drain queue
-    }
-}
-
-static bool visited_contains(visited_voxel_t *visited, const int pos[3])
-{
-    visited_voxel_t *entry = NULL;
-    HASH_FIND(hh, visited, pos, sizeof(int) * 3, entry);
-    return entry != NULL;
-}
+typedef struct {
+    uint8_t reference_color[4];
+    int     color_threshold;
+} fill_cond_t;
 
-static bool visited_add(visited_voxel_t **visited, const int pos[3])
+static bool fill_cond_empty(void *user, const uint8_t value[4])
 {
-    visited_voxel_t *entry = NULL;
-
-    HASH_FIND(hh, *visited, pos, sizeof(int) * 3, entry);
-    if (entry) return true;
-
-    entry = malloc(sizeof(*entry));
-    if (!entry) return false;
-
-    entry->pos[0] = pos[0];
-    entry->pos[1] = pos[1];
-    entry->pos[2] = pos[2];
-
-    HASH_ADD(hh, *visited, pos, sizeof(int) * 3, entry);
-    return true;
+    return rgba_is_empty(value);
 }
 
-static void visited_destroy(visited_voxel_t **visited)
+static bool fill_cond_color(void *user, const uint8_t value[4])
 {
-    visited_voxel_t *cur;
-    visited_voxel_t *tmp;
-
-    HASH_ITER(hh, *visited, cur, tmp) {
-        HASH_DEL(*visited, cur);
-        free(cur);
-    }
-}
-
-static bool in_box(int dims[3], int start_pos[3], int pos[3]) {
-    if (    pos[0] < start_pos[0]
-        ||  pos[0] >= dims[0] + start_pos[0]
-        ||  pos[1] < start_pos[1]
-        ||  pos[1] >= dims[1] + start_pos[1]
-        ||  pos[2] < start_pos[2]
-        ||  pos[2] >= dims[2] + start_pos[2]) {
-            return false;
-        }
-    return true;
+    const fill_cond_t *cond = user;
+    return color_within_threshold(value, cond->reference_color,
+                                  cond->color_threshold);
 }
 
 static bool flood_fill_volume(volume_t *paint_volume,
@@ -185,13 +78,11 @@ static bool flood_fill_volume(volume_t *paint_volume,
                               const uint8_t fill_color[4],
                               int painter_mode, int color_threshold)
 {
-    queue_t queue;
-    visited_voxel_t *visited = NULL;
-    volume_iterator_t iter_sample, new_vol_iter;
-    uint8_t voxel[4], reference_color[4];
-    int box_dimensions[3], box_start_pos[3];
+    fill_cond_t cond = {.color_threshold = color_threshold};
+    int box_dimensions[3], box_start_pos[3], aabb[2][3], i;
     uint64_t layer_key0 = volume_get_key(paint_volume);
-    volume_t *new_vol = volume_new();
+    volume_t *new_vol;
+    mask_t *region;
     bool paint_mode = painter_mode == MODE_PAINT;
 
     const int start[3] = {
@@ -200,113 +91,30 @@ static bool flood_fill_volume(volume_t *paint_volume,
         (int)floorf(start_pos[2])
     };
 
-    static const int directions[6][3] = {
-        {  1,  0,  0 },
-        { -1,  0,  0 },
-        {  0,  1,  0 },
-        {  0, -1,  0 },
-        {  0,  0,  1 },
-        {  0,  0, -1 }
-    };
-    const int direction_count = paint_mode ? 6 : 4;
-
     box_get_dimensions(goxel.image->box, box_dimensions);
     box_get_start_pos(goxel.image->box, box_start_pos);
     LOG_D("flood_fill: start=(%i,%i,%i)", start[0], start[1], start[2]);
     LOG_D("flood_fill: box_dimensions=(%i,%i,%i)", box_dimensions[0], box_dimensions[1], box_dimensions[2]);
     LOG_D("flood_fill: box_start_pos=(%i,%i,%i)", box_start_pos[0], box_start_pos[1], box_start_pos[2]);
-
-    queue_init(&queue);
-
-    iter_sample = volume_get_iterator(sample_volume, VOLUME_ITER_VOXELS);
-    new_vol_iter = volume_get_iterator(new_vol, VOLUME_ITER_VOXELS);
-    volume_get_at(sample_volume, &iter_sample, start, reference_color);
-
-    if (paint_mode ? rgba_is_empty(reference_color)
-                   : !rgba_is_empty(reference_color)) {
-        volume_delete(new_vol);
-        return true;
-    }
-
-    if (!queue_push(&queue, start)) {
-        volume_delete(new_vol);
-        return false;
+    for (i = 0; i < 3; i++) {
+        aabb[0][i] = box_start_pos[i];
+        aabb[1][i] = box_start_pos[i] + box_dimensions[i];
     }
 
-    if (!visited_add(&visited, start)) {
-        queue_destroy(&queue);
-        volume_delete(new_vol);
-        return false;
+    volume_get_at(sample_volume, NULL, start, cond.reference_color);
+    if (paint_mode ? rgba_is_empty(cond.reference_color)
+                   : !rgba_is_empty(cond.reference_color)) {
+        return true;
     }
 
-    while (!queue_is_empty(&queue)) {
-        int pos[3];
-
-        if (!queue_pop(&queue, pos)) {
-            break;
-        }
-
-        //LOG_D("visit: (%i,%i,%i)", pos[0], pos[1], pos[2]);
-
-        volume_get_at(sample_volume, &iter_sample, pos, voxel);
-
-        if (paint_mode
-                ? !color_within_threshold(voxel, reference_color,
-                                          color_threshold)
-                : !rgba_is_empty(voxel)) {
-            LOG_D("skip: (%i,%i,%i) outside fill region",
-                  pos[0], pos[1], pos[2]);
-            continue;
-        }
-
-        //LOG_D("fill: (%i,%i,%i)", pos[0], pos[1], pos[2]);
-        volume_set_at(new_vol, &new_vol_iter, pos, fill_color);
-
-        for (int d = 0; d < direction_count; d++) {
-            int next[3] = {
-                pos[0] + directions[d][0],
-                pos[1] + directions[d][1],
-                pos[2] + directions[d][2]
-            };
-
-            if (!in_box(box_dimensions, box_start_pos, next)){
-                //LOG_D("skip: out of box: (%i,%i,%i)", next[0], next[1], next[2])
-                continue;
-            }
-
-            if (visited_contains(visited, next)) {
-                //LOG_D("skip: (%i,%i,%i) already visited", next[0], next[1], next[2]);
-                continue;
-            }
-
-            if (!visited_add(&visited, next)) {
-                //LOG_D("error: failed to add visited (%i,%i,%i)", next[0], next[1], next[2]);
-                visited_destroy(&visited);
-                queue_destroy(&queue);
-                volume_delete(new_vol);
-                return false;
-            }
-
-            volume_get_at(sample_volume, &iter_sample, next, voxel);
-
-            if (paint_mode
-                    ? color_within_threshold(voxel, reference_color,
-                                             color_threshold)
-                    : rgba_is_empty(voxel)) {
-                //LOG_D("enqueue: (%i,%i,%i)", next[0], next[1], next[2]);
-
-                if (!queue_push(&queue, next)) {
-                    LOG_D("error: failed to enqueue (%i,%i,%i)", next[0], next[1], next[2]);
-                    visited_destroy(&visited);
-                    queue_destroy(&queue);
-                    volume_delete(new_vol);
-                    return false;
-                }
-            } else {
-                //LOG_D("boundary: (%i,%i,%i)", next[0], next[1], next[2]);
-            }
-        }
-    }
+    // Paint fills connected blocks in 3D, add only fills the z level.
+    region = mask_new();
+    volume_flood_fill(sample_volume, start, aabb, paint_mode ? 6 : 4,
+                      paint_mode ? fill_cond_color : fill_cond_empty,
+                      &cond, region);
+    new_vol = volume_new();
+    mask_to_volume(region, new_vol, fill_color);
+    mask_delete(region);
 
     float box[4][4] = MAT4_IDENTITY;
     volume_get_box(new_vol, true, box);
@@ -324,9 +132,6 @@ static bool flood_fill_volume(volume_t *paint_volume,
     volume_delete(new_vol);
 
     LOG_D("flood_fill: complete");
-
-    visited_destroy(&visited);
-    queue_destroy(&queue);
     return true;
 }
 
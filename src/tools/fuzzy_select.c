@@ -155,18 +155,51 @@ static layer_t *copy_as_new_layer(image_t *img, layer_t *layer,
     return new_layer;
 }
 
+// Neighbors search around the voxels of a selection, using a bit mask
+// copy of the selection for fast lookups.
+typedef struct {
+    const mask_t    *src;
+    mask_accessor_t src_acc;
+    mask_t          *dst;
+    mask_accessor_t dst_acc;
+    int             distance;
+    bool            use_box;
+    int             dims[3];
+    int             start[3];
+} neighbors_ctx_t;
+
+static void hollow_voxel(void *user, const int pos[3])
+{
+    neighbors_ctx_t *ctx = user;
+    const int d = ctx->distance;
+    int p[3], dx, dy, dz;
+
+    for (dx = -d; dx <= d; dx++) {
+        for (dy = -d; dy <= d; dy++) {
+            for (dz = -d; dz <= d; dz++) {
+                if (dx == 0 && dy == 0 && dz == 0)
+                    continue;
+                p[0] = pos[0] + dx;
+                p[1] = pos[1] + dy;
+                p[2] = pos[2] + dz;
+                if (!mask_get_at(ctx->src, &ctx->src_acc, p))
+                    return; // Near the outside.
+            }
+        }
+    }
+    mask_set_at(ctx->dst, &ctx->dst_acc, pos, true);
+}
+
 /*
  * Hollow the selection: either delete interior voxels from the active layer
  * (leaving a shell of `thickness`), or replace the mask with the interior.
  */
 static void hollow_selection(int thickness, bool mask_mode)
 {
+    neighbors_ctx_t ctx = {.distance = thickness};
+    mask_t *src;
     volume_t *interior;
     volume_t *volume;
-    volume_iterator_t iter;
-    volume_accessor_t acc, src_acc;
-    int pos[3], p[3], dx, dy, dz;
-    bool near_outside;
     static const uint8_t white[4] = {255, 255, 255, 255};
 
     if (thickness < 1 || !goxel.mask || volume_is_empty(goxel.mask))
@@ -174,33 +207,15 @@ static void hollow_selection(int thickness, bool mask_mode)
     if (!mask_mode && (!goxel.image || !goxel.image->active_layer))
         return;
 
+    src = mask_new();
+    mask_from_volume(src, goxel.mask);
+    ctx.src = src;
+    ctx.dst = mask_new();
+    mask_iter(ctx.src, hollow_voxel, &ctx);
     interior = volume_new();
-    acc = volume_get_accessor(interior);
-    src_acc = volume_get_accessor(goxel.mask);
-    iter = volume_get_iterator(goxel.mask,
-                               VOLUME_ITER_VOXELS | VOLUME_ITER_SKIP_EMPTY);
-    while (volume_iter(&iter, pos)) {
-        if (!volume_get_alpha_at(goxel.mask, &src_acc, pos))
-            continue;
-        near_outside = false;
-        for (dx = -thickness; dx <= thickness && !near_outside; dx++) {
-            for (dy = -thickness; dy <= thickness && !near_outside; dy++) {
-                for (dz = -thickness; dz <= thickness; dz++) {
-                    if (dx == 0 && dy == 0 && dz == 0)
-                        continue;
-                    p[0] = pos[0] + dx;
-                    p[1] = pos[1] + dy;
-                    p[2] = pos[2] + dz;
-                    if (!volume_get_alpha_at(goxel.mask, &src_acc, p)) {
-                        near_outside = true;
-                        break;
-                    }
-                }
-            }
-        }
-        if (!near_outside)
-            volume_set_at(interior, &acc, pos, white);
-    }
+    mask_to_volume(ctx.dst, interior, white);
+    mask_delete(src);
+    mask_delete(ctx.dst);
 
     if (mask_mode) {
         volume_delete(goxel.mask);
@@ -218,54 +233,61 @@ static void hollow_selection(int thickness, bool mask_mode)
     goxel.mask = volume_new();
 }
 
+static void expand_voxel(void *user, const int pos[3])
+{
+    neighbors_ctx_t *ctx = user;
+    const int d = ctx->distance;
+    const int *start = ctx->start, *dims = ctx->dims;
+    int p[3], dx, dy, dz;
+
+    for (dx = -d; dx <= d; dx++) {
+        for (dy = -d; dy <= d; dy++) {
+            for (dz = -d; dz <= d; dz++) {
+                if (dx == 0 && dy == 0 && dz == 0)
+                    continue;
+                p[0] = pos[0] + dx;
+                p[1] = pos[1] + dy;
+                p[2] = pos[2] + dz;
+                if (ctx->use_box &&
+                    (p[0] < start[0] || p[0] >= start[0] + dims[0] ||
+                     p[1] < start[1] || p[1] >= start[1] + dims[1] ||
+                     p[2] < start[2] || p[2] >= start[2] + dims[2]))
+                    continue;
+                mask_set_at(ctx->dst, &ctx->dst_acc, p, true);
+            }
+        }
+    }
+}
+
 /* Grow goxel.mask by Chebyshev distance, clamped to the image box. */
 static void expand_selection_mask(int distance)
 {
-    volume_t *expanded;
-    volume_iterator_t iter;
-    volume_accessor_t acc, src_acc;
-    int pos[3], p[3], dx, dy, dz;
-    int dims[3], start[3];
-    bool use_box;
+    neighbors_ctx_t ctx = {.distance = distance};
+    mask_t *src;
+    volume_t *added;
     static const uint8_t white[4] = {255, 255, 255, 255};
 
     if (distance < 1 || !goxel.mask || volume_is_empty(goxel.mask))
         return;
 
-    use_box = !box_is_null(goxel.image->box);
-    if (use_box) {
-        box_get_dimensions(goxel.image->box, dims);
-        box_get_start_pos(goxel.image->box, start);
+    ctx.use_box = !box_is_null(goxel.image->box);
+    if (ctx.use_box) {
+        box_get_dimensions(goxel.image->box, ctx.dims);
+        box_get_start_pos(goxel.image->box, ctx.start);
     }
 
-    expanded = volume_copy(goxel.mask);
-    acc = volume_get_accessor(expanded);
-    src_acc = volume_get_accessor(goxel.mask);
-    iter = volume_get_iterator(goxel.mask,
-                               VOLUME_ITER_VOXELS | VOLUME_ITER_SKIP_EMPTY);
-    while (volume_iter(&iter, pos)) {
-        if (!volume_get_alpha_at(goxel.mask, &src_acc, pos))
-            continue;
-        for (dx = -distance; dx <= distance; dx++) {
-            for (dy = -distance; dy <= distance; dy++) {
-                for (dz = -distance; dz <= distance; dz++) {
-                    if (dx == 0 && dy == 0 && dz == 0)
-                        continue;
-                    p[0] = pos[0] + dx;
-                    p[1] = pos[1] + dy;
-                    p[2] = pos[2] + dz;
-                    if (use_box &&
-                        (p[0] < start[0] || p[0] >= start[0] + dims[0] ||
-                         p[1] < start[1] || p[1] >= start[1] + dims[1] ||
-                         p[2] < start[2] || p[2] >= start[2] + dims[2]))
-                        continue;
-                    volume_set_at(expanded, &acc, p, white);
-                }
-            }
-        }
-    }
-    volume_delete(goxel.mask);
-    goxel.mask = expanded;
+    src = mask_new();
+    mask_from_volume(src, goxel.mask);
+    ctx.src = src;
+    ctx.dst = mask_new();
+    mask_iter(ctx.src, expand_voxel, &ctx);
+    // The neighbors are set to white, the other voxels keep their color.
+    added = volume_new();
+    mask_to_volume(ctx.dst, added, white);
+    volume_merge(goxel.mask, added, MODE_OVER, NULL);
+    volume_delete(added);
+    mask_delete(src);
+    mask_delete(ctx.dst);
 }
 
 /*
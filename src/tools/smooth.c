@@ -177,19 +177,7 @@ static float smooth_fast_exp(float x)
 static int column_top_z(const volume_t *volume, volume_accessor_t *acc,
                         int x, int y, int z_lo, int z_hi)
 {
-    int pos[3];
-    uint8_t c[4];
-    int z;
-
-    pos[0] = x;
-    pos[1] = y;
-    for (z = z_hi; z >= z_lo; z--) {
-        pos[2] = z;
-        volume_get_at(volume, acc, pos, c);
-        if (c[3])
-            return z;
-    }
-    return INT_MIN;
+    return volume_get_column_top(volume, x, y, z_lo, z_hi);
 }
 
 /*
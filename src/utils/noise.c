@@ -21,9 +21,11 @@ float uniform_noise(float x, float y, float z) {
 
 /* ---- Seeded 2D Perlin (shared by Smooth, water-layer, …) ---------------- */
 
-static unsigned char g_perlin2_perm[512];
-static unsigned g_perlin2_seed = 0;
-static bool g_perlin2_inited = false;
+// Per thread, so that the filter jobs can seed their own table without
+// changing the one of the tools on the main thread.
+static __thread unsigned char g_perlin2_perm[512];
+static __thread unsigned g_perlin2_seed = 0;
+static __thread bool g_perlin2_inited = false;
 
 void perlin2_init_seed(unsigned seed)
 {
@@ -11,7 +11,7 @@
 
 float uniform_noise(float x, float y, float z);
 
-/* Seeded 2D classic Perlin (~[-1, 1]).  One shared permutation table;
+/* Seeded 2D classic Perlin (~[-1, 1]).  One permutation table per thread;
  * call perlin2_init_seed when the seed changes.  Seed 0 is treated as 1. */
 void perlin2_init_seed(unsigned seed);
 /* Like init, but only if the table has never been built (keeps stroke seeds). */
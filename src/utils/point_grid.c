@@ -0,0 +1,250 @@
+/* Goxel 3D voxels editor
+ *
+ * copyright (c) 2024-present Guillaume Chereau <guillaume@noctua-software.com>
+ *
+ * Goxel is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * Goxel is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * goxel.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "point_grid.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct point_grid {
+    int     cell_size;
+    int     nb;
+    int     capacity;
+    int     (*points)[2];
+
+    // The cells are only computed at the first query after some points
+    // have been added.
+    bool    dirty;
+    int     origin[2];  // Position of the first cell, in cells.
+    int     size[2];    // Number of cells.
+    int     *cells;     // Start of each cell in ids (size[0] * size[1] + 1).
+    int     *ids;       // Points indices sorted by cell, then by index.
+};
+
+static int floor_div(int a, int b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static int imax(int a, int b)
+{
+    return a > b ? a : b;
+}
+
+static int imin(int a, int b)
+{
+    return a < b ? a : b;
+}
+
+point_grid_t *point_grid_new(int cell_size)
+{
+    point_grid_t *grid = calloc(1, sizeof(*grid));
+    grid->cell_size = imax(cell_size, 1);
+    return grid;
+}
+
+void point_grid_delete(point_grid_t *grid)
+{
+    if (!grid) return;
+    free(grid->points);
+    free(grid->cells);
+    free(grid->ids);
+    free(grid);
+}
+
+void point_grid_add(point_grid_t *grid, int x, int y)
+{
+    if (grid->nb == grid->capacity) {
+        grid->capacity = imax(grid->capacity * 2, 64);
+        grid->points = realloc(grid->points,
+                               grid->capacity * sizeof(*grid->points));
+    }
+    grid->points[grid->nb][0] = x;
+    grid->points[grid->nb][1] = y;
+    grid->nb++;
+    grid->dirty = true;
+}
+
+static int cell_index(const point_grid_t *grid, const int p[2])
+{
+    int cx = floor_div(p[0], grid->cell_size) - grid->origin[0];
+    int cy = floor_div(p[1], grid->cell_size) - grid->origin[1];
+    return cx + cy * grid->size[0];
+}
+
+// Counting sort of the points by cell.  Since we add the points in order,
+// each cell lists its points by increasing index.
+static void point_grid_build(point_grid_t *grid)
+{
+    int i, c, p, nb_cells, max[2] = {0, 0};
+    int *next;
+
+    if (!grid->dirty) return;
+    grid->dirty = false;
+    free(grid->cells);
+    free(grid->ids);
+
+    for (i = 0; i < grid->nb; i++) {
+        for (c = 0; c < 2; c++) {
+            p = floor_div(grid->points[i][c], grid->cell_size);
+            grid->origin[c] = i ? imin(grid->origin[c], p) : p;
+            max[c] = i ? imax(max[c], p) : p;
+        }
+    }
+    grid->size[0] = max[0] - grid->origin[0] + 1;
+    grid->size[1] = max[1] - grid->origin[1] + 1;
+    nb_cells = grid->size[0] * grid->size[1];
+
+    grid->cells = calloc(nb_cells + 1, sizeof(*grid->cells));
+    grid->ids = malloc(grid->nb * sizeof(*grid->ids));
+    for (i = 0; i < grid->nb; i++)
+        grid->cells[cell_index(grid, grid->points[i]) + 1]++;
+    for (i = 0; i < nb_cells; i++)
+        grid->cells[i + 1] += grid->cells[i];
+    next = malloc(nb_cells * sizeof(*next));
+    for (i = 0; i < nb_cells; i++)
+        next[i] = grid->cells[i];
+    for (i = 0; i < grid->nb; i++)
+        grid->ids[next[cell_index(grid, grid->points[i])]++] = i;
+    free(next);
+}
+
+typedef struct {
+    int     x, y;
+    bool    cheb;
+    int64_t best;
+    int     best_id;
+} nearest_ctx_t;
+
+static void nearest_visit_cell(const point_grid_t *grid, nearest_ctx_t *ctx,
+                               int cx, int cy)
+{
+    int c, k, id;
+    int64_t dx, dy, d;
+
+    c = (cx - grid->origin[0]) + (cy - grid->origin[1]) * grid->size[0];
+    for (k = grid->cells[c]; k < grid->cells[c + 1]; k++) {
+        id = grid->ids[k];
+        dx = llabs((int64_t)grid->points[id][0] - ctx->x);
+        dy = llabs((int64_t)grid->points[id][1] - ctx->y);
+        d = ctx->cheb ? (dx > dy ? dx : dy) : dx * dx + dy * dy;
+        if (d > ctx->best) continue;
+        if (d == ctx->best && ctx->best_id != -1 && id > ctx->best_id)
+            continue;
+        ctx->best = d;
+        ctx->best_id = id;
+    }
+}
+
+static int nearest(point_grid_t *grid, int x, int y, int max_dist, bool cheb,
+                   int64_t *dist)
+{
+    nearest_ctx_t ctx = {x, y, cheb, 0, -1};
+    int qx, qy, r, r0, r1, i, x0, x1, y0, y1;
+    int64_t lb;
+
+    if (max_dist < 0) return -1;
+    point_grid_build(grid);
+    if (!grid->nb) return -1;
+    ctx.best = cheb ? max_dist : (int64_t)max_dist * max_dist;
+
+    // Cells bounds, relative to the cell of the position.
+    qx = floor_div(x, grid->cell_size);
+    qy = floor_div(y, grid->cell_size);
+    x0 = grid->origin[0] - qx;
+    y0 = grid->origin[1] - qy;
+    x1 = x0 + grid->size[0] - 1;
+    y1 = y0 + grid->size[1] - 1;
+
+    // Visit the rings of cells around the position, starting from the first
+    // one that intersects the grid.
+    r0 = imax(imax(x0, -x1), imax(y0, -y1));
+    r0 = imax(r0, 0);
+    r1 = imax(imax(-x0, x1), imax(-y0, y1));
+    for (r = r0; r <= r1; r++) {
+        // The points of the ring r are at least that far.
+        if (r > 0) {
+            lb = (int64_t)(r - 1) * grid->cell_size + 1;
+            if ((cheb ? lb : lb * lb) > ctx.best) break;
+        }
+        if (r == 0) {
+            nearest_visit_cell(grid, &ctx, qx, qy);
+            continue;
+        }
+        for (i = imax(-r, x0); i <= imin(r, x1); i++) {
+            if (-r >= y0) nearest_visit_cell(grid, &ctx, qx + i, qy - r);
+            if (r <= y1) nearest_visit_cell(grid, &ctx, qx + i, qy + r);
+        }
+        for (i = imax(-r + 1, y0); i <= imin(r - 1, y1); i++) {
+            if (-r >= x0) nearest_visit_cell(grid, &ctx, qx - r, qy + i);
+            if (r <= x1) nearest_visit_cell(grid, &ctx, qx + r, qy + i);
+        }
+    }
+    if (dist && ctx.best_id != -1) *dist = ctx.best;
+    return ctx.best_id;
+}
+
+int point_grid_nearest(point_grid_t *grid, int x, int y, int max_dist,
+                       int64_t *dist2)
+{
+    return nearest(grid, x, y, max_dist, false, dist2);
+}
+
+int point_grid_nearest_cheb(point_grid_t *grid, int x, int y, int max_dist,
+                            int *dist)
+{
+    int64_t d;
+    int ret = nearest(grid, x, y, max_dist, true, &d);
+    if (dist && ret != -1) *dist = (int)d;
+    return ret;
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+int point_grid_query(point_grid_t *grid, int x, int y, int radius,
+                     int *ids, int max_ids)
+{
+    int cx, cy, cx0, cx1, cy0, cy1, c, k, id, n = 0;
+
+    if (radius < 0) return 0;
+    point_grid_build(grid);
+    if (!grid->nb) return 0;
+
+    cx0 = imax(floor_div(x - radius, grid->cell_size), grid->origin[0]);
+    cy0 = imax(floor_div(y - radius, grid->cell_size), grid->origin[1]);
+    cx1 = imin(floor_div(x + radius, grid->cell_size),
+               grid->origin[0] + grid->size[0] - 1);
+    cy1 = imin(floor_div(y + radius, grid->cell_size),
+               grid->origin[1] + grid->size[1] - 1);
+    for (cy = cy0; cy <= cy1; cy++)
+    for (cx = cx0; cx <= cx1; cx++) {
+        c = (cx - grid->origin[0]) + (cy - grid->origin[1]) * grid->size[0];
+        for (k = grid->cells[c]; k < grid->cells[c + 1]; k++) {
+            id = grid->ids[k];
+            if (abs(grid->points[id][0] - x) > radius) continue;
+            if (abs(grid->points[id][1] - y) > radius) continue;
+            if (n < max_ids) ids[n] = id;
+            n++;
+        }
+    }
+    if (n <= max_ids) qsort(ids, n, sizeof(*ids), int_cmp);
+    return n;
+}
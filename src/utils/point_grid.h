@@ -0,0 +1,104 @@
+/* Goxel 3D voxels editor
+ *
+ * copyright (c) 2024-present Guillaume Chereau <guillaume@noctua-software.com>
+ *
+ * Goxel is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * Goxel is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * goxel.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POINT_GRID_H
+#define POINT_GRID_H
+
+#include <stdint.h>
+
+/*
+ * Type: point_grid_t
+ * Spatial index of 2D integer points, to find the nearest points of a
+ * position without looping over all of them.
+ *
+ * The points are put into square cells, and the queries only look at the
+ * cells around the position, from the closest ones, until no other cell
+ * can contain a better point.  The points are identified by their index,
+ * in the order they were added, and when several points are at the same
+ * distance the lowest index wins, like a loop over all the points would
+ * do.
+ */
+typedef struct point_grid point_grid_t;
+
+/*
+ * Function: point_grid_new
+ * Create a new empty grid.
+ *
+ * Parameters:
+ *   cell_size - Size of the cells.  Ideally of the order of the distance
+ *               of the queries.
+ */
+point_grid_t *point_grid_new(int cell_size);
+
+/*
+ * Function: point_grid_delete
+ * Delete a grid.  Can be called with NULL.
+ */
+void point_grid_delete(point_grid_t *grid);
+
+/*
+ * Function: point_grid_add
+ * Add a point to the grid.  Its index is the number of points added
+ * before it.
+ */
+void point_grid_add(point_grid_t *grid, int x, int y);
+
+/*
+ * Function: point_grid_nearest
+ * Find the nearest point of a position, using the euclidean distance.
+ *
+ * Parameters:
+ *   grid     - The grid.
+ *   x, y     - The position.
+ *   max_dist - Ignore the points further than this distance.
+ *   dist2    - Set to the squared distance of the point found.  Can be
+ *              NULL.
+ *
+ * Returns:
+ *   The index of the nearest point, or -1 if there is none.
+ */
+int point_grid_nearest(point_grid_t *grid, int x, int y, int max_dist,
+                       int64_t *dist2);
+
+/*
+ * Function: point_grid_nearest_cheb
+ * Like point_grid_nearest, but using the Chebyshev distance, that is the
+ * max of the distances along x and y.
+ */
+int point_grid_nearest_cheb(point_grid_t *grid, int x, int y, int max_dist,
+                            int *dist);
+
+/*
+ * Function: point_grid_query
+ * Get all the points in a square around a position.
+ *
+ * Parameters:
+ *   grid     - The grid.
+ *   x, y     - Center of the square.
+ *   radius   - Max Chebyshev distance of the points.
+ *   ids      - Output array of points indices, sorted.
+ *   max_ids  - Size of the ids array.
+ *
+ * Returns:
+ *   The number of points in the square.  If it is more than max_ids, the
+ *   ids array is not valid and we should call again with a bigger one.
+ */
+int point_grid_query(point_grid_t *grid, int x, int y, int radius,
+                     int *ids, int max_ids);
+
+#endif // POINT_GRID_H
@@ -0,0 +1,93 @@
+/* Goxel 3D voxels editor
+ *
+ * copyright (c) 2024-present Guillaume Chereau <guillaume@noctua-software.com>
+ *
+ * Goxel is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * Goxel is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * goxel.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rle.h"
+
+#include <string.h>
+
+#define MAX_PACKET 128
+
+static inline uint32_t get_value(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static int put_literals(const uint8_t *src, int nb, uint8_t *dst)
+{
+    if (nb == 0) return 0;
+    dst[0] = nb - 1;
+    memcpy(dst + 1, src, nb * 4);
+    return 1 + nb * 4;
+}
+
+int rle_encode_rgba(const uint8_t *src, int n, uint8_t *dst)
+{
+    int i = 0, run, lit_start = 0, size = 0;
+    uint32_t v;
+
+    while (i < n) {
+        v = get_value(src + i * 4);
+        for (run = 1; i + run < n && run < MAX_PACKET; run++) {
+            if (get_value(src + (i + run) * 4) != v) break;
+        }
+        // Runs shorter than three values are cheaper stored as literals.
+        if (run >= 3) {
+            size += put_literals(src + lit_start * 4, i - lit_start,
+                                 dst + size);
+            dst[size++] = 127 + run;
+            memcpy(dst + size, src + i * 4, 4);
+            size += 4;
+            i += run;
+            lit_start = i;
+            continue;
+        }
+        i++;
+        if (i - lit_start == MAX_PACKET) {
+            size += put_literals(src + lit_start * 4, i - lit_start,
+                                 dst + size);
+            lit_start = i;
+        }
+    }
+    size += put_literals(src + lit_start * 4, i - lit_start, dst + size);
+    return size;
+}
+
+int rle_decode_rgba(const uint8_t *src, int size, uint8_t *dst, int n)
+{
+    int pos = 0, i = 0, c, nb, k;
+
+    while (pos < size) {
+        c = src[pos++];
+        if (c < 128) {
+            nb = c + 1;
+            if (i + nb > n || pos + nb * 4 > size) return -1;
+            memcpy(dst + i * 4, src + pos, nb * 4);
+            pos += nb * 4;
+        } else {
+            nb = c - 127;
+            if (i + nb > n || pos + 4 > size) return -1;
+            for (k = 0; k < nb; k++)
+                memcpy(dst + (i + k) * 4, src + pos, 4);
+            pos += 4;
+        }
+        i += nb;
+    }
+    return i == n ? 0 : -1;
+}
@@ -0,0 +1,67 @@
+/* Goxel 3D voxels editor
+ *
+ * copyright (c) 2024-present Guillaume Chereau <guillaume@noctua-software.com>
+ *
+ * Goxel is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * Goxel is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * goxel.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RLE_H
+#define RLE_H
+
+#include <stdint.h>
+
+/*
+ * Fast run-length compression of RGBA values, used to store voxel tiles.
+ *
+ * The data is a list of packets starting with a control byte c:
+ *   c < 128  : c + 1 literal RGBA values follow.
+ *   c >= 128 : the next RGBA value is repeated c - 127 times.
+ */
+
+/*
+ * Macro: RLE_MAX_SIZE
+ * Max size of the rle data for n RGBA values.
+ */
+#define RLE_MAX_SIZE(n) ((n) * 4 + ((n) + 127) / 128)
+
+/*
+ * Function: rle_encode_rgba
+ * Compress n RGBA values.
+ *
+ * Parameters:
+ *   src    - Input RGBA values (n * 4 bytes).
+ *   n      - Number of values.
+ *   dst    - Output buffer, of at least RLE_MAX_SIZE(n) bytes.
+ *
+ * Returns:
+ *   The size of the compressed data.
+ */
+int rle_encode_rgba(const uint8_t *src, int n, uint8_t *dst);
+
+/*
+ * Function: rle_decode_rgba
+ * Decompress RGBA values compressed with rle_encode_rgba.
+ *
+ * Parameters:
+ *   src    - Compressed data.
+ *   size   - Size of the compressed data.
+ *   dst    - Output RGBA values (n * 4 bytes).
+ *   n      - Number of values expected.
+ *
+ * Returns:
+ *   0 on success, -1 if the data is corrupted.
+ */
+int rle_decode_rgba(const uint8_t *src, int size, uint8_t *dst, int n);
+
+#endif // RLE_H
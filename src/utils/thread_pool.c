@@ -0,0 +1,292 @@
+/* Goxel 3D voxels editor
+ *
+ * copyright (c) 2024-present Guillaume Chereau <guillaume@noctua-software.com>
+ *
+ * Goxel is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * Goxel is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * goxel.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread_pool.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifndef THREAD_POOL_MAX_THREADS
+#   define THREAD_POOL_MAX_THREADS 32
+#endif
+
+#if defined(__EMSCRIPTEN__)
+#   define THREAD_POOL_ENABLED 0
+#else
+#   define THREAD_POOL_ENABLED 1
+#endif
+
+#if THREAD_POOL_ENABLED
+
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef WIN32
+#   include <windows.h>
+#endif
+
+typedef struct {
+    int     n;
+    int     next;       // Next index to process (atomic).
+    int     active;     // Number of workers running the job.
+    void    (*func)(void *user, int i);
+    void    *user;
+} job_t;
+
+typedef struct task task_t;
+struct task {
+    task_t  *next;
+    void    (*func)(void *user);
+    void    *user;
+};
+
+static pthread_once_t g_pool_once = PTHREAD_ONCE_INIT;
+static pthread_once_t g_tasks_once = PTHREAD_ONCE_INIT;
+
+static struct {
+    int             nb_threads; // Including the calling thread.
+    pthread_t       threads[THREAD_POOL_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t  work_cond;
+    pthread_cond_t  done_cond;
+    job_t           *job;
+} g_pool = {};
+
+// Background threads for thread_pool_submit.
+static struct {
+    int             nb_threads;
+    pthread_t       threads[THREAD_POOL_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    task_t          *first;
+    task_t          *last;
+} g_tasks = {};
+
+static __thread bool g_in_task = false;
+
+static int get_nb_cpus(void)
+{
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+static void job_process(job_t *job)
+{
+    int i;
+    while (true) {
+        i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->n) break;
+        job->func(job->user, i);
+    }
+}
+
+static bool job_has_work(const job_t *job)
+{
+    return job && __atomic_load_n(&job->next, __ATOMIC_RELAXED) < job->n;
+}
+
+static void *worker_func(void *arg)
+{
+    job_t *job;
+    pthread_mutex_lock(&g_pool.lock);
+    while (true) {
+        while (!job_has_work(g_pool.job))
+            pthread_cond_wait(&g_pool.work_cond, &g_pool.lock);
+        job = g_pool.job;
+        job->active++;
+        pthread_mutex_unlock(&g_pool.lock);
+        job_process(job);
+        pthread_mutex_lock(&g_pool.lock);
+        if (--job->active == 0)
+            pthread_cond_broadcast(&g_pool.done_cond);
+    }
+    return NULL;
+}
+
+static void pool_init(void)
+{
+    int i;
+    g_pool.nb_threads = get_nb_cpus();
+    if (g_pool.nb_threads < 1) g_pool.nb_threads = 1;
+    if (g_pool.nb_threads > THREAD_POOL_MAX_THREADS)
+        g_pool.nb_threads = THREAD_POOL_MAX_THREADS;
+    pthread_mutex_init(&g_pool.lock, NULL);
+    pthread_cond_init(&g_pool.work_cond, NULL);
+    pthread_cond_init(&g_pool.done_cond, NULL);
+    for (i = 1; i < g_pool.nb_threads; i++) {
+        if (pthread_create(&g_pool.threads[i], NULL, worker_func, NULL)) {
+            g_pool.nb_threads = i;
+            break;
+        }
+    }
+}
+
+int thread_pool_get_nb_threads(void)
+{
+    pthread_once(&g_pool_once, pool_init);
+    return g_pool.nb_threads;
+}
+
+void thread_pool_run(int n, void (*func)(void *user, int i), void *user)
+{
+    int i;
+    job_t job = {.n = n, .func = func, .user = user};
+
+    if (n <= 0) return;
+    pthread_once(&g_pool_once, pool_init);
+
+    pthread_mutex_lock(&g_pool.lock);
+    if (n == 1 || g_pool.nb_threads == 1 || g_pool.job) {
+        pthread_mutex_unlock(&g_pool.lock);
+        for (i = 0; i < n; i++) func(user, i);
+        return;
+    }
+    g_pool.job = &job;
+    pthread_cond_broadcast(&g_pool.work_cond);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    job_process(&job);
+
+    pthread_mutex_lock(&g_pool.lock);
+    while (job.active)
+        pthread_cond_wait(&g_pool.done_cond, &g_pool.lock);
+    g_pool.job = NULL;
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+static void *task_worker_func(void *arg)
+{
+    task_t *task;
+    g_in_task = true;
+    pthread_mutex_lock(&g_tasks.lock);
+    while (true) {
+        while (!g_tasks.first)
+            pthread_cond_wait(&g_tasks.cond, &g_tasks.lock);
+        task = g_tasks.first;
+        g_tasks.first = task->next;
+        if (!g_tasks.first) g_tasks.last = NULL;
+        pthread_mutex_unlock(&g_tasks.lock);
+        task->func(task->user);
+        free(task);
+        pthread_mutex_lock(&g_tasks.lock);
+    }
+    return NULL;
+}
+
+static void tasks_init(void)
+{
+    int i, n;
+    // Leave one core for the main thread.
+    n = get_nb_cpus() - 1;
+    if (n < 1) n = 1;
+    if (n > THREAD_POOL_MAX_THREADS) n = THREAD_POOL_MAX_THREADS;
+    pthread_mutex_init(&g_tasks.lock, NULL);
+    pthread_cond_init(&g_tasks.cond, NULL);
+    for (i = 0; i < n; i++) {
+        if (pthread_create(&g_tasks.threads[i], NULL, task_worker_func, NULL))
+            break;
+    }
+    g_tasks.nb_threads = i;
+}
+
+void thread_pool_submit(void (*func)(void *user), void *user)
+{
+    task_t *task;
+
+    pthread_once(&g_tasks_once, tasks_init);
+    if (g_tasks.nb_threads == 0) {
+        func(user);
+        return;
+    }
+    task = calloc(1, sizeof(*task));
+    task->func = func;
+    task->user = user;
+    pthread_mutex_lock(&g_tasks.lock);
+    if (g_tasks.last)
+        g_tasks.last->next = task;
+    else
+        g_tasks.first = task;
+    g_tasks.last = task;
+    pthread_cond_signal(&g_tasks.cond);
+    pthread_mutex_unlock(&g_tasks.lock);
+}
+
+static void *spawn_func(void *arg)
+{
+    task_t *task = arg;
+    g_in_task = true;
+    task->func(task->user);
+    free(task);
+    return NULL;
+}
+
+void thread_pool_spawn(void (*func)(void *user), void *user)
+{
+    pthread_t thread;
+    task_t *task = calloc(1, sizeof(*task));
+
+    task->func = func;
+    task->user = user;
+    if (pthread_create(&thread, NULL, spawn_func, task)) {
+        free(task);
+        func(user);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+bool thread_pool_in_task(void)
+{
+    return g_in_task;
+}
+
+#else // THREAD_POOL_ENABLED
+
+int thread_pool_get_nb_threads(void)
+{
+    return 1;
+}
+
+void thread_pool_run(int n, void (*func)(void *user, int i), void *user)
+{
+    int i;
+    for (i = 0; i < n; i++) func(user, i);
+}
+
+void thread_pool_submit(void (*func)(void *user), void *user)
+{
+    func(user);
+}
+
+void thread_pool_spawn(void (*func)(void *user), void *user)
+{
+    func(user);
+}
+
+bool thread_pool_in_task(void)
+{
+    return false;
+}
+
+#endif
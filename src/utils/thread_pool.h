@@ -0,0 +1,83 @@
+/* Goxel 3D voxels editor
+ *
+ * copyright (c) 2024-present Guillaume Chereau <guillaume@noctua-software.com>
+ *
+ * Goxel is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * Goxel is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * goxel.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdbool.h>
+
+// Minimal pool of worker threads, used to spread independent work items
+// (tiles, file blocks...) on all the cores.
+
+/*
+ * Function: thread_pool_get_nb_threads
+ * Return the number of threads used by thread_pool_run, including the
+ * calling thread.
+ */
+int thread_pool_get_nb_threads(void);
+
+/*
+ * Function: thread_pool_run
+ * Call a function for every index in [0, n) using all the cores, and wait
+ * until all the calls are done.
+ *
+ * The calls are done in no particular order, so the function should only
+ * write into data owned by its index.  If the pool is already busy (for
+ * example when called from a worker), the calls are done serially on the
+ * calling thread.
+ *
+ * Parameters:
+ *   n      - Number of items.
+ *   func   - Function called for each item.
+ *   user   - User data passed to the function.
+ */
+void thread_pool_run(int n, void (*func)(void *user, int i), void *user);
+
+/*
+ * Function: thread_pool_submit
+ * Queue a function to be called later by a background thread.
+ *
+ * The background threads are separate from the ones used by
+ * thread_pool_run, and there is always at least one, even on a single
+ * core machine.  The tasks are started in order, but can run concurrently,
+ * so the caller has to synchronize the access to any shared data.
+ *
+ * Parameters:
+ *   func   - Function to call.
+ *   user   - User data passed to the function.
+ */
+void thread_pool_submit(void (*func)(void *user), void *user);
+
+/*
+ * Function: thread_pool_spawn
+ * Call a function in a new background thread.
+ *
+ * For the long tasks that should not delay the ones queued with
+ * thread_pool_submit.  If threads are not supported, the function is
+ * called directly.
+ */
+void thread_pool_spawn(void (*func)(void *user), void *user);
+
+/*
+ * Function: thread_pool_in_task
+ * Return true if called from one of the background threads that run the
+ * functions passed to thread_pool_submit or thread_pool_spawn.
+ */
+bool thread_pool_in_task(void);
+
+#endif // THREAD_POOL_H
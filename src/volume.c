@@ -21,6 +21,7 @@
 #include <assert.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
 
 #define min(a, b) ({ \
       __typeof__ (a) _a = (a); \
@@ -41,22 +42,72 @@ enum {
     VOLUME_ITER_VOLUME2                     = 1 << 11,
 };
 
+// Voxels of the uniform tiles, shared by all the tiles of the same color.
+typedef struct uniform_block uniform_block_t;
+struct uniform_block
+{
+    UT_hash_handle  hh;
+    uint32_t        color;
+    int             ref;
+    uint8_t         voxels[TILE_SIZE * TILE_SIZE * TILE_SIZE][4];
+};
+
+// The uniform tiles (all the voxels with the same value, like the solid
+// underground of the maps) don't have their own voxels, but point to the
+// shared block of their color, so that they only cost the size of the
+// struct.  They get expanded by tile_prepare_write before any change.
+//
+// The palette tiles (at most 256 different values) store a palette and
+// 4 or 8 bits indices per voxel.  Setting a voxel keeps the encoding as
+// long as the palette has room for its value, otherwise the tile is
+// expanded to RGBA.  volume_get_tile_data needs RGBA voxels, so it decodes
+// them once and keeps them until the tile changes.
 typedef struct tile_data tile_data_t;
 struct tile_data
 {
-    int         ref;
-    uint64_t    id;
-    uint8_t     voxels[TILE_SIZE * TILE_SIZE * TILE_SIZE][4]; // RGBA voxels.
+    int             ref;
+    uint64_t        id;
+    uniform_block_t *block;     // Set for the uniform tiles.
+    uint8_t         (*voxels)[4]; // RGBA voxels, own or the block ones.
+    int             bits;       // 4 or 8 for the palette tiles, else 0.
+    int             nb_colors;  // Number of colors used in the palette.
+    uint32_t        *palette;   // (1 << bits) colors, in buf.
+    uint8_t         *indices;   // Voxels palette indices, in buf.
+    uint8_t         buf[][4];   // Own voxels, or palette and indices.
 };
 
+#define TILE_DATA_SIZE \
+    (sizeof(tile_data_t) + TILE_SIZE * TILE_SIZE * TILE_SIZE * 4)
+
+#define PALETTE_DATA_SIZE(bits) \
+    (sizeof(tile_data_t) + (1 << (bits)) * 4 + \
+     TILE_SIZE * TILE_SIZE * TILE_SIZE * (bits) / 8)
+
 struct tile
 {
     UT_hash_handle  hh;     // The hash table of pos -> tiles in a volume.
     tile_data_t     *data;
     int             pos[3];
     uint64_t        id;
+    uint64_t        gen;    // Volume key of the last change of the voxels.
+};
+
+// Top solid z of each column of a tile column, for volume_get_column_top.
+typedef struct heights_col heights_col_t;
+struct heights_col
+{
+    UT_hash_handle  hh;
+    int             pos[2];     // Tile column position.
+    int             top[TILE_SIZE * TILE_SIZE]; // x + y * N, or INT_MIN.
 };
 
+// Log of the removed tiles, used by volume_get_dirty_tiles.
+#define MAX_REMOVED_TILES 1024
+typedef struct {
+    int      pos[3];
+    uint64_t gen;
+} removed_tile_t;
+
 struct volume
 {
     int ref;
@@ -68,12 +119,54 @@ struct volume
     bool bbox_exact;
     bool bbox_nonempty;
     int bbox[2][3];
+    /* Dirty tiles tracking: we know the changes since any key >= horizon,
+     * or since the key base (the key we got from volume_set). */
+    uint64_t dirty_base;
+    uint64_t dirty_horizon;
+    int nb_removed;
+    removed_tile_t *removed;
+    /* Lazy cache of the columns tops, for volume_get_column_top.  A tile
+     * column is removed as soon as one of its tiles changes. */
+    heights_col_t *heights;
 };
 
 static uint64_t g_uid = 2; // Global id counter.
 
 static volume_global_stats_t g_global_stats = {};
 
+// Hash table of the uniform blocks by color.
+static uniform_block_t *g_uniform_blocks = NULL;
+static pthread_mutex_t g_uniform_blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool g_palette_tiles = true;
+
+// The tiles data can be shared between volumes used from different threads
+// (see filter_job_t), so the ids counter, the references counters and the
+// stats are all updated atomically.
+static uint64_t new_uid(void)
+{
+    return __atomic_fetch_add(&g_uid, 1, __ATOMIC_RELAXED);
+}
+
+static int ref_get(const int *ref)
+{
+    return __atomic_load_n(ref, __ATOMIC_ACQUIRE);
+}
+
+static void ref_inc(int *ref)
+{
+    __atomic_add_fetch(ref, 1, __ATOMIC_RELAXED);
+}
+
+// Return the new value.
+static int ref_dec(int *ref)
+{
+    return __atomic_sub_fetch(ref, 1, __ATOMIC_ACQ_REL);
+}
+
+#define STATS_ADD(attr, v) \
+    __atomic_add_fetch(&g_global_stats.attr, v, __ATOMIC_RELAXED)
+
 #define N TILE_SIZE
 
 #define vec3_copy(a, b) do {b[0] = a[0]; b[1] = a[1]; b[2] = a[2];} while (0)
@@ -84,8 +177,8 @@ static volume_global_stats_t g_global_stats = {};
         for (y = 0; y < N; y++) \
             for (x = 0; x < N; x++)
 
-#define DATA_AT(d, x, y, z) (d->voxels[x + y * N + z * N * N])
-#define TILE_AT(c, x, y, z) (DATA_AT(c->data, x, y, z))
+// Index of a voxel in a tile.
+#define VOXEL_INDEX(x, y, z) ((x) + (y) * N + (z) * N * N)
 
 static void mat4_mul_vec4(float mat[4][4], const float v[4], float out[4])
 {
@@ -137,24 +230,243 @@ static void bbox_intersection(int a[2][3], int b[2][3], int out[2][3])
 
 static tile_data_t *get_empty_data(void)
 {
-    static tile_data_t *data = NULL;
-    if (!data) {
-        data = calloc(1, sizeof(*data));
-        data->ref = 1;
-        data->id = 0;
+    // Never released, since the refs start at one.
+    static uniform_block_t block = {.ref = 1};
+    static tile_data_t data = {.ref = 1, .id = 0, .block = &block,
+                               .voxels = block.voxels};
+    return &data;
+}
+
+static bool tile_is_uniform(const tile_t *tile)
+{
+    return tile->data->block != NULL;
+}
+
+static uniform_block_t *uniform_block_get(const uint8_t color[4])
+{
+    uniform_block_t *block;
+    uint32_t c;
+    int i;
+
+    memcpy(&c, color, 4);
+    pthread_mutex_lock(&g_uniform_blocks_lock);
+    HASH_FIND(hh, g_uniform_blocks, &c, sizeof(c), block);
+    if (!block) {
+        block = calloc(1, sizeof(*block));
+        block->color = c;
+        for (i = 0; i < N * N * N; i++)
+            memcpy(block->voxels[i], color, 4);
+        HASH_ADD(hh, g_uniform_blocks, color, sizeof(block->color), block);
+        STATS_ADD(nb_uniform_blocks, 1);
+        STATS_ADD(mem, sizeof(*block));
+        STATS_ADD(mem_saved, -(int64_t)sizeof(*block));
+    }
+    block->ref++;
+    pthread_mutex_unlock(&g_uniform_blocks_lock);
+    return block;
+}
+
+static void uniform_block_release(uniform_block_t *block)
+{
+    pthread_mutex_lock(&g_uniform_blocks_lock);
+    if (--block->ref == 0) {
+        HASH_DEL(g_uniform_blocks, block);
+        free(block);
+        STATS_ADD(nb_uniform_blocks, -1);
+        STATS_ADD(mem, -sizeof(*block));
+        STATS_ADD(mem_saved, sizeof(*block));
+    }
+    pthread_mutex_unlock(&g_uniform_blocks_lock);
+}
+
+// Return true if all the voxels of a tile buffer have the same value.
+static bool voxels_are_uniform(const uint8_t *voxels)
+{
+    uint32_t v0, v;
+    int i;
+
+    memcpy(&v0, voxels, 4);
+    for (i = 1; i < N * N * N; i++) {
+        memcpy(&v, voxels + i * 4, 4);
+        if (v != v0) return false;
     }
+    return true;
+}
+
+// New data with its own voxels, with a ref of one.
+static tile_data_t *tile_data_new(void)
+{
+    tile_data_t *data = calloc(1, TILE_DATA_SIZE);
+    data->ref = 1;
+    data->id = new_uid();
+    data->voxels = data->buf;
+    STATS_ADD(nb_tiles, 1);
+    STATS_ADD(mem, TILE_DATA_SIZE);
+    return data;
+}
+
+static tile_data_t *tile_data_new_uniform(const uint8_t color[4])
+{
+    tile_data_t *data = calloc(1, sizeof(*data));
+    data->ref = 1;
+    data->id = new_uid();
+    data->block = uniform_block_get(color);
+    data->voxels = data->block->voxels;
+    STATS_ADD(nb_tiles, 1);
+    STATS_ADD(nb_uniform_tiles, 1);
+    STATS_ADD(mem, sizeof(*data));
+    STATS_ADD(mem_saved, TILE_DATA_SIZE - sizeof(*data));
     return data;
 }
 
+// Try to encode some voxels with a palette.  Return NULL if there are too
+// many different values.
+static tile_data_t *tile_data_new_palette(const uint8_t *voxels)
+{
+    // Open addressing hash table of the colors, slots with a zero count are
+    // free.
+    struct {
+        uint32_t    color;
+        int         count;
+        int         index;
+    } table[512] = {};
+    uint32_t colors[256], c;
+    uint8_t indices[N * N * N];
+    int i, h, nb = 0, bits;
+    tile_data_t *data;
+
+    for (i = 0; i < N * N * N; i++) {
+        memcpy(&c, voxels + i * 4, 4);
+        h = (c * 2654435761u) >> 23;
+        while (table[h].count && table[h].color != c) h = (h + 1) % 512;
+        if (!table[h].count) {
+            if (nb == 256) return NULL;
+            table[h].color = c;
+            table[h].index = nb;
+            colors[nb++] = c;
+        }
+        table[h].count++;
+        indices[i] = table[h].index;
+    }
+
+    bits = nb <= 16 ? 4 : 8;
+    data = calloc(1, PALETTE_DATA_SIZE(bits));
+    data->ref = 1;
+    data->id = new_uid();
+    data->bits = bits;
+    data->nb_colors = nb;
+    data->palette = (uint32_t*)data->buf;
+    data->indices = (uint8_t*)(data->palette + (1 << bits));
+    memcpy(data->palette, colors, nb * 4);
+    if (bits == 8) {
+        memcpy(data->indices, indices, N * N * N);
+    } else {
+        for (i = 0; i < N * N * N; i += 2)
+            data->indices[i / 2] = indices[i] | (indices[i + 1] << 4);
+    }
+    STATS_ADD(nb_tiles, 1);
+    STATS_ADD(nb_palette_tiles, 1);
+    STATS_ADD(mem, PALETTE_DATA_SIZE(bits));
+    STATS_ADD(mem_saved, TILE_DATA_SIZE - PALETTE_DATA_SIZE(bits));
+    return data;
+}
+
+static int palette_index_get(const tile_data_t *data, int i)
+{
+    if (data->bits == 8) return data->indices[i];
+    return (data->indices[i / 2] >> ((i % 2) * 4)) & 15;
+}
+
+static void palette_index_set(tile_data_t *data, int i, int index)
+{
+    uint8_t *v;
+    if (data->bits == 8) {
+        data->indices[i] = index;
+        return;
+    }
+    v = &data->indices[i / 2];
+    *v = (i % 2) ? ((*v & 0x0f) | (index << 4)) : ((*v & 0xf0) | index);
+}
+
+// Get the RGBA voxels of a data if we have them.
+static uint8_t (*data_get_voxels(const tile_data_t *data))[4]
+{
+    return __atomic_load_n(&data->voxels, __ATOMIC_ACQUIRE);
+}
+
+static void data_get_at(const tile_data_t *data, int i, uint8_t out[4])
+{
+    uint8_t (*voxels)[4] = data_get_voxels(data);
+    if (voxels)
+        memcpy(out, voxels[i], 4);
+    else
+        memcpy(out, &data->palette[palette_index_get(data, i)], 4);
+}
+
+// Copy the RGBA voxels of a data into a buffer.
+static void data_read(const tile_data_t *data, uint8_t *out)
+{
+    uint8_t (*voxels)[4] = data_get_voxels(data);
+    int i;
+    if (voxels) {
+        memcpy(out, voxels, N * N * N * 4);
+        return;
+    }
+    for (i = 0; i < N * N * N; i++)
+        memcpy(out + i * 4, &data->palette[palette_index_get(data, i)], 4);
+}
+
+// Return the RGBA voxels of a data, decoding the palette tiles if needed.
+// The decoded voxels stay until the data changes or is released.  This can
+// be called from several threads at the same time.
+static uint8_t (*data_decode(tile_data_t *data))[4]
+{
+    uint8_t (*voxels)[4] = data_get_voxels(data), (*expected)[4] = NULL;
+    if (voxels) return voxels;
+    voxels = malloc(N * N * N * 4);
+    data_read(data, (uint8_t*)voxels);
+    if (!__atomic_compare_exchange_n(&data->voxels, &expected, voxels, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(voxels);
+        return expected;
+    }
+    STATS_ADD(mem, N * N * N * 4);
+    STATS_ADD(mem_saved, -(N * N * N * 4));
+    return voxels;
+}
+
+// Drop the decoded voxels of a palette data.
+static void data_drop_decoded(tile_data_t *data)
+{
+    if (!data->bits || !data->voxels) return;
+    free(data->voxels);
+    data->voxels = NULL;
+    STATS_ADD(mem, -(N * N * N * 4));
+    STATS_ADD(mem_saved, N * N * N * 4);
+}
+
+// Memory used by a data, not counting the shared uniform blocks.
+static int64_t tile_data_get_mem(const tile_data_t *data)
+{
+    if (data == get_empty_data()) return 0;
+    if (data->block) return sizeof(*data);
+    if (!data->bits) return TILE_DATA_SIZE;
+    return PALETTE_DATA_SIZE(data->bits) +
+           (data_get_voxels(data) ? N * N * N * 4 : 0);
+}
+
 static bool tile_is_empty(const tile_t *tile, bool fast)
 {
     int x, y, z;
+    uint8_t v[4];
     if (!tile) return true;
     if (tile->data->id == 0) return true;
+    if (tile_is_uniform(tile)) return tile->data->voxels[0][3] == 0;
     if (fast) return false;
 
     TILE_ITER(x, y, z) {
-        if (TILE_AT(tile, x, y, z)[3]) return false;
+        data_get_at(tile->data, VOXEL_INDEX(x, y, z), v);
+        if (v[3]) return false;
     }
     return true;
 }
@@ -164,19 +476,35 @@ static tile_t *tile_new(const int pos[3])
     tile_t *tile = calloc(1, sizeof(*tile));
     memcpy(tile->pos, pos, sizeof(tile->pos));
     tile->data = get_empty_data();
-    tile->data->ref++;
-    tile->id = g_uid++;
+    ref_inc(&tile->data->ref);
+    tile->id = new_uid();
     return tile;
 }
 
-static void tile_delete(tile_t *tile)
+static void tile_data_release(tile_data_t *data)
 {
-    tile->data->ref--;
-    if (tile->data->ref == 0) {
-        free(tile->data);
-        g_global_stats.nb_tiles--;
-        g_global_stats.mem -= sizeof(*tile->data);
+    if (ref_dec(&data->ref) != 0) return;
+    STATS_ADD(nb_tiles, -1);
+    if (data->block) {
+        uniform_block_release(data->block);
+        STATS_ADD(nb_uniform_tiles, -1);
+        STATS_ADD(mem, -sizeof(*data));
+        STATS_ADD(mem_saved, -(int64_t)(TILE_DATA_SIZE - sizeof(*data)));
+    } else if (data->bits) {
+        data_drop_decoded(data);
+        STATS_ADD(nb_palette_tiles, -1);
+        STATS_ADD(mem, -PALETTE_DATA_SIZE(data->bits));
+        STATS_ADD(mem_saved, -(int64_t)(TILE_DATA_SIZE -
+                                        PALETTE_DATA_SIZE(data->bits)));
+    } else {
+        STATS_ADD(mem, -TILE_DATA_SIZE);
     }
+    free(data);
+}
+
+static void tile_delete(tile_t *tile)
+{
+    tile_data_release(tile->data);
     free(tile);
 }
 
@@ -185,40 +513,106 @@ static tile_t *tile_copy(const tile_t *other)
     tile_t *tile = malloc(sizeof(*tile));
     *tile = *other;
     memset(&tile->hh, 0, sizeof(tile->hh));
-    tile->data->ref++;
-    tile->id = g_uid++;
+    ref_inc(&tile->data->ref);
+    tile->id = new_uid();
     return tile;
 }
 
 static void tile_set_data(tile_t *tile, tile_data_t *data)
 {
-    tile->data->ref--;
-    if (tile->data->ref == 0) {
-        free(tile->data);
-        g_global_stats.nb_tiles--;
-        g_global_stats.mem -= sizeof(*tile->data);
-    }
+    tile_data_release(tile->data);
     tile->data = data;
-    data->ref++;
+    ref_inc(&data->ref);
+}
+
+static bool tile_is_rgba(const tile_t *tile)
+{
+    return !tile->data->block && !tile->data->bits;
 }
 
-// Copy the data if there are any other tiles having reference to it.
+// Copy the data if there are any other tiles having reference to it, or
+// expand it to RGBA if it is uniform or uses a palette.
 static void tile_prepare_write(tile_t *tile)
 {
-    if (tile->data->ref == 1) {
-        tile->data->id = ++g_uid;
+    tile_data_t *data;
+    if (ref_get(&tile->data->ref) == 1 && tile_is_rgba(tile)) {
+        tile->data->id = new_uid();
         return;
     }
-    tile->data->ref--;
-    tile_data_t *data;
-    data = calloc(1, sizeof(*tile->data));
-    memcpy(data->voxels, tile->data->voxels, N * N * N * 4);
-    data->ref = 1;
+    // Only release the shared data after the copy.
+    data = tile_data_new();
+    data_read(tile->data, (uint8_t*)data->voxels);
+    tile_data_release(tile->data);
     tile->data = data;
-    tile->data->id = ++g_uid;
+}
+
+// Set a voxel of a palette tile, if its palette has room for the value.
+// Return false if the tile needs to be expanded to RGBA instead.
+static bool tile_palette_set_at(tile_t *tile, int i, const uint8_t v[4])
+{
+    tile_data_t *data = tile->data;
+    uint32_t c;
+    int index;
+
+    if (!data->bits) return false;
+    memcpy(&c, v, 4);
+    for (index = 0; index < data->nb_colors; index++) {
+        if (data->palette[index] == c) break;
+    }
+    if (index == (1 << data->bits)) return false;
+    // Copy the shared data, the palette tiles are small.
+    if (ref_get(&data->ref) > 1) {
+        data = calloc(1, PALETTE_DATA_SIZE(tile->data->bits));
+        memcpy(data->buf, tile->data->buf,
+               PALETTE_DATA_SIZE(tile->data->bits) - sizeof(*data));
+        data->ref = 1;
+        data->bits = tile->data->bits;
+        data->nb_colors = tile->data->nb_colors;
+        data->palette = (uint32_t*)data->buf;
+        data->indices = (uint8_t*)(data->palette + (1 << data->bits));
+        STATS_ADD(nb_tiles, 1);
+        STATS_ADD(nb_palette_tiles, 1);
+        STATS_ADD(mem, PALETTE_DATA_SIZE(data->bits));
+        STATS_ADD(mem_saved, TILE_DATA_SIZE - PALETTE_DATA_SIZE(data->bits));
+        tile_data_release(tile->data);
+        tile->data = data;
+    }
+    data_drop_decoded(data);
+    data->id = new_uid();
+    if (index == data->nb_colors) data->palette[data->nb_colors++] = c;
+    palette_index_set(data, i, index);
+    return true;
+}
 
-    g_global_stats.nb_tiles++;
-    g_global_stats.mem += sizeof(*tile->data);
+// Like tile_prepare_write, but don't copy the previous data since it is
+// going to be overwritten.
+static void tile_prepare_overwrite(tile_t *tile)
+{
+    if (ref_get(&tile->data->ref) == 1 && tile_is_rgba(tile)) {
+        tile->data->id = new_uid();
+        return;
+    }
+    tile_data_release(tile->data);
+    tile->data = tile_data_new();
+}
+
+// Set all the voxels of a tile, using a uniform or palette data if
+// possible.
+static void tile_write_voxels(tile_t *tile, const uint8_t *voxels)
+{
+    tile_data_t *data = NULL;
+
+    if (voxels_are_uniform(voxels))
+        data = tile_data_new_uniform(voxels);
+    else if (__atomic_load_n(&g_palette_tiles, __ATOMIC_RELAXED))
+        data = tile_data_new_palette(voxels);
+    if (data) {
+        tile_data_release(tile->data);
+        tile->data = data;
+        return;
+    }
+    tile_prepare_overwrite(tile);
+    memcpy(tile->data->voxels, voxels, N * N * N * 4);
 }
 
 static void tile_get_at(const tile_t *tile, const int pos[3],
@@ -235,7 +629,7 @@ static void tile_get_at(const tile_t *tile, const int pos[3],
     assert(x >= 0 && x < N);
     assert(y >= 0 && y < N);
     assert(z >= 0 && z < N);
-    memcpy(out, TILE_AT(tile, x, y, z), 4);
+    data_get_at(tile->data, VOXEL_INDEX(x, y, z), out);
 }
 
 /*
@@ -309,21 +703,77 @@ bool volume_get_bbox(const volume_t *volume, int bbox[2][3], bool exact)
 static void volume_prepare_write(volume_t *volume)
 {
     tile_t *tiles, *tile, *new_tile;
-    assert(*volume->tiles_ref > 0);
-    volume->key = g_uid++;
-    if (*volume->tiles_ref == 1)
+    assert(ref_get(volume->tiles_ref) > 0);
+    volume->key = new_uid();
+    if (ref_get(volume->tiles_ref) == 1)
         return;
-    (*volume->tiles_ref)--;
+    ref_dec(volume->tiles_ref);
     volume->tiles_ref = calloc(1, sizeof(*volume->tiles_ref));
     *volume->tiles_ref = 1;
     tiles = volume->tiles;
     volume->tiles = NULL;
     for (tile = tiles; tile; tile = tile->hh.next) {
-        tile->id = g_uid++; // Invalidate all accessors.
+        tile->id = new_uid(); // Invalidate all accessors.
         new_tile = tile_copy(tile);
         HASH_ADD(hh, volume->tiles, pos, sizeof(new_tile->pos), new_tile);
     }
-    g_global_stats.nb_volumes++;
+    STATS_ADD(nb_volumes, 1);
+}
+
+static void heights_clear(volume_t *volume)
+{
+    heights_col_t *col, *tmp;
+    HASH_ITER(hh, volume->heights, col, tmp) {
+        HASH_DEL(volume->heights, col);
+        free(col);
+    }
+}
+
+// Called when the voxels of a tile changed.  Checking if there is a cache
+// first keeps this cheap for the volumes that never use it.
+static void heights_invalidate(volume_t *volume, const int pos[3])
+{
+    heights_col_t *col;
+    if (!volume->heights) return;
+    HASH_FIND(hh, volume->heights, pos, 2 * sizeof(int), col);
+    if (!col) return;
+    HASH_DEL(volume->heights, col);
+    free(col);
+}
+
+// Forget the changes history, only the current key is valid.
+static void volume_reset_dirty(volume_t *volume)
+{
+    volume->dirty_base = volume->key;
+    volume->dirty_horizon = __atomic_load_n(&g_uid, __ATOMIC_RELAXED);
+    volume->nb_removed = 0;
+    heights_clear(volume);
+}
+
+// Called before deleting a tile that is still in the volume.
+static void volume_log_removed(volume_t *volume, const tile_t *tile,
+                               uint64_t gen)
+{
+    int i, n = MAX_REMOVED_TILES / 2;
+    if (gen == 0) return; // The tile never had any voxel.
+    if (!volume->removed)
+        volume->removed = malloc(MAX_REMOVED_TILES * sizeof(*volume->removed));
+    // If the log is full, drop the oldest half.  We don't know the changes
+    // before those anymore.
+    if (volume->nb_removed == MAX_REMOVED_TILES) {
+        for (i = 0; i < n; i++) {
+            volume->dirty_horizon = max(volume->dirty_horizon,
+                                        volume->removed[i].gen);
+        }
+        volume->dirty_base = 0;
+        memmove(volume->removed, volume->removed + n,
+                (MAX_REMOVED_TILES - n) * sizeof(*volume->removed));
+        volume->nb_removed -= n;
+    }
+    memcpy(volume->removed[volume->nb_removed].pos, tile->pos,
+           sizeof(tile->pos));
+    volume->removed[volume->nb_removed].gen = gen;
+    volume->nb_removed++;
 }
 
 static tile_t *volume_add_tile(volume_t *volume, const int pos[3]);
@@ -361,6 +811,9 @@ void volume_remove_empty_tiles(volume_t *volume, bool fast)
     volume_prepare_write(volume);
     HASH_ITER(hh, volume->tiles, tile, tmp) {
         if (tile_is_empty(tile, false)) {
+            // The voxels didn't change, but the tile might have been cleared
+            // since the key of a caller of volume_get_dirty_tiles.
+            volume_log_removed(volume, tile, tile->gen);
             HASH_DEL(volume->tiles, tile);
             assert(volume->tiles != tile);
             tile_delete(tile);
@@ -383,7 +836,8 @@ volume_t *volume_new(void)
     volume->tiles_ref = calloc(1, sizeof(*volume->tiles_ref));
     volume->key = 1; // Empty volume key.
     *volume->tiles_ref = 1;
-    g_global_stats.nb_volumes++;
+    volume_reset_dirty(volume);
+    STATS_ADD(nb_volumes, 1);
     return volume;
 }
 
@@ -449,6 +903,7 @@ void volume_clear(volume_t *volume)
     }
     volume->key = 1; // Empty volume key.
     volume->tiles = NULL;
+    volume_reset_dirty(volume);
 }
 
 void volume_delete(volume_t *volume)
@@ -456,16 +911,17 @@ void volume_delete(volume_t *volume)
     tile_t *tile, *tmp;
     if (!volume) return;
     if (--volume->ref > 0) return;
-    (*volume->tiles_ref)--;
-    if (*volume->tiles_ref == 0) {
+    if (ref_dec(volume->tiles_ref) == 0) {
         HASH_ITER(hh, volume->tiles, tile, tmp) {
             HASH_DEL(volume->tiles, tile);
             assert(volume->tiles != tile);
             tile_delete(tile);
         }
         free(volume->tiles_ref);
-        g_global_stats.nb_volumes--;
+        STATS_ADD(nb_volumes, -1);
     }
+    free(volume->removed);
+    heights_clear(volume);
     free(volume);
 }
 
@@ -480,7 +936,24 @@ volume_t *volume_copy(const volume_t *other)
     volume->bbox_exact = other->bbox_exact;
     volume->bbox_nonempty = other->bbox_nonempty;
     memcpy(volume->bbox, other->bbox, sizeof(volume->bbox));
-    (*volume->tiles_ref)++;
+    volume->dirty_base = other->dirty_base;
+    volume->dirty_horizon = other->dirty_horizon;
+    if (other->nb_removed) {
+        volume->removed = malloc(MAX_REMOVED_TILES * sizeof(*volume->removed));
+        memcpy(volume->removed, other->removed,
+               other->nb_removed * sizeof(*volume->removed));
+        volume->nb_removed = other->nb_removed;
+    }
+    ref_inc(volume->tiles_ref);
+    return volume;
+}
+
+volume_t *volume_copy_detached(const volume_t *other)
+{
+    volume_t *volume = volume_copy(other);
+    uint64_t key = volume->key;
+    volume_prepare_write(volume);
+    volume->key = key; // Still the same value.
     return volume;
 }
 
@@ -494,17 +967,17 @@ void volume_set(volume_t *volume, const volume_t *other)
         volume->bbox_exact = other->bbox_exact;
         volume->bbox_nonempty = other->bbox_nonempty;
         memcpy(volume->bbox, other->bbox, sizeof(volume->bbox));
+        volume_reset_dirty(volume);
         return; // Already the same.
     }
-    (*volume->tiles_ref)--;
-    if (*volume->tiles_ref == 0) {
+    if (ref_dec(volume->tiles_ref) == 0) {
         HASH_ITER(hh, volume->tiles, tile, tmp) {
             HASH_DEL(volume->tiles, tile);
             assert(volume->tiles != tile);
             tile_delete(tile);
         }
         free(volume->tiles_ref);
-        g_global_stats.nb_volumes--;
+        STATS_ADD(nb_volumes, -1);
     }
     volume->tiles = other->tiles;
     volume->tiles_ref = other->tiles_ref;
@@ -513,7 +986,8 @@ void volume_set(volume_t *volume, const volume_t *other)
     volume->bbox_exact = other->bbox_exact;
     volume->bbox_nonempty = other->bbox_nonempty;
     memcpy(volume->bbox, other->bbox, sizeof(volume->bbox));
-    (*volume->tiles_ref)++;
+    ref_inc(volume->tiles_ref);
+    volume_reset_dirty(volume);
 }
 
 static uint64_t get_tile_id(const tile_t *tile)
@@ -574,7 +1048,8 @@ void volume_get_at(const volume_t *volume, volume_iterator_t *it,
             if (!it->tile)
                 memset(out, 0, 4);
             else
-                memcpy(out, TILE_AT(it->tile, p[0], p[1], p[2]), 4);
+                data_get_at(it->tile->data, VOXEL_INDEX(p[0], p[1], p[2]),
+                            out);
             return;
         }
     }
@@ -586,7 +1061,8 @@ void volume_get_at(const volume_t *volume, volume_iterator_t *it,
 void volume_set_at(volume_t *volume, volume_iterator_t *iter,
                  const int pos[3], const uint8_t v[4])
 {
-    int p[3] = {pos[0] & ~(int)(N - 1),
+    tile_data_t *data;
+    int i, p[3] = {pos[0] & ~(int)(N - 1),
                 pos[1] & ~(int)(N - 1),
                 pos[2] & ~(int)(N - 1)};
     volume_prepare_write(volume);
@@ -602,14 +1078,30 @@ void volume_set_at(volume_t *volume, volume_iterator_t *iter,
         }
     }
 
-    tile_prepare_write(tile);
+    // Setting the value a uniform tile already has changes nothing, and
+    // would expand it.
+    if (tile_is_uniform(tile) && memcmp(tile->data->voxels[0], v, 4) == 0)
+        return;
+    tile->gen = volume->key;
+    heights_invalidate(volume, tile->pos);
     p[0] = pos[0] - tile->pos[0];
     p[1] = pos[1] - tile->pos[1];
     p[2] = pos[2] - tile->pos[2];
     assert(p[0] >= 0 && p[0] < N);
     assert(p[1] >= 0 && p[1] < N);
     assert(p[2] >= 0 && p[2] < N);
-    memcpy(TILE_AT(tile, p[0], p[1], p[2]), v, 4);
+    i = VOXEL_INDEX(p[0], p[1], p[2]);
+
+    // A uniform tile becomes a palette tile of one color.
+    if (    tile_is_uniform(tile) && tile->data->id != 0 &&
+            __atomic_load_n(&g_palette_tiles, __ATOMIC_RELAXED)) {
+        data = tile_data_new_palette((uint8_t*)tile->data->voxels);
+        tile_data_release(tile->data);
+        tile->data = data;
+    }
+    if (tile_palette_set_at(tile, i, v)) return;
+    tile_prepare_write(tile);
+    memcpy(tile->data->voxels[i], v, 4);
 }
 
 void volume_clear_tile(volume_t *volume, volume_iterator_t *it, const int pos[3])
@@ -618,6 +1110,8 @@ void volume_clear_tile(volume_t *volume, volume_iterator_t *it, const int pos[3]
     volume_prepare_write(volume);
     tile = volume_get_tile_at(volume, pos, it);
     if (!tile) return;
+    volume_log_removed(volume, tile, volume->key);
+    heights_invalidate(volume, tile->pos);
     HASH_DEL(volume->tiles, tile);
     assert(volume->tiles != tile);
     tile_delete(tile);
@@ -670,7 +1164,7 @@ static bool volume_iter_next_tile_union(volume_iterator_t *it)
     return true;
 }
 
-static bool volume_iter_next_tile(volume_iterator_t *it)
+static bool volume_iter_next_any_tile(volume_iterator_t *it)
 {
     if (it->tile_id && it->tile_id != get_tile_id(it->tile)) {
         it->tile = volume_get_tile_at(
@@ -690,6 +1184,19 @@ static bool volume_iter_next_tile(volume_iterator_t *it)
     return true;
 }
 
+// Skip the uniform empty tiles when we don't want empty voxels.  The tiles
+// added by VOLUME_ITER_INCLUDES_NEIGHBORS are empty, but still needed.
+static bool volume_iter_next_tile(volume_iterator_t *it)
+{
+    const int flags = VOLUME_ITER_SKIP_EMPTY | VOLUME_ITER_INCLUDES_NEIGHBORS;
+    while (volume_iter_next_any_tile(it)) {
+        if ((it->flags & flags) != VOLUME_ITER_SKIP_EMPTY) return true;
+        if (!it->tile || !tile_is_uniform(it->tile)) return true;
+        if (it->tile->data->voxels[0][3]) return true;
+    }
+    return false;
+}
+
 int volume_iter(volume_iterator_t *it, int pos[3])
 {
     int i;
@@ -741,7 +1248,7 @@ void *volume_get_tile_data(const volume_t *volume, volume_accessor_t *iter,
         HASH_FIND(hh, volume->tiles, bpos, sizeof(iter->pos), tile);
     }
     if (id) *id = tile ? tile->data->id : 0;
-    return tile ? tile->data->voxels : NULL;
+    return tile ? data_decode(tile->data) : NULL;
 }
 
 uint8_t volume_get_alpha_at(const volume_t *volume, volume_iterator_t *iter,
@@ -761,6 +1268,131 @@ void volume_copy_tile(const volume_t *src, const int src_pos[3],
     b2 = volume_get_tile_at(dst, dst_pos, NULL);
     if (!b2) b2 = volume_add_tile(dst, dst_pos);
     tile_set_data(b2, b1->data);
+    b2->gen = dst->key;
+    heights_invalidate(dst, b2->pos);
+}
+
+void volume_set_tile(volume_t *volume, const int pos[3],
+                     const uint8_t *data)
+{
+    tile_t *tile;
+
+    assert(pos[0] % N == 0 && pos[1] % N == 0 && pos[2] % N == 0);
+    volume_prepare_write(volume);
+    tile = volume_get_tile_at(volume, pos, NULL);
+    if (!tile) tile = volume_add_tile(volume, pos);
+    tile_write_voxels(tile, data);
+    tile->gen = volume->key;
+    heights_invalidate(volume, tile->pos);
+}
+
+void volume_write_tile(volume_t *volume, const int pos[3],
+                       const uint8_t *data)
+{
+    tile_t *tile;
+    int i;
+    bool empty = true;
+
+    assert(pos[0] % N == 0 && pos[1] % N == 0 && pos[2] % N == 0);
+    for (i = 0; data && i < N * N * N; i++) {
+        if (data[i * 4 + 3]) {
+            empty = false;
+            break;
+        }
+    }
+    // Writing an empty tile where there is none doesn't change the volume.
+    if (empty && !volume_get_tile_at(volume, pos, NULL)) return;
+    volume_prepare_write(volume);
+    tile = volume_get_tile_at(volume, pos, NULL);
+    if (empty) {
+        volume_log_removed(volume, tile, volume->key);
+        heights_invalidate(volume, tile->pos);
+        HASH_DEL(volume->tiles, tile);
+        tile_delete(tile);
+        return;
+    }
+    if (!tile) tile = volume_add_tile(volume, pos);
+    tile_write_voxels(tile, data);
+    tile->gen = volume->key;
+    heights_invalidate(volume, tile->pos);
+}
+
+void volume_write_tiles(volume_t *volume, const int aabb[2][3],
+                        bool (*func)(void *user, const int pos[3],
+                                     uint8_t *voxels),
+                        void *user)
+{
+    int p[3];
+    tile_t *tile;
+    uint8_t *voxels;
+
+    if (    aabb[0][0] >= aabb[1][0] ||
+            aabb[0][1] >= aabb[1][1] ||
+            aabb[0][2] >= aabb[1][2]) return;
+    voxels = malloc(N * N * N * 4);
+    for (p[2] = aabb[0][2] & ~(N - 1); p[2] < aabb[1][2]; p[2] += N)
+    for (p[1] = aabb[0][1] & ~(N - 1); p[1] < aabb[1][1]; p[1] += N)
+    for (p[0] = aabb[0][0] & ~(N - 1); p[0] < aabb[1][0]; p[0] += N) {
+        tile = volume_get_tile_at(volume, p, NULL);
+        if (tile)
+            data_read(tile->data, voxels);
+        else
+            memset(voxels, 0, N * N * N * 4);
+        if (func(user, p, voxels))
+            volume_write_tile(volume, p, voxels);
+    }
+    free(voxels);
+}
+
+typedef struct {
+    const int       (*aabb)[3];
+    const uint8_t   *data;
+    bool            skip_empty;
+} fill_box_t;
+
+static bool fill_box_func(void *user, const int pos[3], uint8_t *voxels)
+{
+    const fill_box_t *fill = user;
+    const int (*aabb)[3] = fill->aabb;
+    int i, x, y, z, x0, x1, y0, y1, z0, z1, w, h;
+    const uint8_t *src;
+    uint8_t *dst;
+    bool changed = false;
+
+    x0 = max(pos[0], aabb[0][0]);
+    x1 = min(pos[0] + N, aabb[1][0]);
+    y0 = max(pos[1], aabb[0][1]);
+    y1 = min(pos[1] + N, aabb[1][1]);
+    z0 = max(pos[2], aabb[0][2]);
+    z1 = min(pos[2] + N, aabb[1][2]);
+    w = aabb[1][0] - aabb[0][0];
+    h = aabb[1][1] - aabb[0][1];
+
+    for (z = z0; z < z1; z++)
+    for (y = y0; y < y1; y++) {
+        src = fill->data + (((size_t)(z - aabb[0][2]) * h +
+                             (y - aabb[0][1])) * w + (x0 - aabb[0][0])) * 4;
+        dst = voxels + (((z - pos[2]) * N + (y - pos[1])) * N +
+                        (x0 - pos[0])) * 4;
+        if (!fill->skip_empty) {
+            memcpy(dst, src, (x1 - x0) * 4);
+            changed = true;
+            continue;
+        }
+        for (x = x0, i = 0; x < x1; x++, i += 4) {
+            if (!src[i + 3]) continue;
+            memcpy(dst + i, src + i, 4);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void volume_fill_box(volume_t *volume, const int aabb[2][3],
+                     const uint8_t *data, bool skip_empty)
+{
+    fill_box_t fill = {aabb, data, skip_empty};
+    volume_write_tiles(volume, aabb, fill_box_func, &fill);
 }
 
 void volume_read(const volume_t *volume,
@@ -786,15 +1418,26 @@ void volume_read(const volume_t *volume,
     tile = volume_get_tile_at(volume, tile_pos, NULL);
     if (!tile) goto rest;
 
+    if (tile_is_uniform(tile)) {
+        memcpy(v, tile->data->voxels[0], 4);
+        if (!v[3] && !v[0] && !v[1] && !v[2]) goto rest;
+        for (z = 0; z < N; z++)
+        for (y = 0; y < N; y++)
+        for (x = 0; x < N; x++) {
+            memcpy(&data[((z + 1) * size[1] * size[0] + (y + 1) * size[0] +
+                          x + 1) * 4], v, 4);
+        }
+        goto rest;
+    }
+
     for (z = 0; z < N; z++)
     for (y = 0; y < N; y++)
     for (x = 0; x < N; x++) {
         dx = x + 1;
         dy = y + 1;
         dz = z + 1;
-        memcpy(&data[(dz * size[1] * size[0] + dy * size[0] + dx) * 4],
-               &tile->data->voxels[z * N * N + y * N + x],
-               4);
+        data_get_at(tile->data, VOXEL_INDEX(x, y, z),
+                    &data[(dz * size[1] * size[0] + dy * size[0] + dx) * 4]);
     }
 
 rest:
@@ -849,12 +1492,187 @@ rest:
     }
 }
 
+bool volume_get_dirty_tiles(const volume_t *volume, uint64_t key,
+                            void (*func)(void *user, const int pos[3]),
+                            void *user)
+{
+    const tile_t *tile;
+    const removed_tile_t *removed;
+    int i;
+
+    if (key == volume->key) return true;
+    if (key < volume->dirty_horizon &&
+            (key == 0 || key != volume->dirty_base)) {
+        return false;
+    }
+    for (tile = volume->tiles; tile; tile = tile->hh.next) {
+        if (tile->gen > key) func(user, tile->pos);
+    }
+    for (i = 0; i < volume->nb_removed; i++) {
+        removed = &volume->removed[i];
+        if (removed->gen <= key) continue;
+        // Already reported if the tile has been added back.
+        HASH_FIND(hh, volume->tiles, removed->pos, sizeof(removed->pos),
+                  tile);
+        if (tile && tile->gen > key) continue;
+        func(user, removed->pos);
+    }
+    return true;
+}
+
+static heights_col_t *heights_col_compute(const volume_t *volume,
+                                          const int pos[2])
+{
+    heights_col_t *col;
+    tile_t *tile;
+    int i, x, y, z, p[3], bbox[2][3], left = N * N;
+    uint8_t v[4];
+
+    col = malloc(sizeof(*col));
+    memcpy(col->pos, pos, sizeof(col->pos));
+    for (i = 0; i < N * N; i++) col->top[i] = INT_MIN;
+    if (!volume_get_bbox(volume, bbox, false)) return col;
+
+    // Go down the tiles until we found the top of all the columns.
+    p[0] = pos[0];
+    p[1] = pos[1];
+    for (p[2] = (bbox[1][2] - 1) & ~(int)(N - 1);
+         p[2] + N > bbox[0][2] && left; p[2] -= N) {
+        HASH_FIND(hh, volume->tiles, p, sizeof(p), tile);
+        if (tile_is_empty(tile, true)) continue;
+        if (tile_is_uniform(tile)) {
+            for (i = 0; i < N * N; i++) {
+                if (col->top[i] != INT_MIN) continue;
+                col->top[i] = p[2] + N - 1;
+                left--;
+            }
+            continue;
+        }
+        for (y = 0; y < N; y++)
+        for (x = 0; x < N; x++) {
+            if (col->top[x + y * N] != INT_MIN) continue;
+            for (z = N - 1; z >= 0; z--) {
+                data_get_at(tile->data, VOXEL_INDEX(x, y, z), v);
+                if (!v[3]) continue;
+                col->top[x + y * N] = p[2] + z;
+                left--;
+                break;
+            }
+        }
+    }
+    return col;
+}
+
+int volume_get_column_top(const volume_t *volume, int x, int y,
+                          int z_min, int z_max)
+{
+    volume_t *v = (volume_t *)volume;
+    heights_col_t *col;
+    volume_accessor_t accessor = {0};
+    int pos[3], top;
+
+    if (z_max < z_min) return INT_MIN;
+
+    pos[0] = x & ~(int)(N - 1);
+    pos[1] = y & ~(int)(N - 1);
+    HASH_FIND(hh, volume->heights, pos, 2 * sizeof(int), col);
+    if (!col) {
+        col = heights_col_compute(volume, pos);
+        HASH_ADD(hh, v->heights, pos, sizeof(col->pos), col);
+    }
+    top = col->top[(x - pos[0]) + (y - pos[1]) * N];
+    if (top < z_min) return INT_MIN;
+    if (top <= z_max) return top;
+
+    // There are voxels above z_max, so we have to look down the column.
+    pos[0] = x;
+    pos[1] = y;
+    for (pos[2] = z_max; pos[2] >= z_min; pos[2]--) {
+        if (volume_get_alpha_at(volume, &accessor, pos)) return pos[2];
+    }
+    return INT_MIN;
+}
+
+bool volume_get_tile_uniform(const volume_t *volume, const int pos[3],
+                             uint8_t color[4])
+{
+    tile_t *tile;
+
+    assert(pos[0] % N == 0 && pos[1] % N == 0 && pos[2] % N == 0);
+    HASH_FIND(hh, volume->tiles, pos, 3 * sizeof(int), tile);
+    if (!tile) {
+        memset(color, 0, 4);
+        return true;
+    }
+    if (!tile_is_uniform(tile)) return false;
+    memcpy(color, tile->data->voxels[0], 4);
+    return true;
+}
+
+bool volume_get_tile_id(const volume_t *volume, const int pos[3],
+                        uint64_t *id)
+{
+    tile_t *tile;
+    HASH_FIND(hh, volume->tiles, pos, 3 * sizeof(int), tile);
+    if (id) *id = tile ? tile->data->id : 0;
+    return tile != NULL;
+}
+
+const uint8_t *volume_get_tile_voxels(const volume_t *volume,
+                                      const int pos[3], uint8_t *buf)
+{
+    tile_t *tile;
+    uint8_t (*voxels)[4];
+
+    HASH_FIND(hh, volume->tiles, pos, 3 * sizeof(int), tile);
+    if (!tile) return NULL;
+    voxels = data_get_voxels(tile->data);
+    if (voxels) return (const uint8_t*)voxels;
+    data_read(tile->data, buf);
+    return buf;
+}
+
+void volume_set_palette_tiles(bool enabled)
+{
+    __atomic_store_n(&g_palette_tiles, enabled, __ATOMIC_RELAXED);
+}
+
 int volume_get_tiles_count(const volume_t *volume)
 {
     return HASH_COUNT(volume->tiles);
 }
 
+int64_t volume_get_unshared_mem(const volume_t *volume,
+                                const volume_t *other)
+{
+    const tile_t *tile, *other_tile = NULL;
+    int64_t ret = 0;
+
+    if (other && volume->tiles == other->tiles) return 0;
+    for (tile = volume->tiles; tile; tile = tile->hh.next) {
+        if (other) {
+            HASH_FIND(hh, other->tiles, tile->pos, sizeof(tile->pos),
+                      other_tile);
+            if (other_tile && other_tile->data == tile->data) continue;
+        }
+        ret += tile_data_get_mem(tile->data);
+    }
+    return ret;
+}
+
 void volume_get_global_stats(volume_global_stats_t *stats)
 {
-    *stats = g_global_stats;
+    __atomic_load(&g_global_stats.nb_volumes, &stats->nb_volumes,
+                  __ATOMIC_RELAXED);
+    __atomic_load(&g_global_stats.nb_tiles, &stats->nb_tiles,
+                  __ATOMIC_RELAXED);
+    __atomic_load(&g_global_stats.mem, &stats->mem, __ATOMIC_RELAXED);
+    __atomic_load(&g_global_stats.nb_uniform_tiles, &stats->nb_uniform_tiles,
+                  __ATOMIC_RELAXED);
+    __atomic_load(&g_global_stats.nb_uniform_blocks,
+                  &stats->nb_uniform_blocks, __ATOMIC_RELAXED);
+    __atomic_load(&g_global_stats.nb_palette_tiles, &stats->nb_palette_tiles,
+                  __ATOMIC_RELAXED);
+    __atomic_load(&g_global_stats.mem_saved, &stats->mem_saved,
+                  __ATOMIC_RELAXED);
 }
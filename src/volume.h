@@ -114,6 +114,16 @@ volume_t *volume_dup(const volume_t *volume);
 
 volume_t *volume_copy(const volume_t *volume);
 
+/*
+ * Function: volume_copy_detached
+ * Like volume_copy, but the copy doesn't share its list of tiles with the
+ * original, only the tiles data.
+ *
+ * This is slower than volume_copy, but after that the copy can be used from
+ * an other thread while the original is still modified.
+ */
+volume_t *volume_copy_detached(const volume_t *volume);
+
 void volume_set(volume_t *volume, const volume_t *other);
 
 volume_accessor_t volume_get_accessor(const volume_t *volume);
@@ -192,6 +202,29 @@ bool volume_is_empty(const volume_t *volume);
  */
 bool volume_get_bbox(const volume_t *volume, int bbox[2][3], bool exact);
 
+/*
+ * Function: volume_get_column_top
+ * Get the z of the highest solid voxel of a column.
+ *
+ * The top of each column is cached on the volume, per tile column of
+ * TILE_SIZE x TILE_SIZE voxels, and only the tile columns that changed
+ * are recomputed when the volume is modified, so repeated calls are O(1).
+ * Like volume_get_bbox, this updates the cache so don't call it from
+ * several threads at the same time on the same volume.
+ *
+ * Parameters:
+ *   volume - The volume.
+ *   x, y   - Position of the column.
+ *   z_min  - Lowest z to consider.
+ *   z_max  - Highest z to consider (included).
+ *
+ * Returns:
+ *   The z of the highest solid voxel in [z_min, z_max], or INT_MIN if
+ *   there is none.
+ */
+int volume_get_column_top(const volume_t *volume, int x, int y,
+                          int z_min, int z_max);
+
 /*
  * Function: volume_get_iterator
  * Return an iterator that yield all the voxels of the volume.
@@ -232,23 +265,210 @@ int volume_iter(volume_iterator_t *it, int pos[3]);
  */
 uint64_t volume_get_key(const volume_t *volume);
 
+/*
+ * Function: volume_get_tile_data
+ * Get the RGBA voxels of a tile.
+ *
+ * The tiles stored with a palette get decoded, and keep the decoded voxels
+ * until they change, so prefer <volume_get_tile_id> or
+ * <volume_get_tile_voxels> when possible.
+ *
+ * Parameters:
+ *   volume   - The volume.
+ *   accessor - Optional accessor.
+ *   bpos     - Position of the tile.
+ *   id       - Set to the id of the tile data (zero if empty).  Can be NULL.
+ *
+ * Returns:
+ *   The voxels, only valid until the volume changes, or NULL if there is
+ *   no tile at this position.
+ */
 void *volume_get_tile_data(const volume_t *volume, volume_accessor_t *accessor,
                            const int bpos[3], uint64_t *id);
 
+/*
+ * Function: volume_get_tile_id
+ * Get the id of the data of a tile, without reading the voxels.
+ *
+ * Two tiles with the same data id have the same voxels.  The id is zero for
+ * the empty tiles.
+ *
+ * Returns:
+ *   true if there is a tile at this position.
+ */
+bool volume_get_tile_id(const volume_t *volume, const int pos[3],
+                        uint64_t *id);
+
+/*
+ * Function: volume_get_tile_voxels
+ * Get the RGBA voxels of a tile, decoding them in a buffer if needed.
+ *
+ * Parameters:
+ *   volume - The volume.
+ *   pos    - Position of the tile.
+ *   buf    - A buffer of TILE_SIZE^3 * 4 bytes, used for the tiles that
+ *            are not stored as RGBA.
+ *
+ * Returns:
+ *   The voxels, either buf or the tile own voxels, or NULL if there is no
+ *   tile at this position.
+ */
+const uint8_t *volume_get_tile_voxels(const volume_t *volume,
+                                      const int pos[3], uint8_t *buf);
+
 // Maybe replace this with a generic volume_copy_part function?
 void volume_copy_tile(const volume_t *src, const int src_pos[3],
                       volume_t *dst, const int dst_pos[3]);
 
+/*
+ * Function: volume_write_tile
+ * Replace the content of a whole tile.
+ *
+ * This is much faster than setting the voxels one by one.
+ *
+ * Parameters:
+ *   volume - The volume.
+ *   pos    - Position of the tile, must be a multiple of TILE_SIZE.
+ *   data   - TILE_SIZE^3 RGBA values in x, y, z order.  If NULL or fully
+ *            transparent, the tile is removed.
+ */
+void volume_write_tile(volume_t *volume, const int pos[3],
+                       const uint8_t *data);
+
+/*
+ * Function: volume_set_tile
+ * Like volume_write_tile, but always keep the tile, even if all the new
+ * voxels are transparent.
+ *
+ * This gives the exact same volume as calling volume_set_at for each
+ * voxel of the tile that changed.
+ */
+void volume_set_tile(volume_t *volume, const int pos[3],
+                     const uint8_t *data);
+
+/*
+ * Function: volume_write_tiles
+ * Update all the tiles intersecting a box, one whole tile at a time.
+ *
+ * For each tile position intersecting the box, the callback gets a copy of
+ * the tile voxels (all zero if there is no tile) that it can modify.  If it
+ * returns true, the tile is replaced with the new voxels.  This is much
+ * faster than calling volume_set_at for each voxel.
+ *
+ * Parameters:
+ *   volume - The volume.
+ *   aabb   - The box to update.
+ *   func   - Function called for each tile with the tile position and its
+ *            TILE_SIZE^3 RGBA values in x, y, z order.  Returns whether
+ *            the voxels have been modified.
+ *   user   - User data passed to the callback.
+ */
+void volume_write_tiles(volume_t *volume, const int aabb[2][3],
+                        bool (*func)(void *user, const int pos[3],
+                                     uint8_t *voxels),
+                        void *user);
+
+/*
+ * Function: volume_fill_box
+ * Copy a dense box of voxels into a volume.
+ *
+ * Parameters:
+ *   volume     - The volume.
+ *   aabb       - The box to fill.
+ *   data       - The box RGBA values in x, y, z order.
+ *   skip_empty - If set, the transparent voxels of data are ignored,
+ *                otherwise they clear the volume voxels.
+ */
+void volume_fill_box(volume_t *volume, const int aabb[2][3],
+                     const uint8_t *data, bool skip_empty);
+
 void volume_read(const volume_t *volume,
                  const int pos[3], const int size[3],
                  uint8_t *data);
 
+/*
+ * Function: volume_get_dirty_tiles
+ * Iterate the tiles that changed since a previous key of the volume.
+ *
+ * This allows to update some data computed from a volume with an amount
+ * of work proportional to the size of the changes.  The cost of the call
+ * itself only depends on the number of tiles, not on the number of voxels.
+ *
+ * The changes are not known anymore after the volume has been cleared or
+ * set from an other volume, or if too many tiles have been removed.
+ *
+ * Parameters:
+ *   volume - The volume.
+ *   key    - A previous value of volume_get_key(volume).
+ *   func   - Called with the position of each tile that changed, including
+ *            the removed ones.  A removed tile can be reported more than
+ *            once.
+ *   user   - User data passed to the callback.
+ *
+ * Returns:
+ *   false if the changes since the key are unknown, in which case func is
+ *   not called and the caller should consider the whole volume changed.
+ */
+bool volume_get_dirty_tiles(const volume_t *volume, uint64_t key,
+                            void (*func)(void *user, const int pos[3]),
+                            void *user);
+
+/*
+ * Function: volume_get_tile_uniform
+ * Check if all the voxels of a tile have the same value.
+ *
+ * The tiles written with a single value (for example by volume_write_tile)
+ * are stored as this value only, so this is fast.  A tile that got all its
+ * voxels set one by one to the same value is not seen as uniform.
+ *
+ * Parameters:
+ *   volume - The volume.
+ *   pos    - Position of the tile.
+ *   color  - Set to the value of the voxels if the tile is uniform.  A
+ *            missing tile is uniform with all zero voxels.
+ */
+bool volume_get_tile_uniform(const volume_t *volume, const int pos[3],
+                             uint8_t color[4]);
+
+/*
+ * Function: volume_set_palette_tiles
+ * Enable or disable the palette encoding of the tiles.
+ *
+ * When enabled (the default), the tiles written as a whole (for example
+ * with volume_write_tile) that have at most 256 different values are
+ * stored as a palette plus 4 or 8 bits per voxel, instead of 4 bytes.
+ * Their voxels are still accessed with the usual functions.  Only affects
+ * the tiles written after the call.
+ */
+void volume_set_palette_tiles(bool enabled);
+
 int volume_get_tiles_count(const volume_t *volume);
 
+/*
+ * Function: volume_get_unshared_mem
+ * Return the memory of the tiles data of a volume that an other volume
+ * doesn't share at the same position.
+ *
+ * This is what we would free by deleting the volume if the other one was
+ * the only other owner of its tiles.  Fast if both volumes are copies of
+ * each other, otherwise it iterates all the tiles.
+ *
+ * Parameters:
+ *   volume - The volume.
+ *   other  - The volume to compare with, or NULL to get all the memory.
+ */
+int64_t volume_get_unshared_mem(const volume_t *volume,
+                                const volume_t *other);
+
 typedef struct {
     int       nb_volumes;
     int       nb_tiles;
     uint64_t  mem;
+    int       nb_uniform_tiles;   // Tiles stored as a single value.
+    int       nb_uniform_blocks;  // Distinct values of the uniform tiles.
+    int       nb_palette_tiles;   // Tiles stored with a palette.
+    int64_t   mem_saved;          // Memory saved by the uniform and
+                                  // palette tiles.
 } volume_global_stats_t;
 
 void volume_get_global_stats(volume_global_stats_t *stats);
@@ -209,6 +209,34 @@ static uint32_t get_neighboors(const uint8_t *data,
     return ret;
 }
 
+// Fast check for the tiles that cannot have any face, using the uniform
+// tiles: the empty tiles, the solid tiles surrounded by solid tiles, and for
+// the marching cubes any tile where all the neighbors have the same
+// solidity.
+bool volume_block_is_hidden(const volume_t *volume, const int block_pos[3],
+                            int effects)
+{
+    uint8_t v[4];
+    int i, p[3];
+    bool solid;
+    const bool mc = effects & EFFECT_MARCHING_CUBES;
+
+    if (!volume_get_tile_uniform(volume, block_pos, v)) return false;
+    solid = voxel_is_solid(v);
+    if (!solid && !mc) return true;
+    for (i = 0; i < 27; i++) {
+        // Only the six faces neighbors matter for the blocks.
+        if (!mc && abs(i % 3 - 1) + abs(i / 3 % 3 - 1) + abs(i / 9 - 1) != 1)
+            continue;
+        p[0] = block_pos[0] + (i % 3 - 1) * N;
+        p[1] = block_pos[1] + (i / 3 % 3 - 1) * N;
+        p[2] = block_pos[2] + (i / 9 - 1) * N;
+        if (!volume_get_tile_uniform(volume, p, v)) return false;
+        if (voxel_is_solid(v) != solid) return false;
+    }
+    return true;
+}
+
 /* Packing of block id, pos, and face:
  *
  *    x   :  4 bits
@@ -246,6 +274,7 @@ int volume_generate_vertices(const volume_t *volume, const int block_pos[3],
 
     *size = 4;      // Quad.
     *subdivide = 1; // Unit is one voxel.
+    if (volume_block_is_hidden(volume, block_pos, effects)) return 0;
 
     // To speed things up we first get the voxel cube around the block.
     // XXX: can we do this while still using volume iterators somehow?
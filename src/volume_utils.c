@@ -21,6 +21,11 @@
 #include "xxhash.h"
 
 #include <limits.h>
+#include <pthread.h>
+
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
 
 #define N TILE_SIZE
 
@@ -40,6 +45,28 @@
 #   define VOLUME_MERGE_CACHE_SIZE 2048
 #endif
 
+static cache_t *g_op_cache = NULL;
+static cache_t *g_tile_merge_cache = NULL;
+static cache_t *g_merge_cache = NULL;
+static pthread_once_t g_caches_once = PTHREAD_ONCE_INIT;
+
+static void caches_init(void)
+{
+    g_op_cache = cache_create(VOLUME_OP_CACHE_SIZE);
+    g_tile_merge_cache = cache_create(VOLUME_TILE_MERGE_CACHE_SIZE);
+    g_merge_cache = cache_create(VOLUME_MERGE_CACHE_SIZE);
+}
+
+// The caches are not thread safe, so they are only used from the main
+// thread, the filters running in the background always do the work.
+// They are still created once for all threads, since the functions
+// using them can be called from anywhere.
+static bool use_caches(void)
+{
+    pthread_once(&g_caches_once, caches_init);
+    return !thread_pool_in_task();
+}
+
 // Used for the cache.
 static int volume_del(void *data_)
 {
@@ -102,6 +129,99 @@ int volume_select(const volume_t *volume,
     return 0;
 }
 
+typedef struct {
+    const volume_t      *volume;
+    volume_accessor_t   accessor;
+    const int           *start;
+    const int           (*aabb)[3];
+    bool                (*cond)(void *user, const uint8_t value[4]);
+    void                *user;
+    mask_t              *out;
+    mask_accessor_t     out_accessor;
+} flood_fill_t;
+
+// Check if a voxel is part of the region and not filled yet.
+static bool flood_fill_test(flood_fill_t *f, const int pos[3])
+{
+    uint8_t value[4];
+    int i;
+
+    if (f->aabb && memcmp(pos, f->start, sizeof(int) * 3) != 0) {
+        for (i = 0; i < 3; i++) {
+            if (pos[i] < f->aabb[0][i] || pos[i] >= f->aabb[1][i])
+                return false;
+        }
+    }
+    if (mask_get_at(f->out, &f->out_accessor, pos)) return false;
+    volume_get_at(f->volume, &f->accessor, pos, value);
+    return f->cond(f->user, value);
+}
+
+void volume_flood_fill(const volume_t *volume, const int start[3],
+                       const int aabb[2][3], int connectivity,
+                       bool (*cond)(void *user, const uint8_t value[4]),
+                       void *user, mask_t *out)
+{
+    // Neighbor rows of a span: y - 1, y + 1, z - 1, z + 1.
+    const int rows[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+    flood_fill_t f = {
+        .volume = volume,
+        .accessor = volume_get_accessor(volume),
+        .start = start,
+        .aabb = aabb,
+        .cond = cond,
+        .user = user,
+        .out = out,
+    };
+    int (*stack)[3] = NULL;
+    int nb = 0, size = 0, pos[3], p[3], x, x0, x1, r;
+    bool in_span;
+
+    assert(connectivity == 4 || connectivity == 6);
+    mask_clear(out);
+
+#define PUSH(p_) do { \
+    if (nb == size) { \
+        size = max(size * 2, 256); \
+        stack = realloc(stack, size * sizeof(*stack)); \
+    } \
+    memcpy(stack[nb++], p_, sizeof(stack[0])); \
+} while (0)
+
+    PUSH(start);
+    while (nb) {
+        memcpy(pos, stack[--nb], sizeof(pos));
+        if (!flood_fill_test(&f, pos)) continue;
+
+        // Extend the span along x.
+        memcpy(p, pos, sizeof(p));
+        for (p[0] = pos[0] - 1; flood_fill_test(&f, p); p[0]--) {}
+        x0 = p[0] + 1;
+        for (p[0] = pos[0] + 1; flood_fill_test(&f, p); p[0]++) {}
+        x1 = p[0] - 1;
+        for (p[0] = x0; p[0] <= x1; p[0]++)
+            mask_set_at(out, &f.out_accessor, p, true);
+
+        // Add a seed for each span of the neighbor rows.
+        for (r = 0; r < (connectivity == 6 ? 4 : 2); r++) {
+            p[1] = pos[1] + rows[r][0];
+            p[2] = pos[2] + rows[r][1];
+            in_span = false;
+            for (x = x0; x <= x1; x++) {
+                p[0] = x;
+                if (!flood_fill_test(&f, p)) {
+                    in_span = false;
+                    continue;
+                }
+                if (!in_span) PUSH(p);
+                in_span = true;
+            }
+        }
+    }
+#undef PUSH
+    free(stack);
+}
+
 static inline int noise_tex_coord(int w);
 void apply_noise_if_applicable(const painter_t *painter, float global_p[3],
                                uint8_t col[4]);
@@ -361,6 +481,146 @@ void voxel_combine(const uint8_t a[4], const uint8_t b[4], int mode,
     memcpy(out, ret, 4);
 }
 
+#ifdef __SSE2__
+
+// Take the color of x and the alpha of y, for four voxels.
+static inline __m128i sse_rgb_alpha(__m128i x, __m128i y)
+{
+    const __m128i am = _mm_set1_epi32((int)0xff000000);
+    return _mm_or_si128(_mm_andnot_si128(am, x), _mm_and_si128(am, y));
+}
+
+// Broadcast the alpha of two voxels unpacked to 16 bits.
+static inline __m128i sse_alpha16(__m128i x)
+{
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+// x * y / 255 for 16 bits values, with x and y <= 255.
+static inline __m128i sse_mul_div255(__m128i x, __m128i y)
+{
+    // For v <= 255 * 255: v / 255 == (v + 1 + (v >> 8)) >> 8.
+    __m128i v = _mm_mullo_epi16(x, y);
+    v = _mm_add_epi16(v, _mm_add_epi16(_mm_set1_epi16(1),
+                                       _mm_srli_epi16(v, 8)));
+    return _mm_srli_epi16(v, 8);
+}
+
+// Multiply the components of four voxels by 16 bits factors, as
+// color_mul does.  lo and hi are the factors of the first and last two
+// voxels.
+static inline __m128i sse_mul(__m128i x, __m128i lo, __m128i hi)
+{
+    const __m128i zero = _mm_setzero_si128();
+    lo = sse_mul_div255(_mm_unpacklo_epi8(x, zero), lo);
+    hi = sse_mul_div255(_mm_unpackhi_epi8(x, zero), hi);
+    return _mm_packus_epi16(lo, hi);
+}
+
+// Combine four voxels.  Return false if the values need the scalar code,
+// in which case nothing is written.
+static bool sse_combine4(const uint8_t *pa, const uint8_t *pb, int mode,
+                         uint8_t *pout)
+{
+    const __m128i am = _mm_set1_epi32((int)0xff000000);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = _mm_loadu_si128((const __m128i*)pa);
+    __m128i b = _mm_loadu_si128((const __m128i*)pb);
+    __m128i ba = _mm_and_si128(b, am);
+    __m128i r, z;
+
+    switch (mode) {
+    case MODE_OVER:
+    case MODE_PAINT:
+        // The blend of semi transparent values needs a division, so we
+        // only handle fully opaque or fully transparent sources.
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(ba, am)) == 0xffff) {
+            r = (mode == MODE_OVER) ? b : sse_rgb_alpha(b, a);
+            break;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(ba, zero)) == 0xffff) {
+            r = a;
+            break;
+        }
+        return false;
+    case MODE_SUB:
+        r = sse_rgb_alpha(a, _mm_subs_epu8(a, b));
+        break;
+    case MODE_MAX:
+        r = sse_rgb_alpha(b, _mm_max_epu8(a, b));
+        break;
+    case MODE_SUB_CLAMP:
+        r = sse_rgb_alpha(a, _mm_min_epu8(a, _mm_xor_si128(b, am)));
+        break;
+    case MODE_MULT_ALPHA:
+        r = sse_mul(a, sse_alpha16(_mm_unpacklo_epi8(b, zero)),
+                       sse_alpha16(_mm_unpackhi_epi8(b, zero)));
+        break;
+    case MODE_INTERSECT:
+        r = sse_rgb_alpha(a, _mm_min_epu8(a, b));
+        break;
+    case MODE_INTERSECT_FILL:
+        r = _mm_and_si128(_mm_min_epu8(a, b), am);
+        // Keep the color of a where the alpha is zero.
+        z = _mm_cmpeq_epi32(r, zero);
+        r = _mm_or_si128(r, _mm_andnot_si128(am, _mm_or_si128(
+                _mm_and_si128(z, a), _mm_andnot_si128(z, b))));
+        break;
+    default:
+        return false;
+    }
+    _mm_storeu_si128((__m128i*)pout, r);
+    return true;
+}
+
+#endif // __SSE2__
+
+// Multiply n voxels by a color.
+static void voxels_mul(const uint8_t *v, const uint8_t color[4],
+                       uint8_t *out, int n)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i c = _mm_set_epi16(color[3], color[2], color[1], color[0],
+                                    color[3], color[2], color[1], color[0]);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_si128((__m128i*)(out + i * 4), sse_mul(
+                _mm_loadu_si128((const __m128i*)(v + i * 4)), c, c));
+    }
+#endif
+    for (; i < n; i++)
+        color_mul(v + i * 4, color, out + i * 4);
+}
+
+void voxels_combine(const uint8_t *a, const uint8_t *b, int mode,
+                    const uint8_t color[4], uint8_t *out, int n)
+{
+    uint8_t tmp[64 * 4];
+    int i = 0, nb;
+
+    if (color) {
+        for (i = 0; i < n; i += nb) {
+            nb = min(n - i, 64);
+            voxels_mul(b + i * 4, color, tmp, nb);
+            voxels_combine(a + i * 4, tmp, mode, NULL, out + i * 4, nb);
+        }
+        return;
+    }
+
+#ifdef __SSE2__
+    for (; i + 4 <= n; i += 4) {
+        if (sse_combine4(a + i * 4, b + i * 4, mode, out + i * 4)) continue;
+        for (int k = 0; k < 4; k++) {
+            voxel_combine(a + (i + k) * 4, b + (i + k) * 4, mode,
+                          out + (i + k) * 4);
+        }
+    }
+#endif
+    for (; i < n; i++)
+        voxel_combine(a + i * 4, b + i * 4, mode, out + i * 4);
+}
+
 /* Context for color_inherit lookups within one volume_op / surface stamp.
  * Caller fetches goxel_get_layers_volume once; do not call it per voxel. */
 typedef struct color_beneath_ctx {
@@ -699,31 +959,167 @@ void volume_brush_surface_stamp(volume_t *dst, const volume_t *src,
     }
 }
 
+// Max number of tiles computed in parallel before writing them to the
+// volume.
+#define TILES_BATCH_SIZE 1024
+
+// Get the list of all the tiles positions of an iterator, so that we can
+// process them in parallel, or modify the volume.
+static int iter_get_tiles(volume_iterator_t *iter, int (**tiles)[3])
+{
+    int nb = 0, size = 0, pos[3];
+
+    *tiles = NULL;
+    iter->flags |= VOLUME_ITER_TILES;
+    while (volume_iter(iter, pos)) {
+        if (nb == size) {
+            size = max(size * 2, 64);
+            *tiles = realloc(*tiles, size * sizeof(**tiles));
+        }
+        memcpy((*tiles)[nb++], pos, sizeof(pos));
+    }
+    return nb;
+}
+
+// Parameters of a volume_op, shared by all the tiles.
+typedef struct {
+    const volume_t  *volume;
+    const painter_t *painter;
+    float (*shape_func)(const float[3], const float[3], float smoothness);
+    float           mat[4][4];
+    float           size[3];
+    float           shape_sm;
+    bool            use_box;
+    bool            skip_src_empty;
+    bool            skip_dst_empty;
+    color_beneath_ctx_t inherit_ctx;
+    int             (*tiles)[3];
+    uint8_t         **out;  // New voxels of each tile, NULL if unchanged.
+} op_ctx_t;
+
+// Compute the new value of a voxel for volume_op.
+// Return false if the voxel doesn't change.
+static bool op_voxel(const op_ctx_t *ctx, color_beneath_ctx_t *inherit_ctx,
+                     const int vp[3], const uint8_t value[4],
+                     uint8_t new_value[4])
+{
+    const painter_t *painter = ctx->painter;
+    const int mode = painter->mode;
+    float p[3], global_p[3], k, v;
+    uint8_t c[4], col[4];
+
+    vec3_set(p, vp[0] + 0.5, vp[1] + 0.5, vp[2] + 0.5);
+    vec3_set(global_p,
+             (float)noise_tex_coord(vp[0]),
+             (float)noise_tex_coord(vp[1]),
+             (float)noise_tex_coord(vp[2]));
+    if (ctx->use_box && !bbox_contains_vec(*painter->box, p)) return false;
+    mat4_mul_vec3(ctx->mat, p, p);
+    k = ctx->shape_func(p, ctx->size, ctx->shape_sm);
+    // Randomly displace the SDF boundary so edges dither/scatter.
+    if (painter->dithering > 0) {
+        float n = uniform_noise((float)vp[0], (float)vp[1], (float)vp[2]);
+        k += (n * 2.f - 1.f) * painter->dithering;
+    }
+    if (painter->smoothness) {
+        v = clamp(k / painter->smoothness, -1.0f, 1.0f) / 2.0f + 0.5f;
+    } else {
+        v = (k >= 0.f) ? 1.f : 0.f;
+    }
+    if (!v && ctx->skip_src_empty) return false;
+
+    // Apply colours
+    memcpy(col, painter->color, 4);
+    if (goxel.tool && goxel.tool->id == TOOL_BRUSH &&
+            goxel.brush_source_mode == BRUSH_SOURCE_TEXTURE &&
+            brush_sample_texture_color(vp, col)) {
+        // Apply shared brush opacity to sampled texture alpha.
+        col[3] = ((int)col[3] * (int)painter->color[3]) / 255;
+    } else if (goxel.tool && goxel.tool->id == TOOL_BRUSH &&
+               goxel.brush_source_mode == BRUSH_SOURCE_PALETTE &&
+               goxel_brush_palette_sample_at(vp, col)) {
+        if (painter->mode == MODE_PAINT)
+            col[3] = ((int)col[3] * (int)painter->color[3]) / 255;
+    } else if (painter->color_inherit) {
+        get_color_beneath(inherit_ctx, vp, col);
+    }
+
+    // Texture / palette mode should not inherit hidden color-noise settings.
+    if (!(goxel.tool && goxel.tool->id == TOOL_BRUSH &&
+          (goxel.brush_source_mode == BRUSH_SOURCE_TEXTURE ||
+           goxel.brush_source_mode == BRUSH_SOURCE_PALETTE))) {
+        apply_noise_if_applicable(painter, global_p, col);
+    }
+
+    memcpy(c, col, 4);
+    c[3] *= v;
+    if (!voxel_is_solid(c) && ctx->skip_src_empty) return false;
+    if (!voxel_is_solid(value) && ctx->skip_dst_empty) return false;
+    voxel_combine(value, c, mode, new_value);
+    return !vec4_equal(value, new_value);
+}
+
+// Compute the new voxels of a tile for volume_op.  Called from the thread
+// pool: only reads the volume, and writes the result into ctx->out[i].
+static void op_tile(void *user, int i)
+{
+    op_ctx_t *ctx = user;
+    const int *pos = ctx->tiles[i];
+    const int n = TILE_SIZE;
+    color_beneath_ctx_t inherit_ctx = ctx->inherit_ctx;
+    const uint8_t *data;
+    uint8_t *voxels, *v, new_value[4];
+    int x, y, z, vp[3];
+    bool changed = false;
+
+    // Each thread needs its own accessor.
+    memset(&inherit_ctx.iter, 0, sizeof(inherit_ctx.iter));
+    voxels = malloc(n * n * n * 4);
+    data = volume_get_tile_voxels(ctx->volume, pos, voxels);
+    if (!data)
+        memset(voxels, 0, n * n * n * 4);
+    else if (data != voxels)
+        memcpy(voxels, data, n * n * n * 4);
+
+    for (z = 0; z < n; z++)
+    for (y = 0; y < n; y++)
+    for (x = 0; x < n; x++) {
+        v = &voxels[(x + y * n + z * n * n) * 4];
+        vp[0] = pos[0] + x;
+        vp[1] = pos[1] + y;
+        vp[2] = pos[2] + z;
+        if (!op_voxel(ctx, &inherit_ctx, vp, v, new_value)) continue;
+        memcpy(v, new_value, 4);
+        changed = true;
+    }
+    if (!changed) {
+        free(voxels);
+        voxels = NULL;
+    }
+    ctx->out[i] = voxels;
+}
+
 void volume_op(volume_t *volume, const painter_t *painter, const float box[4][4])
 {   
     // box[1][0] = 1/2 x size
     // box[2][1] = 1/2 y size
     // box[0][2] = 1/2 z size
 
-    int i, vp[3];
-    uint8_t value[4], new_value[4], c[4];
+    int i, n, vp[3], nb_tiles, batch;
+    int (*tiles)[3];
     volume_iterator_t iter;
-    volume_accessor_t accessor;
-    float size[3], p[3], global_p[3];
+    float size[3];
     float mat[4][4];
     float (*shape_func)(const float[3], const float[3], float smoothness);
-    float k, v;
     int mode = painter->mode;
     bool use_box, skip_src_empty, skip_dst_empty;
     painter_t painter2;
     float box2[4][4];
     int aabb[2][3];
     volume_t *cached;
-    static cache_t *cache = NULL;
     const float *sym_o = painter->symmetry_origin;
 
     // Check if the operation has been cached.
-    if (!cache) cache = cache_create(VOLUME_OP_CACHE_SIZE);
     struct {
         uint64_t  id;
         float     box[4][4];
@@ -747,7 +1143,7 @@ void volume_op(volume_t *volume, const painter_t *painter, const float box[4][4]
     key.brush_texture_saturation = goxel.brush_texture_saturation;
     key.brush_texture_lightness = goxel.brush_texture_lightness;
     key.brush_palette_fp = goxel_brush_palette_fingerprint();
-    cached = cache_get(cache, &key, sizeof(key));
+    cached = use_caches() ? cache_get(g_op_cache, &key, sizeof(key)) : NULL;
     if (cached) {
         volume_set(volume, cached);
         return;
@@ -820,77 +1216,44 @@ void volume_op(volume_t *volume, const painter_t *painter, const float box[4][4]
                 skip_dst_empty ? VOLUME_ITER_SKIP_EMPTY : 0);
     }
 
-    // XXX: for the moment we cannot use the same accessor for both
-    // setting and getting!  Need to fix that!!
-    accessor = volume_get_accessor(volume);
-
-    color_beneath_ctx_t inherit_ctx;
+    op_ctx_t ctx = {
+        .volume = volume,
+        .painter = painter,
+        .shape_func = shape_func,
+        .shape_sm = shape_sm,
+        .use_box = use_box,
+        .skip_src_empty = skip_src_empty,
+        .skip_dst_empty = skip_dst_empty,
+    };
+    mat4_copy(mat, ctx.mat);
+    vec3_copy(size, ctx.size);
     if (painter->color_inherit)
-        color_beneath_ctx_init(&inherit_ctx);
-
-    // For every tile in the volume, iterate
-    while (volume_iter(&iter, vp)) {
-        vec3_set(p, vp[0] + 0.5, vp[1] + 0.5, vp[2] + 0.5);
-        vec3_set(global_p,
-                 (float)noise_tex_coord(vp[0]),
-                 (float)noise_tex_coord(vp[1]),
-                 (float)noise_tex_coord(vp[2]));
-        if (use_box && !bbox_contains_vec(*painter->box, p)) continue;
-        mat4_mul_vec3(mat, p, p);
-        k = shape_func(p, size, shape_sm);
-        // Randomly displace the SDF boundary so edges dither/scatter.
-        if (painter->dithering > 0) {
-            float n = uniform_noise((float)vp[0], (float)vp[1], (float)vp[2]);
-            k += (n * 2.f - 1.f) * painter->dithering;
-        }
-        if (painter->smoothness) {
-            v = clamp(k / painter->smoothness, -1.0f, 1.0f) / 2.0f + 0.5f;
-        } else {
-            v = (k >= 0.f) ? 1.f : 0.f;
-        }
-        if (!v && skip_src_empty) continue;
-
-        // Apply colours
-        uint8_t col[4];
-        memcpy(col, painter->color, 4);
-        if (goxel.tool && goxel.tool->id == TOOL_BRUSH &&
-                goxel.brush_source_mode == BRUSH_SOURCE_TEXTURE &&
-                brush_sample_texture_color(vp, col)) {
-            // Apply shared brush opacity to sampled texture alpha.
-            col[3] = ((int)col[3] * (int)painter->color[3]) / 255;
-        } else if (goxel.tool && goxel.tool->id == TOOL_BRUSH &&
-                   goxel.brush_source_mode == BRUSH_SOURCE_PALETTE &&
-                   goxel_brush_palette_sample_at(vp, col)) {
-            if (painter->mode == MODE_PAINT)
-                col[3] = ((int)col[3] * (int)painter->color[3]) / 255;
-        } else if (painter->color_inherit) {
-            get_color_beneath(&inherit_ctx, vp, col);
-        }
-
-        // Texture / palette mode should not inherit hidden color-noise settings.
-        if (!(goxel.tool && goxel.tool->id == TOOL_BRUSH &&
-              (goxel.brush_source_mode == BRUSH_SOURCE_TEXTURE ||
-               goxel.brush_source_mode == BRUSH_SOURCE_PALETTE))) {
-            apply_noise_if_applicable(painter, global_p, col);
-        }
-        
-        memcpy(c, col, 4);
-
-        c[3] *= v;
-            //LOG_D("C: %i/%i/%i", c[0], c[1], c[2]);
-        if (!voxel_is_solid(c) && skip_src_empty) continue;
-        // volume = tool volume, value = color at point in tool volume
-        volume_get_at(volume, &accessor, vp, value);
-        if (!voxel_is_solid(value) && skip_dst_empty) continue;
-            //LOG_D("Value: %i/%i/%i, C: %i/%i/%i", value[0], value[1], value[2], c[0], c[1], c[2]);
-        voxel_combine(value, c, mode, new_value);
-            //LOG_D("new_value: %i/%i/%i", new_value[0], new_value[1], new_value[2]);
-        if (!vec4_equal(value, new_value)) {
-            volume_set_at(volume, &accessor, vp, new_value);
+        color_beneath_ctx_init(&ctx.inherit_ctx);
+
+    // Get the list of tiles to update first, since we are going to modify
+    // the volume.
+    nb_tiles = iter_get_tiles(&iter, &tiles);
+
+    // Compute the new tiles in parallel, and commit them in order, by
+    // batches to limit the memory used.  Each voxel only depends on its
+    // previous value, so this gives the same result as doing it serially.
+    ctx.out = calloc(min(nb_tiles, TILES_BATCH_SIZE), sizeof(*ctx.out));
+    for (batch = 0; batch < nb_tiles; batch += TILES_BATCH_SIZE) {
+        n = min(nb_tiles - batch, TILES_BATCH_SIZE);
+        ctx.tiles = tiles + batch;
+        thread_pool_run(n, op_tile, &ctx);
+        for (i = 0; i < n; i++) {
+            if (!ctx.out[i]) continue;
+            volume_set_tile(volume, ctx.tiles[i], ctx.out[i]);
+            free(ctx.out[i]);
         }
     }
+    free(tiles);
+    free(ctx.out);
 
-    cache_add(cache, &key, sizeof(key), volume_copy(volume), 1, volume_del);
+    if (use_caches())
+        cache_add(g_op_cache, &key, sizeof(key), volume_copy(volume), 1,
+                  volume_del);
 }
 
 // XXX: remove this function!
@@ -946,42 +1309,45 @@ void volume_get_heights(const volume_t *volume, int* heights) {
 void volume_get_heights_in_box(const volume_t *volume, int dimensions[3], int start_pos[3], int* heights)
 {
     // We assume heights has already been instatiated using allocate_heights above
-    int x, y, z, pos[3];
-    uint8_t cur_block_color[4];
-    volume_iterator_t iter = volume_get_iterator(volume, VOLUME_ITER_VOXELS | VOLUME_ITER_SKIP_EMPTY);
-    
+    int x, y, z;
+
     for (x = 0; x < dimensions[0]; x++) {
         for (y = 0; y < dimensions[1]; y++) {
-            pos[0] = x + start_pos[0];
-            pos[1] = y + start_pos[1];
-            // Start from top and go down
-            for (z = dimensions[2]; z >= 0; z--) {
-                pos[2] = z + start_pos[2];
-                // Get the block color at the position; if has alpha, is a block
-                volume_get_at(volume, &iter, pos, cur_block_color);
-                if (cur_block_color[3] != 0) {
-                    heights[y * dimensions[0] + x] = z;
-                    break;
-                }
-            }
+            z = volume_get_column_top(volume, x + start_pos[0],
+                                      y + start_pos[1], start_pos[2],
+                                      start_pos[2] + dimensions[2]);
+            if (z != INT_MIN)
+                heights[y * dimensions[0] + x] = z - start_pos[2];
         }
     }
 }
 
+typedef struct {
+    uint64_t id1;
+    uint64_t id2;
+    int      mode;
+    uint8_t  color[4];
+} tile_merge_key_t;
+
+static cache_t *get_tile_merge_cache(void)
+{
+    pthread_once(&g_caches_once, caches_init);
+    return g_tile_merge_cache;
+}
+
+// Handle the tile merges that don't need to compute the voxels: trivial
+// cases and cached results.  Return false if the voxels need to be
+// computed with tile_merge_voxels.
 // for brush, volume = tool_volume, other = brush volume
-static void tile_merge(volume_t *volume, const volume_t *other, const int pos[3],
-                        int mode, const uint8_t color[4])
+static bool tile_merge_fast(volume_t *volume, const volume_t *other,
+                            const int pos[3], int mode,
+                            const uint8_t color[4], tile_merge_key_t *key)
 {
-    int p[3];
-    int x, y, z;
     uint64_t id1, id2;
     volume_t *tile;
-    uint8_t v1[4], v2[4];
-    static cache_t *cache = NULL;
-    volume_accessor_t a1, a2, a3;
 
-    volume_get_tile_data(volume,  NULL, pos, &id1);
-    volume_get_tile_data(other, NULL, pos, &id2);
+    volume_get_tile_id(volume, pos, &id1);
+    volume_get_tile_id(other, pos, &id2);
 
     // XXX: cleanup this code!
 
@@ -990,64 +1356,140 @@ static void tile_merge(volume_t *volume, const volume_t *other, const int pos[3]
              mode == MODE_SUB ||
              mode == MODE_SUB_CLAMP) && id2 == 0)
     {
-        return;
+        return true;
     }
 
     if ((mode == MODE_OVER || mode == MODE_MAX) && id1 == 0 && !color) {
         volume_copy_tile(other, pos, volume, pos);
-        return;
+        return true;
     }
 
-    if ((mode == MODE_MULT_ALPHA) && id1 == 0) return;
+    if ((mode == MODE_MULT_ALPHA) && id1 == 0) return true;
     if ((mode == MODE_MULT_ALPHA) && id2 == 0) {
         // XXX: could just delete the tile.
     }
 
     // Check if the merge op has been cached.
-    if (!cache) cache = cache_create(VOLUME_TILE_MERGE_CACHE_SIZE);
-    struct {
-        uint64_t id1;
-        uint64_t id2;
-        int      mode;
-        uint8_t  color[4];
-    } key = { id1, id2, mode };
-    if (color) memcpy(key.color, color, 4);
-    _Static_assert(sizeof(key) == 24, "");
-    tile = cache_get(cache, &key, sizeof(key));
-    if (tile) goto end;
-
-    tile = volume_new();
-    a1 = volume_get_accessor(volume);
-    a2 = volume_get_accessor(other);
-    a3 = volume_get_accessor(tile);
-
-    for (z = 0; z < N; z++)
-    for (y = 0; y < N; y++)
-    for (x = 0; x < N; x++) {
-        p[0] = pos[0] + x;
-        p[1] = pos[1] + y;
-        p[2] = pos[2] + z;
-        //uint8_t ov1[4], ov2[4];
-        volume_get_at(volume, &a1, p, v1);
-        //volume_get_at(volume, &a1, p, ov1);
-        volume_get_at(other, &a2, p, v2);
-        //volume_get_at(other, &a2, p, ov2);
-        // When a color is not given, v1 is blank and v2 is from the tool
-        // When a color is given, v1 is blank, and v2 becomes the paint color * colour in tool
-        if (color) color_mul(v2, color, v2);
-        //if (!vec4_equal(v1, v2)) {
-            // LOG_D("Pos: %i/%i/%i", pos[0], pos[1], pos[2]);
-            // LOG_D("V1: %i/%i/%i, V2: %i/%i/%i", v1[0], v1[1], v1[2], v2[0], v2[1], v2[2]);
-            // LOG_D("OV1: %i/%i/%i, OV2: %i/%i/%i", ov1[0], ov1[1], ov1[2], ov2[0], ov2[1], ov2[2]);
-        //}
-        voxel_combine(v1, v2, mode, v1);
-        volume_set_at(tile, &a3, (int[]){x, y, z}, v1);
-    }
-    cache_add(cache, &key, sizeof(key), tile, 1, volume_del);
+    memset(key, 0, sizeof(*key));
+    key->id1 = id1;
+    key->id2 = id2;
+    key->mode = mode;
+    if (color) memcpy(key->color, color, 4);
+    _Static_assert(sizeof(*key) == 24, "");
+    if (!use_caches()) return false;
+    tile = cache_get(get_tile_merge_cache(), key, sizeof(*key));
+    if (!tile) return false;
+    volume_copy_tile(tile, (int[]){0, 0, 0}, volume, pos);
+    return true;
+}
+
+// Compute the merged voxels of a tile.  Only reads the volumes, so that
+// it can run in the thread pool.
+static void tile_merge_voxels(const volume_t *volume, const volume_t *other,
+                              const int pos[3], int mode,
+                              const uint8_t color[4], uint8_t *out)
+{
+    static const uint8_t empty[N * N * N * 4] = {};
+    uint8_t buf1[N * N * N * 4], buf2[N * N * N * 4];
+    const uint8_t *v1, *v2;
+
+    // When a color is not given, v1 is blank and v2 is from the tool
+    // When a color is given, v1 is blank, and v2 becomes the paint color *
+    // colour in tool
+    v1 = volume_get_tile_voxels(volume, pos, buf1);
+    v2 = volume_get_tile_voxels(other, pos, buf2);
+    voxels_combine(v1 ?: empty, v2 ?: empty, mode, color, out, N * N * N);
+}
+
+// Write the merged voxels of a tile, and add them to the cache.
+static void tile_merge_commit(volume_t *volume, const int pos[3],
+                              const tile_merge_key_t *key,
+                              const uint8_t *voxels)
+{
+    cache_t *cache;
+    volume_t *tile;
 
-end:
+    if (!use_caches()) {
+        volume_set_tile(volume, pos, voxels);
+        return;
+    }
+    cache = get_tile_merge_cache();
+    // The same merge might have been done for an other tile of the batch.
+    tile = cache_get(cache, key, sizeof(*key));
+    if (!tile) {
+        tile = volume_new();
+        volume_set_tile(tile, (int[]){0, 0, 0}, voxels);
+        cache_add(cache, key, sizeof(*key), tile, 1, volume_del);
+    }
     volume_copy_tile(tile, (int[]){0, 0, 0}, volume, pos);
-    return;
+}
+
+static void tile_merge(volume_t *volume, const volume_t *other,
+                       const int pos[3], int mode, const uint8_t color[4])
+{
+    tile_merge_key_t key;
+    uint8_t *voxels;
+
+    if (tile_merge_fast(volume, other, pos, mode, color, &key)) return;
+    voxels = malloc(N * N * N * 4);
+    tile_merge_voxels(volume, other, pos, mode, color, voxels);
+    tile_merge_commit(volume, pos, &key, voxels);
+    free(voxels);
+}
+
+// Parameters of a merge of several tiles.
+typedef struct {
+    const volume_t  *volume;
+    const volume_t  *other;
+    int             mode;
+    const uint8_t   *color;
+    int             (*tiles)[3];
+    uint8_t         (*out)[N * N * N * 4];
+} merge_ctx_t;
+
+static void merge_tile_job(void *user, int i)
+{
+    merge_ctx_t *ctx = user;
+    tile_merge_voxels(ctx->volume, ctx->other, ctx->tiles[i], ctx->mode,
+                      ctx->color, ctx->out[i]);
+}
+
+// Merge a list of tiles.  The tiles that need to be computed are done in
+// parallel, and then written in order, so that the result is the same as
+// calling tile_merge on each of them.
+static void tiles_merge(volume_t *volume, const volume_t *other,
+                        int (*tiles)[3], int nb_tiles, int mode,
+                        const uint8_t color[4])
+{
+    tile_merge_key_t *keys;
+    int i, n, batch;
+    merge_ctx_t ctx = {
+        .volume = volume,
+        .other = other,
+        .mode = mode,
+        .color = color,
+    };
+
+    // Handle the simple tiles first, and only keep the others.
+    keys = calloc(nb_tiles, sizeof(*keys));
+    for (i = 0, n = 0; i < nb_tiles; i++) {
+        if (tile_merge_fast(volume, other, tiles[i], mode, color, &keys[n]))
+            continue;
+        memcpy(tiles[n++], tiles[i], sizeof(tiles[i]));
+    }
+    nb_tiles = n;
+
+    ctx.out = malloc(min(nb_tiles, TILES_BATCH_SIZE) * sizeof(*ctx.out));
+    for (batch = 0; batch < nb_tiles; batch += TILES_BATCH_SIZE) {
+        n = min(nb_tiles - batch, TILES_BATCH_SIZE);
+        ctx.tiles = tiles + batch;
+        thread_pool_run(n, merge_tile_job, &ctx);
+        for (i = 0; i < n; i++)
+            tile_merge_commit(volume, ctx.tiles[i], &keys[batch + i],
+                              ctx.out[i]);
+    }
+    free(ctx.out);
+    free(keys);
 }
 
 void volume_merge(volume_t *volume, const volume_t *other, int mode,
@@ -1055,9 +1497,8 @@ void volume_merge(volume_t *volume, const volume_t *other, int mode,
 {
     volume_t *cached;
     assert(volume && other);
-    static cache_t *cache = NULL;
     volume_iterator_t iter;
-    int bpos[3];
+    int (*tiles)[3], nb_tiles;
     uint64_t id1, id2;
 
     // Simple case for replace.
@@ -1067,7 +1508,6 @@ void volume_merge(volume_t *volume, const volume_t *other, int mode,
     }
 
     // Check if the merge op has been cached.
-    if (!cache) cache = cache_create(VOLUME_MERGE_CACHE_SIZE);
     id1 = volume_get_key(volume);
     id2 = volume_get_key(other);
     struct {
@@ -1078,25 +1518,27 @@ void volume_merge(volume_t *volume, const volume_t *other, int mode,
     } key = { id1, id2, mode };
     if (color) memcpy(key.color, color, 4);
     _Static_assert(sizeof(key) == 24, "");
-    cached = cache_get(cache, &key, sizeof(key));
+    cached = use_caches() ? cache_get(g_merge_cache, &key, sizeof(key)) : NULL;
     if (cached) {
         volume_set(volume, cached);
         return;
     }
 
     iter = volume_get_union_iterator(volume, other, VOLUME_ITER_TILES);
-    while (volume_iter(&iter, bpos)) {
-        tile_merge(volume, other, bpos, mode, color);
-    }
+    nb_tiles = iter_get_tiles(&iter, &tiles);
+    tiles_merge(volume, other, tiles, nb_tiles, mode, color);
+    free(tiles);
 
-    cache_add(cache, &key, sizeof(key), volume_copy(volume), 1, volume_del);
+    if (use_caches())
+        cache_add(g_merge_cache, &key, sizeof(key), volume_copy(volume), 1,
+                  volume_del);
 }
 
 void volume_merge_from(volume_t *volume, const volume_t *other, int mode,
                        const uint8_t color[4])
 {
     volume_iterator_t iter;
-    int bpos[3];
+    int (*tiles)[3], nb_tiles;
 
     assert(volume && other);
     if (mode == MODE_REPLACE) {
@@ -1105,9 +1547,17 @@ void volume_merge_from(volume_t *volume, const volume_t *other, int mode,
     }
 
     iter = volume_get_iterator(other, VOLUME_ITER_TILES);
-    while (volume_iter(&iter, bpos)) {
-        tile_merge(volume, other, bpos, mode, color);
-    }
+    nb_tiles = iter_get_tiles(&iter, &tiles);
+    tiles_merge(volume, other, tiles, nb_tiles, mode, color);
+    free(tiles);
+}
+
+void volume_merge_tile(volume_t *volume, const volume_t *other,
+                       const int pos[3], int mode, const uint8_t color[4])
+{
+    assert(volume && other);
+    assert(mode != MODE_REPLACE);
+    tile_merge(volume, other, pos, mode, color);
 }
 
 void volume_merge_sparse_from(volume_t *volume, const volume_t *other, int mode)
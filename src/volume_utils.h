@@ -23,6 +23,7 @@
 #ifndef MESH_UTILS_H
 #define MESH_UTILS_H
 
+#include "mask.h"
 #include "shape.h"
 #include "palette.h"
 
@@ -220,6 +221,30 @@ int volume_select(const volume_t *volume,
                             volume_accessor_t *volume_accessor),
                 void *user, volume_t *selection);
 
+/*
+ * Function: volume_flood_fill
+ * Get the connected region of voxels around a position that satisfy a
+ * condition.
+ *
+ * This uses a scanline fill: we fill whole spans of voxels along x, and
+ * only remember the start of each span on the neighbor rows.
+ *
+ * Parameters:
+ *   volume       - The volume to sample.
+ *   start        - Start position.  If it satisfies the condition it is
+ *                  always part of the region, even outside aabb.
+ *   aabb         - Limit of the region, or NULL.
+ *   connectivity - 4 to only fill along x and y, or 6 to also fill
+ *                  along z.
+ *   cond         - Condition that the voxels of the region satisfy.
+ *   user         - Data passed to cond.
+ *   out          - Set to the voxels of the region.
+ */
+void volume_flood_fill(const volume_t *volume, const int start[3],
+                       const int aabb[2][3], int connectivity,
+                       bool (*cond)(void *user, const uint8_t value[4]),
+                       void *user, mask_t *out);
+
 /*
  * Function: volume_merge
  * Merge a volume into an other using a given blending function.
@@ -245,6 +270,16 @@ void volume_merge(volume_t *volume, const volume_t *other, int mode,
 void volume_merge_from(volume_t *volume, const volume_t *other, int mode,
                        const uint8_t color[4]);
 
+/*
+ * Function: volume_merge_tile
+ * Like volume_merge, but only for the tile at a given position.
+ *
+ * Merging all the tiles one by one gives the same result as volume_merge,
+ * so this can be used to update a merged volume after some tiles changed.
+ */
+void volume_merge_tile(volume_t *volume, const volume_t *other,
+                       const int pos[3], int mode, const uint8_t color[4]);
+
 /*
  * Function: volume_merge_sparse_from
  * Like volume_merge_from, but only applies source voxels that have alpha.
@@ -263,6 +298,24 @@ void volume_merge_sparse_from(volume_t *volume, const volume_t *other,
 void voxel_combine(const uint8_t a[4], const uint8_t b[4], int mode,
                    uint8_t out[4]);
 
+/*
+ * Function: voxels_combine
+ * Apply voxel_combine to arrays of voxels.
+ *
+ * The result is exactly the same as calling voxel_combine for each voxel,
+ * but the simple modes are vectorized when SSE2 is available.
+ *
+ * Parameters:
+ *   a      - Destination voxels.
+ *   b      - Source voxels.
+ *   mode   - A <MODE> value.
+ *   color  - If not NULL, multiply the source voxels by this color first.
+ *   out    - Output voxels, can be the same as `a`.
+ *   n      - Number of voxels.
+ */
+void voxels_combine(const uint8_t *a, const uint8_t *b, int mode,
+                    const uint8_t color[4], uint8_t *out, int n);
+
 /*
  * Function: volume_generate_vertices
  * Generate a vertice array for rendering a volume block.
@@ -283,6 +336,15 @@ int volume_generate_vertices(const volume_t *volume, const int block_pos[3],
                            int effects, voxel_vertex_t *out,
                            int *size, int *subdivide);
 
+/*
+ * Function: volume_block_is_hidden
+ * Fast check, using the uniform tiles, for the blocks that cannot generate
+ * any face with the given effects.  Used by the vertices generation to skip
+ * those blocks early.
+ */
+bool volume_block_is_hidden(const volume_t *volume, const int block_pos[3],
+                            int effects);
+
 /*
  * volume_generate_mesh
  * Compared to volume_generate_vertices, this generate a single mesh for